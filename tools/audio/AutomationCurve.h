@@ -0,0 +1,367 @@
+#pragma once
+#ifndef AutomationCurve_H
+#define AutomationCurve_H
+
+// Pose automation compiled from the .sequence files of spatial_sequencer.
+// A sequence is a list of steps, one per line:
+//
+//   +<delta time>:/_pose:<x,y,z or x,y,z,qw,qx,qy,qz>:<morph time>
+//
+// Each step starts delta seconds after the previous one and morphs the pose
+// from its current value to the target over the morph time. A step that
+// starts before the previous morph is done interrupts it where it is. "::"
+// ends the sequence, lines starting with '#' are comments.
+//
+// Instead of replaying the text through a PresetSequencer per voice, the
+// file is parsed once into segments that each interpolate linearly (and
+// slerp the orientation) between two poses. Interruptions are resolved at
+// compile time, so evaluating is a segment lookup plus one interpolation.
+// A curve is immutable once built and can be shared by all voices playing
+// the same file (see AutomationLibrary); each voice keeps its own
+// AutomationCursor, which makes evaluation at increasing times O(1).
+//
+// Only what the compiler can reproduce exactly is accepted: /_pose steps,
+// with a first step that doesn't morph (its start pose would depend on the
+// voice). Anything else fails to compile, and callers keep the
+// PresetSequencer for that file.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct AutomationPose {
+  float position[3]{0.0f, 0.0f, 0.0f};
+  /// Quaternion w, x, y, z
+  float orientation[4]{1.0f, 0.0f, 0.0f, 0.0f};
+};
+
+/// Per voice playback state of an AutomationCurve
+struct AutomationCursor {
+  size_t segment{0};
+};
+
+class AutomationCurve {
+public:
+  /// Compiles a .sequence file. Returns false if it can't be read or uses
+  /// something the compiler doesn't support, see errorMessage().
+  bool load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+      mError = "can't open " + path;
+      return false;
+    }
+    return parse(file);
+  }
+
+  bool parse(std::istream &input) {
+    mSegments.clear();
+    mError.clear();
+    std::vector<Step> steps;
+    double time = 0.0;
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(input, line)) {
+      lineNumber++;
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      if (line.compare(0, 2, "::") == 0) {
+        break;
+      }
+      Step step;
+      if (!parseStep(line, step)) {
+        mError = "line " + std::to_string(lineNumber) + ": unsupported \"" +
+                 line + "\"";
+        return false;
+      }
+      time += step.delta;
+      step.delta = time; // absolute start time from here on
+      steps.push_back(step);
+    }
+    if (steps.empty()) {
+      mError = "no steps";
+      return false;
+    }
+    if (steps[0].morph > 0.0) {
+      mError = "first step morphs from the voice's own pose";
+      return false;
+    }
+    build(steps);
+    return true;
+  }
+
+  const std::string &errorMessage() const { return mError; }
+
+  /// Time of the first step. The curve has no value before it.
+  double startTime() const {
+    return mSegments.empty() ? 0.0 : mSegments.front().start;
+  }
+
+  /// Time the last morph ends, the pose holds after that
+  double endTime() const { return mEndTime; }
+
+  size_t numSegments() const { return mSegments.size(); }
+
+  /// Writes the pose at time (seconds since the trigger) and returns true,
+  /// or returns false before startTime(). Fastest with increasing times;
+  /// earlier times than the cursor's are found by binary search.
+  bool evaluate(double time, AutomationCursor &cursor,
+                AutomationPose &pose) const {
+    if (mSegments.empty() || time < mSegments.front().start) {
+      return false;
+    }
+    size_t s = std::min(cursor.segment, mSegments.size() - 1);
+    if (time < mSegments[s].start) {
+      s = size_t(std::upper_bound(mSegments.begin(), mSegments.end(), time,
+                                  [](double t, const Segment &segment) {
+                                    return t < segment.start;
+                                  }) -
+                 mSegments.begin()) -
+          1;
+    }
+    while (s + 1 < mSegments.size() && time >= mSegments[s + 1].start) {
+      s++;
+    }
+    cursor.segment = s;
+    mSegments[s].evaluate(time, pose);
+    return true;
+  }
+
+private:
+  struct Step {
+    double delta{0.0};
+    double morph{0.0};
+    AutomationPose target;
+    bool hasOrientation{false};
+  };
+
+  // Interpolates from -> to over [start, start + 1 / invDuration), clamped
+  // at to. invDuration 0 holds from. The slerp angle is cached.
+  struct Segment {
+    double start{0.0};
+    float invDuration{0.0f};
+    float angle{0.0f};
+    float invSinAngle{0.0f};
+    AutomationPose from;
+    AutomationPose to;
+
+    void evaluate(double time, AutomationPose &pose) const {
+      if (invDuration == 0.0f) {
+        pose = from;
+        return;
+      }
+      const float f = std::min(float(time - start) * invDuration, 1.0f);
+      for (int i = 0; i < 3; i++) {
+        pose.position[i] =
+            from.position[i] + f * (to.position[i] - from.position[i]);
+      }
+      float a = 1.0f - f, b = f;
+      if (invSinAngle != 0.0f) {
+        a = std::sin((1.0f - f) * angle) * invSinAngle;
+        b = std::sin(f * angle) * invSinAngle;
+      }
+      float norm = 0.0f;
+      for (int i = 0; i < 4; i++) {
+        pose.orientation[i] = a * from.orientation[i] + b * to.orientation[i];
+        norm += pose.orientation[i] * pose.orientation[i];
+      }
+      norm = norm > 0.0f ? 1.0f / std::sqrt(norm) : 1.0f;
+      for (int i = 0; i < 4; i++) {
+        pose.orientation[i] *= norm;
+      }
+    }
+  };
+
+  static bool parseStep(const std::string &line, Step &step) {
+    // +<delta>:/_pose:<values>:<morph>
+    if (line.empty() || line[0] != '+') {
+      return false;
+    }
+    std::vector<std::string> fields;
+    std::stringstream stream(line.substr(1));
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+      fields.push_back(field);
+    }
+    if (fields.size() != 4 || fields[1] != "/_pose") {
+      return false;
+    }
+    std::vector<float> values;
+    std::stringstream valueStream(fields[2]);
+    while (std::getline(valueStream, field, ',')) {
+      char *end;
+      values.push_back(std::strtof(field.c_str(), &end));
+      if (end == field.c_str()) {
+        return false;
+      }
+    }
+    if (values.size() != 3 && values.size() != 7) {
+      return false;
+    }
+    char *end;
+    step.delta = std::strtod(fields[0].c_str(), &end);
+    if (end == fields[0].c_str() || step.delta < 0.0) {
+      return false;
+    }
+    step.morph = std::strtod(fields[3].c_str(), &end);
+    if (end == fields[3].c_str()) {
+      return false;
+    }
+    std::copy(values.begin(), values.begin() + 3, step.target.position);
+    step.hasOrientation = values.size() == 7;
+    if (step.hasOrientation) {
+      std::copy(values.begin() + 3, values.end(), step.target.orientation);
+    }
+    return true;
+  }
+
+  static Segment hold(double start, const AutomationPose &pose) {
+    Segment segment;
+    segment.start = start;
+    segment.from = pose;
+    segment.to = pose;
+    return segment;
+  }
+
+  void build(const std::vector<Step> &steps) {
+    AutomationPose current = steps[0].target;
+    mEndTime = 0.0;
+    for (size_t i = 0; i < steps.size(); i++) {
+      const Step &step = steps[i];
+      if (!mSegments.empty()) {
+        // Where the previous step got to, possibly interrupted
+        mSegments.back().evaluate(step.delta, current);
+      }
+      AutomationPose target = step.target;
+      if (!step.hasOrientation) {
+        std::copy(current.orientation, current.orientation + 4,
+                  target.orientation);
+      }
+      const double next = i + 1 < steps.size()
+                              ? steps[i + 1].delta
+                              : std::numeric_limits<double>::infinity();
+      if (step.morph <= 0.0) {
+        mSegments.push_back(hold(step.delta, target));
+        mEndTime = step.delta;
+        continue;
+      }
+      Segment segment;
+      segment.start = step.delta;
+      segment.invDuration = float(1.0 / step.morph);
+      segment.from = current;
+      segment.to = target;
+      // Shortest way round, with the angle cached for the slerp
+      float dot = 0.0f;
+      for (int q = 0; q < 4; q++) {
+        dot += current.orientation[q] * target.orientation[q];
+      }
+      if (dot < 0.0f) {
+        dot = -dot;
+        for (int q = 0; q < 4; q++) {
+          segment.to.orientation[q] = -target.orientation[q];
+        }
+      }
+      if (dot < 0.9995f) {
+        segment.angle = std::acos(dot);
+        segment.invSinAngle = 1.0f / std::sin(segment.angle);
+      }
+      mSegments.push_back(segment);
+      const double end = step.delta + step.morph;
+      if (end < next) {
+        mSegments.push_back(hold(end, segment.to));
+      }
+      mEndTime = std::min(end, next);
+    }
+  }
+
+  std::vector<Segment> mSegments;
+  double mEndTime{0.0};
+  std::string mError;
+};
+
+/// Compiled curves by sequence name, shared by every voice playing the same
+/// file. compile() parses the files of a session up front, on a control
+/// thread; get() is then only a lookup, for the trigger path.
+class AutomationLibrary {
+public:
+  /// Compiles the given .sequence files of directory, replacing the curves
+  /// compiled before (voices keep the curves they have). Files that fail
+  /// keep their error for get(). Returns the number that compiled.
+  size_t compile(const std::string &directory,
+                 const std::vector<std::string> &fileNames) {
+    std::map<std::string, Entry> curves;
+    size_t compiled = 0;
+    for (const std::string &fileName : fileNames) {
+      std::shared_ptr<AutomationCurve> curve(new AutomationCurve);
+      Entry entry;
+      if (curve->load(directory + fileName)) {
+        entry.curve = curve;
+        compiled++;
+      } else {
+        entry.error = curve->errorMessage();
+      }
+      curves[sequenceName(fileName)] = entry;
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    mCurves.swap(curves);
+    return compiled;
+  }
+
+  /// The curve for a sequence, named with or without ".sequence", or
+  /// nullptr if it didn't compile or wasn't compiled (the reason goes to
+  /// errorMessage). Doesn't read or parse anything.
+  std::shared_ptr<const AutomationCurve> get(const std::string &name,
+                                             std::string *errorMessage =
+                                                 nullptr) const {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mCurves.find(sequenceName(name));
+    if (it == mCurves.end()) {
+      if (errorMessage) {
+        *errorMessage = "not a compiled .sequence file of the session";
+      }
+      return nullptr;
+    }
+    if (errorMessage) {
+      *errorMessage = it->second.error;
+    }
+    return it->second.curve;
+  }
+
+  /// Drops all curves. Voices keep the curves they have.
+  void clear() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mCurves.clear();
+  }
+
+private:
+  struct Entry {
+    std::shared_ptr<const AutomationCurve> curve;
+    std::string error;
+  };
+
+  static std::string sequenceName(const std::string &fileName) {
+    const std::string extension = ".sequence";
+    if (fileName.size() > extension.size() &&
+        fileName.compare(fileName.size() - extension.size(),
+                         extension.size(), extension) == 0) {
+      return fileName.substr(0, fileName.size() - extension.size());
+    }
+    return fileName;
+  }
+
+  mutable std::mutex mLock;
+  std::map<std::string, Entry> mCurves;
+};
+
+#endif
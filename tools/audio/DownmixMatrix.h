@@ -0,0 +1,231 @@
+#pragma once
+#ifndef DownmixMatrix_H
+#define DownmixMatrix_H
+
+// A downmix compiled into a sparse gain matrix. build() measures any linear,
+// memoryless mix (e.g. an al::DownMixer) once, by feeding it a unit sample
+// on every input, and keeps only the non-zero gains, grouped by output.
+// process() then runs the mix as a multiply-accumulate over planar buffers
+// that skips the zero coefficients, instead of going through the generic
+// mixer on every callback.
+//
+// Every output sums its inputs in ascending input order, starting from
+// zero, which is what a straightforward mixer does, so the result is
+// usually bit-exact. matches() checks this against the original,
+// so callers can keep the original mixer when it isn't.
+//
+// process() doesn't allocate and can run in the audio callback. Outputs may
+// be the same buffers as inputs (an in-place downmix): rows are computed
+// into internal scratch space first and copied out at the end.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class DownmixMatrix {
+public:
+  /// Builds the matrix. response(input, gains) must write the output of the
+  /// mix for a unit sample on input into gains[0 .. numOutputs). For an
+  /// in-place mix, outputs that pass their own input through unchanged are
+  /// left alone; otherwise they are copied.
+  template <class Response>
+  void build(size_t numInputs, size_t numOutputs, bool inPlace,
+             Response response) {
+    mNumInputs = numInputs;
+    mNumOutputs = numOutputs;
+    std::vector<float> gains(numInputs * numOutputs, 0.0f);
+    std::vector<float> column(numOutputs);
+    for (size_t in = 0; in < numInputs; in++) {
+      std::fill(column.begin(), column.end(), 0.0f);
+      response(in, column.data());
+      for (size_t out = 0; out < numOutputs; out++) {
+        gains[out * numInputs + in] = column[out];
+      }
+    }
+    mEntries.clear();
+    mRows.clear();
+    for (size_t out = 0; out < numOutputs; out++) {
+      const float *row = gains.data() + out * numInputs;
+      if (inPlace && passesThrough(row, out)) {
+        continue;
+      }
+      Row r;
+      r.output = uint32_t(out);
+      r.firstEntry = uint32_t(mEntries.size());
+      for (size_t in = 0; in < numInputs; in++) {
+        if (row[in] != 0.0f) {
+          mEntries.push_back({uint32_t(in), row[in]});
+        }
+      }
+      r.numEntries = uint32_t(mEntries.size() - r.firstEntry);
+      mRows.push_back(r);
+    }
+    mScratch.assign(mRows.size() * kChunkFrames, 0.0f);
+  }
+
+  /// Mixes numFrames of the planar inputs into the outputs
+  void process(const float *const *inputs, float *const *outputs,
+               size_t numFrames) {
+    for (size_t start = 0; start < numFrames; start += kChunkFrames) {
+      // By value: std::min would odr-use the constant, which C++14 doesn't
+      // define out of class
+      const size_t count = std::min(size_t(kChunkFrames), numFrames - start);
+      for (size_t r = 0; r < mRows.size(); r++) {
+        if (mRows[r].numEntries > 0) {
+          mixRow(mRows[r], inputs, start, count,
+                 mScratch.data() + r * kChunkFrames);
+        }
+      }
+      // Rows without gains, e.g. the inputs an in-place downmix clears, are
+      // written directly
+      for (size_t r = 0; r < mRows.size(); r++) {
+        float *out = outputs[mRows[r].output] + start;
+        if (mRows[r].numEntries > 0) {
+          std::memcpy(out, mScratch.data() + r * kChunkFrames,
+                      count * sizeof(float));
+        } else {
+          std::fill(out, out + count, 0.0f);
+        }
+      }
+    }
+  }
+
+  /// Runs process() and the original mix on the same pseudo-random signal
+  /// and compares the outputs bit for bit. original(inputs, outputs) must
+  /// apply the original mix to numFrames of planar buffers; for an in-place
+  /// mix both are the same buffers. The outputs start with noise too, so a
+  /// mix that adds to its outputs instead of writing them doesn't match.
+  template <class Original>
+  bool matches(size_t numFrames, bool inPlace, Original original) {
+    uint32_t state = 12345;
+    auto noise = [&state]() {
+      state = state * 1664525u + 1013904223u;
+      return float(int32_t(state)) * (1.0f / 2147483648.0f);
+    };
+    std::vector<float> input(mNumInputs * numFrames);
+    std::vector<float> expected(mNumOutputs * numFrames);
+    std::generate(input.begin(), input.end(), noise);
+    if (inPlace) {
+      expected = input;
+    } else {
+      std::generate(expected.begin(), expected.end(), noise);
+    }
+    std::vector<float> actual = expected;
+    std::vector<float *> inputs(mNumInputs), expectedOuts(mNumOutputs),
+        actualOuts(mNumOutputs);
+    for (size_t c = 0; c < mNumInputs; c++) {
+      inputs[c] = input.data() + c * numFrames;
+    }
+    for (size_t c = 0; c < mNumOutputs; c++) {
+      expectedOuts[c] = expected.data() + c * numFrames;
+      actualOuts[c] = actual.data() + c * numFrames;
+    }
+    original(inPlace ? expectedOuts.data() : inputs.data(),
+             expectedOuts.data());
+    process(inPlace ? actualOuts.data() : inputs.data(), actualOuts.data(),
+            numFrames);
+    return std::memcmp(expected.data(), actual.data(),
+                       expected.size() * sizeof(float)) == 0;
+  }
+
+  size_t numInputs() const { return mNumInputs; }
+  size_t numOutputs() const { return mNumOutputs; }
+  /// Non-zero gains, the multiply-adds per frame
+  size_t numEntries() const { return mEntries.size(); }
+  /// Outputs written by process()
+  size_t numRows() const { return mRows.size(); }
+
+private:
+  static constexpr size_t kChunkFrames = 256;
+
+  struct Entry {
+    uint32_t input;
+    float gain;
+  };
+
+  struct Row {
+    uint32_t output;
+    uint32_t firstEntry;
+    uint32_t numEntries;
+  };
+
+  bool passesThrough(const float *row, size_t out) const {
+    for (size_t in = 0; in < mNumInputs; in++) {
+      if (row[in] != (in == out ? 1.0f : 0.0f)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Terms are added in entry order, up to four inputs per pass over the row
+  // so the accumulator stays in registers. The first pass writes the row,
+  // the others add to it. The row has at least one entry.
+  void mixRow(const Row &row, const float *const *inputs, size_t start,
+              size_t count, float *__restrict dest) const {
+    const Entry *e = mEntries.data() + row.firstEntry;
+    const Entry *end = e + row.numEntries;
+    size_t terms = std::min<size_t>(4, size_t(end - e));
+    pass<false>(terms, e, inputs, start, count, dest);
+    for (e += terms; e != end; e += terms) {
+      terms = std::min<size_t>(4, size_t(end - e));
+      pass<true>(terms, e, inputs, start, count, dest);
+    }
+  }
+
+  template <bool Add>
+  static void pass(size_t terms, const Entry *e, const float *const *inputs,
+                   size_t start, size_t count, float *__restrict dest) {
+    switch (terms) {
+    case 1:
+      pass<1, Add>(e, inputs, start, count, dest);
+      break;
+    case 2:
+      pass<2, Add>(e, inputs, start, count, dest);
+      break;
+    case 3:
+      pass<3, Add>(e, inputs, start, count, dest);
+      break;
+    default:
+      pass<4, Add>(e, inputs, start, count, dest);
+      break;
+    }
+  }
+
+  // dest = (dest or 0) + g0 * a + g1 * b + ..., added left to right. The
+  // first pass adds to 0 like the mixer does, so every addition has one
+  // product, and FMA contraction (-march with FMA) fuses the same ones.
+  template <int N, bool Add>
+  static void pass(const Entry *e, const float *const *inputs, size_t start,
+                   size_t count, float *__restrict dest) {
+    const float *__restrict a = inputs[e[0].input] + start;
+    const float *__restrict b = inputs[e[N > 1 ? 1 : 0].input] + start;
+    const float *__restrict c = inputs[e[N > 2 ? 2 : 0].input] + start;
+    const float *__restrict d = inputs[e[N > 3 ? 3 : 0].input] + start;
+    const float ga = e[0].gain, gb = e[N > 1 ? 1 : 0].gain,
+                gc = e[N > 2 ? 2 : 0].gain, gd = e[N > 3 ? 3 : 0].gain;
+    for (size_t i = 0; i < count; i++) {
+      float acc = (Add ? dest[i] : 0.0f) + ga * a[i];
+      if (N > 1) {
+        acc = acc + gb * b[i];
+      }
+      if (N > 2) {
+        acc = acc + gc * c[i];
+      }
+      if (N > 3) {
+        acc = acc + gd * d[i];
+      }
+      dest[i] = acc;
+    }
+  }
+
+  size_t mNumInputs{0};
+  size_t mNumOutputs{0};
+  std::vector<Entry> mEntries;
+  std::vector<Row> mRows;
+  std::vector<float> mScratch;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#pragma once
+#ifndef MTCChase_H
+#define MTCChase_H
+
+// Chases an incoming MIDI Time Code stream. The timecodes decoded by
+// MTCParser arrive in bursts and with the jitter of the MIDI driver, and they
+// only resolve whole frames, so they can't drive playback directly. MTCChase
+// runs them through a second order delay locked loop (DLL) that tracks the
+// sender's position and speed against the host clock. The audio callback can
+// then ask for the position at the start of each block with sub-sample
+// resolution.
+//
+// Threading: addEvent()/addTimecode() and reset() must be called from a
+// single thread, usually the MIDI input callback. position() and
+// positionInSamples() can be called from any thread, including the audio
+// callback: they don't lock or allocate.
+//
+// Usage in an audio callback:
+//
+//   MTCChasePosition p = chase.position(hostSeconds);
+//   if (p.locateCount != lastLocateCount) {
+//     // the sender jumped, seek the players to p.seconds
+//   }
+//   // play this block at p.rate (varispeed), starting at p.seconds
+//
+// multichannel_playback, which can't play at a varispeed rate, polls the
+// chase from its graphics thread instead and locates its transport when
+// the locate count changes or the drift grows too large.
+//
+// Host time is in seconds on any monotonic clock, as long as the same clock
+// is used for events and queries. MTCChase::hostSeconds() uses
+// std::chrono::steady_clock, which also provides the microsecond timestamps
+// passed to MTCParser::feed() in midi_time_code.
+
+#include "MTCParser.h"
+#include "Timecode.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+struct MTCChasePosition {
+  /// Sender position in seconds at the requested host time
+  double seconds{0.0};
+  /// Sender speed relative to the host clock. 1.0 is nominal speed, 0.0
+  /// when the sender has stopped
+  double rate{0.0};
+  /// True once the loop has settled
+  bool locked{false};
+  /// False when no timecode has arrived for longer than the timeout
+  bool running{false};
+  /// Incremented every time the position jumps: on the first timecode, full
+  /// frame messages, restarts after a stop, and errors too large to follow
+  /// smoothly
+  uint32_t locateCount{0};
+  /// Smoothed RMS of the loop error in seconds, an estimate of the jitter
+  double jitter{0.0};
+};
+
+class MTCChase {
+public:
+  MTCChase() {}
+
+  /// Loop bandwidth in Hz. Lower values filter more jitter but follow speed
+  /// changes more slowly. Call before feeding timecodes.
+  void setBandwidth(double hz) { mBandwidth = hz; }
+  double bandwidth() const { return mBandwidth; }
+
+  /// Time without timecode after which the sender is considered stopped.
+  /// Call before feeding timecodes.
+  void setTimeout(double seconds) { mTimeout = seconds; }
+
+  /// Errors larger than this (in seconds) are not followed by the loop, the
+  /// position jumps instead. Call before feeding timecodes.
+  void setMaxError(double seconds) { mMaxError = seconds; }
+
+  static double hostSeconds() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /// Feeds an event from MTCParser, whose timestamp is in microseconds.
+  void addEvent(const MTCParser::MTCEvent &event) {
+    const Timecode tc(event.mtc.hour, event.mtc.minute, event.mtc.second,
+                      event.mtc.frame,
+                      static_cast<TimecodeRate>(event.mtc.type & 0x03));
+    const double frame = 1.0 / Timecode::frameRate(tc.rate);
+    double seconds = tc.toSeconds();
+    const bool fullFrame = event.source == MTCParser::Source::FullFrame;
+    if (!fullFrame) {
+      // A quarter frame timecode is complete when its last piece arrives,
+      // 1.75 frames after the frame it encodes started
+      seconds += 1.75 * frame;
+    }
+    // Quarter frame timecodes complete every two frames
+    addTimecode(seconds, event.timestamp * 1e-6, 2.0 * frame, fullFrame);
+  }
+
+  /// Feeds a sender position, received at host time hostTime. interval is
+  /// the nominal time between updates. A locate forces the position to jump
+  /// to the new value.
+  void addTimecode(double seconds, double hostTime, double interval,
+                   bool locate = false) {
+    const bool stopped = !mRunning || hostTime - mT0 > mTimeout;
+    if (locate || stopped) {
+      restart(seconds, hostTime);
+      return;
+    }
+
+    const double predicted = mP0 + mRate * (hostTime - mT0);
+    const double error = seconds - predicted;
+    if (std::fabs(error) > mMaxError) {
+      restart(seconds, hostTime);
+      return;
+    }
+
+    // Second order loop, critically damped:
+    // b = sqrt(2) w, c = w^2, with w = 2 pi B T
+    constexpr double kPi = 3.14159265358979323846;
+    const double w = 2.0 * kPi * mBandwidth * interval;
+    mP0 = predicted + std::sqrt(2.0) * w * error;
+    mRate += w * w * error / interval;
+    mT0 = hostTime;
+    mUpdates++;
+    mErrorPower += 0.05 * (error * error - mErrorPower);
+    // The loop settles in about two time constants, 1 / (pi B) each
+    const bool settled = mUpdates * interval > 2.0 / (kPi * mBandwidth);
+    mLocked = settled && std::fabs(error) < 0.25 * interval;
+    publish();
+  }
+
+  /// Forgets the sender, e.g. when switching MIDI ports.
+  void reset() {
+    mRunning = false;
+    mLocked = false;
+    mUpdates = 0;
+    mRate = 0.0;
+    mErrorPower = 0.0;
+    publish();
+  }
+
+  /// Estimated sender position at host time hostTime. Lock-free and
+  /// wait-free in practice: it only retries if the writer is publishing at
+  /// the same moment.
+  MTCChasePosition position(double hostTime) const {
+    Snapshot s;
+    read(s);
+    MTCChasePosition p;
+    p.locateCount = s.locateCount;
+    p.jitter = std::sqrt(s.errorPower);
+    if (!s.running) {
+      p.seconds = s.p0;
+      return p;
+    }
+    double elapsed = hostTime - s.t0;
+    if (elapsed > mTimeout) {
+      // Stopped, hold the last position that was reached
+      p.seconds = s.p0 + s.rate * mTimeout;
+      return p;
+    }
+    p.seconds = s.p0 + s.rate * elapsed;
+    p.rate = s.rate;
+    p.locked = s.locked;
+    p.running = true;
+    return p;
+  }
+
+  /// Position as a (fractional) sample index at the given sample rate.
+  double positionInSamples(double hostTime, double sampleRate) const {
+    return position(hostTime).seconds * sampleRate;
+  }
+
+private:
+  struct Snapshot {
+    double p0;
+    double t0;
+    double rate;
+    double errorPower;
+    uint32_t locateCount;
+    bool running;
+    bool locked;
+  };
+
+  void restart(double seconds, double hostTime) {
+    mP0 = seconds;
+    mT0 = hostTime;
+    mRate = 1.0;
+    mRunning = true;
+    mLocked = false;
+    mUpdates = 0;
+    mErrorPower = 0.0;
+    mLocateCount++;
+    publish();
+  }
+
+  // Sequence lock: the sequence number is odd while the fields are written,
+  // readers retry if it was odd or changed while they read.
+  void publish() {
+    const uint32_t sequence = mSequence.load(std::memory_order_relaxed);
+    mSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mSharedP0.store(mP0, std::memory_order_relaxed);
+    mSharedT0.store(mT0, std::memory_order_relaxed);
+    mSharedRate.store(mRate, std::memory_order_relaxed);
+    mSharedErrorPower.store(mErrorPower, std::memory_order_relaxed);
+    mSharedLocateCount.store(mLocateCount, std::memory_order_relaxed);
+    mSharedRunning.store(mRunning, std::memory_order_relaxed);
+    mSharedLocked.store(mLocked, std::memory_order_relaxed);
+    mSequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  void read(Snapshot &s) const {
+    uint32_t before, after;
+    do {
+      before = mSequence.load(std::memory_order_acquire);
+      s.p0 = mSharedP0.load(std::memory_order_relaxed);
+      s.t0 = mSharedT0.load(std::memory_order_relaxed);
+      s.rate = mSharedRate.load(std::memory_order_relaxed);
+      s.errorPower = mSharedErrorPower.load(std::memory_order_relaxed);
+      s.locateCount = mSharedLocateCount.load(std::memory_order_relaxed);
+      s.running = mSharedRunning.load(std::memory_order_relaxed);
+      s.locked = mSharedLocked.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = mSequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+
+  double mBandwidth{0.2};
+  double mTimeout{0.25};
+  double mMaxError{0.1};
+
+  // Loop state, only touched by the writer
+  double mP0{0.0};
+  double mT0{0.0};
+  double mRate{0.0};
+  double mErrorPower{0.0};
+  uint64_t mUpdates{0};
+  uint32_t mLocateCount{0};
+  bool mRunning{false};
+  bool mLocked{false};
+
+  // Published copy for the readers
+  std::atomic<uint32_t> mSequence{0};
+  std::atomic<double> mSharedP0{0.0};
+  std::atomic<double> mSharedT0{0.0};
+  std::atomic<double> mSharedRate{0.0};
+  std::atomic<double> mSharedErrorPower{0.0};
+  std::atomic<uint32_t> mSharedLocateCount{0};
+  std::atomic<bool> mSharedRunning{false};
+  std::atomic<bool> mSharedLocked{false};
+};
+
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+#ifndef MTCGenerator_H
+#define MTCGenerator_H
+
+// Generates MIDI Time Code for a transport running on the audio clock. Quarter
+// frame messages are placed with sample accuracy: generate() is called once
+// per audio block with the transport position of the block, and returns the
+// messages whose time falls into it, each with its offset in the block.
+//
+// A sequence of eight quarter frames encodes the frame at which its first
+// piece is sent, and sequences start on even frame counts, as MTCParser
+// expects. Full frame messages are produced by fullFrame(), e.g. after a
+// locate while the transport is stopped.
+//
+// Nothing allocates and the cost is constant per message, so generate() can
+// run in the audio callback.
+
+#include "Timecode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct MTCMessage {
+  /// Offset of the message from the start of the block, in samples
+  uint32_t sampleOffset{0};
+  uint8_t size{0};
+  uint8_t bytes[10]{};
+};
+
+class MTCGenerator {
+public:
+  MTCGenerator() {}
+  MTCGenerator(TimecodeRate rate, uint32_t sampleRate) {
+    configure(rate, sampleRate);
+  }
+
+  void configure(TimecodeRate rate, uint32_t sampleRate) {
+    mRate = rate;
+    mSampleRate = sampleRate;
+  }
+
+  TimecodeRate rate() const { return mRate; }
+  uint32_t sampleRate() const { return mSampleRate; }
+
+  /// F0 7F 7F 01 01 hh mm ss ff F7 for a timecode
+  static MTCMessage fullFrame(const Timecode &tc) {
+    MTCMessage m;
+    m.size = 10;
+    m.bytes[0] = 0xF0;
+    m.bytes[1] = 0x7F;
+    m.bytes[2] = 0x7F;
+    m.bytes[3] = 0x01;
+    m.bytes[4] = 0x01;
+    m.bytes[5] = uint8_t((static_cast<uint8_t>(tc.rate) << 5) | tc.hours);
+    m.bytes[6] = tc.minutes;
+    m.bytes[7] = tc.seconds;
+    m.bytes[8] = tc.frames;
+    m.bytes[9] = 0xF7;
+    return m;
+  }
+
+  /// F1 0nnn dddd for piece 0 - 7 of a timecode
+  static MTCMessage quarterFrame(const Timecode &tc, int piece) {
+    uint8_t value = 0;
+    switch (piece & 0x07) {
+    case 0:
+      value = tc.frames & 0x0F;
+      break;
+    case 1:
+      value = (tc.frames >> 4) & 0x01;
+      break;
+    case 2:
+      value = tc.seconds & 0x0F;
+      break;
+    case 3:
+      value = (tc.seconds >> 4) & 0x03;
+      break;
+    case 4:
+      value = tc.minutes & 0x0F;
+      break;
+    case 5:
+      value = (tc.minutes >> 4) & 0x03;
+      break;
+    case 6:
+      value = tc.hours & 0x0F;
+      break;
+    default:
+      value = uint8_t(((tc.hours >> 4) & 0x01) |
+                      (static_cast<uint8_t>(tc.rate) << 1));
+      break;
+    }
+    MTCMessage m;
+    m.size = 2;
+    m.bytes[0] = 0xF1;
+    m.bytes[1] = uint8_t(((piece & 0x07) << 4) | value);
+    return m;
+  }
+
+  /// Sample position of quarter frame number index, counted from
+  /// 00:00:00:00 (four per frame)
+  int64_t quarterFrameToSamples(int64_t index) const {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(mRate);
+    return -timecode_detail::floorDiv(
+        -index * int64_t(mSampleRate) * info.denominator, 4 * info.numerator);
+  }
+
+  /// Writes the quarter frames due in [blockStart, blockStart + numSamples)
+  /// to messages, at most maxMessages of them. blockStart is the transport
+  /// position in samples since 00:00:00:00. Returns the number written. If
+  /// the array is too small, the remaining messages are skipped.
+  size_t generate(int64_t blockStart, uint32_t numSamples,
+                  MTCMessage *messages, size_t maxMessages) const {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(mRate);
+    // First quarter frame at or after blockStart:
+    // ceil(index * S) >= blockStart <=> index * S > blockStart - 1
+    int64_t index =
+        timecode_detail::floorDiv((blockStart - 1) * 4 * info.numerator,
+                                  int64_t(mSampleRate) * info.denominator) +
+        1;
+    const int64_t blockEnd = blockStart + numSamples;
+    size_t count = 0;
+    for (int64_t sample = quarterFrameToSamples(index);
+         sample < blockEnd && count < maxMessages;
+         sample = quarterFrameToSamples(++index)) {
+      const int64_t sequenceStart = timecode_detail::floorDiv(index, 8) * 2;
+      const int piece = int(timecode_detail::floorMod(index, 8));
+      messages[count] =
+          quarterFrame(Timecode::fromFrameCount(sequenceStart, mRate), piece);
+      messages[count].sampleOffset = uint32_t(sample - blockStart);
+      count++;
+    }
+    return count;
+  }
+
+private:
+  TimecodeRate mRate{TimecodeRate::FPS_25};
+  uint32_t mSampleRate{48000};
+};
+
+#endif
@@ -46,11 +46,34 @@
 // 6	 0110 hhhh Hour lsbits
 // 7	 0111 0rrh Rate and hour msbit
 
+// ---------- Bulk decoding ----------
+// feed() takes buffers of any length. Each byte is classified with a 256 entry
+// table, and the next state and the action to take are looked up in a
+// [state][class] transition table, so there is no per-byte switch over the
+// states. System real-time bytes (0xF8 - 0xFF) may be interleaved anywhere and
+// are skipped; any other status byte aborts the message in progress, and 0xF0
+// or 0xF1 start a new one.
+//
+// Every decoded timecode is appended to a fixed-capacity queue, together with
+// the offset of its last byte in the stream (counting all bytes ever fed) and
+// the timestamp passed to feed(), so bursts of messages between two polls are
+// not lost. If the queue is full, the oldest entry is dropped and counted in
+// droppedCount(). The capacity can be set with MTC_PARSER_QUEUE_SIZE (a power
+// of two). The parser is not thread-safe: feed and pop from the same thread.
+
 #include <stdint.h>
+#include <stddef.h>
 #include <string>
 
+#include "Timecode.h"
+
+#ifndef MTC_PARSER_QUEUE_SIZE
+#define MTC_PARSER_QUEUE_SIZE 32
+#endif
+
 class MTCParser
 {
+public:
 	struct MTCPacket
 	{
 		uint8_t type;
@@ -60,6 +83,17 @@ class MTCParser
 		uint8_t frame;
 	};
 
+	enum class Source : uint8_t { FullFrame, QuarterFrame };
+
+	struct MTCEvent
+	{
+		MTCPacket mtc;
+		Source source;
+		uint64_t byteOffset; // position of the last byte of the message in the stream
+		uint64_t timestamp;  // as passed to feed()
+	};
+
+private:
 #ifdef Arduino_h
 	using string_t = String;
 #else
@@ -68,22 +102,39 @@ class MTCParser
 
 public:
 
-	inline bool available() const { return b_available; }
-	inline void pop() { b_available = false; }
+	// the accessors below refer to the oldest queued timecode, or to the latest one if the queue is empty
+	inline bool available() const { return count_ > 0; }
+	inline void pop() { if (count_ > 0) { head_ = (head_ + 1) & kQueueMask; --count_; } }
 
-	inline uint8_t type() const { return mtc_.type; }
-	inline uint8_t hour() const { return mtc_.hour; }
-	inline uint8_t minute() const { return mtc_.minute; }
-	inline uint8_t second() const { return mtc_.second; }
-	inline uint8_t frame() const { return mtc_.frame; }
+	inline uint8_t type() const { return current().type; }
+	inline uint8_t hour() const { return current().hour; }
+	inline uint8_t minute() const { return current().minute; }
+	inline uint8_t second() const { return current().second; }
+	inline uint8_t frame() const { return current().frame; }
 
-	inline float asSeconds() const
+	// oldest queued event, only valid if available()
+	inline const MTCEvent& front() const { return queue_[head_]; }
+	inline bool pop(MTCEvent& event)
 	{
-		return hour() * 60.f * 60.f + minute() * 60.f + second() + frame() * MTCFrameSecond[type()];
+		if (count_ == 0) return false;
+		event = queue_[head_];
+		pop();
+		return true;
 	}
-	inline float asMillis() const { return asSeconds() * 0.001f; }
-	inline float asMicros() const { return asMillis() * 0.001f; }
-    inline int32_t asFrameCount() const { return asSeconds() * MTCFrameRate[type()]; }
+	inline size_t size() const { return count_; }
+	inline uint32_t droppedCount() const { return dropped_; }
+	inline uint64_t bytesFed() const { return offset_; }
+
+	inline Timecode timecode() const
+	{
+		return Timecode(hour(), minute(), second(), frame(), static_cast<TimecodeRate>(type() & 0x03));
+	}
+
+	// time since 00:00:00:00, drop-frame aware for 29.97
+	inline double asSeconds() const { return timecode().toSeconds(); }
+	inline double asMillis() const { return asSeconds() * 1000.0; }
+	inline double asMicros() const { return asSeconds() * 1000000.0; }
+	inline int32_t asFrameCount() const { return static_cast<int32_t>(timecode().toFrameCount()); }
     inline std::string asString() const
 	{
 #ifdef Arduino_h
@@ -102,179 +153,36 @@ public:
 		return str;
 	}
 
-	inline void feed(const uint8_t* const data, const uint8_t size)
-	{
-		for (uint8_t i = 0; i < size; ++i) feed(data[i]);
-	}
-
-	inline void feed(const uint8_t data)
+	// decodes a buffer of any length, returns the number of timecodes completed in it
+	inline size_t feed(const uint8_t* const data, const size_t size, const uint64_t timestamp = 0)
 	{
-		switch (state)
+		const Tables& t = tables();
+		const size_t before = decoded_;
+		uint8_t s = state_;
+		for (size_t i = 0; i < size; ++i)
 		{
-			// common path for FFM & QFM
-			case State::Header:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_Header_1))
-				{
-					state = State::FFM_Header_2;
-					clearBuffer();
-				}
-				else if (data == static_cast<uint8_t>(StateFlag::QFM_Header))
-				{
-					state = State::QFM_Value;
-				}
-				else
-				{
-					state = State::Header;
-					clearBuffer();
-				}
-				break;
-			}
-
-			// for Full Frame Message (FFM)
-			case State::FFM_Header_2:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_Header_2))
-					state = State::FFM_Channel;
-				else
-					state = State::Header;
-				break;
-			}
-			case State::FFM_Channel:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_Channel))
-					state = State::FFM_ID_1;
-				else
-					state = State::Header;
-				break;
-			}
-			case State::FFM_ID_1:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_ID_1))
-					state = State::FFM_ID_2;
-				else
-					state = State::Header;
-				break;
-			}
-			case State::FFM_ID_2:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_ID_2))
-					state = State::FFM_Hour;
-				else
-					state = State::Header;
-				break;
-			}
-			case State::FFM_Hour:
-			{
-				mtc_buffer_.type = (data >> 5) & 0x03;
-				mtc_buffer_.hour = (data >> 0) & 0x1F;
-				state = State::FFM_Minute;
-				break;
-            }
-			case State::FFM_Minute:
-			{
-				mtc_buffer_.minute = data;
-				state = State::FFM_Second;
-				break;
-			}
-			case State::FFM_Second:
-			{
-				mtc_buffer_.second = data;
-				state = State::FFM_Frame;
-				break;
-			}
-			case State::FFM_Frame:
-			{
-				mtc_buffer_.frame = data;
-				state = State::FFM_EOX;
-				break;
-			}
-			case State::FFM_EOX:
-			{
-				if (data == static_cast<uint8_t>(StateFlag::FFM_EOX))
-				{
-					mtc_ = mtc_buffer_;
-                    b_available = true;
-				}
-				else
-				{
-					// error
-				}
-				state = State::Header;
-				break;
-			}
-
-			// Quarter Frame Message
-			case State::QFM_Value:
-			{
-				uint8_t index = (data >> 4) & 0x07;
-				uint8_t value = (data >> 0) & 0x0F;
-
-				switch (index)
-				{
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Frame_LSB):
-					{
-                        mtc_buffer_.frame = (value & 0x0F);
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Frame_MSB):
-					{
-                        mtc_buffer_.frame |= (value & 0x01) << 4;
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Second_LSB):
-					{
-                        mtc_buffer_.second = (value & 0x0F);
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Second_MSB):
-					{
-                        mtc_buffer_.second |= (value & 0x03) << 4;
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Minute_LSB):
-					{
-                        mtc_buffer_.minute = (value & 0x0F);
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Minute_MSB):
-					{
-                        mtc_buffer_.minute |= (value & 0x03) << 4;
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Hour_LSB):
-					{
-                        mtc_buffer_.hour = (value & 0x0F);
-						break;
-					}
-					case static_cast<uint8_t>(StateFlag::QFM_Index_Hour_MSB):
-					{
-						mtc_buffer_.hour |= (value & 0x01) << 4;
-                        mtc_buffer_.type = (value >> 1) & 0x03;
-                        mtc_ = mtc_buffer_;
-                        b_available = true;
-                        clearBuffer();
-						break;
-					}
-                }
-				state = State::Header;
-				break;
-			}
+			const uint8_t b = data[i];
+			const uint8_t index = s | t.byteClass[b];
+			// the FFM fields are written to their slot, everything else to a scratch slot
+			fields_[t.field[index]] = b;
+			const uint8_t transition = t.next[index];
+			s = transition & kStateMask;
+			if (transition & kActionFlag)
+				act(b, offset_ + i, timestamp);
 		}
+		state_ = s;
+		offset_ += size;
+		return decoded_ - before;
 	}
 
-private:
-
-	void clearBuffer()
+	inline void feed(const uint8_t data, const uint64_t timestamp = 0)
 	{
-		mtc_buffer_.type = 0xFF;
-		mtc_buffer_.hour = 0xFF;
-		mtc_buffer_.minute = 0xFF;
-		mtc_buffer_.second = 0xFF;
-		mtc_buffer_.frame = 0xFF;
+		feed(&data, 1, timestamp);
 	}
 
-	enum class State
+private:
+
+	enum State : uint8_t
 	{
 		// for both
 		Header,
@@ -289,42 +197,171 @@ private:
 		FFM_Frame,
 		FFM_EOX,
 		// for QFM only
-		QFM_Value
+		QFM_Value,
+		NumStates
 	};
-	enum class StateFlag
+
+	// byte classes, the transition table only distinguishes these
+	enum ByteClass : uint8_t
 	{
-		FFM_Header_1 = 0xF0,
-		FFM_Header_2 = 0x7F,
-		FFM_Channel = 0x7F,
-		FFM_ID_1 = 0x01,
-		FFM_ID_2 = 0x01,
-		FFM_EOX = 0xF7,
-
-		QFM_Header = 0xF1,
-		QFM_Index_Frame_LSB = 0x00,
-		QFM_Index_Frame_MSB = 0x01,
-		QFM_Index_Second_LSB = 0x02,
-		QFM_Index_Second_MSB = 0x03,
-		QFM_Index_Minute_LSB = 0x04,
-		QFM_Index_Minute_MSB = 0x05,
-		QFM_Index_Hour_LSB = 0x06,
-		QFM_Index_Hour_MSB = 0x07,
+		Data,         // 0x00 - 0x7F, except the ones below
+		Data_7F,
+		Data_01,
+		SysEx,        // 0xF0
+		QuarterFrame, // 0xF1
+		EOX,          // 0xF7
+		RealTime,     // 0xF8 - 0xFF
+		OtherStatus,
+		NumClasses
 	};
 
-	enum class MTCType { FPS_24, FPS_25, FPS_29_97, FPS_30 };
-    const float MTCFrameRate[4] { 24.f, 25.f, 29.97f, 30.f };
-	const float MTCFrameSecond[4]
+	enum Field : uint8_t { Hour, Minute, Second, Frame, Scratch, NumFields };
+
+	// a table entry is (state << kClassBits) | kActionFlag, so it can be or'ed with the next byte class directly
+	static constexpr uint8_t kClassBits = 3;
+	static constexpr uint8_t kStateMask = 0x7F;
+	static constexpr uint8_t kActionFlag = 0x80;
+	static_assert(NumClasses <= (1 << kClassBits) && (NumStates << kClassBits) <= kStateMask + 1, "table entry overflow");
+
+	static constexpr size_t kQueueSize = MTC_PARSER_QUEUE_SIZE;
+	static constexpr size_t kQueueMask = kQueueSize - 1;
+	static_assert(kQueueSize > 0 && (kQueueSize & kQueueMask) == 0, "MTC_PARSER_QUEUE_SIZE has to be a power of two");
+
+	struct Tables
 	{
-		1.f / MTCFrameRate[0],
-		1.f / MTCFrameRate[1],
-		1.f / MTCFrameRate[2],
-		1.f / MTCFrameRate[3],
+		uint8_t byteClass[256];
+		uint8_t next[NumStates << kClassBits];  // next state, and whether the byte completes a message
+		uint8_t field[NumStates << kClassBits]; // where the byte is stored
 	};
 
-	MTCPacket mtc_;
-    MTCPacket mtc_buffer_;
-    State state {State::Header};
-    bool b_available{false};
+	static constexpr uint8_t entry(const State s, const bool action = false)
+	{
+		return static_cast<uint8_t>((s << kClassBits) | (action ? kActionFlag : 0));
+	}
+
+	static Tables buildTables()
+	{
+		Tables t {};
+		for (int b = 0; b < 256; ++b)
+		{
+			if (b < 0x80) t.byteClass[b] = (b == 0x7F) ? Data_7F : (b == 0x01) ? Data_01 : Data;
+			else if (b == 0xF0) t.byteClass[b] = SysEx;
+			else if (b == 0xF1) t.byteClass[b] = QuarterFrame;
+			else if (b == 0xF7) t.byteClass[b] = EOX;
+			else if (b >= 0xF8) t.byteClass[b] = RealTime;
+			else t.byteClass[b] = OtherStatus;
+		}
+
+		const uint8_t dataClasses[] = {Data, Data_7F, Data_01};
+		for (int s = 0; s < NumStates; ++s)
+		{
+			// defaults for every state: status bytes abort or start a message, real-time bytes are transparent
+			uint8_t* const next = t.next + (s << kClassBits);
+			for (int c = 0; c < NumClasses; ++c) next[c] = entry(Header);
+			next[SysEx] = entry(FFM_Header_2);
+			next[QuarterFrame] = entry(QFM_Value);
+			next[RealTime] = entry(static_cast<State>(s));
+			for (int c = 0; c < (1 << kClassBits); ++c) t.field[(s << kClassBits) | c] = Scratch;
+		}
+
+		// F0 7F 7F 01 01 hh mm ss ff F7
+		t.next[(FFM_Header_2 << kClassBits) | Data_7F] = entry(FFM_Channel);
+		t.next[(FFM_Channel << kClassBits) | Data_7F] = entry(FFM_ID_1);
+		t.next[(FFM_ID_1 << kClassBits) | Data_01] = entry(FFM_ID_2);
+		t.next[(FFM_ID_2 << kClassBits) | Data_01] = entry(FFM_Hour);
+		for (int f = Hour; f <= Frame; ++f)
+		{
+			const int s = FFM_Hour + f;
+			for (const uint8_t c : dataClasses)
+			{
+				t.next[(s << kClassBits) | c] = entry(static_cast<State>(s + 1));
+				t.field[(s << kClassBits) | c] = static_cast<uint8_t>(f);
+			}
+		}
+		t.next[(FFM_EOX << kClassBits) | EOX] = entry(Header, true);
+
+		// F1 0nnn dddd
+		for (const uint8_t c : dataClasses)
+			t.next[(QFM_Value << kClassBits) | c] = entry(Header, true);
+
+		return t;
+	}
+
+	static const Tables& tables()
+	{
+		static const Tables t = buildTables();
+		return t;
+	}
+
+	// called for the last byte of a message only: 0xF7 of a FFM or the value of a QFM
+	inline void act(const uint8_t data, const uint64_t byteOffset, const uint64_t timestamp)
+	{
+		if (data == 0xF7)
+		{
+			MTCPacket p;
+			p.type = (fields_[Hour] >> 5) & 0x03;
+			p.hour = (fields_[Hour] >> 0) & 0x1F;
+			p.minute = fields_[Minute];
+			p.second = fields_[Second];
+			p.frame = fields_[Frame];
+			push(p, Source::FullFrame, byteOffset, timestamp);
+			return;
+		}
+
+		const uint8_t index = (data >> 4) & 0x07;
+		pieces_[index] = data & 0x0F;
+		pieces_received_ |= 1 << index;
+
+		// the last piece completes the timecode, if all others arrived since the previous one
+		if (index == 7)
+		{
+			if (pieces_received_ == 0xFF)
+			{
+				MTCPacket p;
+				p.frame = pieces_[0] | ((pieces_[1] & 0x01) << 4);
+				p.second = pieces_[2] | ((pieces_[3] & 0x03) << 4);
+				p.minute = pieces_[4] | ((pieces_[5] & 0x03) << 4);
+				p.hour = pieces_[6] | ((pieces_[7] & 0x01) << 4);
+				p.type = (pieces_[7] >> 1) & 0x03;
+				push(p, Source::QuarterFrame, byteOffset, timestamp);
+			}
+			pieces_received_ = 0;
+		}
+	}
+
+	inline void push(const MTCPacket& packet, const Source source, const uint64_t byteOffset, const uint64_t timestamp)
+	{
+		mtc_ = packet;
+		++decoded_;
+		if (count_ == kQueueSize)
+		{
+			pop();
+			++dropped_;
+		}
+		MTCEvent& e = queue_[(head_ + count_) & kQueueMask];
+		e.mtc = packet;
+		e.source = source;
+		e.byteOffset = byteOffset;
+		e.timestamp = timestamp;
+		++count_;
+	}
+
+	inline const MTCPacket& current() const { return count_ > 0 ? queue_[head_].mtc : mtc_; }
+
+	enum class MTCType { FPS_24, FPS_25, FPS_29_97, FPS_30 };
+
+	MTCPacket mtc_ {0, 0, 0, 0, 0};
+    uint8_t state_ {entry(Header)};
+    uint8_t fields_[NumFields] {};
+    uint8_t pieces_[8] {};
+    uint8_t pieces_received_ {0};
+
+    MTCEvent queue_[kQueueSize];
+    size_t head_ {0};
+    size_t count_ {0};
+    size_t decoded_ {0};
+    uint32_t dropped_ {0};
+    uint64_t offset_ {0};
 };
 
 #endif
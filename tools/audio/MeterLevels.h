@@ -0,0 +1,213 @@
+#pragma once
+#ifndef MeterLevels_H
+#define MeterLevels_H
+
+// Level meter values for many output channels, computed from planar audio
+// buffers in the audio callback. Each block is reduced per channel to its
+// peak (SSE or NEON, scalar elsewhere) or mean square (independent
+// accumulators the compiler keeps in vector registers). The decibel mapping
+// for display then runs once per block over all channels, with an inline
+// log2 instead of a libm call per channel.
+//
+// Two modes:
+//  - Peak: the block peak, with an instant attack and a release of 5% of
+//    the distance per block (the behavior of the sphere meters so far).
+//  - Rms: the mean square integrated with a time constant (0.4 s by
+//    default, like a momentary loudness meter), independent of the block
+//    size.
+//
+// configure() allocates everything; process() never allocates and can run
+// in the audio callback. Display values are 0.01 for -60 dB and below, up
+// to 0.31 at 0 dB.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum class MeterMode { Peak, Rms };
+
+class MeterLevels {
+public:
+  /// Allocates the meters. Call before the audio starts, or whenever the
+  /// channel count changes, outside the audio thread.
+  void configure(size_t numChannels, double sampleRate,
+                 MeterMode mode = MeterMode::Peak,
+                 double rmsTimeConstant = 0.4) {
+    mMode = mode;
+    mSampleRate = sampleRate;
+    mTimeConstant = rmsTimeConstant;
+    mCoefficientFrames = 0;
+    mLevels.assign(numChannels, 0.0f);
+    mMeanSquares.assign(numChannels, 0.0f);
+    mValues.assign(numChannels, float(kFloor)); // by value, see kFloor
+  }
+
+  size_t numChannels() const { return mValues.size(); }
+  MeterMode mode() const { return mMode; }
+
+  /// Measures one block. Channels beyond numChannels() are ignored, so a
+  /// change of the device's channel count doesn't allocate here.
+  void process(const float *const *channels, size_t numChannels,
+               size_t numFrames) {
+    numChannels = std::min(numChannels, mValues.size());
+    if (numFrames == 0) {
+      return;
+    }
+    if (mMode == MeterMode::Peak) {
+      for (size_t c = 0; c < numChannels; c++) {
+        mLevels[c] = peak(channels[c], numFrames);
+      }
+      // Amplitude to dB: 20 log10(x)
+      toDisplay(mLevels.data(), numChannels, 20.0f);
+      for (size_t c = 0; c < numChannels; c++) {
+        const float target = mLevels[c];
+        float &value = mValues[c];
+        value = value > target ? value - 0.05f * (value - target) : target;
+      }
+    } else {
+      if (numFrames != mCoefficientFrames) {
+        // Integration over the block, for any block size
+        mCoefficient = float(1.0 - std::exp(-double(numFrames) /
+                                            (mTimeConstant * mSampleRate)));
+        mCoefficientFrames = numFrames;
+      }
+      const float invFrames = 1.0f / float(numFrames);
+      for (size_t c = 0; c < numChannels; c++) {
+        const float meanSquare = sumOfSquares(channels[c], numFrames) *
+                                 invFrames;
+        mMeanSquares[c] += mCoefficient * (meanSquare - mMeanSquares[c]);
+        mLevels[c] = mMeanSquares[c];
+      }
+      // Power to dB: 10 log10(x)
+      toDisplay(mLevels.data(), numChannels, 10.0f);
+      std::memcpy(mValues.data(), mLevels.data(), numChannels * sizeof(float));
+    }
+  }
+
+  /// Display values, see the top of the file
+  const std::vector<float> &values() const { return mValues; }
+
+  /// Overwrites the display values, e.g. with the ones received from the
+  /// primary. Allocates if count differs from numChannels().
+  void setValues(const float *values, size_t count) {
+    if (mValues.size() != count) {
+      configure(count, mSampleRate, mMode, mTimeConstant);
+    }
+    std::memcpy(mValues.data(), values, count * sizeof(float));
+  }
+
+  /// Largest absolute sample
+  static float peak(const float *samples, size_t numFrames) {
+    size_t i = 0;
+    float result = 0.0f;
+#if defined(__SSE2__)
+    // Compilers don't vectorize a float max reduction on their own without
+    // -ffast-math
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 a = _mm_setzero_ps(), b = a, c = a, d = a;
+    for (; i + 16 <= numFrames; i += 16) {
+      a = _mm_max_ps(a, _mm_and_ps(_mm_loadu_ps(samples + i), absMask));
+      b = _mm_max_ps(b, _mm_and_ps(_mm_loadu_ps(samples + i + 4), absMask));
+      c = _mm_max_ps(c, _mm_and_ps(_mm_loadu_ps(samples + i + 8), absMask));
+      d = _mm_max_ps(d, _mm_and_ps(_mm_loadu_ps(samples + i + 12), absMask));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_max_ps(_mm_max_ps(a, b), _mm_max_ps(c, d)));
+    result = std::max(std::max(lanes[0], lanes[1]),
+                      std::max(lanes[2], lanes[3]));
+#elif defined(__ARM_NEON)
+    float32x4_t a = vdupq_n_f32(0.0f), b = a, c = a, d = a;
+    for (; i + 16 <= numFrames; i += 16) {
+      a = vmaxq_f32(a, vabsq_f32(vld1q_f32(samples + i)));
+      b = vmaxq_f32(b, vabsq_f32(vld1q_f32(samples + i + 4)));
+      c = vmaxq_f32(c, vabsq_f32(vld1q_f32(samples + i + 8)));
+      d = vmaxq_f32(d, vabsq_f32(vld1q_f32(samples + i + 12)));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vmaxq_f32(vmaxq_f32(a, b), vmaxq_f32(c, d)));
+    result = std::max(std::max(lanes[0], lanes[1]),
+                      std::max(lanes[2], lanes[3]));
+#else
+    float a = 0.0f, b = 0.0f, c = 0.0f, d = 0.0f;
+    for (; i + 4 <= numFrames; i += 4) {
+      a = std::max(a, std::fabs(samples[i]));
+      b = std::max(b, std::fabs(samples[i + 1]));
+      c = std::max(c, std::fabs(samples[i + 2]));
+      d = std::max(d, std::fabs(samples[i + 3]));
+    }
+    result = std::max(std::max(a, b), std::max(c, d));
+#endif
+    for (; i < numFrames; i++) {
+      result = std::max(result, std::fabs(samples[i]));
+    }
+    return result;
+  }
+
+  static float sumOfSquares(const float *samples, size_t numFrames) {
+    float acc[kLanes] = {};
+    size_t i = 0;
+    for (; i + kLanes <= numFrames; i += kLanes) {
+      for (size_t l = 0; l < kLanes; l++) {
+        acc[l] += samples[i + l] * samples[i + l];
+      }
+    }
+    float result = 0.0f;
+    for (size_t l = 0; l < kLanes; l++) {
+      result += acc[l];
+    }
+    for (; i < numFrames; i++) {
+      result += samples[i] * samples[i];
+    }
+    return result;
+  }
+
+private:
+  static constexpr size_t kLanes = 16;
+  // Only used by value: C++14 has no out of class definition for it
+  static constexpr float kFloor = 0.01f;
+
+  // level -> 0.01 + 0.005 * (60 + dB), with dB = scale * log10(level), and
+  // 0.01 for -60 dB and below. log2 from the float exponent plus a short series
+  // for the mantissa, accurate to about 0.001 dB, which is plenty for a
+  // display with 0.005 per dB.
+  static void toDisplay(float *levels, size_t count, float scale) {
+    const float log10Of2 = 0.30103f;
+    for (size_t c = 0; c < count; c++) {
+      const float x = std::max(levels[c], 1e-30f);
+      uint32_t bits;
+      std::memcpy(&bits, &x, sizeof(bits));
+      const float exponent = float(int32_t(bits >> 23) - 127);
+      bits = (bits & 0x007FFFFFu) | 0x3F800000u;
+      float m;
+      std::memcpy(&m, &bits, sizeof(m));
+      // log2(m) for m in [1, 2), from the series of atanh
+      const float t = (m - 1.0f) / (m + 1.0f);
+      const float t2 = t * t;
+      const float log2m =
+          2.88539f * t *
+          (1.0f + t2 * (0.333333f + t2 * (0.2f + t2 * 0.142857f)));
+      const float db = scale * log10Of2 * (exponent + log2m);
+      levels[c] = db < -60.0f ? kFloor : kFloor + 0.005f * (60.0f + db);
+    }
+  }
+
+  MeterMode mMode{MeterMode::Peak};
+  double mSampleRate{48000.0};
+  double mTimeConstant{0.4};
+  size_t mCoefficientFrames{0};
+  float mCoefficient{0.0f};
+  std::vector<float> mLevels;
+  std::vector<float> mMeanSquares;
+  std::vector<float> mValues;
+};
+
+#endif
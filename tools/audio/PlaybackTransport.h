@@ -0,0 +1,304 @@
+#pragma once
+#ifndef PlaybackTransport_H
+#define PlaybackTransport_H
+
+// Transport for a group of streams played in sync, e.g. all files of a
+// multichannel_playback session. Control threads post commands (play, pause,
+// locate, skip) to a queue; the audio thread applies them at block
+// boundaries in beginBlock(), so every stream is moved to the same timeline
+// frame between two blocks and no read ever races a seek.
+//
+// Every stop is sample accurate: running audio fades out over a few
+// milliseconds, then all streams are seeked to a single frame (the locate
+// target, or the frame where a pause ended), so they are back in sync even
+// if one of them underran. Playback resumes only once every stream has its
+// prefetch buffered, polling StreamingScheduler::ready() once per block
+// instead of waiting, and fades back in.
+//
+// Usage in the audio callback:
+//
+//   const TransportBlock block = transport.beginBlock(numFrames);
+//   if (block.read) {
+//     // read numFrames from every stream and mix them
+//     for (each output channel) block.applyGain(out, numFrames);
+//   }
+//
+// The timeline frame is the same as the file frame, except for looping
+// files, which wrap around.
+
+#include "StreamingScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifndef PLAYBACK_TRANSPORT_QUEUE_SIZE
+#define PLAYBACK_TRANSPORT_QUEUE_SIZE 64 // must be a power of two
+#endif
+
+enum class TransportCommandType : uint8_t {
+  Play,
+  Pause,
+  /// Go to frame
+  Locate,
+  /// Move by frames (negative for backwards) from the current position, or
+  /// from the target of a locate that hasn't been applied yet
+  Skip
+};
+
+struct TransportCommand {
+  TransportCommandType type{TransportCommandType::Play};
+  int64_t frames{0};
+};
+
+enum class TransportState : uint8_t {
+  Stopped,
+  /// Waiting for all streams to buffer their prefetch before playing
+  Prefetching,
+  Playing
+};
+
+/// What the audio callback does with one block
+struct TransportBlock {
+  /// Read and mix the streams. False while stopped or prefetching; the
+  /// block is silent and the streams must not be read.
+  bool read{false};
+  /// Timeline frame of the first frame of the block
+  uint64_t position{0};
+  /// The gain ramps from gainStart by gainStep per frame for rampFrames
+  /// frames, and stays at gainEnd after that
+  float gainStart{1.0f};
+  float gainStep{0.0f};
+  uint32_t rampFrames{0};
+  float gainEnd{1.0f};
+
+  bool fading() const { return rampFrames > 0 || gainEnd != 1.0f; }
+
+  /// Applies the fade to one mixed output channel of the block
+  void applyGain(float *buffer, size_t numFrames) const {
+    if (!fading()) {
+      return;
+    }
+    const size_t ramp = std::min<size_t>(rampFrames, numFrames);
+    for (size_t i = 0; i < ramp; i++) {
+      buffer[i] *= gainStart + gainStep * float(i);
+    }
+    for (size_t i = ramp; i < numFrames; i++) {
+      buffer[i] *= gainEnd;
+    }
+  }
+};
+
+class PlaybackTransport {
+public:
+  /// fadeFrames is the length of the fades around stops and locates,
+  /// prefetchFrames what every stream must have buffered before playback
+  /// starts. Call before the audio starts, and set the streams with
+  /// setStreams().
+  void configure(StreamingScheduler &streamer, uint32_t fadeFrames,
+                 uint64_t prefetchFrames) {
+    mStreamer = &streamer;
+    mFadeFrames = std::max<uint32_t>(fadeFrames, 1);
+    mPrefetchFrames = prefetchFrames;
+  }
+
+  void setStreams(const std::vector<int> &streams) { mStreams = streams; }
+
+  /// Queues a command for the next block. Can be called from any thread
+  /// except the audio thread. Returns false if the queue is full.
+  bool post(TransportCommand command) {
+    std::lock_guard<std::mutex> lock(mPostLock);
+    const uint32_t write = mWriteIndex.load(std::memory_order_relaxed);
+    if (write - mReadIndex.load(std::memory_order_acquire) >= kQueueSize) {
+      return false;
+    }
+    mQueue[write & (kQueueSize - 1)] = command;
+    mWriteIndex.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool play() { return post({TransportCommandType::Play, 0}); }
+  bool pause() { return post({TransportCommandType::Pause, 0}); }
+  bool locate(uint64_t frame) {
+    return post({TransportCommandType::Locate, int64_t(frame)});
+  }
+  bool skip(int64_t frames) {
+    return post({TransportCommandType::Skip, frames});
+  }
+
+  /// Called by the audio thread at the start of every block, before any
+  /// stream is read. Doesn't lock, allocate or wait.
+  TransportBlock beginBlock(size_t numFrames) {
+    applyCommands();
+
+    if (mSeekPending) {
+      // The previous block finished a fade out
+      seekAll(mSeekFrame);
+      mSeekPending = false;
+      mState = mWantPlay ? TransportState::Prefetching
+                         : TransportState::Stopped;
+    }
+
+    if (mState != TransportState::Playing) {
+      if (mLocatePending) {
+        // Silent already, no fade needed
+        seekAll(mLocateFrame);
+        mLocatePending = false;
+      }
+      for (int stream : mStreams) {
+        mStreamer->dropStale(stream);
+      }
+      if (!mWantPlay) {
+        mState = TransportState::Stopped;
+      } else if (allReady()) {
+        mState = TransportState::Playing;
+        mGain = 0.0f;
+      } else {
+        mState = TransportState::Prefetching;
+      }
+      publish();
+      if (mState != TransportState::Playing) {
+        TransportBlock block;
+        block.position = mPosition;
+        return block;
+      }
+    }
+
+    // Playing: fade out for a stop or locate, in otherwise
+    const bool stopping = !mWantPlay || mLocatePending;
+    const float target = stopping ? 0.0f : 1.0f;
+    TransportBlock block;
+    block.read = true;
+    block.position = mPosition;
+    block.gainStart = mGain;
+    block.gainEnd = target;
+    if (mGain != target) {
+      const float step = 1.0f / float(mFadeFrames);
+      const uint32_t remaining =
+          uint32_t(std::ceil(std::fabs(target - mGain) / step));
+      block.rampFrames = uint32_t(std::min<size_t>(remaining, numFrames));
+      block.gainStep = stopping ? -step : step;
+      if (remaining <= numFrames) {
+        mGain = target;
+        if (stopping) {
+          // Silent from here on: stop where the fade ended
+          mSeekPending = true;
+          mSeekFrame = mLocatePending ? mLocateFrame : mPosition + remaining;
+          mLocatePending = false;
+        }
+      } else {
+        mGain += block.gainStep * float(numFrames);
+      }
+    }
+    mPosition += numFrames;
+    publish();
+    return block;
+  }
+
+  /// Timeline position of the audio thread, for display
+  uint64_t position() const {
+    return mSharedPosition.load(std::memory_order_relaxed);
+  }
+
+  TransportState state() const {
+    return mSharedState.load(std::memory_order_relaxed);
+  }
+
+  /// Number of locates applied, including the re-syncs after each pause
+  uint64_t locateCount() const {
+    return mSharedLocateCount.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr uint32_t kQueueSize = PLAYBACK_TRANSPORT_QUEUE_SIZE;
+
+  void applyCommands() {
+    const uint32_t write = mWriteIndex.load(std::memory_order_acquire);
+    uint32_t read = mReadIndex.load(std::memory_order_relaxed);
+    for (; read != write; read++) {
+      const TransportCommand &command = mQueue[read & (kQueueSize - 1)];
+      switch (command.type) {
+      case TransportCommandType::Play:
+        mWantPlay = true;
+        break;
+      case TransportCommandType::Pause:
+        mWantPlay = false;
+        break;
+      case TransportCommandType::Locate:
+        mLocatePending = true;
+        mLocateFrame = uint64_t(std::max<int64_t>(command.frames, 0));
+        break;
+      case TransportCommandType::Skip: {
+        const uint64_t from = mLocatePending ? mLocateFrame
+                              : mSeekPending ? mSeekFrame
+                                             : mPosition;
+        mLocatePending = true;
+        mLocateFrame = command.frames < 0 && uint64_t(-command.frames) > from
+                           ? 0
+                           : uint64_t(int64_t(from) + command.frames);
+        break;
+      }
+      }
+    }
+    mReadIndex.store(read, std::memory_order_release);
+  }
+
+  void seekAll(uint64_t frame) {
+    for (int stream : mStreams) {
+      const uint64_t frames = mStreamer->frames(stream);
+      mStreamer->seek(stream,
+                      mStreamer->loops(stream) && frames > 0 ? frame % frames
+                                                             : frame,
+                      false);
+    }
+    mStreamer->wake();
+    mPosition = frame;
+    mLocateCount++;
+  }
+
+  bool allReady() const {
+    for (int stream : mStreams) {
+      if (!mStreamer->ready(stream, mPrefetchFrames)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void publish() {
+    mSharedPosition.store(mPosition, std::memory_order_relaxed);
+    mSharedState.store(mState, std::memory_order_relaxed);
+    mSharedLocateCount.store(mLocateCount, std::memory_order_relaxed);
+  }
+
+  StreamingScheduler *mStreamer{nullptr};
+  std::vector<int> mStreams;
+  uint32_t mFadeFrames{64};
+  uint64_t mPrefetchFrames{8192};
+
+  // Command queue, many producers serialized by mPostLock, one consumer
+  TransportCommand mQueue[kQueueSize];
+  std::atomic<uint32_t> mWriteIndex{0};
+  std::atomic<uint32_t> mReadIndex{0};
+  std::mutex mPostLock;
+
+  // Audio thread only
+  TransportState mState{TransportState::Stopped};
+  bool mWantPlay{false};
+  bool mLocatePending{false};
+  uint64_t mLocateFrame{0};
+  bool mSeekPending{false};
+  uint64_t mSeekFrame{0};
+  uint64_t mPosition{0};
+  uint64_t mLocateCount{0};
+  float mGain{0.0f};
+
+  std::atomic<uint64_t> mSharedPosition{0};
+  std::atomic<TransportState> mSharedState{TransportState::Stopped};
+  std::atomic<uint64_t> mSharedLocateCount{0};
+};
+
+#endif
@@ -0,0 +1,238 @@
+#pragma once
+#ifndef RenderPool_H
+#define RenderPool_H
+
+// Threads that help the audio thread with the work of one block, e.g.
+// rendering and spatializing many voices. The audio thread calls run() with
+// a number of items; it works on them itself as worker 0, the pool threads
+// as workers 1 to numWorkers() - 1, each claiming the next item from an
+// atomic counter, and run() returns once all of them are done.
+//
+// Between blocks the pool threads spin (pausing the core, then yielding)
+// on a generation counter instead of sleeping on a condition variable, so
+// the audio thread never locks, allocates or makes a system call to wake
+// them: the start and the end of run() are the only synchronization, a
+// barrier of atomics. The end of run() waits for the items, not for the
+// threads: a thread that wakes late, or not at all before the items are
+// done, doesn't hold up the audio thread. Items are claimed with the
+// generation of their run, so such a thread can't claim or count an item
+// of a later run. The price is CPU time spent spinning, so keep the pool
+// smaller than the number of cores. Only when no block came for a while
+// (the audio stopped) do the threads sleep between checks. On Linux the
+// threads can be pinned to cores, which keeps their buffers in the core's
+// cache from one block to the next.
+//
+// Each worker writes to its own buffers, indexed by the worker number, and
+// the buffers are summed in a second run() over the output channels, with
+// accumulate().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class RenderPool {
+public:
+  /// Work on one item, called with the worker number (0 is the thread that
+  /// called run()) and the item index
+  typedef void (*Job)(void *context, unsigned int worker, size_t item);
+
+  RenderPool() {}
+  RenderPool(const RenderPool &) = delete;
+  RenderPool &operator=(const RenderPool &) = delete;
+  ~RenderPool() { stop(); }
+
+  /// Starts workers - 1 threads, the caller of run() being the first
+  /// worker. With pinToCores, thread n runs on core n (modulo the number of
+  /// cores), Linux only. Not while run() is running.
+  void start(unsigned int workers, bool pinToCores) {
+    stop();
+    mStop = false;
+    // Taken here, so a run() right after start() isn't missed by a thread
+    // that starts late
+    const uint32_t generation = mGeneration.load();
+    for (unsigned int w = 1; w < std::max(workers, 1u); w++) {
+      mThreads.emplace_back(
+          [this, w, generation]() { workerLoop(w, generation); });
+      if (pinToCores) {
+        pin(mThreads.back(), w);
+      }
+    }
+  }
+
+  void stop() {
+    mStop = true;
+    for (auto &thread : mThreads) {
+      thread.join();
+    }
+    mThreads.clear();
+  }
+
+  unsigned int numWorkers() const { return unsigned(mThreads.size()) + 1; }
+
+  /// Runs job on items 0 to count - 1 and returns when all are done. Only
+  /// one thread may call it, usually the audio thread. Doesn't lock or
+  /// allocate.
+  void run(size_t count, Job job, void *context) {
+    if (mThreads.empty() || count < 2) {
+      for (size_t i = 0; i < count; i++) {
+        job(context, 0, i);
+      }
+      return;
+    }
+    // Start barrier, a sequence lock: the job is written while the
+    // generation is odd, and a thread that reads it across a change of the
+    // generation reads it again
+    const uint32_t generation = mGeneration.load(std::memory_order_relaxed);
+    mGeneration.store(generation + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mJob.store(job, std::memory_order_relaxed);
+    mContext.store(context, std::memory_order_relaxed);
+    mCount.store(count, std::memory_order_relaxed);
+    mDone.store(0, std::memory_order_relaxed);
+    mNext.store(uint64_t(generation + 2) << 32, std::memory_order_relaxed);
+    mGeneration.store(generation + 2, std::memory_order_release);
+    work(0, generation + 2, job, context, count);
+    // End barrier: every item is done. Threads still in work() only find
+    // items of this run, all claimed, or a newer generation.
+    unsigned int spins = 0;
+    while (mDone.load(std::memory_order_acquire) < count) {
+      wait(spins, false);
+    }
+  }
+
+  /// out[i] += the sum of inputs[0 .. numInputs - 1][i], numFrames values
+  static void accumulate(float *out, const float *const *inputs,
+                         size_t numInputs, size_t numFrames) {
+    size_t i = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    const size_t vectorFrames = numFrames - numFrames % 4;
+#endif
+#if defined(__SSE2__)
+    for (; i < vectorFrames; i += 4) {
+      __m128 sum = _mm_loadu_ps(out + i);
+      for (size_t n = 0; n < numInputs; n++) {
+        sum = _mm_add_ps(sum, _mm_loadu_ps(inputs[n] + i));
+      }
+      _mm_storeu_ps(out + i, sum);
+    }
+#elif defined(__ARM_NEON)
+    for (; i < vectorFrames; i += 4) {
+      float32x4_t sum = vld1q_f32(out + i);
+      for (size_t n = 0; n < numInputs; n++) {
+        sum = vaddq_f32(sum, vld1q_f32(inputs[n] + i));
+      }
+      vst1q_f32(out + i, sum);
+    }
+#endif
+    for (; i < numFrames; i++) {
+      float sum = out[i];
+      for (size_t n = 0; n < numInputs; n++) {
+        sum += inputs[n][i];
+      }
+      out[i] = sum;
+    }
+  }
+
+private:
+  // Busy waiting, then yielding, then (if mayRest) sleeping after about
+  // 100 ms without work
+  static const unsigned int kSpins = 2000;
+  static const unsigned int kYields = 200000;
+
+  static void wait(unsigned int &spins, bool mayRest) {
+    if (spins < kSpins) {
+      spins++;
+#if defined(__SSE2__)
+      _mm_pause();
+#endif
+    } else if (spins < kSpins + kYields || !mayRest) {
+      spins++;
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  static void pin(std::thread &thread, unsigned int index) {
+#if defined(__linux__)
+    const unsigned int cores =
+        std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)index;
+#endif
+  }
+
+  // Claims and runs items of the run with the given generation, until
+  // there are none left or a newer run started. mNext holds the generation
+  // in the upper 32 bits and the next item in the lower ones.
+  void work(unsigned int worker, uint32_t generation, Job job, void *context,
+            size_t count) {
+    uint64_t next = mNext.load(std::memory_order_relaxed);
+    while (uint32_t(next >> 32) == generation && (next & 0xFFFFFFFFu) < count) {
+      if (mNext.compare_exchange_weak(next, next + 1,
+                                      std::memory_order_relaxed)) {
+        job(context, worker, size_t(next & 0xFFFFFFFFu));
+        mDone.fetch_add(1, std::memory_order_release);
+        next = mNext.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void workerLoop(unsigned int worker, uint32_t seen) {
+    while (true) {
+      unsigned int spins = 0;
+      uint32_t generation;
+      while ((generation = mGeneration.load(std::memory_order_acquire)) ==
+                 seen ||
+             (generation & 1)) {
+        if (mStop.load(std::memory_order_relaxed)) {
+          return;
+        }
+        wait(spins, true);
+      }
+      const Job job = mJob.load(std::memory_order_relaxed);
+      void *const context = mContext.load(std::memory_order_relaxed);
+      const size_t count = mCount.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (mGeneration.load(std::memory_order_relaxed) != generation) {
+        continue; // the next run started while reading, read it again
+      }
+      seen = generation;
+      work(worker, generation, job, context, count);
+    }
+  }
+
+  std::vector<std::thread> mThreads;
+  std::atomic<bool> mStop{false};
+  // Even between runs, odd while run() writes the job
+  std::atomic<uint32_t> mGeneration{0};
+  std::atomic<uint64_t> mNext{0};
+  // Items of the current run done
+  std::atomic<size_t> mDone{0};
+  // Set by run() while the generation is odd
+  std::atomic<Job> mJob{nullptr};
+  std::atomic<void *> mContext{nullptr};
+  std::atomic<size_t> mCount{0};
+};
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef RoutingTable_H
+#define RoutingTable_H
+
+// Flat routing table of multichannel_playback: every channel of every file
+// is one entry, and the entries of a file are stored contiguously, so the
+// audio callback mixes a file with one call and no per-channel lookups.
+// See deinterleave_bench for the check and timing of the kernel.
+
+#include <cstddef>
+#include <cstdint>
+
+/// One file channel mixed into one output channel. The routes of a file are
+/// stored contiguously in a flat table built at onInit().
+struct Route {
+  uint32_t sourceChannel;
+  uint32_t outChannel;
+  float gain;
+};
+
+/// Accumulates gain * interleaved[frame * numChannels + sourceChannel] into
+/// outs[route] for all routes of a file. The output channels never alias the
+/// read buffer, and with __restrict and the common strides spelled out the
+/// compiler vectorizes the mono and stereo loops.
+inline void deinterleaveAccumulate(const float *interleaved,
+                                   size_t numChannels, const Route *routes,
+                                   float *const *outs, size_t numRoutes,
+                                   size_t numFrames) {
+  for (size_t r = 0; r < numRoutes; r++) {
+    float *__restrict out = outs[r];
+    const float *__restrict in = interleaved + routes[r].sourceChannel;
+    const float gain = routes[r].gain;
+    if (numChannels == 1) {
+      for (size_t i = 0; i < numFrames; i++) {
+        out[i] += gain * in[i];
+      }
+    } else if (numChannels == 2) {
+      for (size_t i = 0; i < numFrames; i++) {
+        out[i] += gain * in[2 * i];
+      }
+    } else {
+      for (size_t i = 0; i < numFrames; i++) {
+        out[i] += gain * in[i * numChannels];
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,157 @@
+#pragma once
+#ifndef StatePacking_H
+#define StatePacking_H
+
+// Compact fields for the shared state of DistributedAppWithState apps.
+// Cuttlebone broadcasts the whole state struct every frame, so what it
+// costs is its size: these fields quantize what the renderers don't need at
+// full precision, and carry change information so renderers only apply
+// what changed.
+//
+//  - PackedMeters: meter display values (see MeterLevels.h) as 8 bit dB, in
+//    0.25 dB steps, with a mask of the meters that changed.
+//  - PackedPose: position as floats, orientation as 16 bit integers.
+//  - StateHeader: a sequence number, bumped whenever a field changes, and
+//    a mask of the fields that changed in that step.
+//
+// The primary packs its values every frame; a field that didn't change
+// (after quantization) is left untouched, and so is the header if nothing
+// changed. Renderers pass the header to a StateReceiver, which tells them
+// which fields to apply: none for a state they have already seen, the
+// changed ones for the next step, and all of them after a dropped frame or
+// on the first state, since the masks are only relative to the previous
+// step.
+//
+// All types are trivially copyable and can be members of a state struct.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+struct StateHeader {
+  uint32_t sequence{0};
+  /// Fields changed since sequence - 1, one bit per field as chosen by the
+  /// app
+  uint32_t changedFields{0};
+
+  /// Primary: starts a new step if any field changed
+  void publish(uint32_t fields) {
+    if (fields != 0) {
+      sequence++;
+      changedFields = fields;
+    }
+  }
+};
+
+/// Renderer side of StateHeader
+class StateReceiver {
+public:
+  static constexpr uint32_t kAllFields = 0xFFFFFFFFu;
+
+  /// Fields to apply from the state with this header
+  uint32_t receive(const StateHeader &header) {
+    if (mValid && header.sequence == mSequence) {
+      return 0;
+    }
+    const bool next = mValid && header.sequence == mSequence + 1;
+    mValid = true;
+    mSequence = header.sequence;
+    return next ? header.changedFields : uint32_t(kAllFields);
+  }
+
+  /// True if the last receive() returned kAllFields
+  static bool all(uint32_t fields) { return fields == kAllFields; }
+
+private:
+  uint32_t mSequence{0};
+  bool mValid{false};
+};
+
+/// Meter display values, 0.01 + 0.005 per dB above -60 dB, as one byte each
+template <size_t N> struct PackedMeters {
+  static constexpr float kFloor = 0.01f;
+  /// Display value per step, 0.25 dB
+  static constexpr float kStep = 0.00125f;
+
+  uint8_t levels[N] = {0};
+  /// Meters changed in the last step that changed any
+  uint64_t changed[(N + 63) / 64] = {0};
+
+  static uint8_t pack(float value) {
+    const float steps = (value - kFloor) * (1.0f / kStep) + 0.5f;
+    return uint8_t(std::min(std::max(steps, 0.0f), 255.0f));
+  }
+
+  static float unpack(uint8_t level) { return kFloor + kStep * level; }
+
+  /// Primary: quantizes count values (at most N, the rest read as silent).
+  /// Returns false, and leaves everything as it was, if no level changed.
+  bool pack(const float *values, size_t count) {
+    uint64_t mask[(N + 63) / 64] = {0};
+    uint8_t packed[N];
+    bool any = false;
+    for (size_t i = 0; i < N; i++) {
+      packed[i] = i < count ? pack(values[i]) : 0;
+      if (packed[i] != levels[i]) {
+        mask[i / 64] |= uint64_t(1) << (i % 64);
+        any = true;
+      }
+    }
+    if (any) {
+      std::memcpy(levels, packed, sizeof(levels));
+      std::memcpy(changed, mask, sizeof(changed));
+    }
+    return any;
+  }
+
+  /// Renderer: writes count values (at most N), only the changed ones
+  /// unless all is true
+  void unpack(float *values, size_t count, bool all) const {
+    count = std::min(count, N);
+    for (size_t i = 0; i < count; i++) {
+      if (all || (changed[i / 64] >> (i % 64)) & 1) {
+        values[i] = unpack(levels[i]);
+      }
+    }
+  }
+};
+
+/// Position as floats, unit quaternion (w, x, y, z) as 16 bit integers
+struct PackedPose {
+  float position[3] = {0.0f, 0.0f, 0.0f};
+  int16_t orientation[4] = {32767, 0, 0, 0};
+
+  /// Primary: returns false, and leaves the pose as it was, if it didn't
+  /// change after quantization
+  bool pack(const float *newPosition, const float *quaternion) {
+    PackedPose packed;
+    std::memcpy(packed.position, newPosition, sizeof(packed.position));
+    for (int i = 0; i < 4; i++) {
+      const float q = std::min(std::max(quaternion[i], -1.0f), 1.0f);
+      packed.orientation[i] = int16_t(std::lround(q * 32767.0f));
+    }
+    if (std::memcmp(&packed, this, sizeof(PackedPose)) == 0) {
+      return false;
+    }
+    *this = packed;
+    return true;
+  }
+
+  /// Renderer: the quaternion is renormalized
+  void unpack(float *outPosition, float *quaternion) const {
+    std::memcpy(outPosition, position, sizeof(position));
+    float norm = 0.0f;
+    for (int i = 0; i < 4; i++) {
+      quaternion[i] = orientation[i] * (1.0f / 32767.0f);
+      norm += quaternion[i] * quaternion[i];
+    }
+    norm = norm > 0.0f ? 1.0f / std::sqrt(norm) : 1.0f;
+    for (int i = 0; i < 4; i++) {
+      quaternion[i] *= norm;
+    }
+  }
+};
+
+#endif
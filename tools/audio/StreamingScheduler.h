@@ -0,0 +1,740 @@
+#pragma once
+#ifndef StreamingScheduler_H
+#define StreamingScheduler_H
+
+// Streams many WAV files from disk for real-time playback. Instead of one
+// reader thread per file, a small pool of I/O threads serves all files: each
+// file has a ring of fixed-size blocks, and whenever a thread is free it
+// refills the file that will run dry first (the least buffered time), with
+// one read covering as many contiguous free blocks as allowed. Under disk
+// contention this keeps every file ahead instead of letting the unlucky ones
+// starve.
+//
+// Threads:
+//  - read(), dropStale() are for a single consumer, the audio callback. They
+//    don't lock or allocate.
+//  - seek() can be called from any one control thread (e.g. the GUI, or
+//    the audio thread through PlaybackTransport).
+//  - position(), ready() and the counters can be read from anywhere.
+//
+// Seeking: seek() bumps the file's generation number. Blocks carry the
+// generation they were read for, and the consumer discards blocks from older
+// generations, so the audio thread never waits for the I/O threads. While
+// playback is paused the consumer should still call dropStale() so the ring
+// makes room for the new position.
+//
+// Files can also be memory mapped instead (POSIX only, other platforms
+// fall back to streaming). Mapped files bypass the ring and the I/O threads:
+// the consumer decodes straight from the mapping, float files aren't even
+// copied (see readDirect()), and a seek is applied at the next read.
+//
+// Only WavFile.h and the standard library are needed, so the scheduler also
+// runs headless (see multichannel_playback --headless).
+
+#include "WavFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define STREAMING_HAS_MMAP 1
+#endif
+
+/// A file for StreamingScheduler::addFiles()
+struct StreamRequest {
+  std::string path;
+  bool loop{false};
+  /// Memory map instead of streaming
+  bool map{false};
+};
+
+/// Paging hint for memory mapped files
+enum class MapAdvice { None, Sequential, WillNeed };
+
+struct StreamingConfig {
+  /// Frames buffered ahead for each file
+  uint64_t ringFrames{65536};
+  /// Frames per ring block. Reads are multiples of this.
+  uint64_t blockFrames{8192};
+  /// Most blocks read by a single request
+  uint64_t maxBlocksPerRead{4};
+  unsigned int ioThreads{2};
+  /// Hint given to the kernel for memory mapped files
+  MapAdvice mapAdvice{MapAdvice::WillNeed};
+  /// Touch every page of mapped files when they are added, so playback
+  /// doesn't start with page faults on the audio thread
+  bool mapWarmup{true};
+};
+
+class StreamingScheduler {
+public:
+  StreamingScheduler() {}
+  ~StreamingScheduler() { stop(); }
+  StreamingScheduler(const StreamingScheduler &) = delete;
+  StreamingScheduler &operator=(const StreamingScheduler &) = delete;
+
+  /// Must be called before adding files.
+  void configure(const StreamingConfig &config) {
+    mConfig = config;
+    mConfig.blockFrames = std::max<uint64_t>(mConfig.blockFrames, 64);
+    mConfig.ringFrames = std::max(mConfig.ringFrames, 2 * mConfig.blockFrames);
+    mConfig.maxBlocksPerRead = std::max<uint64_t>(mConfig.maxBlocksPerRead, 1);
+    mConfig.ioThreads = std::max(mConfig.ioThreads, 1u);
+  }
+  const StreamingConfig &config() const { return mConfig; }
+
+  /// Opens a file and allocates its ring, or maps it if map is true (and
+  /// warms up the mapping, see StreamingConfig::mapWarmup). Returns the
+  /// stream index, or -1 if the file can't be read (see errorMessage()). If
+  /// mapping fails the file is streamed, see mapped(). Not allowed while
+  /// running.
+  int addFile(const std::string &path, bool loop, bool map = false) {
+    std::unique_ptr<Stream> stream = openStream({path, loop, map}, mError);
+    if (!stream) {
+      return -1;
+    }
+    if (stream->mapData) {
+      prime(*stream, 0);
+    }
+    mStreams.push_back(std::move(stream));
+    return int(mStreams.size() - 1);
+  }
+
+  /// Opens many files at once, with up to `threads` files opened (and
+  /// mapped) concurrently, which hides the latency of network storage.
+  /// Streams are added in request order. Returns their indices, with -1
+  /// for files that couldn't be opened and the reason in errors. Nothing
+  /// is read ahead yet, see prime(). Not allowed while running.
+  std::vector<int> addFiles(const std::vector<StreamRequest> &requests,
+                            unsigned int threads,
+                            std::vector<std::string> &errors) {
+    std::vector<std::unique_ptr<Stream>> opened(requests.size());
+    errors.assign(requests.size(), std::string());
+    parallelFor(requests.size(), threads, [&](size_t i) {
+      opened[i] = openStream(requests[i], errors[i]);
+    });
+    std::vector<int> indices(requests.size(), -1);
+    for (size_t i = 0; i < requests.size(); i++) {
+      if (opened[i]) {
+        mStreams.push_back(std::move(opened[i]));
+        indices[i] = int(mStreams.size() - 1);
+      }
+    }
+    return indices;
+  }
+
+  /// Fills the first frames of the rings of streamed files (up to the ring
+  /// size), and warms up mapped files, with up to `threads` files at a time.
+  /// Playback then starts without waiting for the I/O threads. Not allowed
+  /// while running.
+  void prime(const std::vector<int> &streams, unsigned int threads,
+             uint64_t frames) {
+    parallelFor(streams.size(), threads, [&](size_t i) {
+      if (streams[i] >= 0) {
+        prime(*mStreams[streams[i]], frames);
+      }
+    });
+  }
+
+  /// True if the file is memory mapped rather than streamed
+  bool mapped(int stream) const { return mStreams[stream]->mapData != nullptr; }
+
+  /// Time taken to open the file, and map it
+  double openSeconds(int stream) const { return mStreams[stream]->openSeconds; }
+
+  /// Time taken to prime the file, or warm up the mapping
+  double primeSeconds(int stream) const {
+    return mStreams[stream]->primeSeconds;
+  }
+
+  const std::string &errorMessage() const { return mError; }
+
+  size_t numStreams() const { return mStreams.size(); }
+  int channels(int stream) const { return mStreams[stream]->channels; }
+  int sampleRate(int stream) const {
+    return mStreams[stream]->reader.sampleRate();
+  }
+  uint64_t frames(int stream) const {
+    return mStreams[stream]->reader.frames();
+  }
+  bool loops(int stream) const { return mStreams[stream]->loop; }
+
+  void start() {
+    if (mRunning) {
+      return;
+    }
+    mRunning = true;
+    for (unsigned int i = 0; i < mConfig.ioThreads; i++) {
+      mThreads.emplace_back([this]() { ioLoop(); });
+    }
+  }
+
+  void stop() {
+    if (!mRunning) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mWakeMutex);
+      mRunning = false;
+    }
+    mWake.notify_all();
+    for (auto &t : mThreads) {
+      t.join();
+    }
+    mThreads.clear();
+  }
+
+  // ---- Consumer (audio thread)
+
+  /// Copies up to numFrames interleaved frames of the current position.
+  /// Returns the number of frames copied. Fewer than numFrames means either
+  /// the end of the file or an underrun, which is counted.
+  uint64_t read(int stream, float *interleaved, uint64_t numFrames) {
+    Stream &s = *mStreams[stream];
+    if (s.mapData) {
+      return readMapped(s, interleaved, numFrames);
+    }
+    const uint32_t generation =
+        s.requestedGeneration.load(std::memory_order_acquire);
+    uint64_t readIndex = s.readIndex.load(std::memory_order_relaxed);
+    const uint64_t writeIndex = s.writeIndex.load(std::memory_order_acquire);
+    uint64_t done = 0;
+    bool ended = false;
+    while (done < numFrames && readIndex != writeIndex) {
+      const Block &block = s.blocks[readIndex % s.numBlocks];
+      if (block.generation != generation) {
+        readIndex++;
+        s.readOffset = 0;
+        continue;
+      }
+      if (block.endOfFile) {
+        ended = true;
+        break;
+      }
+      const uint64_t count =
+          std::min<uint64_t>(block.numFrames - s.readOffset, numFrames - done);
+      const float *src =
+          s.samples.data() +
+          ((readIndex % s.numBlocks) * mConfig.blockFrames + s.readOffset) *
+              s.channels;
+      std::memcpy(interleaved + done * s.channels, src,
+                  count * s.channels * sizeof(float));
+      done += count;
+      s.readOffset += count;
+      s.position.store(block.startFrame + s.readOffset,
+                       std::memory_order_relaxed);
+      if (s.readOffset == block.numFrames) {
+        readIndex++;
+        s.readOffset = 0;
+      }
+    }
+    s.readIndex.store(readIndex, std::memory_order_release);
+    if (done < numFrames && !ended) {
+      s.underruns.fetch_add(1, std::memory_order_relaxed);
+      s.underrunFrames.fetch_add(numFrames - done, std::memory_order_relaxed);
+    }
+    return done;
+  }
+
+  /// Zero-copy read for mapped float files: returns a pointer to numFrames
+  /// interleaved frames inside the mapping and advances the position, or
+  /// nullptr if the stream can't provide them contiguously (not mapped, not
+  /// float, or wrapping around a loop). Use read() when this fails.
+  /// framesRead is less than numFrames only at the end of the file.
+  const float *readDirect(int stream, uint64_t numFrames,
+                          uint64_t &framesRead) {
+    Stream &s = *mStreams[stream];
+    if (!s.mapData || !s.directFloat) {
+      return nullptr;
+    }
+    applyMappedSeek(s);
+    const uint64_t available = s.reader.frames() - s.mapPosition;
+    if (available < numFrames && s.loop) {
+      return nullptr;
+    }
+    framesRead = std::min(available, numFrames);
+    const float *src = reinterpret_cast<const float *>(
+                           s.mapData + s.reader.dataOffset()) +
+                       s.mapPosition * s.channels;
+    s.mapPosition += framesRead;
+    s.position.store(s.mapPosition, std::memory_order_relaxed);
+    return src;
+  }
+
+  /// Discards blocks left over from before a seek. read() does this too,
+  /// call this instead while not reading.
+  void dropStale(int stream) {
+    Stream &s = *mStreams[stream];
+    if (s.mapData) {
+      applyMappedSeek(s);
+      return;
+    }
+    const uint32_t generation =
+        s.requestedGeneration.load(std::memory_order_acquire);
+    uint64_t readIndex = s.readIndex.load(std::memory_order_relaxed);
+    const uint64_t writeIndex = s.writeIndex.load(std::memory_order_acquire);
+    while (readIndex != writeIndex &&
+           s.blocks[readIndex % s.numBlocks].generation != generation) {
+      readIndex++;
+      s.readOffset = 0;
+    }
+    s.readIndex.store(readIndex, std::memory_order_release);
+  }
+
+  // ---- Control
+
+  /// Requests playback to continue from frame. Takes effect as soon as an
+  /// I/O thread has read the new position, see ready(). When seeking many
+  /// streams at once, pass wakeThreads = false and call wake() after the last one,
+  /// so the I/O threads are woken once.
+  void seek(int stream, uint64_t frame, bool wakeThreads = true) {
+    Stream &s = *mStreams[stream];
+    frame = std::min(frame, s.reader.frames());
+    s.seekFrame.store(frame, std::memory_order_relaxed);
+    s.position.store(frame, std::memory_order_relaxed);
+    s.seekRequestTime.store(nowNanoseconds(), std::memory_order_relaxed);
+    s.requestedGeneration.fetch_add(1, std::memory_order_release);
+    if (wakeThreads) {
+      wake();
+    }
+  }
+
+  /// Wakes the I/O threads to serve new seeks
+  void wake() { mWake.notify_all(); }
+
+  /// Time from the last seek() until its position was available: the first
+  /// block read from disk for streamed files, the next read for mapped ones
+  double lastSeekLatency(int stream) const {
+    return mStreams[stream]->seekLatency.load(std::memory_order_relaxed);
+  }
+
+  /// True once at least minFrames of the current position are buffered, or
+  /// the file ends before that.
+  bool ready(int stream, uint64_t minFrames) const {
+    const Stream &s = *mStreams[stream];
+    if (s.mapData) {
+      return true;
+    }
+    const uint32_t generation =
+        s.requestedGeneration.load(std::memory_order_acquire);
+    if (s.filledGeneration.load(std::memory_order_acquire) != generation) {
+      return false;
+    }
+    return s.filledFrames.load(std::memory_order_relaxed) >= minFrames ||
+           s.filledToEnd.load(std::memory_order_relaxed);
+  }
+
+  /// File frame the consumer has reached
+  uint64_t position(int stream) const {
+    return mStreams[stream]->position.load(std::memory_order_relaxed);
+  }
+
+  /// Number of read() calls that came up short, and the missing frames
+  uint64_t underruns(int stream) const {
+    return mStreams[stream]->underruns.load(std::memory_order_relaxed);
+  }
+  uint64_t underrunFrames(int stream) const {
+    return mStreams[stream]->underrunFrames.load(std::memory_order_relaxed);
+  }
+
+  /// Blocks read from disk, and the number of read requests for them
+  uint64_t blocksRead(int stream) const {
+    return mStreams[stream]->blocksRead.load(std::memory_order_relaxed);
+  }
+  uint64_t readRequests(int stream) const {
+    return mStreams[stream]->readRequests.load(std::memory_order_relaxed);
+  }
+
+  void resetCounters() {
+    for (auto &s : mStreams) {
+      s->underruns = 0;
+      s->underrunFrames = 0;
+      s->blocksRead = 0;
+      s->readRequests = 0;
+    }
+  }
+
+private:
+  struct Block {
+    uint32_t generation{0};
+    uint32_t numFrames{0};
+    uint64_t startFrame{0};
+    bool endOfFile{false};
+  };
+
+  struct Stream {
+    WavReader reader;
+    bool loop{false};
+    int channels{0};
+    uint64_t numBlocks{0};
+    std::vector<Block> blocks;
+    std::vector<float> samples;
+
+    std::atomic<uint64_t> writeIndex{0};
+    std::atomic<uint64_t> readIndex{0};
+    // Consumer only: frames already read from the front block
+    uint64_t readOffset{0};
+
+    std::atomic<uint32_t> requestedGeneration{0};
+    std::atomic<uint64_t> seekFrame{0};
+    // Claimed by the I/O thread that services the stream
+    std::atomic<bool> busy{false};
+    // Written by the producer that holds busy, atomic because
+    // claimMostUrgent() looks at them from other I/O threads
+    std::atomic<uint32_t> fileGeneration{0};
+    std::atomic<bool> ended{false};
+    // Producer only: the first read after a seek records its latency
+    bool seekPending{false};
+
+    // Published by the producer for ready()
+    std::atomic<uint32_t> filledGeneration{0};
+    std::atomic<uint64_t> filledFrames{0};
+    std::atomic<bool> filledToEnd{false};
+
+    std::atomic<uint64_t> position{0};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> underrunFrames{0};
+    std::atomic<uint64_t> blocksRead{0};
+    std::atomic<uint64_t> readRequests{0};
+
+    double openSeconds{0.0};
+    double primeSeconds{0.0};
+    std::atomic<int64_t> seekRequestTime{0};
+    std::atomic<double> seekLatency{0.0};
+
+    // Memory mapped files, null if streamed
+    const uint8_t *mapData{nullptr};
+    size_t mapSize{0};
+    // Float samples in host order at a float aligned offset
+    bool directFloat{false};
+    // Consumer only
+    uint64_t mapPosition{0};
+    uint32_t mapGeneration{0};
+
+    ~Stream() {
+#ifdef STREAMING_HAS_MMAP
+      if (mapData) {
+        munmap(const_cast<uint8_t *>(mapData), mapSize);
+      }
+#endif
+    }
+  };
+
+  static int64_t nowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static void recordSeekLatency(Stream &s) {
+    const int64_t requested =
+        s.seekRequestTime.load(std::memory_order_relaxed);
+    s.seekLatency.store((nowNanoseconds() - requested) * 1e-9,
+                        std::memory_order_relaxed);
+  }
+
+  bool mapFile(Stream &s, const std::string &path) const {
+#ifdef STREAMING_HAS_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    const size_t size = size_t(info.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    if (mConfig.mapAdvice == MapAdvice::Sequential) {
+      madvise(data, size, MADV_SEQUENTIAL);
+    } else if (mConfig.mapAdvice == MapAdvice::WillNeed) {
+      madvise(data, size, MADV_WILLNEED);
+    }
+    s.mapData = static_cast<const uint8_t *>(data);
+    s.mapSize = size;
+    const uint32_t one = 1;
+    uint8_t firstByte;
+    std::memcpy(&firstByte, &one, 1);
+    s.directFloat = firstByte == 1 &&
+                    s.reader.sampleFormat() == WavSampleFormat::FLOAT32 &&
+                    s.reader.dataOffset() % alignof(float) == 0;
+    return true;
+#else
+    (void)s;
+    (void)path;
+    return false;
+#endif
+  }
+
+  // Only reads mConfig, so files can be opened concurrently
+  std::unique_ptr<Stream> openStream(const StreamRequest &request,
+                                     std::string &error) const {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Stream> stream(new Stream);
+    if (!stream->reader.open(request.path)) {
+      error = stream->reader.errorMessage();
+      return nullptr;
+    }
+    stream->loop = request.loop;
+    stream->channels = stream->reader.channels();
+    if (!request.map || !mapFile(*stream, request.path)) {
+      stream->numBlocks = mConfig.ringFrames / mConfig.blockFrames;
+      stream->blocks.resize(stream->numBlocks);
+      stream->samples.resize(stream->numBlocks * mConfig.blockFrames *
+                             stream->channels);
+    }
+    stream->openSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+    return stream;
+  }
+
+  // Touches every page of a mapped file, or reads until frames are buffered
+  // or the ring is full. Only for streams the I/O threads don't serve yet.
+  void prime(Stream &s, uint64_t frames) {
+    const auto start = std::chrono::steady_clock::now();
+#ifdef STREAMING_HAS_MMAP
+    if (s.mapData && mConfig.mapWarmup) {
+      const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+      volatile uint8_t sink = 0;
+      for (size_t offset = 0; offset < s.mapSize; offset += pageSize) {
+        sink = sink + s.mapData[offset];
+      }
+    }
+#endif
+    while (!s.mapData && !s.ended.load(std::memory_order_relaxed) &&
+           s.filledFrames.load(std::memory_order_relaxed) < frames &&
+           s.writeIndex.load(std::memory_order_relaxed) -
+                   s.readIndex.load(std::memory_order_relaxed) <
+               s.numBlocks) {
+      const uint64_t before = s.writeIndex.load(std::memory_order_relaxed);
+      service(s);
+      if (s.writeIndex.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    s.primeSeconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+  }
+
+  // Runs job(0 .. count - 1) on up to `threads` threads, including the
+  // calling one
+  template <class Job>
+  static void parallelFor(size_t count, unsigned int threads, Job job) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next++) < count) {
+        job(i);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads && t < count; t++) {
+      pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : pool) {
+      t.join();
+    }
+  }
+
+  void applyMappedSeek(Stream &s) {
+    const uint32_t generation =
+        s.requestedGeneration.load(std::memory_order_acquire);
+    if (generation != s.mapGeneration) {
+      s.mapGeneration = generation;
+      s.mapPosition = s.seekFrame.load(std::memory_order_relaxed);
+      s.position.store(s.mapPosition, std::memory_order_relaxed);
+      recordSeekLatency(s);
+    }
+  }
+
+  uint64_t readMapped(Stream &s, float *interleaved, uint64_t numFrames) {
+    applyMappedSeek(s);
+    const uint64_t frames = s.reader.frames();
+    const size_t bytesPerFrame = size_t(s.reader.bytesPerFrame());
+    const uint8_t *data = s.mapData + s.reader.dataOffset();
+    uint64_t done = 0;
+    while (done < numFrames) {
+      if (s.mapPosition >= frames) {
+        if (!s.loop || frames == 0) {
+          break;
+        }
+        s.mapPosition = 0;
+      }
+      const uint64_t count = std::min(numFrames - done, frames - s.mapPosition);
+      wav_detail::decode(data + s.mapPosition * bytesPerFrame,
+                         interleaved + done * s.channels,
+                         size_t(count * s.channels), s.reader.sampleFormat());
+      s.mapPosition += count;
+      done += count;
+    }
+    s.position.store(s.mapPosition, std::memory_order_relaxed);
+    return done;
+  }
+
+  void ioLoop() {
+    while (mRunning) {
+      Stream *stream = claimMostUrgent();
+      if (!stream) {
+        // Everything is full. Seeks wake us up early, consumption is
+        // picked up by polling so the audio thread never has to notify.
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        if (mRunning) {
+          mWake.wait_for(lock, std::chrono::milliseconds(2));
+        }
+        continue;
+      }
+      service(*stream);
+      stream->busy.store(false, std::memory_order_release);
+    }
+  }
+
+  // Earliest deadline first: the stream with the least buffered time, with
+  // pending seeks first of all.
+  Stream *claimMostUrgent() {
+    while (true) {
+      Stream *best = nullptr;
+      double bestDeadline = 0.0;
+      for (auto &s : mStreams) {
+        if (s->mapData || s->busy.load(std::memory_order_relaxed)) {
+          continue;
+        }
+        const bool seekPending =
+            s->requestedGeneration.load(std::memory_order_acquire) !=
+            s->fileGeneration.load(std::memory_order_relaxed);
+        const uint64_t queued =
+            s->writeIndex.load(std::memory_order_relaxed) -
+            s->readIndex.load(std::memory_order_acquire);
+        // Wait until a full read's worth of blocks is free, unless the ring
+        // is down to half, so reads stay large
+        const uint64_t freeBlocks = s->numBlocks - queued;
+        const bool worthReading =
+            freeBlocks >= std::min(mConfig.maxBlocksPerRead, s->numBlocks / 2) ||
+            2 * queued < s->numBlocks;
+        if (!seekPending && (s->ended.load(std::memory_order_relaxed) ||
+                             freeBlocks == 0 || !worthReading)) {
+          continue;
+        }
+        const double deadline =
+            seekPending ? -1.0
+                        : double(queued * mConfig.blockFrames) /
+                              s->reader.sampleRate();
+        if (!best || deadline < bestDeadline) {
+          best = s.get();
+          bestDeadline = deadline;
+        }
+      }
+      if (!best) {
+        return nullptr;
+      }
+      bool expected = false;
+      if (best->busy.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire)) {
+        return best;
+      }
+      // Another thread took it, look again
+    }
+  }
+
+  void service(Stream &s) {
+    const uint32_t generation =
+        s.requestedGeneration.load(std::memory_order_acquire);
+    if (generation != s.fileGeneration.load(std::memory_order_relaxed)) {
+      s.reader.seek(s.seekFrame.load(std::memory_order_relaxed));
+      s.fileGeneration.store(generation, std::memory_order_relaxed);
+      s.ended.store(false, std::memory_order_relaxed);
+      s.filledFrames.store(0, std::memory_order_relaxed);
+      s.filledToEnd.store(false, std::memory_order_relaxed);
+      s.filledGeneration.store(generation, std::memory_order_release);
+      s.seekPending = true;
+    }
+    if (s.ended.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    const uint64_t writeIndex = s.writeIndex.load(std::memory_order_relaxed);
+    const uint64_t freeBlocks =
+        s.numBlocks - (writeIndex - s.readIndex.load(std::memory_order_acquire));
+    // Contiguous free blocks up to the end of the ring
+    const uint64_t firstSlot = writeIndex % s.numBlocks;
+    const uint64_t numBlocks = std::min(
+        {freeBlocks, s.numBlocks - firstSlot, mConfig.maxBlocksPerRead});
+    if (numBlocks == 0) {
+      return;
+    }
+
+    float *dest = s.samples.data() + firstSlot * mConfig.blockFrames * s.channels;
+    const uint64_t startFrame = s.reader.position();
+    uint64_t framesRead =
+        s.reader.read(dest, numBlocks * mConfig.blockFrames);
+    s.readRequests.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t blocksWritten = 0;
+    for (uint64_t offset = 0; offset < framesRead;
+         offset += mConfig.blockFrames) {
+      Block &block = s.blocks[firstSlot + blocksWritten];
+      block.generation = generation;
+      block.numFrames =
+          uint32_t(std::min(mConfig.blockFrames, framesRead - offset));
+      block.startFrame = startFrame + offset;
+      block.endOfFile = false;
+      blocksWritten++;
+    }
+    if (framesRead < numBlocks * mConfig.blockFrames) {
+      // End of the file: loop, or leave a marker for the consumer
+      if (s.loop && s.reader.frames() > 0) {
+        s.reader.seek(0);
+      } else if (blocksWritten < numBlocks) {
+        Block &block = s.blocks[firstSlot + blocksWritten];
+        block.generation = generation;
+        block.numFrames = 0;
+        block.startFrame = startFrame + framesRead;
+        block.endOfFile = true;
+        blocksWritten++;
+        s.ended.store(true, std::memory_order_relaxed);
+      }
+      // else the marker goes into the next free block on the next pass
+    }
+    s.blocksRead.fetch_add(blocksWritten, std::memory_order_relaxed);
+    s.writeIndex.store(writeIndex + blocksWritten, std::memory_order_release);
+    s.filledFrames.fetch_add(framesRead, std::memory_order_relaxed);
+    if (s.seekPending) {
+      recordSeekLatency(s);
+      s.seekPending = false;
+    }
+    if (s.ended.load(std::memory_order_relaxed) ||
+        (s.reader.position() >= s.reader.frames() && !s.loop)) {
+      s.filledToEnd.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  StreamingConfig mConfig;
+  std::vector<std::unique_ptr<Stream>> mStreams;
+  std::vector<std::thread> mThreads;
+  std::atomic<bool> mRunning{false};
+  std::mutex mWakeMutex;
+  std::condition_variable mWake;
+  std::string mError;
+};
+
+#endif
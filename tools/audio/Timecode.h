@@ -0,0 +1,193 @@
+#pragma once
+#ifndef Timecode_H
+#define Timecode_H
+
+// SMPTE timecode at the four MIDI Time Code rates, with integer arithmetic
+// only. Conversions between timecode labels, frame counts and sample
+// positions are exact, constant-time and don't allocate, so they can be used
+// in the audio callback.
+//
+// 29.97 fps is always drop-frame (the MTC "30 drop" type): frame labels 00
+// and 01 are skipped at the start of every minute, except minutes divisible
+// by ten, so that the labels follow the wall clock. A frame count is the
+// number of frames since 00:00:00:00, and it wraps at 24 hours.
+//
+// Only <stdint.h> is needed, so this also builds for Arduino next to
+// MTCParser.h.
+
+#include <stdint.h>
+
+/// Values match the rate bits of MTC messages.
+enum class TimecodeRate : uint8_t { FPS_24, FPS_25, FPS_29_97_DF, FPS_30 };
+
+namespace timecode_detail {
+
+// Frame rate as an exact fraction, and frame labels per second
+struct RateInfo {
+  int64_t numerator;
+  int64_t denominator;
+  int64_t nominal;
+  int64_t framesPerDay;
+};
+
+inline const RateInfo &rateInfo(TimecodeRate rate) {
+  static const RateInfo info[4] = {
+      {24, 1, 24, 24 * 86400},
+      {25, 1, 25, 25 * 86400},
+      // 2 labels dropped in 9 of every 10 minutes
+      {30000, 1001, 30, 30 * 86400 - 2 * 9 * 144},
+      {30, 1, 30, 30 * 86400},
+  };
+  return info[static_cast<uint8_t>(rate) & 0x03];
+}
+
+// Division rounding towards negative infinity
+inline int64_t floorDiv(int64_t a, int64_t b) {
+  const int64_t q = a / b;
+  return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+inline int64_t floorMod(int64_t a, int64_t b) { return a - floorDiv(a, b) * b; }
+
+// Drop-frame: 17982 frames per 10 minutes, 1798 per dropped minute
+constexpr int64_t kFramesPer10Minutes = 17982;
+constexpr int64_t kFramesPerDroppedMinute = 1798;
+
+} // namespace timecode_detail
+
+struct Timecode {
+  uint8_t hours{0};
+  uint8_t minutes{0};
+  uint8_t seconds{0};
+  uint8_t frames{0};
+  TimecodeRate rate{TimecodeRate::FPS_25};
+
+  Timecode() {}
+  Timecode(uint8_t h, uint8_t m, uint8_t s, uint8_t f, TimecodeRate r)
+      : hours(h), minutes(m), seconds(s), frames(f), rate(r) {}
+
+  /// Frame rate in frames per second
+  static double frameRate(TimecodeRate rate) {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(rate);
+    return double(info.numerator) / double(info.denominator);
+  }
+
+  /// Frame labels per second (24, 25, 30 or 30)
+  static int nominalFrameRate(TimecodeRate rate) {
+    return int(timecode_detail::rateInfo(rate).nominal);
+  }
+
+  static int64_t framesPerDay(TimecodeRate rate) {
+    return timecode_detail::rateInfo(rate).framesPerDay;
+  }
+
+  /// True if the fields are in range and, for drop-frame, the label exists.
+  bool valid() const {
+    const int64_t nominal = nominalFrameRate(rate);
+    if (hours > 23 || minutes > 59 || seconds > 59 || frames >= nominal) {
+      return false;
+    }
+    if (rate == TimecodeRate::FPS_29_97_DF && seconds == 0 && frames < 2 &&
+        minutes % 10 != 0) {
+      return false;
+    }
+    return true;
+  }
+
+  /// Frames since 00:00:00:00. Labels skipped by drop-frame map to the next
+  /// existing frame.
+  int64_t toFrameCount() const {
+    const int64_t nominal = nominalFrameRate(rate);
+    const int64_t totalMinutes = int64_t(hours) * 60 + minutes;
+    int64_t label = frames;
+    if (rate == TimecodeRate::FPS_29_97_DF && seconds == 0 && frames < 2 &&
+        minutes % 10 != 0) {
+      label = 2; // skipped, the minute starts at ;02
+    }
+    int64_t count = (totalMinutes * 60 + seconds) * nominal + label;
+    if (rate == TimecodeRate::FPS_29_97_DF) {
+      count -= 2 * (totalMinutes - totalMinutes / 10);
+    }
+    return count;
+  }
+
+  /// Label of a frame count, wrapped to 24 hours.
+  static Timecode fromFrameCount(int64_t count, TimecodeRate rate) {
+    using namespace timecode_detail;
+    const RateInfo &info = rateInfo(rate);
+    count = floorMod(count, info.framesPerDay);
+    if (rate == TimecodeRate::FPS_29_97_DF) {
+      // Add back the labels dropped before this frame
+      const int64_t tens = count / kFramesPer10Minutes;
+      const int64_t rest = count % kFramesPer10Minutes;
+      count += 18 * tens;
+      if (rest >= 2) {
+        count += 2 * ((rest - 2) / kFramesPerDroppedMinute);
+      }
+    }
+    Timecode tc;
+    tc.rate = rate;
+    tc.frames = uint8_t(count % info.nominal);
+    count /= info.nominal;
+    tc.seconds = uint8_t(count % 60);
+    count /= 60;
+    tc.minutes = uint8_t(count % 60);
+    tc.hours = uint8_t(count / 60);
+    return tc;
+  }
+
+  /// First sample at or after the start of frame count, i.e.
+  /// ceil(count * sampleRate / frameRate). Valid for any int64 frame count
+  /// whose sample position fits in 63 bits.
+  static int64_t frameCountToSamples(int64_t count, TimecodeRate rate,
+                                     uint32_t sampleRate) {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(rate);
+    return -timecode_detail::floorDiv(
+        -count * int64_t(sampleRate) * info.denominator, info.numerator);
+  }
+
+  /// Frame count that contains sample. The inverse of frameCountToSamples()
+  /// as long as the frame rate is lower than the sample rate.
+  static int64_t samplesToFrameCount(int64_t sample, TimecodeRate rate,
+                                     uint32_t sampleRate) {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(rate);
+    return timecode_detail::floorDiv(sample * info.numerator,
+                                     int64_t(sampleRate) * info.denominator);
+  }
+
+  int64_t toSamples(uint32_t sampleRate) const {
+    return frameCountToSamples(toFrameCount(), rate, sampleRate);
+  }
+
+  static Timecode fromSamples(int64_t sample, TimecodeRate rate,
+                              uint32_t sampleRate) {
+    return fromFrameCount(samplesToFrameCount(sample, rate, sampleRate), rate);
+  }
+
+  /// Start of the frame in seconds since 00:00:00:00
+  double toSeconds() const {
+    const timecode_detail::RateInfo &info = timecode_detail::rateInfo(rate);
+    return double(toFrameCount() * info.denominator) / double(info.numerator);
+  }
+
+  /// Offsets by a number of frames, wrapping at 24 hours
+  Timecode operator+(int64_t frameOffset) const {
+    return fromFrameCount(toFrameCount() + frameOffset, rate);
+  }
+  Timecode operator-(int64_t frameOffset) const {
+    return fromFrameCount(toFrameCount() - frameOffset, rate);
+  }
+  /// Difference in frames, both timecodes must have the same rate
+  int64_t operator-(const Timecode &other) const {
+    return toFrameCount() - other.toFrameCount();
+  }
+
+  bool operator==(const Timecode &other) const {
+    return hours == other.hours && minutes == other.minutes &&
+           seconds == other.seconds && frames == other.frames &&
+           rate == other.rate;
+  }
+  bool operator!=(const Timecode &other) const { return !(*this == other); }
+};
+
+#endif
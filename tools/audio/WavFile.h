@@ -0,0 +1,473 @@
+#pragma once
+#ifndef WavFile_H
+#define WavFile_H
+
+// Minimal streaming reader and writer for RIFF/WAVE files, shared by the
+// command line tools in this folder. It has no dependencies besides the
+// standard library, so the tools can run on headless machines.
+//
+// Supported sample formats: 16, 24 and 32 bit integer PCM and 32 bit float,
+// with plain or WAVE_FORMAT_EXTENSIBLE headers. Samples are always exchanged
+// as interleaved floats in [-1, 1]. Files larger than 4 GB (RF64) are not
+// supported.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum class WavSampleFormat { PCM16, PCM24, PCM32, FLOAT32 };
+
+inline int wavBytesPerSample(WavSampleFormat format) {
+  switch (format) {
+  case WavSampleFormat::PCM16:
+    return 2;
+  case WavSampleFormat::PCM24:
+    return 3;
+  default:
+    return 4;
+  }
+}
+
+inline const char *wavSampleFormatName(WavSampleFormat format) {
+  switch (format) {
+  case WavSampleFormat::PCM16:
+    return "pcm16";
+  case WavSampleFormat::PCM24:
+    return "pcm24";
+  case WavSampleFormat::PCM32:
+    return "pcm32";
+  default:
+    return "float";
+  }
+}
+
+/// Parses "pcm16", "pcm24", "pcm32" or "float". Returns false for anything
+/// else.
+inline bool wavSampleFormatFromName(const std::string &name,
+                                    WavSampleFormat &format) {
+  if (name == "pcm16") {
+    format = WavSampleFormat::PCM16;
+  } else if (name == "pcm24") {
+    format = WavSampleFormat::PCM24;
+  } else if (name == "pcm32") {
+    format = WavSampleFormat::PCM32;
+  } else if (name == "float") {
+    format = WavSampleFormat::FLOAT32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+namespace wav_detail {
+
+// 64 bit file offsets, so files beyond 2 GB work everywhere
+inline int seek(std::FILE *file, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, int64_t(offset), SEEK_SET);
+#else
+  return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+}
+
+inline uint64_t size(std::FILE *file) {
+#ifdef _WIN32
+  _fseeki64(file, 0, SEEK_END);
+  return uint64_t(_ftelli64(file));
+#else
+  fseeko(file, 0, SEEK_END);
+  return uint64_t(ftello(file));
+#endif
+}
+
+inline uint64_t tell(std::FILE *file) {
+#ifdef _WIN32
+  return uint64_t(_ftelli64(file));
+#else
+  return uint64_t(ftello(file));
+#endif
+}
+
+inline uint16_t readU16(const uint8_t *p) {
+  return uint16_t(p[0] | (p[1] << 8));
+}
+
+inline uint32_t readU32(const uint8_t *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+inline void writeU16(uint8_t *p, uint16_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+}
+
+inline void writeU32(uint8_t *p, uint32_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+  p[2] = uint8_t(v >> 16);
+  p[3] = uint8_t(v >> 24);
+}
+
+/// Scales x by fullScale, rounds to the nearest integer and clips it to
+/// [-fullScale, fullScale - 1].
+inline int64_t quantize(float x, double fullScale) {
+  double v = std::floor(double(x) * fullScale + 0.5);
+  v = v < -fullScale ? -fullScale : (v > fullScale - 1.0 ? fullScale - 1.0 : v);
+  return int64_t(v);
+}
+
+/// Converts numSamples little endian samples to floats.
+inline void decode(const uint8_t *src, float *dest, size_t numSamples,
+                   WavSampleFormat format) {
+  switch (format) {
+  case WavSampleFormat::PCM16:
+    for (size_t i = 0; i < numSamples; i++, src += 2) {
+      dest[i] = int16_t(readU16(src)) * (1.0f / 32768.0f);
+    }
+    break;
+  case WavSampleFormat::PCM24:
+    for (size_t i = 0; i < numSamples; i++, src += 3) {
+      // assemble in the upper 24 bits, so the shift back extends the sign
+      int32_t v = int32_t((uint32_t(src[0]) << 8) | (uint32_t(src[1]) << 16) |
+                          (uint32_t(src[2]) << 24));
+      dest[i] = (v >> 8) * (1.0f / 8388608.0f);
+    }
+    break;
+  case WavSampleFormat::PCM32:
+    for (size_t i = 0; i < numSamples; i++, src += 4) {
+      dest[i] = float(int32_t(readU32(src)) * (1.0 / 2147483648.0));
+    }
+    break;
+  case WavSampleFormat::FLOAT32:
+    for (size_t i = 0; i < numSamples; i++, src += 4) {
+      uint32_t bits = readU32(src);
+      std::memcpy(dest + i, &bits, 4);
+    }
+    break;
+  }
+}
+
+/// Converts numSamples floats to little endian samples. Integer formats use
+/// the same scaling as decode(), so decoded files are written back bit-exact,
+/// and are rounded and clipped to their range.
+inline void encode(const float *src, uint8_t *dest, size_t numSamples,
+                   WavSampleFormat format) {
+  switch (format) {
+  case WavSampleFormat::PCM16:
+    for (size_t i = 0; i < numSamples; i++, dest += 2) {
+      writeU16(dest, uint16_t(int16_t(quantize(src[i], 32768.0))));
+    }
+    break;
+  case WavSampleFormat::PCM24:
+    for (size_t i = 0; i < numSamples; i++, dest += 3) {
+      int32_t s = int32_t(quantize(src[i], 8388608.0));
+      dest[0] = uint8_t(s);
+      dest[1] = uint8_t(s >> 8);
+      dest[2] = uint8_t(s >> 16);
+    }
+    break;
+  case WavSampleFormat::PCM32:
+    for (size_t i = 0; i < numSamples; i++, dest += 4) {
+      writeU32(dest, uint32_t(int32_t(quantize(src[i], 2147483648.0))));
+    }
+    break;
+  case WavSampleFormat::FLOAT32:
+    for (size_t i = 0; i < numSamples; i++, dest += 4) {
+      uint32_t bits;
+      std::memcpy(&bits, src + i, 4);
+      writeU32(dest, bits);
+    }
+    break;
+  }
+}
+
+} // namespace wav_detail
+
+/// Reads a WAV file in chunks of frames. Only the header is read on open().
+class WavReader {
+public:
+  WavReader() {}
+  ~WavReader() { close(); }
+  WavReader(const WavReader &) = delete;
+  WavReader &operator=(const WavReader &) = delete;
+
+  bool open(const std::string &path) {
+    close();
+    mFile = std::fopen(path.c_str(), "rb");
+    if (!mFile) {
+      mError = "can't open " + path;
+      return false;
+    }
+    if (!parseHeader()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (mFile) {
+      std::fclose(mFile);
+      mFile = nullptr;
+    }
+  }
+
+  bool opened() const { return mFile != nullptr; }
+  const std::string &errorMessage() const { return mError; }
+
+  int channels() const { return mChannels; }
+  int sampleRate() const { return mSampleRate; }
+  uint64_t frames() const { return mFrames; }
+  WavSampleFormat sampleFormat() const { return mFormat; }
+  int bytesPerFrame() const { return mChannels * wavBytesPerSample(mFormat); }
+  /// Byte offset of the first sample in the file.
+  uint64_t dataOffset() const { return mDataOffset; }
+  uint64_t position() const { return mPosition; }
+
+  /// Reads up to numFrames interleaved frames. Returns the number of frames
+  /// read, which is only smaller than numFrames at the end of the file or on
+  /// a read error.
+  uint64_t read(float *interleaved, uint64_t numFrames) {
+    if (!mFile) {
+      return 0;
+    }
+    if (numFrames > mFrames - mPosition) {
+      numFrames = mFrames - mPosition;
+    }
+    const size_t numBytes = size_t(numFrames) * bytesPerFrame();
+    if (mRaw.size() < numBytes) {
+      mRaw.resize(numBytes);
+    }
+    const size_t bytesRead = std::fread(mRaw.data(), 1, numBytes, mFile);
+    const uint64_t framesRead = bytesRead / bytesPerFrame();
+    wav_detail::decode(mRaw.data(), interleaved,
+                       size_t(framesRead) * mChannels, mFormat);
+    mPosition += framesRead;
+    return framesRead;
+  }
+
+  bool seek(uint64_t frame) {
+    if (!mFile || frame > mFrames) {
+      return false;
+    }
+    if (wav_detail::seek(mFile, mDataOffset + frame * bytesPerFrame()) != 0) {
+      return false;
+    }
+    mPosition = frame;
+    return true;
+  }
+
+private:
+  bool parseHeader() {
+    uint8_t riff[12];
+    if (std::fread(riff, 1, 12, mFile) != 12 || std::memcmp(riff, "RIFF", 4) ||
+        std::memcmp(riff + 8, "WAVE", 4)) {
+      mError = "not a RIFF/WAVE file";
+      return false;
+    }
+
+    bool haveFormat = false;
+    uint8_t chunkHeader[8];
+    while (std::fread(chunkHeader, 1, 8, mFile) == 8) {
+      const uint32_t chunkSize = wav_detail::readU32(chunkHeader + 4);
+      if (!std::memcmp(chunkHeader, "fmt ", 4)) {
+        std::vector<uint8_t> fmt(chunkSize);
+        if (chunkSize < 16 ||
+            std::fread(fmt.data(), 1, chunkSize, mFile) != chunkSize) {
+          mError = "truncated fmt chunk";
+          return false;
+        }
+        uint16_t tag = wav_detail::readU16(&fmt[0]);
+        mChannels = wav_detail::readU16(&fmt[2]);
+        mSampleRate = int(wav_detail::readU32(&fmt[4]));
+        const uint16_t bits = wav_detail::readU16(&fmt[14]);
+        if (tag == 0xFFFE && chunkSize >= 26) {
+          tag = wav_detail::readU16(&fmt[24]); // sub format GUID
+        }
+        if (tag == 1 && bits == 16) {
+          mFormat = WavSampleFormat::PCM16;
+        } else if (tag == 1 && bits == 24) {
+          mFormat = WavSampleFormat::PCM24;
+        } else if (tag == 1 && bits == 32) {
+          mFormat = WavSampleFormat::PCM32;
+        } else if (tag == 3 && bits == 32) {
+          mFormat = WavSampleFormat::FLOAT32;
+        } else {
+          mError = "unsupported sample format (tag " + std::to_string(tag) +
+                   ", " + std::to_string(bits) + " bits)";
+          return false;
+        }
+        if (mChannels == 0) {
+          mError = "file has no channels";
+          return false;
+        }
+        haveFormat = true;
+        if (chunkSize & 1) {
+          std::fseek(mFile, 1, SEEK_CUR);
+        }
+      } else if (!std::memcmp(chunkHeader, "data", 4)) {
+        if (!haveFormat) {
+          mError = "data chunk before fmt chunk";
+          return false;
+        }
+        mDataOffset = wav_detail::tell(mFile);
+        mFrames = chunkSize / bytesPerFrame();
+        // some writers leave the size at 0 or 0xFFFFFFFF when streaming
+        const uint64_t available =
+            (wav_detail::size(mFile) - mDataOffset) / bytesPerFrame();
+        if (mFrames == 0 || mFrames > available) {
+          mFrames = available;
+        }
+        mPosition = 0;
+        return seek(0);
+      } else {
+        std::fseek(mFile, long(chunkSize + (chunkSize & 1)), SEEK_CUR);
+      }
+    }
+    mError = haveFormat ? "no data chunk" : "no fmt chunk";
+    return false;
+  }
+
+  std::FILE *mFile{nullptr};
+  std::string mError;
+  int mChannels{0};
+  int mSampleRate{0};
+  WavSampleFormat mFormat{WavSampleFormat::PCM16};
+  uint64_t mFrames{0};
+  uint64_t mDataOffset{0};
+  uint64_t mPosition{0};
+  std::vector<uint8_t> mRaw;
+};
+
+/// Writes a WAV file in chunks of frames. The sizes in the header are filled
+/// in by close(), which the destructor calls too.
+class WavWriter {
+public:
+  WavWriter() {}
+  ~WavWriter() { close(); }
+  WavWriter(const WavWriter &) = delete;
+  WavWriter &operator=(const WavWriter &) = delete;
+
+  bool open(const std::string &path, int channels, int sampleRate,
+            WavSampleFormat format) {
+    close();
+    mFile = std::fopen(path.c_str(), "wb");
+    if (!mFile) {
+      mError = "can't create " + path;
+      return false;
+    }
+    mChannels = channels;
+    mSampleRate = sampleRate;
+    mFormat = format;
+    mFrames = 0;
+    // WAVE_FORMAT_EXTENSIBLE is required for more than two channels or more
+    // than 16 bits
+    mExtensible = channels > 2 || wavBytesPerSample(format) > 2;
+    return writeHeader();
+  }
+
+  bool opened() const { return mFile != nullptr; }
+  const std::string &errorMessage() const { return mError; }
+  uint64_t frames() const { return mFrames; }
+
+  bool write(const float *interleaved, uint64_t numFrames) {
+    if (!mFile) {
+      return false;
+    }
+    const size_t numSamples = size_t(numFrames) * mChannels;
+    const size_t numBytes = numSamples * wavBytesPerSample(mFormat);
+    if (mRaw.size() < numBytes) {
+      mRaw.resize(numBytes);
+    }
+    wav_detail::encode(interleaved, mRaw.data(), numSamples, mFormat);
+    if (std::fwrite(mRaw.data(), 1, numBytes, mFile) != numBytes) {
+      mError = "write failed";
+      return false;
+    }
+    mFrames += numFrames;
+    return true;
+  }
+
+  /// Writes the final sizes into the header and closes the file. Returns
+  /// false if that failed.
+  bool close() {
+    if (!mFile) {
+      return true;
+    }
+    bool ok = true;
+    const uint64_t dataBytes =
+        mFrames * uint64_t(mChannels * wavBytesPerSample(mFormat));
+    if (dataBytes & 1) {
+      ok = std::fputc(0, mFile) != EOF;
+    }
+    ok = ok && std::fseek(mFile, 0, SEEK_SET) == 0 && writeHeader();
+    ok = std::fclose(mFile) == 0 && ok;
+    mFile = nullptr;
+    return ok;
+  }
+
+private:
+  bool writeHeader() {
+    const uint32_t bytesPerSample = uint32_t(wavBytesPerSample(mFormat));
+    const uint32_t fmtSize = mExtensible ? 40 : 16;
+    const uint64_t dataBytes = mFrames * mChannels * bytesPerSample;
+    if (dataBytes > 0xFFFFFFFFull - 64) {
+      mError = "file too large for WAV";
+      return false;
+    }
+    const uint16_t tag = mFormat == WavSampleFormat::FLOAT32 ? 3 : 1;
+
+    uint8_t header[68] = {0};
+    uint8_t *p = header;
+    std::memcpy(p, "RIFF", 4);
+    wav_detail::writeU32(p + 4, uint32_t(4 + 8 + fmtSize + 8 + dataBytes +
+                                         (dataBytes & 1)));
+    std::memcpy(p + 8, "WAVEfmt ", 8);
+    wav_detail::writeU32(p + 16, fmtSize);
+    p += 20;
+    wav_detail::writeU16(p, mExtensible ? 0xFFFE : tag);
+    wav_detail::writeU16(p + 2, uint16_t(mChannels));
+    wav_detail::writeU32(p + 4, uint32_t(mSampleRate));
+    wav_detail::writeU32(p + 8, uint32_t(mSampleRate) * mChannels *
+                                    bytesPerSample);
+    wav_detail::writeU16(p + 12, uint16_t(mChannels * bytesPerSample));
+    wav_detail::writeU16(p + 14, uint16_t(bytesPerSample * 8));
+    p += 16;
+    if (mExtensible) {
+      static const uint8_t guidTail[14] = {0x00, 0x00, 0x00, 0x00, 0x10,
+                                           0x00, 0x80, 0x00, 0x00, 0xAA,
+                                           0x00, 0x38, 0x9B, 0x71};
+      wav_detail::writeU16(p, 22);
+      wav_detail::writeU16(p + 2, uint16_t(bytesPerSample * 8));
+      wav_detail::writeU32(p + 4, 0); // no speaker positions
+      wav_detail::writeU16(p + 8, tag);
+      std::memcpy(p + 10, guidTail, 14);
+      p += 24;
+    }
+    std::memcpy(p, "data", 4);
+    wav_detail::writeU32(p + 4, uint32_t(dataBytes));
+    p += 8;
+
+    const size_t headerSize = size_t(p - header);
+    if (std::fwrite(header, 1, headerSize, mFile) != headerSize) {
+      mError = "write failed";
+      return false;
+    }
+    return std::fseek(mFile, 0, SEEK_END) == 0;
+  }
+
+  std::FILE *mFile{nullptr};
+  std::string mError;
+  int mChannels{0};
+  int mSampleRate{0};
+  WavSampleFormat mFormat{WavSampleFormat::PCM16};
+  bool mExtensible{false};
+  uint64_t mFrames{0};
+  std::vector<uint8_t> mRaw;
+};
+
+#endif // WavFile_H
@@ -0,0 +1,86 @@
+#pragma once
+#ifndef WorkerPool_H
+#define WorkerPool_H
+
+// A fixed set of threads running jobs from a FIFO queue, for work that must
+// stay off the audio and render threads (opening files, closing them, which
+// joins their reader threads, etc). post() locks and allocates, so it's for
+// control threads only; jobs report back through their own handshake, e.g.
+// an atomic state the audio thread polls.
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+  WorkerPool() {}
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+  ~WorkerPool() { stop(); }
+
+  void start(unsigned int threads) {
+    stop();
+    mRunning = true;
+    for (unsigned int i = 0; i < std::max(threads, 1u); i++) {
+      mThreads.emplace_back([this]() { run(); });
+    }
+  }
+
+  /// Runs the jobs already queued, then joins the threads
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mRunning = false;
+    }
+    mWake.notify_all();
+    for (auto &thread : mThreads) {
+      thread.join();
+    }
+    mThreads.clear();
+  }
+
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mJobs.push_back(std::move(job));
+    }
+    mWake.notify_one();
+  }
+
+  /// Jobs waiting for a thread
+  size_t pending() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mJobs.size();
+  }
+
+  size_t numThreads() const { return mThreads.size(); }
+
+private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+      mWake.wait(lock, [this]() { return !mRunning || !mJobs.empty(); });
+      if (mJobs.empty()) {
+        return; // stopped
+      }
+      std::function<void()> job = std::move(mJobs.front());
+      mJobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+
+  std::vector<std::thread> mThreads;
+  std::deque<std::function<void()>> mJobs;
+  std::mutex mLock;
+  std::condition_variable mWake;
+  bool mRunning{false};
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/GainReductionComputer.cpp"
+
+// Checks the hard-knee, soft-knee and limiter kernels which
+// GainReductionComputer::updateCharacteristic selects against the piecewise
+// characteristic, and times them against the generic path they replaced.
+// Exits with 1 if an error bound is exceeded. See
+// readme_characteristic_bench.md
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const float kThreshold = -20.0f;
+
+// The hard-knee and limiter kernels are exact. The soft knee is a clamped
+// quadratic plus a clamped linear part, which rounds differently: two float
+// ulps at the 60 dB of gain reduction the sweep reaches
+const double kKernelBoundDb = 8e-6;
+// Plus the level detection of VectorOperations (2.5e-5 dB) times the slope
+const double kComputerBoundDb = 5e-5;
+
+struct Configuration {
+  const char *name;
+  float knee;
+  float ratio;
+};
+
+const Configuration kConfigurations[] = {
+    {"hard knee, 4:1", 0.0f, 4.0f},
+    {"hard knee, 100:1", 0.0f, 100.0f},
+    {"soft knee 6 dB, 4:1", 6.0f, 4.0f},
+    {"soft knee 12 dB, 100:1", 12.0f, 100.0f},
+    {"limiter", 0.0f, std::numeric_limits<float>::infinity()},
+};
+
+float slopeOf(const Configuration &configuration) {
+  return 1.0f / configuration.ratio - 1.0f;
+}
+
+// The characteristic as applyCharacteristicToOverShoot computes it, and as
+// the per-sample loop did before the kernels
+float piecewise(float overShoot, float knee, float slope) {
+  const float halfKnee = knee / 2.0f;
+  if (overShoot <= -halfKnee) {
+    return 0.0f;
+  } else if (overShoot <= halfKnee) {
+    return 0.5f * slope * (overShoot + halfKnee) * (overShoot + halfKnee) /
+           knee;
+  }
+  return slope * overShoot;
+}
+
+// The kernel updateCharacteristic picks for the configuration
+template <typename Function>
+auto withKernel(const Configuration &configuration, Function function)
+    -> decltype(function(CharacteristicKernels::HardKnee(0, 0, 0, 0))) {
+  const float slope = slopeOf(configuration);
+  const float knee = configuration.knee;
+  if (knee > 0.0f) {
+    return function(
+        CharacteristicKernels::SoftKnee(kThreshold, slope, knee, knee / 2.0f));
+  } else if (slope == -1.0f) {
+    return function(
+        CharacteristicKernels::Limiter(kThreshold, slope, knee, knee / 2.0f));
+  }
+  return function(
+      CharacteristicKernels::HardKnee(kThreshold, slope, knee, knee / 2.0f));
+}
+
+// Every kernel against the piecewise formula, from -120 to +40 dB
+double kernelError(const Configuration &configuration) {
+  const float slope = slopeOf(configuration);
+  return withKernel(configuration, [&](const auto &kernel) {
+    double error = 0.0;
+    for (double level = -120.0; level <= 40.0; level += 0.001) {
+      const float l = float(level);
+      error = std::max(
+          error, std::fabs(double(kernel(l)) -
+                           piecewise(l - kThreshold, configuration.knee,
+                                     slope)));
+    }
+    return error;
+  });
+}
+
+void configure(GainReductionComputer &computer,
+               const Configuration &configuration, float attack,
+               float release) {
+  computer.setThreshold(kThreshold);
+  computer.setKnee(configuration.knee);
+  computer.setRatio(configuration.ratio);
+  computer.setAttackTime(attack);
+  computer.setReleaseTime(release);
+  computer.prepare(kSampleRate);
+}
+
+// The whole computer, with instant ballistics, against its own
+// getCharacteristicSample, which still uses the piecewise formula. This also
+// checks that updateCharacteristic picks a kernel of the right shape.
+double computerError(const Configuration &configuration,
+                     const std::vector<float> &levels) {
+  GainReductionComputer computer;
+  configure(computer, configuration, 0.0f, 0.0f);
+  std::vector<float> sideChain(levels.size()), gain(levels.size());
+  for (size_t i = 0; i < levels.size(); i++) {
+    sideChain[i] = std::pow(10.0f, levels[i] / 20.0f);
+  }
+  computer.computeGainInDecibelsFromSidechainSignal(sideChain.data(),
+                                                    gain.data(),
+                                                    int(levels.size()));
+  double error = 0.0;
+  for (size_t i = 0; i < levels.size(); i++) {
+    const double level = 20.0 * std::log10(double(sideChain[i]));
+    const double expected =
+        computer.getCharacteristicSample(float(level)) - level;
+    error = std::max(error, std::fabs(gain[i] - expected));
+  }
+  return error;
+}
+
+template <typename Function> double secondsOf(Function function, int runs) {
+  double best = 1e9;
+  for (int run = 0; run < runs; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best;
+}
+
+void printUsage() {
+  std::cout << "Usage: characteristic_bench [options]\n"
+               "  --block <frames>    samples per call, default 512\n"
+               "  --blocks <n>        calls per run, default 4000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int blockSize = 512;
+  int numBlocks = 4000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--block") {
+      blockSize = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--blocks") {
+      numBlocks = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  // Levels from -60 to +20 dBFS, around the threshold and the knees
+  std::mt19937 random(5);
+  std::uniform_real_distribution<float> levelDb(-60.0f, 20.0f);
+  std::vector<float> levels(48000);
+  for (float &level : levels) {
+    level = levelDb(random);
+  }
+  const size_t numSamples = size_t(blockSize) * size_t(numBlocks);
+  std::vector<float> signal(numSamples);
+  for (size_t i = 0; i < numSamples; i++) {
+    signal[i] = std::pow(10.0f, levels[i % levels.size()] / 20.0f);
+  }
+  std::vector<float> destination(static_cast<size_t>(blockSize));
+
+  bool ok = true;
+  std::cout << "kernel vs piecewise, computer vs getCharacteristicSample "
+               "(max error in dB); generic / kernel / whole computer "
+               "(ns/sample), kernel speedup:\n";
+  for (const Configuration &configuration : kConfigurations) {
+    const double kernel = kernelError(configuration);
+    const double computer = computerError(configuration, levels);
+    ok = ok && kernel <= kKernelBoundDb && computer <= kComputerBoundDb;
+
+    // The previous static stage: level detection, then the piecewise
+    // characteristic in a second, branching loop
+    const float slope = slopeOf(configuration);
+    const double genericSeconds = secondsOf(
+        [&]() {
+          for (size_t offset = 0; offset < numSamples;
+               offset += size_t(blockSize)) {
+            VectorOperations::amplitudeToDecibels(
+                destination.data(), signal.data() + offset, blockSize);
+            for (int i = 0; i < blockSize; i++) {
+              destination[size_t(i)] =
+                  piecewise(destination[size_t(i)] - kThreshold,
+                            configuration.knee, slope);
+            }
+          }
+        },
+        runs);
+
+    // The static stage as computeStaticGain runs it, fused with the level
+    // detection
+    const double kernelSeconds = withKernel(configuration, [&](const auto
+                                                                   &k) {
+      const float increment = 0.0f;
+      return secondsOf(
+          [&]() {
+            for (size_t offset = 0; offset < numSamples;
+                 offset += size_t(blockSize)) {
+              VectorOperations::amplitudeToDecibels(
+                  destination.data(), signal.data() + offset, blockSize,
+                  [k, increment](const float levelInDecibels, const int i) {
+                    return k(levelInDecibels - increment * i);
+                  });
+            }
+          },
+          runs);
+    });
+
+    GainReductionComputer timed;
+    configure(timed, configuration, 0.005f, 0.1f);
+    const double computerSeconds = secondsOf(
+        [&]() {
+          for (size_t offset = 0; offset < numSamples;
+               offset += size_t(blockSize)) {
+            timed.computeGainInDecibelsFromSidechainSignal(
+                signal.data() + offset, destination.data(), blockSize);
+          }
+        },
+        runs);
+
+    const double perSample = 1e9 / double(numSamples);
+    std::cout << "  " << configuration.name << ": " << kernel << ", "
+              << computer << "; " << genericSeconds * perSample << " / "
+              << kernelSeconds * perSample << " / "
+              << computerSeconds * perSample << ", "
+              << genericSeconds / kernelSeconds << "x\n";
+  }
+  std::cout << "bounds: " << kKernelBoundDb << " dB (kernels), "
+            << kComputerBoundDb << " dB (computer)\n";
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WavFile.h"
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/GainReductionComputer.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/LookAheadGainReduction.cpp"
+
+// Runs a test signal through every combination of the given compressor
+// parameters, in parallel, and writes objective metrics of each configuration
+// to a CSV file. See readme_compressor_sweep.md
+
+struct SweepConfig {
+  float threshold;
+  float ratio;
+  float knee;
+  float attack;
+  float release;
+  float lookAhead;
+};
+
+struct SweepMetrics {
+  float maxGainReduction{0.0f}; // dB, negative
+  float outputPeak{-200.0f};    // dB
+  float maxOvershoot{0.0f};     // dB above the static characteristic
+  float grLatencyMs{NAN};       // NAN if it can't be measured, see evaluate()
+  float distortionEnergy{-200.0f}; // dB relative to the output energy
+};
+
+// The test signal, analyzed once and shared read-only by all workers
+struct TestSignal {
+  int sampleRate{0};
+  uint64_t frames{0};
+  std::vector<float> sideChain; // maximum of the absolute values of all
+                                // channels, padded with zeros at the end
+  std::vector<float> energy;    // sum of the squares of all channels
+};
+
+float toDecibels(float gain) {
+  return gain > 0.0f ? 20.0f * std::log10(gain) : -200.0f;
+}
+
+bool loadTestSignal(const std::string &path, int maxPadding,
+                    TestSignal &signal, std::string &error) {
+  WavReader reader;
+  if (!reader.open(path)) {
+    error = reader.errorMessage();
+    return false;
+  }
+  const int nCh = reader.channels();
+  signal.sampleRate = reader.sampleRate();
+  signal.frames = reader.frames();
+  signal.sideChain.assign(signal.frames + maxPadding, 0.0f);
+  signal.energy.assign(signal.frames, 0.0f);
+
+  std::vector<float> interleaved(size_t(nCh) * signal.frames);
+  if (reader.read(interleaved.data(), signal.frames) != signal.frames) {
+    error = "could not read all frames";
+    return false;
+  }
+  for (uint64_t i = 0; i < signal.frames; i++) {
+    float peak = 0.0f;
+    float sum = 0.0f;
+    for (int ch = 0; ch < nCh; ch++) {
+      const float x = interleaved[i * nCh + ch];
+      peak = std::max(peak, std::fabs(x));
+      sum += x * x;
+    }
+    signal.sideChain[i] = peak;
+    signal.energy[i] = sum;
+  }
+  return true;
+}
+
+// Scratch buffers of one worker, reused for all its configurations
+struct Workspace {
+  std::vector<float> gains;
+  std::vector<double> prefix;
+};
+
+// Computes the linked gain of one configuration and measures it. The gain is
+// applied in the analysis only, the output signal itself is never built:
+// output[n] = gain[n] * input[n], with the look-ahead delay compensated.
+SweepMetrics evaluate(const SweepConfig &config, const TestSignal &signal,
+                      int blockSize, float smoothingTime, Workspace &ws) {
+  GainReductionComputer computer;
+  computer.setThreshold(config.threshold);
+  computer.setRatio(config.ratio);
+  computer.setKnee(config.knee);
+  computer.setAttackTime(config.attack);
+  computer.setReleaseTime(config.release);
+  computer.prepare(signal.sampleRate);
+
+  LookAheadGainReduction lookAhead;
+  lookAhead.setDelayTime(config.lookAhead);
+  lookAhead.prepare(signal.sampleRate, blockSize);
+  const bool useLookAhead = lookAhead.getDelayInSamples() > 0;
+  const uint64_t delay = uint64_t(lookAhead.getDelayInSamples());
+
+  const uint64_t total = signal.frames + delay;
+  ws.gains.resize(total);
+  float *gains = ws.gains.data();
+  for (uint64_t offset = 0; offset < total; offset += blockSize) {
+    const int n = int(std::min<uint64_t>(blockSize, total - offset));
+    const float *sc = signal.sideChain.data() + offset;
+    if (useLookAhead) {
+      computer.computeGainInDecibelsFromSidechainSignal(sc, gains + offset, n);
+      lookAhead.pushSamples(gains + offset, n);
+      lookAhead.process();
+      lookAhead.readSamples(gains + offset, n);
+      computer.convertToLinearGain(gains + offset, gains + offset, n);
+    } else {
+      computer.computeLinearGainFromSidechainSignal(sc, gains + offset, n);
+    }
+  }
+  // gain[delay + i] is applied to input sample i
+  const float *g = gains + delay;
+
+  SweepMetrics m;
+  const uint64_t N = signal.frames;
+  float minGain = 1e30f;
+  float outputPeak = 0.0f;
+  float overshoot = -200.0f;
+  float inputPeak = 0.0f;
+  uint64_t peakIndex = 0;
+  for (uint64_t i = 0; i < N; i++) {
+    const float x = signal.sideChain[i];
+    minGain = std::min(minGain, g[i]);
+    outputPeak = std::max(outputPeak, g[i] * x);
+    if (x > inputPeak) {
+      inputPeak = x;
+      peakIndex = i;
+    }
+    if (x > 1e-5f) {
+      overshoot = std::max(overshoot,
+                           toDecibels(g[i] * x) -
+                               computer.getCharacteristicSample(toDecibels(x)));
+    }
+  }
+  m.maxGainReduction = N > 0 ? toDecibels(minGain) : 0.0f;
+  m.outputPeak = toDecibels(outputPeak);
+  m.maxOvershoot = overshoot;
+
+  // latency: from the loudest input sample to the gain reduction reaching
+  // half the way from where it was before to its maximum, negative if the
+  // look-ahead fades it in before the peak. The search starts a bit before
+  // the look-ahead time, and the gain reduction just before that is the
+  // baseline, so a signal that is compressed already (e.g. a loud tone
+  // under the peak) is measured from its own level. NAN if the gain
+  // reduction doesn't rise from there, or is already past half way at the
+  // start of the search.
+  if (m.maxGainReduction < -0.01f) {
+    const uint64_t searchStart = uint64_t(std::max<int64_t>(
+        0, int64_t(peakIndex) - int64_t(delay) -
+               int64_t(0.001f * signal.sampleRate)));
+    const float baseline =
+        searchStart > 0 ? toDecibels(g[searchStart - 1]) : 0.0f;
+    const float halfGainReduction =
+        baseline + 0.5f * (m.maxGainReduction - baseline);
+    if (m.maxGainReduction - baseline < -0.01f &&
+        toDecibels(g[searchStart]) > halfGainReduction) {
+      for (uint64_t i = searchStart + 1; i < N; i++) {
+        if (toDecibels(g[i]) <= halfGainReduction) {
+          m.grLatencyMs = 1000.0f * float(int64_t(i) - int64_t(peakIndex)) /
+                          signal.sampleRate;
+          break;
+        }
+      }
+    }
+  }
+
+  // distortion: the energy of the fast part of the gain modulation, i.e. the
+  // difference to the gain smoothed with a centered moving average, applied
+  // to the input, relative to the energy of the output
+  const int64_t half =
+      std::max<int64_t>(1, int64_t(smoothingTime * signal.sampleRate / 2));
+  ws.prefix.resize(N + 1);
+  ws.prefix[0] = 0.0;
+  for (uint64_t i = 0; i < N; i++) {
+    ws.prefix[i + 1] = ws.prefix[i] + g[i];
+  }
+  double distortion = 0.0;
+  double output = 0.0;
+  for (int64_t i = 0; i < int64_t(N); i++) {
+    const int64_t a = std::max<int64_t>(0, i - half);
+    const int64_t b = std::min<int64_t>(int64_t(N), i + half + 1);
+    const double smooth = (ws.prefix[b] - ws.prefix[a]) / double(b - a);
+    const double d = g[i] - smooth;
+    distortion += d * d * signal.energy[i];
+    output += double(g[i]) * g[i] * signal.energy[i];
+  }
+  if (output > 0.0 && distortion > 0.0) {
+    m.distortionEnergy = float(10.0 * std::log10(distortion / output));
+  }
+  return m;
+}
+
+// Parses "value", "start:stop:step" or "a,b,c"
+bool parseRange(const std::string &text, std::vector<float> &values) {
+  values.clear();
+  try {
+    const size_t colon = text.find(':');
+    if (colon != std::string::npos) {
+      const size_t colon2 = text.find(':', colon + 1);
+      if (colon2 == std::string::npos) {
+        return false;
+      }
+      const float start = std::stof(text.substr(0, colon));
+      const float stop = std::stof(text.substr(colon + 1, colon2 - colon - 1));
+      const float step = std::stof(text.substr(colon2 + 1));
+      if (!(step > 0.0f)) {
+        return false;
+      }
+      const int count = int(std::floor((stop - start) / step + 1e-4f)) + 1;
+      for (int i = 0; i < count; i++) {
+        values.push_back(start + i * step);
+      }
+    } else {
+      std::stringstream ss(text);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+        values.push_back(std::stof(item));
+      }
+    }
+  } catch (std::exception &) {
+    return false;
+  }
+  return !values.empty();
+}
+
+void printUsage() {
+  std::cout
+      << "Usage: compressor_sweep [options] signal.wav\n"
+         "Each parameter takes a value, a list a,b,c or a range "
+         "start:stop:step\n"
+         "  --threshold <dB>    default -30:-6:6\n"
+         "  --ratio <ratio>     default 2,4,8,inf\n"
+         "  --knee <dB>         default 0,6\n"
+         "  --attack <s>        default 0.001,0.005,0.02\n"
+         "  --release <s>       default 0.05,0.2\n"
+         "  --lookahead <s>     default 0,0.005\n"
+         "  --jobs <n>          default: number of cores\n"
+         "  --block <frames>    default 512\n"
+         "  --smoothing <s>     window of the distortion measure, default "
+         "0.01\n"
+         "  --out <file.csv>    default sweep.csv\n";
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<float> thresholds{-30, -24, -18, -12, -6};
+  std::vector<float> ratios{2, 4, 8, INFINITY};
+  std::vector<float> knees{0, 6};
+  std::vector<float> attacks{0.001f, 0.005f, 0.02f};
+  std::vector<float> releases{0.05f, 0.2f};
+  std::vector<float> lookAheads{0, 0.005f};
+  unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
+  int blockSize = 512;
+  float smoothingTime = 0.01f;
+  std::string outputFile = "sweep.csv";
+  std::string inputFile;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0) {
+      if (i + 1 >= argc) {
+        std::cerr << "ERROR: missing value for " << arg << std::endl;
+        return 1;
+      }
+      std::string value = argv[++i];
+      bool ok = true;
+      try {
+        if (arg == "--threshold") {
+          ok = parseRange(value, thresholds);
+        } else if (arg == "--ratio") {
+          ok = parseRange(value, ratios);
+        } else if (arg == "--knee") {
+          ok = parseRange(value, knees);
+        } else if (arg == "--attack") {
+          ok = parseRange(value, attacks);
+        } else if (arg == "--release") {
+          ok = parseRange(value, releases);
+        } else if (arg == "--lookahead") {
+          ok = parseRange(value, lookAheads);
+        } else if (arg == "--jobs") {
+          jobs = unsigned(std::max(1, std::stoi(value)));
+        } else if (arg == "--block") {
+          blockSize = std::max(1, std::stoi(value));
+        } else if (arg == "--smoothing") {
+          smoothingTime = std::stof(value);
+        } else if (arg == "--out") {
+          outputFile = value;
+        } else {
+          std::cerr << "ERROR: unknown option " << arg << std::endl;
+          printUsage();
+          return 1;
+        }
+      } catch (std::exception &) {
+        ok = false;
+      }
+      if (!ok) {
+        std::cerr << "ERROR: invalid value for " << arg << std::endl;
+        return 1;
+      }
+    } else {
+      inputFile = arg;
+    }
+  }
+  if (inputFile.empty()) {
+    printUsage();
+    return 1;
+  }
+
+  std::vector<SweepConfig> configs;
+  for (float t : thresholds)
+    for (float r : ratios)
+      for (float k : knees)
+        for (float a : attacks)
+          for (float rel : releases)
+            for (float la : lookAheads) {
+              configs.push_back({t, r, k, a, rel, la});
+            }
+
+  // the side-chain is padded for the longest look-ahead, so every
+  // configuration can flush its delay-line
+  TestSignal signal;
+  std::string error;
+  const float maxLookAhead =
+      *std::max_element(lookAheads.begin(), lookAheads.end());
+  WavReader probe;
+  if (!probe.open(inputFile)) {
+    std::cerr << "ERROR: " << inputFile << ": " << probe.errorMessage()
+              << std::endl;
+    return 1;
+  }
+  const int maxPadding = int(maxLookAhead * probe.sampleRate()) + 1;
+  probe.close();
+  if (!loadTestSignal(inputFile, maxPadding, signal, error)) {
+    std::cerr << "ERROR: " << inputFile << ": " << error << std::endl;
+    return 1;
+  }
+
+  std::cout << configs.size() << " configurations of " << signal.frames
+            << " frames, " << jobs << " jobs" << std::endl;
+
+  std::vector<SweepMetrics> results(configs.size());
+  std::atomic<size_t> nextConfig{0};
+  auto start = std::chrono::steady_clock::now();
+
+  // configurations are handed out one at a time, each worker keeps its
+  // scratch buffers
+  auto worker = [&]() {
+    Workspace ws;
+    size_t index;
+    while ((index = nextConfig++) < configs.size()) {
+      results[index] =
+          evaluate(configs[index], signal, blockSize, smoothingTime, ws);
+    }
+  };
+  jobs = std::min(jobs, unsigned(configs.size()));
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < jobs; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : threads) {
+    t.join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  std::ofstream csv(outputFile);
+  if (!csv) {
+    std::cerr << "ERROR: can't write " << outputFile << std::endl;
+    return 1;
+  }
+  csv << "threshold_db,ratio,knee_db,attack_s,release_s,lookahead_s,"
+         "max_gain_reduction_db,output_peak_db,max_overshoot_db,"
+         "gr_latency_ms,distortion_energy_db\n";
+  for (size_t i = 0; i < configs.size(); i++) {
+    const SweepConfig &c = configs[i];
+    const SweepMetrics &m = results[i];
+    csv << c.threshold << "," << c.ratio << "," << c.knee << "," << c.attack
+        << "," << c.release << "," << c.lookAhead << "," << m.maxGainReduction
+        << "," << m.outputPeak << "," << m.maxOvershoot << ",";
+    if (!std::isnan(m.grLatencyMs)) {
+      csv << m.grLatencyMs;
+    }
+    csv << "," << m.distortionEnergy << "\n";
+  }
+
+  std::cout << configs.size() << " configurations in " << seconds << " s ("
+            << configs.size() / seconds << " per second), written to "
+            << outputFile << std::endl;
+  return 0;
+}
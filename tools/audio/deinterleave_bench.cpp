@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "RoutingTable.h"
+
+// Compares deinterleaveAccumulate (RoutingTable.h), the mixing kernel of
+// multichannel_playback, with the per-sample scatter loop it replaced, for
+// exactness on random layouts and for speed with mono, 8-channel and
+// 60-channel files. Exits with 1 if any output differs. See
+// readme_deinterleave_bench.md
+
+namespace {
+
+const size_t kNumOutputs = 64;
+
+// A file of the session: its interleaved block and where its channels go
+struct File {
+  size_t numChannels;
+  float gain;
+  std::vector<size_t> outChannelMap;
+  std::vector<float> interleaved;
+};
+
+// The loop of onSound before the routing table: every channel of the map
+// scattered to its output, one sample at a time
+void scatterAccumulate(const File &file, float *const *outputs,
+                       size_t numFrames) {
+  for (size_t i = 0; i < file.outChannelMap.size(); i++) {
+    const size_t outIndex = file.outChannelMap[i];
+    for (size_t sample = 0; sample < numFrames; sample++) {
+      outputs[outIndex][sample] +=
+          file.gain * file.interleaved[sample * file.numChannels + i];
+    }
+  }
+}
+
+// The session as multichannel_playback flattens it in buildRoutes()
+struct Session {
+  std::vector<File> files;
+  std::vector<Route> routes;
+  std::vector<size_t> firstRoute;
+  std::vector<float *> routeOutputs;
+
+  void buildRoutes(float *const *outputs) {
+    routes.clear();
+    firstRoute.clear();
+    for (const File &file : files) {
+      firstRoute.push_back(routes.size());
+      for (size_t i = 0; i < file.outChannelMap.size(); i++) {
+        routes.push_back({uint32_t(i), uint32_t(file.outChannelMap[i]),
+                          file.gain});
+      }
+    }
+    routeOutputs.clear();
+    for (const Route &route : routes) {
+      routeOutputs.push_back(outputs[route.outChannel]);
+    }
+  }
+
+  void mix(size_t numFrames) {
+    for (size_t f = 0; f < files.size(); f++) {
+      const size_t numRoutes = files[f].outChannelMap.size();
+      deinterleaveAccumulate(files[f].interleaved.data(),
+                             files[f].numChannels,
+                             routes.data() + firstRoute[f],
+                             routeOutputs.data() + firstRoute[f], numRoutes,
+                             numFrames);
+    }
+  }
+
+  void scatter(float *const *outputs, size_t numFrames) {
+    for (const File &file : files) {
+      scatterAccumulate(file, outputs, numFrames);
+    }
+  }
+};
+
+File randomFile(std::mt19937 &random, size_t numChannels, size_t numFrames) {
+  std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+  File file;
+  file.numChannels = numChannels;
+  file.gain = std::uniform_real_distribution<float>(0.1f, 2.0f)(random);
+  file.interleaved.resize(numChannels * numFrames);
+  for (float &value : file.interleaved) {
+    value = sample(random);
+  }
+  return file;
+}
+
+struct Outputs {
+  std::vector<std::vector<float>> buffers;
+  std::vector<float *> pointers;
+
+  Outputs(size_t numFrames) {
+    buffers.assign(kNumOutputs, std::vector<float>(numFrames));
+    for (auto &buffer : buffers) {
+      pointers.push_back(buffer.data());
+    }
+  }
+
+  void fill(uint32_t seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+    for (auto &buffer : buffers) {
+      for (float &value : buffer) {
+        value = sample(random);
+      }
+    }
+  }
+
+  bool operator==(const Outputs &other) const {
+    for (size_t c = 0; c < buffers.size(); c++) {
+      if (std::memcmp(buffers[c].data(), other.buffers[c].data(),
+                      buffers[c].size() * sizeof(float)) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Random sessions: 1 to 8 files of 1 to 64 channels (mono and stereo more
+// often, since they have their own loops), routed anywhere, several
+// channels to the same output included, mixed on top of existing output
+size_t checkLayouts(int numLayouts, uint32_t seed) {
+  std::mt19937 random(seed);
+  size_t mismatches = 0;
+  for (int layout = 0; layout < numLayouts; layout++) {
+    const size_t numFrames =
+        std::uniform_int_distribution<size_t>(1, 1024)(random);
+    Session session;
+    const int numFiles = std::uniform_int_distribution<int>(1, 8)(random);
+    for (int f = 0; f < numFiles; f++) {
+      const int kind = std::uniform_int_distribution<int>(0, 3)(random);
+      const size_t numChannels =
+          kind == 0 ? 1
+                    : kind == 1 ? 2
+                                : std::uniform_int_distribution<size_t>(
+                                      3, 64)(random);
+      File file = randomFile(random, numChannels, numFrames);
+      std::uniform_int_distribution<size_t> out(0, kNumOutputs - 1);
+      for (size_t c = 0; c < numChannels; c++) {
+        file.outChannelMap.push_back(out(random));
+      }
+      session.files.push_back(file);
+    }
+
+    Outputs routed(numFrames), scattered(numFrames);
+    routed.fill(uint32_t(layout));
+    scattered.fill(uint32_t(layout));
+    session.buildRoutes(routed.pointers.data());
+    session.mix(numFrames);
+    session.scatter(scattered.pointers.data(), numFrames);
+    if (!(routed == scattered)) {
+      if (mismatches < 10) {
+        std::cerr << "MISMATCH: layout " << layout << ", " << numFiles
+                  << " files, " << numFrames << " frames" << std::endl;
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+template <typename Function> double secondsOf(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Times numFiles files of numChannels channels each, every channel on its
+// own output in a shuffled order, like a sphere session
+void timeLayout(size_t numChannels, size_t numFiles, size_t blockSize,
+                int numBlocks, int runs) {
+  std::mt19937 random(1);
+  Session session;
+  const size_t numOutputs = numChannels * numFiles;
+  std::vector<size_t> order(numOutputs);
+  for (size_t i = 0; i < numOutputs; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), random);
+  for (size_t f = 0; f < numFiles; f++) {
+    File file = randomFile(random, numChannels, blockSize);
+    file.outChannelMap.assign(order.begin() + f * numChannels,
+                              order.begin() + (f + 1) * numChannels);
+    session.files.push_back(file);
+  }
+  Outputs outputs(blockSize);
+  session.buildRoutes(outputs.pointers.data());
+
+  double routedSeconds = 1e9, scatteredSeconds = 1e9;
+  for (int run = 0; run < runs; run++) {
+    outputs.fill(0);
+    routedSeconds = std::min(routedSeconds, secondsOf([&]() {
+      for (int block = 0; block < numBlocks; block++) {
+        session.mix(blockSize);
+      }
+    }));
+    outputs.fill(0);
+    scatteredSeconds = std::min(scatteredSeconds, secondsOf([&]() {
+      for (int block = 0; block < numBlocks; block++) {
+        session.scatter(outputs.pointers.data(), blockSize);
+      }
+    }));
+  }
+  std::cout << numFiles << " x " << numChannels << " ch, " << blockSize
+            << " frames: scatter " << scatteredSeconds * 1e6 / numBlocks
+            << " us, routes " << routedSeconds * 1e6 / numBlocks << " us, "
+            << scatteredSeconds / routedSeconds << "x\n";
+}
+
+void printUsage() {
+  std::cout << "Usage: deinterleave_bench [options]\n"
+               "  --layouts <n>       random layouts checked, default 200\n"
+               "  --seed <n>          seed of the layouts, default 1\n"
+               "  --block <frames>    frames per timed block, default 1024\n"
+               "  --blocks <n>        timed blocks per run, default 2000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numLayouts = 200;
+  uint32_t seed = 1;
+  int blockSize = 1024;
+  int numBlocks = 2000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--layouts") {
+      numLayouts = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--block") {
+      blockSize = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--blocks") {
+      numBlocks = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  const size_t mismatches = checkLayouts(numLayouts, seed);
+  std::cout << numLayouts << " random layouts: " << mismatches
+            << " differ from the scatter loop\n";
+  const bool ok = mismatches == 0;
+
+  timeLayout(1, 60, size_t(blockSize), numBlocks, runs);
+  timeLayout(8, 8, size_t(blockSize), numBlocks, runs);
+  timeLayout(60, 1, size_t(blockSize), numBlocks, runs);
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
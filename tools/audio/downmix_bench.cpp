@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DownmixMatrix.h"
+
+// Checks DownmixMatrix against a mixer built like al::DownMixer, bit for bit,
+// and times both for 5.1 to stereo, 60 to stereo and 60 to 8 channels, in
+// place as multichannel_playback and spatial_sequencer run them. Exits with
+// 1 if any output differs. See readme_downmix_bench.md
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// The mix of al::DownMixer: for every output, a list of inputs and gains,
+// summed from zero into a temporary buffer in list order. The inputs are
+// then cleared and the temporary buffers copied to the outputs. The
+// DownMixer runs in place on the channels of the audio callback, i.e. with
+// inputs and outputs the same buffers; the benchmark reads a separate
+// input so the outputs aren't fed back block after block.
+struct ReferenceDownMixer {
+  std::vector<std::vector<std::pair<size_t, float>>> mix;
+  std::vector<size_t> outputs;
+  std::vector<std::vector<float>> temporary;
+
+  void prepare(size_t numFrames) {
+    temporary.assign(mix.size(), std::vector<float>(numFrames));
+  }
+
+  void downMix(const float *const *inputs, float *const *channels,
+               size_t numFrames) {
+    for (size_t o = 0; o < mix.size(); o++) {
+      float *sum = temporary[o].data();
+      std::fill(sum, sum + numFrames, 0.0f);
+      for (const auto &term : mix[o]) {
+        const float *in = inputs[term.first];
+        for (size_t i = 0; i < numFrames; i++) {
+          sum[i] += term.second * in[i];
+        }
+      }
+    }
+    for (const auto &terms : mix) {
+      for (const auto &term : terms) {
+        std::fill(channels[term.first], channels[term.first] + numFrames,
+                  0.0f);
+      }
+    }
+    for (size_t o = 0; o < mix.size(); o++) {
+      std::copy(temporary[o].begin(), temporary[o].begin() + numFrames,
+                channels[outputs[o]]);
+    }
+  }
+};
+
+struct Setup {
+  std::string name;
+  size_t numChannels;
+  ReferenceDownMixer mixer;
+};
+
+// L R C LFE Ls Rs to the first two channels, the gains of set5_1toStereo
+Setup fiveOneToStereo() {
+  Setup s;
+  s.name = "5.1 -> 2";
+  s.numChannels = 6;
+  s.mixer.mix = {{{0, 1.0f}, {2, 0.7071f}, {3, 0.5f}, {4, 0.7071f}},
+                 {{1, 1.0f}, {2, 0.7071f}, {3, 0.5f}, {5, 0.7071f}}};
+  s.mixer.outputs = {0, 1};
+  return s;
+}
+
+// numInputs speakers on a ring, panned by azimuth to numOutputs speakers
+// (equal power between neighbours), or to stereo with cardioids, like
+// layoutToStereo
+Setup ringTo(size_t numInputs, size_t numOutputs) {
+  Setup s;
+  s.name = std::to_string(numInputs) + " -> " + std::to_string(numOutputs);
+  s.numChannels = numInputs;
+  s.mixer.mix.resize(numOutputs);
+  for (size_t o = 0; o < numOutputs; o++) {
+    s.mixer.outputs.push_back(o);
+  }
+  for (size_t in = 0; in < numInputs; in++) {
+    const double azimuth = 2.0 * kPi * double(in) / double(numInputs);
+    if (numOutputs == 2) {
+      const double norm = 1.0 / std::sqrt(double(numInputs) / 2.0);
+      s.mixer.mix[0].push_back(
+          {in, float(0.5 * (1.0 + std::cos(azimuth)) * norm)});
+      s.mixer.mix[1].push_back(
+          {in, float(0.5 * (1.0 - std::cos(azimuth)) * norm)});
+    } else {
+      const double position = double(in) * numOutputs / double(numInputs);
+      const size_t a = size_t(position) % numOutputs;
+      const size_t b = (a + 1) % numOutputs;
+      const double fraction = position - std::floor(position);
+      s.mixer.mix[a].push_back({in, float(std::cos(fraction * kPi / 2.0))});
+      if (fraction > 0.0) {
+        s.mixer.mix[b].push_back({in, float(std::sin(fraction * kPi / 2.0))});
+      }
+    }
+  }
+  // Terms in ascending input order, as the mixer lists them
+  for (auto &terms : s.mixer.mix) {
+    std::sort(terms.begin(), terms.end());
+  }
+  return s;
+}
+
+struct Buffers {
+  std::vector<float> data;
+  std::vector<float *> channels;
+
+  Buffers(size_t numChannels, size_t numFrames)
+      : data(numChannels * numFrames) {
+    for (size_t c = 0; c < numChannels; c++) {
+      channels.push_back(data.data() + c * numFrames);
+    }
+  }
+
+  void fill(uint32_t state) {
+    for (float &value : data) {
+      state = state * 1664525u + 1013904223u;
+      value = float(int32_t(state)) * (1.0f / 2147483648.0f);
+    }
+  }
+};
+
+// Compiles the setup the way CompiledDownMixer::compile() does: the unit
+// sample response of the mixer, then matches() on a full block
+bool compile(Setup &setup, DownmixMatrix &matrix, size_t numFrames) {
+  const size_t n = setup.numChannels;
+  setup.mixer.prepare(numFrames);
+  Buffers io(n, numFrames);
+  matrix.build(n, n, true, [&](size_t input, float *gains) {
+    std::fill(io.data.begin(), io.data.end(), 0.0f);
+    io.channels[input][0] = 1.0f;
+    setup.mixer.downMix(io.channels.data(), io.channels.data(), numFrames);
+    for (size_t c = 0; c < n; c++) {
+      gains[c] = io.channels[c][0];
+    }
+  });
+  return matrix.matches(numFrames, true,
+                        [&](float *const *inputs, float *const *outputs) {
+                          setup.mixer.downMix(inputs, outputs, numFrames);
+                        });
+}
+
+// Bit for bit on blocks around the matrix's 256-frame chunks
+size_t countMismatches(Setup &setup, DownmixMatrix &matrix) {
+  const size_t sizes[] = {1, 7, 64, 255, 256, 257, 1000, 1024};
+  size_t mismatches = 0;
+  uint32_t seed = 1;
+  for (const size_t numFrames : sizes) {
+    Buffers expected(setup.numChannels, numFrames),
+        actual(setup.numChannels, numFrames);
+    expected.fill(seed);
+    actual.fill(seed);
+    seed++;
+    setup.mixer.downMix(expected.channels.data(), expected.channels.data(),
+                        numFrames);
+    matrix.process(actual.channels.data(), actual.channels.data(), numFrames);
+    if (std::memcmp(expected.data.data(), actual.data.data(),
+                    expected.data.size() * sizeof(float)) != 0) {
+      if (mismatches < 10) {
+        std::cerr << "MISMATCH: " << setup.name << ", " << numFrames
+                  << " frames" << std::endl;
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+template <typename Function> double secondsOf(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void printUsage() {
+  std::cout << "Usage: downmix_bench [options]\n"
+               "  --block <frames>    frames per block, default 1024\n"
+               "  --blocks <n>        timed blocks per run, default 5000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int blockSize = 1024;
+  int numBlocks = 5000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--block") {
+      blockSize = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--blocks") {
+      numBlocks = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  std::vector<Setup> setups = {fiveOneToStereo(), ringTo(60, 2),
+                               ringTo(60, 8)};
+  for (Setup &setup : setups) {
+    const size_t numFrames = size_t(blockSize);
+    DownmixMatrix matrix;
+    const bool exact = compile(setup, matrix, numFrames);
+    const size_t mismatches = countMismatches(setup, matrix);
+    ok = ok && exact && mismatches == 0;
+
+    setup.mixer.prepare(numFrames);
+    Buffers input(setup.numChannels, numFrames),
+        output(setup.numChannels, numFrames);
+    input.fill(1);
+    double matrixSeconds = 1e9, mixerSeconds = 1e9;
+    for (int run = 0; run < runs; run++) {
+      matrixSeconds = std::min(matrixSeconds, secondsOf([&]() {
+        for (int block = 0; block < numBlocks; block++) {
+          matrix.process(input.channels.data(), output.channels.data(),
+                         numFrames);
+        }
+      }));
+      mixerSeconds = std::min(mixerSeconds, secondsOf([&]() {
+        for (int block = 0; block < numBlocks; block++) {
+          setup.mixer.downMix(input.channels.data(), output.channels.data(),
+                              numFrames);
+        }
+      }));
+    }
+    std::cout << setup.name << ": " << matrix.numEntries() << " gains, "
+              << matrix.numRows() << " rows, matches() "
+              << (exact ? "exact" : "NOT EXACT") << ", " << mismatches
+              << " blocks differ; per " << numFrames << "-frame block: mixer "
+              << mixerSeconds * 1e6 / numBlocks << " us, matrix "
+              << matrixSeconds * 1e6 / numBlocks << " us, "
+              << mixerSeconds / matrixSeconds << "x\n";
+  }
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
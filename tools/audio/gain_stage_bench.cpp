@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/GainReductionComputer.cpp"
+
+// Compares the vectorized level and gain stages of GainReductionComputer
+// (VectorOperations.h) with the scalar std::log10 / std::pow path they
+// replaced, for accuracy and speed. Exits with 1 if the error exceeds the
+// bounds documented in VectorOperations.h. See readme_gain_stage_bench.md
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const float kThreshold = -20.0f;
+const float kKnee = 6.0f;
+const float kRatio = 4.0f;
+const float kAttack = 0.005f;
+const float kRelease = 0.1f;
+const float kMakeUp = 3.0f;
+
+// Documented in VectorOperations.h, plus float rounding of the callers
+const double kLevelBoundDb = 2.5e-5;
+const double kGainBoundDb = 5.5e-5;
+const double kComputerBoundDb = 1e-4;
+
+// The scalar side-chain as it was before the vectorized stages
+class ScalarReference {
+public:
+  ScalarReference() {
+    mAlphaAttack =
+        1.0f - std::exp(-1.0f / (float(kSampleRate) * kAttack));
+    mAlphaRelease =
+        1.0f - std::exp(-1.0f / (float(kSampleRate) * kRelease));
+  }
+
+  void computeLinearGain(const float *sideChain, float *destination,
+                         int numSamples) {
+    const float slope = 1.0f / kRatio - 1.0f;
+    for (int i = 0; i < numSamples; i++) {
+      const float level = 20.0f * std::log10(std::fabs(sideChain[i]));
+      const float gainReduction =
+          characteristic(level - kThreshold, kKnee, slope);
+      const float diff = gainReduction - mState;
+      mState += (diff < 0.0f ? mAlphaAttack : mAlphaRelease) * diff;
+      destination[i] = std::pow(10.0f, 0.05f * (mState + kMakeUp));
+    }
+  }
+
+private:
+  static float characteristic(float overShoot, float knee, float slope) {
+    const float halfKnee = knee / 2.0f;
+    if (overShoot <= -halfKnee) {
+      return 0.0f;
+    } else if (overShoot <= halfKnee) {
+      return 0.5f * slope * (overShoot + halfKnee) * (overShoot + halfKnee) /
+             knee;
+    }
+    return slope * overShoot;
+  }
+
+  float mState{0.0f};
+  float mAlphaAttack;
+  float mAlphaRelease;
+};
+
+// Noise whose level changes every few milliseconds between -60 and +6 dBFS,
+// so the compressor goes through its whole characteristic
+std::vector<float> makeSignal(size_t numSamples) {
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> levelDb(-60.0f, 6.0f);
+  std::vector<float> signal(numSamples);
+  float gain = 1.0f;
+  for (size_t i = 0; i < numSamples; i++) {
+    if (i % 256 == 0) {
+      gain = std::pow(10.0f, levelDb(random) / 20.0f);
+    }
+    signal[i] = gain * noise(random);
+  }
+  return signal;
+}
+
+double toDb(double ratio) { return 20.0 * std::log10(ratio); }
+
+template <typename Function> double secondsOf(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Sweeps VectorOperations against std::log10 and std::pow
+bool checkConversions() {
+  std::vector<float> amplitudes, decibels;
+  for (double db = -140.0; db <= 60.0; db += 0.001) {
+    amplitudes.push_back(float(std::pow(10.0, db / 20.0)));
+    decibels.push_back(float(db));
+  }
+  const int n = int(amplitudes.size());
+  std::vector<float> result(amplitudes.size());
+
+  VectorOperations::amplitudeToDecibels(result.data(), amplitudes.data(), n);
+  double levelError = 0.0;
+  for (int i = 0; i < n; i++) {
+    levelError = std::max(
+        levelError,
+        std::fabs(result[i] - 20.0 * std::log10(double(amplitudes[i]))));
+  }
+  VectorOperations::decibelsToGain(result.data(), decibels.data(), 0.0f, n);
+  double gainError = 0.0;
+  for (int i = 0; i < n; i++) {
+    gainError = std::max(
+        gainError,
+        std::fabs(toDb(result[i] / std::pow(10.0, decibels[i] / 20.0))));
+  }
+  std::cout << "amplitudeToDecibels: max error " << levelError
+            << " dB (bound " << kLevelBoundDb << ")\n"
+            << "decibelsToGain: max error " << gainError << " dB (bound "
+            << kGainBoundDb << ")\n";
+  return levelError <= kLevelBoundDb && gainError <= kGainBoundDb;
+}
+
+void printUsage() {
+  std::cout << "Usage: gain_stage_bench [options]\n"
+               "  --block <frames>    samples per call, default 128\n"
+               "  --blocks <n>        calls per run, default 4000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int blockSize = 128;
+  int numBlocks = 4000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--block") {
+      blockSize = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--blocks") {
+      numBlocks = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  bool ok = checkConversions();
+
+  const size_t numSamples = size_t(blockSize) * size_t(numBlocks);
+  const std::vector<float> signal = makeSignal(numSamples);
+  std::vector<float> vectorized(numSamples), scalar(numSamples);
+
+  // Accuracy: one pass through both, block by block
+  GainReductionComputer computer;
+  computer.setThreshold(kThreshold);
+  computer.setKnee(kKnee);
+  computer.setRatio(kRatio);
+  computer.setAttackTime(kAttack);
+  computer.setReleaseTime(kRelease);
+  computer.setMakeUpGain(kMakeUp);
+  computer.prepare(kSampleRate);
+  ScalarReference reference;
+  for (size_t offset = 0; offset < numSamples; offset += size_t(blockSize)) {
+    computer.computeLinearGainFromSidechainSignal(
+        signal.data() + offset, vectorized.data() + offset, blockSize);
+    reference.computeLinearGain(signal.data() + offset,
+                                scalar.data() + offset, blockSize);
+  }
+  double maxError = 0.0;
+  double maxReduction = 0.0;
+  for (size_t i = 0; i < numSamples; i++) {
+    maxError = std::max(maxError, std::fabs(toDb(vectorized[i] / scalar[i])));
+    maxReduction = std::min(maxReduction, toDb(scalar[i]) - kMakeUp);
+  }
+  std::cout << "GainReductionComputer: max deviation from the scalar path "
+            << maxError << " dB (bound " << kComputerBoundDb
+            << "), max gain reduction " << maxReduction << " dB\n";
+  ok = ok && maxError <= kComputerBoundDb;
+
+  // Speed: the fastest of several runs, the same blocks every time
+  double vectorSeconds = 1e9, scalarSeconds = 1e9;
+  for (int run = 0; run < runs; run++) {
+    computer.reset();
+    vectorSeconds = std::min(vectorSeconds, secondsOf([&]() {
+      for (size_t offset = 0; offset < numSamples;
+           offset += size_t(blockSize)) {
+        computer.computeLinearGainFromSidechainSignal(
+            signal.data() + offset, vectorized.data() + offset, blockSize);
+      }
+    }));
+    ScalarReference timed;
+    scalarSeconds = std::min(scalarSeconds, secondsOf([&]() {
+      for (size_t offset = 0; offset < numSamples;
+           offset += size_t(blockSize)) {
+        timed.computeLinearGain(signal.data() + offset,
+                                scalar.data() + offset, blockSize);
+      }
+    }));
+  }
+  std::cout << numBlocks << " blocks of " << blockSize << " samples: scalar "
+            << scalarSeconds * 1e9 / double(numSamples)
+            << " ns/sample, vectorized "
+            << vectorSeconds * 1e9 / double(numSamples) << " ns/sample, "
+            << scalarSeconds / vectorSeconds << "x\n";
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
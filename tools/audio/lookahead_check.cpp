@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/LookAheadGainReduction.cpp"
+
+// Checks the two processing modes of LookAheadGainReduction on random
+// gain-reduction signals, and times them. The sliding minimum must match a
+// brute-force evaluation of its formula and never reduce less than the
+// backward scan, and the backward scan must never reduce less than the input.
+// Exits with 1 on any violation. See readme_lookahead_check.md
+
+namespace {
+
+typedef LookAheadGainReduction::ProcessingMode Mode;
+
+const double kSampleRate = 48000.0;
+const float kTolerance = 1e-3f; // dB
+
+// Gain reduction in dB (<= 0) with isolated peaks, steps, plateaus and
+// smooth release curves, the shapes a GainReductionComputer produces
+std::vector<float> makeGainReduction(std::mt19937 &random, size_t numSamples,
+                                     bool smooth) {
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<float> x(numSamples, 0.0f);
+  float state = 0.0f;
+  float target = 0.0f;
+  for (size_t i = 0; i < numSamples; i++) {
+    if (smooth) {
+      // attack/release ballistics towards a random target
+      if (i % 480 == 0) {
+        target = -30.0f * uniform(random) * uniform(random);
+      }
+      state += (target < state ? 0.05f : 0.002f) * (target - state);
+      x[i] = state;
+    } else {
+      const float r = uniform(random);
+      if (r < 0.02f) {
+        x[i] = -40.0f * uniform(random); // isolated peak
+      } else if (r < 0.025f) {
+        state = -20.0f * uniform(random); // step to a new plateau
+        x[i] = state;
+      } else {
+        state *= 0.999f; // release
+        x[i] = state;
+      }
+    }
+  }
+  return x;
+}
+
+// Pushes x through a LookAheadGainReduction in blocks of random sizes up to
+// maxBlock, and returns the output aligned with x (the delay removed)
+std::vector<float> runMode(const std::vector<float> &x, Mode mode,
+                           float delaySeconds, int maxBlock,
+                           std::mt19937 &random) {
+  LookAheadGainReduction lookAhead;
+  lookAhead.setProcessingMode(mode);
+  lookAhead.setDelayTime(delaySeconds);
+  lookAhead.prepare(kSampleRate, maxBlock);
+  const size_t delay = size_t(lookAhead.getDelayInSamples());
+  std::vector<float> padded(x);
+  padded.resize(x.size() + delay, 0.0f);
+  std::vector<float> out(padded.size());
+  std::uniform_int_distribution<int> blockSize(1, maxBlock);
+  for (size_t offset = 0; offset < padded.size();) {
+    const int n = int(std::min<size_t>(size_t(blockSize(random)),
+                                       padded.size() - offset));
+    lookAhead.pushSamples(padded.data() + offset, n);
+    lookAhead.process();
+    lookAhead.readSamples(out.data() + offset, n);
+    offset += size_t(n);
+  }
+  return std::vector<float>(out.begin() + long(delay), out.end());
+}
+
+// y[n] = min over j = 0 ... D of x[n + j] * (1 - j / D), x being 0 after
+// the end
+std::vector<float> bruteForce(const std::vector<float> &x, int delay) {
+  std::vector<float> y(x.size());
+  for (size_t n = 0; n < x.size(); n++) {
+    double minimum = x[n];
+    for (int j = 1; j <= delay && n + size_t(j) < x.size(); j++) {
+      minimum = std::min(minimum,
+                         double(x[n + size_t(j)]) * (1.0 - double(j) / delay));
+    }
+    y[n] = float(minimum);
+  }
+  return y;
+}
+
+struct Counts {
+  uint64_t samples{0};
+  uint64_t formulaErrors{0};
+  uint64_t orderErrors{0};
+  double maxFormulaError{0.0};
+  double maxModeDifference{0.0};
+};
+
+void checkConfiguration(std::mt19937 &random, Counts &counts) {
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  const bool smooth = uniform(random) < 0.5f;
+  const float delaySeconds =
+      uniform(random) < 0.05f ? 0.0f : 0.05f * uniform(random);
+  const int maxBlock = 1 + int(1023.0f * uniform(random) * uniform(random));
+  const size_t numSamples = 20000 + size_t(20000.0f * uniform(random));
+  const std::vector<float> x = makeGainReduction(random, numSamples, smooth);
+
+  const std::vector<float> sliding =
+      runMode(x, Mode::slidingMinimum, delaySeconds, maxBlock, random);
+  const std::vector<float> backward =
+      runMode(x, Mode::backwardScan, delaySeconds, maxBlock, random);
+  const int delay = int(delaySeconds * kSampleRate);
+  const std::vector<float> expected = bruteForce(x, delay);
+
+  for (size_t n = 0; n < numSamples; n++) {
+    counts.samples++;
+    const double error = std::fabs(sliding[n] - expected[n]);
+    counts.maxFormulaError = std::max(counts.maxFormulaError, error);
+    counts.maxModeDifference = std::max(
+        counts.maxModeDifference, double(backward[n]) - double(sliding[n]));
+    if (error > kTolerance) {
+      if (counts.formulaErrors++ < 5) {
+        std::cerr << "MISMATCH: sliding minimum " << sliding[n]
+                  << " dB, formula " << expected[n] << " dB at sample " << n
+                  << " (delay " << delay << ", blocks up to " << maxBlock
+                  << ")" << std::endl;
+      }
+    }
+    if (sliding[n] > backward[n] + kTolerance ||
+        backward[n] > x[n] + kTolerance) {
+      if (counts.orderErrors++ < 5) {
+        std::cerr << "ORDER: x " << x[n] << ", backward scan " << backward[n]
+                  << ", sliding minimum " << sliding[n] << " dB at sample "
+                  << n << " (delay " << delay << ")" << std::endl;
+      }
+    }
+  }
+}
+
+// ns per sample for one mode, delay and block size, the fastest of runs
+double timeMode(const std::vector<float> &x, Mode mode, float delaySeconds,
+                int blockSize, int runs) {
+  LookAheadGainReduction lookAhead;
+  lookAhead.setProcessingMode(mode);
+  lookAhead.setDelayTime(delaySeconds);
+  lookAhead.prepare(kSampleRate, blockSize);
+  std::vector<float> out(static_cast<size_t>(blockSize));
+  double best = 1e9;
+  for (int run = 0; run < runs; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset + size_t(blockSize) <= x.size();
+         offset += size_t(blockSize)) {
+      lookAhead.pushSamples(x.data() + offset, blockSize);
+      lookAhead.process();
+      lookAhead.readSamples(out.data(), blockSize);
+    }
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best * 1e9 / double(x.size());
+}
+
+void printUsage() {
+  std::cout << "Usage: lookahead_check [options]\n"
+               "  --configs <n>       random configurations, default 300\n"
+               "  --seed <n>          default 1\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 3\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numConfigs = 300;
+  unsigned int seed = 1;
+  int runs = 3;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--configs") {
+      numConfigs = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = unsigned(std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::mt19937 random(seed);
+  Counts counts;
+  for (int c = 0; c < numConfigs; c++) {
+    checkConfiguration(random, counts);
+  }
+  std::cout << numConfigs << " configurations, " << counts.samples
+            << " samples: sliding minimum vs formula max error "
+            << counts.maxFormulaError << " dB, " << counts.formulaErrors
+            << " above " << kTolerance << " dB; " << counts.orderErrors
+            << " samples out of order (sliding <= backward <= input)\n"
+            << "the backward scan reduces up to " << counts.maxModeDifference
+            << " dB less than the sliding minimum\n";
+
+  // Throughput on both kinds of signals, 10 s each
+  const size_t numSamples = size_t(kSampleRate) * 10;
+  for (bool smooth : {true, false}) {
+    std::mt19937 signalRandom(7);
+    const std::vector<float> x =
+        makeGainReduction(signalRandom, numSamples, smooth);
+    std::cout << (smooth ? "smooth" : "spiky")
+              << " gain reduction, ns/sample (backward scan / sliding "
+                 "minimum):\n";
+    for (float delayMs : {1.0f, 5.0f, 20.0f, 50.0f}) {
+      std::cout << "  " << delayMs << " ms:";
+      for (int blockSize : {16, 64, 512}) {
+        std::cout << "  block " << blockSize << " "
+                  << timeMode(x, Mode::backwardScan, delayMs / 1000.0f,
+                              blockSize, runs)
+                  << " / "
+                  << timeMode(x, Mode::slidingMinimum, delayMs / 1000.0f,
+                              blockSize, runs);
+      }
+      std::cout << "\n";
+    }
+  }
+
+  const bool ok = counts.formulaErrors == 0 && counts.orderErrors == 0;
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "MeterLevels.h"
+
+// Checks MeterLevels against the per-sample meter loop sphere_audio_test used
+// before, and its RMS mode against the exact integration, then times both
+// modes and the old loop for 64 channels at 64, 256 and 1024 frames. Exits
+// with 1 if a bound is exceeded. See readme_meter_bench.md
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const size_t kNumChannels = 64;
+const size_t kBlockSizes[] = {64, 256, 1024};
+
+// Display units per dB, see MeterLevels.h
+const double kDisplayPerDb = 0.005;
+const double kPeakBoundDb = 0.001;
+const double kRmsBoundDb = 0.01;
+const double kSumOfSquaresBound = 1e-5; // relative
+
+// The meter of sphere_audio_test before MeterLevels, as it was
+struct OldMeter {
+  std::vector<float> values, tempValues;
+
+  void process(float *const *channels, size_t numChannels, size_t fpb) {
+    if (tempValues.size() != numChannels) {
+      tempValues.resize(numChannels);
+      values.resize(numChannels);
+    }
+    for (size_t i = 0; i < numChannels; i++) {
+      tempValues[i] = FLT_MIN;
+      const float *outBuf = channels[i];
+      for (size_t samp = 0; samp < fpb; samp++) {
+        float val = std::fabs(*outBuf);
+        if (tempValues[i] < val) {
+          tempValues[i] = val;
+        }
+        outBuf++;
+      }
+      if (tempValues[i] == 0) {
+        tempValues[i] = 0.01;
+      } else {
+        float db = 20.0 * std::log10(tempValues[i]);
+        if (db < -60) {
+          tempValues[i] = 0.01;
+        } else {
+          tempValues[i] = 0.01 + 0.005 * (60 + db);
+        }
+      }
+      if (values[i] > tempValues[i]) {
+        values[i] = values[i] - 0.05 * (values[i] - tempValues[i]);
+      } else {
+        values[i] = tempValues[i];
+      }
+    }
+  }
+};
+
+struct Block {
+  std::vector<float> data;
+  std::vector<float *> channels;
+
+  Block(size_t numChannels, size_t numFrames) : data(numChannels * numFrames) {
+    for (size_t c = 0; c < numChannels; c++) {
+      channels.push_back(data.data() + c * numFrames);
+    }
+  }
+};
+
+// Noise whose level steps from 0 to -80 dB every 50 blocks, with every
+// seventh channel silent; the largest display difference to the old meter,
+// in dB
+double peakError(size_t blockSize, int numBlocks) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  Block block(kNumChannels, blockSize);
+  OldMeter old;
+  MeterLevels meter;
+  meter.configure(kNumChannels, kSampleRate);
+  double error = 0.0;
+  for (int b = 0; b < numBlocks; b++) {
+    if (b % 50 == 0) {
+      const float gain = std::pow(10.0f, -float(b / 50 % 81) / 20.0f);
+      for (size_t c = 0; c < kNumChannels; c++) {
+        for (size_t i = 0; i < blockSize; i++) {
+          block.channels[c][i] = c % 7 == 0 ? 0.0f : gain * noise(random);
+        }
+      }
+    }
+    old.process(block.channels.data(), kNumChannels, blockSize);
+    meter.process(block.channels.data(), kNumChannels, blockSize);
+    for (size_t c = 0; c < kNumChannels; c++) {
+      error = std::max(error, std::fabs(double(meter.values()[c]) -
+                                        double(old.values[c])) /
+                                  kDisplayPerDb);
+    }
+  }
+  return error;
+}
+
+// peak() of every length up to 1100 at every alignment of a 16-float
+// vector must be exactly the largest absolute sample. Returns the failures.
+size_t peakMismatches() {
+  std::mt19937 random(2);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::vector<float> samples(1100 + 16);
+  for (float &s : samples) {
+    s = noise(random);
+  }
+  size_t mismatches = 0;
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length <= 1100; length++) {
+      float expected = 0.0f;
+      for (size_t i = 0; i < length; i++) {
+        expected = std::max(expected, std::fabs(samples[offset + i]));
+      }
+      if (MeterLevels::peak(samples.data() + offset, length) != expected) {
+        mismatches++;
+      }
+    }
+  }
+  return mismatches;
+}
+
+// sumOfSquares() against a double accumulation, relative error
+double sumOfSquaresError() {
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::vector<float> samples(1024);
+  double error = 0.0;
+  for (int run = 0; run < 100; run++) {
+    for (float &s : samples) {
+      s = noise(random);
+    }
+    for (size_t length = 1; length <= samples.size(); length += 37) {
+      double expected = 0.0;
+      for (size_t i = 0; i < length; i++) {
+        expected += double(samples[i]) * samples[i];
+      }
+      error = std::max(
+          error, std::fabs(MeterLevels::sumOfSquares(samples.data(), length) -
+                           expected) /
+                     expected);
+    }
+  }
+  return error;
+}
+
+// A 0.5 DC step for 0.4 s (rounded up to whole blocks) in RMS mode, against
+// 10 log10(0.25 (1 - exp(-t / 0.4))); the difference in dB
+double rmsError(size_t blockSize) {
+  MeterLevels meter;
+  meter.configure(kNumChannels, kSampleRate, MeterMode::Rms);
+  Block block(kNumChannels, blockSize);
+  std::fill(block.data.begin(), block.data.end(), 0.5f);
+  const size_t numBlocks =
+      (size_t(0.4 * kSampleRate) + blockSize - 1) / blockSize;
+  for (size_t b = 0; b < numBlocks; b++) {
+    meter.process(block.channels.data(), kNumChannels, blockSize);
+  }
+  const double seconds = double(numBlocks * blockSize) / kSampleRate;
+  const double expected =
+      10.0 * std::log10(0.25 * (1.0 - std::exp(-seconds / 0.4)));
+  double error = 0.0;
+  for (const float value : meter.values()) {
+    const double db = (value - 0.01) / kDisplayPerDb - 60.0;
+    error = std::max(error, std::fabs(db - expected));
+  }
+  return error;
+}
+
+// A meter configured for 64 channels given 80 must neither grow nor read
+// the extra channels (here null), and must measure the first 64 as usual
+bool extraChannelsIgnored(size_t blockSize) {
+  Block block(kNumChannels, blockSize);
+  std::fill(block.data.begin(), block.data.end(), 0.5f);
+  std::vector<float *> channels = block.channels;
+  channels.resize(kNumChannels + 16, nullptr);
+  MeterLevels meter, expected;
+  meter.configure(kNumChannels, kSampleRate);
+  expected.configure(kNumChannels, kSampleRate);
+  meter.process(channels.data(), channels.size(), blockSize);
+  expected.process(block.channels.data(), kNumChannels, blockSize);
+  return meter.numChannels() == kNumChannels &&
+         meter.values() == expected.values();
+}
+
+template <typename Function> double secondsOf(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Microseconds per block for the old loop, the peak and the RMS meter
+void timeBlocks(size_t blockSize, int numBlocks, int runs) {
+  std::mt19937 random(4);
+  std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+  Block block(kNumChannels, blockSize);
+  for (float &s : block.data) {
+    s = noise(random);
+  }
+  OldMeter old;
+  MeterLevels peak, rms;
+  peak.configure(kNumChannels, kSampleRate);
+  rms.configure(kNumChannels, kSampleRate, MeterMode::Rms);
+
+  double oldSeconds = 1e9, peakSeconds = 1e9, rmsSeconds = 1e9;
+  for (int run = 0; run < runs; run++) {
+    oldSeconds = std::min(oldSeconds, secondsOf([&]() {
+      for (int b = 0; b < numBlocks; b++) {
+        old.process(block.channels.data(), kNumChannels, blockSize);
+      }
+    }));
+    peakSeconds = std::min(peakSeconds, secondsOf([&]() {
+      for (int b = 0; b < numBlocks; b++) {
+        peak.process(block.channels.data(), kNumChannels, blockSize);
+      }
+    }));
+    rmsSeconds = std::min(rmsSeconds, secondsOf([&]() {
+      for (int b = 0; b < numBlocks; b++) {
+        rms.process(block.channels.data(), kNumChannels, blockSize);
+      }
+    }));
+  }
+  std::cout << kNumChannels << " ch, " << blockSize << " frames: old "
+            << oldSeconds * 1e6 / numBlocks << " us, peak "
+            << peakSeconds * 1e6 / numBlocks << " us ("
+            << oldSeconds / peakSeconds << "x), rms "
+            << rmsSeconds * 1e6 / numBlocks << " us ("
+            << oldSeconds / rmsSeconds << "x)\n";
+}
+
+void printUsage() {
+  std::cout << "Usage: meter_bench [options]\n"
+               "  --samples <n>       timed samples per channel and run, "
+               "default 4000000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numSamples = 4000000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--samples") {
+      numSamples = std::max(1024, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  bool ok = true;
+#if defined(__SSE2__)
+  const char *peakPath = "SSE2";
+#elif defined(__ARM_NEON)
+  const char *peakPath = "NEON";
+#else
+  const char *peakPath = "scalar";
+#endif
+  const size_t mismatches = peakMismatches();
+  std::cout << "peak() (" << peakPath << "), every length to 1100 at 16 "
+            << "alignments: " << mismatches << " differ from the exact "
+            << "maximum\n";
+  ok = ok && mismatches == 0;
+
+  const double squaresError = sumOfSquaresError();
+  std::cout << "sumOfSquares(): max relative error " << squaresError
+            << " (bound " << kSumOfSquaresBound << ")\n";
+  ok = ok && squaresError <= kSumOfSquaresBound;
+
+  for (const size_t blockSize : kBlockSizes) {
+    const double peakDb = peakError(blockSize, 81 * 50);
+    const double rmsDb = rmsError(blockSize);
+    std::cout << blockSize << " frames: peak display within " << peakDb
+              << " dB of the old meter (bound " << kPeakBoundDb
+              << "), RMS within " << rmsDb << " dB of the integration "
+              << "(bound " << kRmsBoundDb << ")\n";
+    ok = ok && peakDb <= kPeakBoundDb && rmsDb <= kRmsBoundDb;
+    if (!extraChannelsIgnored(blockSize)) {
+      std::cerr << "MISMATCH: " << blockSize << " frames, channels beyond "
+                << "numChannels() not ignored" << std::endl;
+      ok = false;
+    }
+  }
+
+  for (const size_t blockSize : kBlockSizes) {
+    timeBlocks(blockSize, std::max(1, numSamples / int(blockSize)), runs);
+  }
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
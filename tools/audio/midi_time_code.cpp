@@ -30,30 +30,47 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
+#include "MTCChase.h"
 #include "MTCParser.h"
+#include "Timecode.h"
+
+#include <atomic>
+#include <chrono>
 
 using namespace al;
 
 class MTCReceiver : public MIDIMessageHandler {
 public:
   MTCParser mtc;
+  MTCChase chase;
   uint8_t hour{0};
   uint8_t minute{0};
   uint8_t second{0};
   uint8_t frame{0};
+  // host time of the message that completed the last timecode
+  uint64_t timestampMicros{0};
+  std::atomic<uint64_t> decodedCount{0};
+  std::atomic<uint32_t> droppedCount{0};
   virtual ~MTCReceiver() {}
 
   /// Called when a MIDI message is received
   virtual void onMIDIMessage(const MIDIMessage &m) {
     if (m.type() == MIDIByte::SYSTEM_MSG && m.status() == MIDIByte::TIME_CODE) {
-      mtc.feed(m.bytes, m.dataSize());
-      if (mtc.available()) {
-        hour = mtc.hour();
-        minute = mtc.minute();
-        second = mtc.second();
-        frame = mtc.frame();
-        mtc.pop();
+      auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now().time_since_epoch())
+                     .count();
+      decodedCount += mtc.feed(m.bytes, m.dataSize(), now);
+      // Drain everything decoded, the last event is the current position
+      MTCParser::MTCEvent event;
+      while (mtc.pop(event)) {
+        hour = event.mtc.hour;
+        minute = event.mtc.minute;
+        second = event.mtc.second;
+        frame = event.mtc.frame;
+        timestampMicros = event.timestamp;
+        chase.addEvent(event);
       }
+      droppedCount = mtc.droppedCount();
     }
   };
 
@@ -67,7 +84,6 @@ public:
   MTCReceiver mtcReceiver;
   ParameterMenu TCframes{"TC_fps"};
   ParameterInt frameOffset{"frame_offset", "", 0, -25, 25};
-  std::vector<float> frameValues = {24, 25, 30, 30};
   // App callbacks
   void onInit() override {
     mtcReceiver.bindTo(midiIn);
@@ -88,11 +104,28 @@ public:
 
     ImGui::Text("%02i:%02i:%02i:%02i", mtcReceiver.hour, mtcReceiver.minute,
                 mtcReceiver.second, mtcReceiver.frame);
-    int fps = frameValues[TCframes.get()];
-    int frameNum = mtcReceiver.hour * 60 * 60 * fps +
-                   mtcReceiver.minute * 60 * fps + mtcReceiver.second * fps +
-                   mtcReceiver.frame;
-    ImGui::Text("Frame num : %i", frameNum);
+    // Menu entries are in the order of TimecodeRate
+    Timecode tc(mtcReceiver.hour, mtcReceiver.minute, mtcReceiver.second,
+                mtcReceiver.frame, static_cast<TimecodeRate>(TCframes.get()));
+    ImGui::Text("Frame num : %lli", (long long)tc.toFrameCount());
+    ImGui::Text("Decoded : %llu  Dropped : %u",
+                (unsigned long long)mtcReceiver.decodedCount.load(),
+                mtcReceiver.droppedCount.load());
+
+    ImGui::Separator();
+    MTCChasePosition chased =
+        mtcReceiver.chase.position(MTCChase::hostSeconds());
+    const char *chaseState = "locking";
+    if (!chased.running) {
+      chaseState = "stopped";
+    } else if (chased.locked) {
+      chaseState = "locked";
+    }
+    ImGui::Text("Chase : %s", chaseState);
+    ImGui::Text("Position : %.4f s (%.1f samples at 48 kHz)", chased.seconds,
+                chased.seconds * 48000.0);
+    ImGui::Text("Rate : %.5f  Jitter : %.2f ms  Locates : %u", chased.rate,
+                chased.jitter * 1000.0, chased.locateCount);
 
     ImGui::End();
     imguiEndFrame();
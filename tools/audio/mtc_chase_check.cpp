@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "MTCChase.h"
+#include "MTCGenerator.h"
+#include "MTCParser.h"
+#include "Timecode.h"
+
+// Checks MTCChase against synthetic quarter frame streams with arrival jitter
+// and off-speed senders: lock time, rate error, position error and spurious
+// jumps. Also checks that a reader never sees a half-published state while
+// the writer keeps locating. Exits with 1 if a bound is exceeded. See
+// readme_mtc_chase_check.md
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const double kQueryInterval = 0.01; // seconds of host time between queries
+
+// Bounds at the default bandwidth of 0.2 Hz
+const double kLockTimeBound = 5.0;     // seconds
+const double kRateErrorBound = 1e-4;   // relative, of the mean rate
+const double kNoJitterErrorBound = 1.0 / kSampleRate; // one sample
+// Standard deviation of the position error per ms of jitter, in seconds
+const double kStdDevPerJitterBound = 0.3e-3;
+
+const char *rateName(TimecodeRate rate) {
+  switch (rate) {
+  case TimecodeRate::FPS_24:
+    return "24";
+  case TimecodeRate::FPS_25:
+    return "25";
+  case TimecodeRate::FPS_29_97_DF:
+    return "29.97 drop";
+  case TimecodeRate::FPS_30:
+    return "30";
+  }
+  return "?";
+}
+
+struct Result {
+  double lockTime{-1.0}; // host seconds until locked, -1 if never
+  double rateError{0.0};       // of the mean rate, relative
+  double rateStdDev{0.0};      // relative
+  double meanError{0.0};
+  double stdDevError{0.0};
+  double maxError{0.0}; // largest |error - mean|
+  uint32_t locateCount{0};
+};
+
+// Sends quarter frames from 01:00:00:00 at the given speed for the given
+// host duration. Each message arrives late by a half-normal delay with scale
+// jitterSeconds, in order, and is fed to MTCParser with a microsecond
+// timestamp, like midi_time_code does. The chase is queried every
+// kQueryInterval; statistics are taken over the second half of the run,
+// once the loop has settled.
+Result simulate(TimecodeRate rate, double speed, double jitterSeconds,
+                double duration, uint32_t seed) {
+  MTCParser parser;
+  MTCChase chase;
+  std::mt19937 random(seed);
+  std::normal_distribution<double> normal(0.0, 1.0);
+
+  const double frameRate = Timecode::frameRate(rate);
+  const int64_t startFrame =
+      Timecode(1, 0, 0, 0, rate).toFrameCount(); // sequences start even
+  const double startSeconds = Timecode(1, 0, 0, 0, rate).toSeconds();
+  // Sender position at host time t
+  auto sender = [&](double t) { return startSeconds + speed * t; };
+
+  Result result;
+  double sum = 0.0, sumSquares = 0.0;
+  double rateSum = 0.0, rateSumSquares = 0.0;
+  double minError = 1e9, maxError = -1e9;
+  uint64_t count = 0;
+  double lastArrival = 0.0;
+  double nextQuery = 0.0;
+
+  for (int64_t index = startFrame * 4;; ++index) {
+    // The piece leaves when the sender reaches it
+    const double sent =
+        (double(index) / (4.0 * frameRate) - startSeconds) / speed;
+    if (sent > duration) {
+      break;
+    }
+    // MIDI keeps the order, a late message delays the ones behind it
+    const double arrival = std::max(
+        lastArrival, sent + jitterSeconds * std::fabs(normal(random)));
+    lastArrival = arrival;
+
+    // Queries due before this message arrives
+    for (; nextQuery < arrival; nextQuery += kQueryInterval) {
+      const MTCChasePosition p = chase.position(nextQuery);
+      if (p.locked && result.lockTime < 0.0) {
+        result.lockTime = nextQuery;
+      }
+      if (nextQuery > 0.5 * duration) {
+        const double error = p.seconds - sender(nextQuery);
+        sum += error;
+        sumSquares += error * error;
+        minError = std::min(minError, error);
+        maxError = std::max(maxError, error);
+        count++;
+        const double rateError = p.rate / speed - 1.0;
+        rateSum += rateError;
+        rateSumSquares += rateError * rateError;
+      }
+    }
+
+    const int64_t sequenceStart = timecode_detail::floorDiv(index, 8) * 2;
+    const MTCMessage m = MTCGenerator::quarterFrame(
+        Timecode::fromFrameCount(sequenceStart, rate),
+        int(timecode_detail::floorMod(index, 8)));
+    parser.feed(m.bytes, m.size, uint64_t(std::llround(arrival * 1e6)));
+    MTCParser::MTCEvent event;
+    while (parser.pop(event)) {
+      chase.addEvent(event);
+    }
+  }
+
+  result.meanError = sum / double(count);
+  result.stdDevError = std::sqrt(std::max(
+      0.0, sumSquares / double(count) - result.meanError * result.meanError));
+  result.rateError = std::fabs(rateSum / double(count));
+  result.rateStdDev = std::sqrt(std::max(
+      0.0, rateSumSquares / double(count) -
+               result.rateError * result.rateError));
+  result.maxError = std::max(maxError - result.meanError,
+                             result.meanError - minError);
+  result.locateCount = chase.position(duration).locateCount;
+  return result;
+}
+
+// The writer locates to 2k at host time k, over and over. At a fixed host
+// time H a consistent snapshot reads 2k + (H - k) = k + H with locate count
+// k + 1; anything else mixes fields of two publishes. Returns the number of
+// torn reads.
+uint64_t tornReads(uint64_t numWrites, uint64_t &numReads) {
+  MTCChase chase;
+  chase.setTimeout(1e12); // never time out, so the formula holds
+  const double host = 1e9;
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> reads{0};
+  uint64_t torn = 0;
+
+  std::thread reader([&]() {
+    while (running.load(std::memory_order_relaxed)) {
+      const MTCChasePosition p = chase.position(host);
+      if (p.locateCount > 0 &&
+          p.seconds - host != double(p.locateCount) - 1.0) {
+        torn++;
+      }
+      reads++;
+    }
+  });
+  // On one core the threads only overlap when the scheduler switches, so
+  // keep writing until the reader has had its share
+  for (uint64_t k = 0; k < numWrites || reads.load() < numWrites; ++k) {
+    chase.addTimecode(2.0 * double(k), double(k), 1.0, true);
+  }
+  running = false;
+  reader.join();
+  numReads = reads.load();
+  return torn;
+}
+
+void printUsage() {
+  std::cout << "Usage: mtc_chase_check [options]\n"
+               "  --seconds <s>       simulated seconds per stream, default "
+               "600\n"
+               "  --seed <n>          jitter seed, default 1\n"
+               "  --writes <n>        locates in the reader/writer check, "
+               "default 2000000\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  double duration = 600.0;
+  uint32_t seed = 1;
+  uint64_t numWrites = 2000000;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--seconds") {
+      duration = std::max(30.0, std::atof(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--writes") {
+      numWrites = std::max<uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  const TimecodeRate rates[] = {TimecodeRate::FPS_24, TimecodeRate::FPS_25,
+                                TimecodeRate::FPS_29_97_DF,
+                                TimecodeRate::FPS_30};
+  const double speeds[] = {0.999, 1.001, 1.02};
+  const double jitters[] = {0.0, 0.001, 0.002};
+
+  double worstLock = 0.0, worstRate = 0.0, worstNoJitter = 0.0;
+  double worstStdDev[3] = {0.0, 0.0, 0.0};
+  double worstRateStdDev[3] = {0.0, 0.0, 0.0};
+  for (const TimecodeRate rate : rates) {
+    for (const double speed : speeds) {
+      for (int j = 0; j < 3; ++j) {
+        const double jitter = jitters[j];
+        const Result r = simulate(rate, speed, jitter, duration, seed++);
+        bool good = r.lockTime >= 0.0 && r.lockTime <= kLockTimeBound &&
+                    r.rateError <= kRateErrorBound && r.locateCount == 1;
+        if (jitter == 0.0) {
+          good = good && r.maxError <= kNoJitterErrorBound &&
+                 std::fabs(r.meanError) <= kNoJitterErrorBound;
+          worstNoJitter = std::max(
+              worstNoJitter, std::max(r.maxError, std::fabs(r.meanError)));
+        } else {
+          good = good &&
+                 r.stdDevError <= kStdDevPerJitterBound * jitter * 1e3;
+        }
+        if (!good) {
+          std::cerr << "MISMATCH: " << rateName(rate) << " fps, speed "
+                    << speed << ", jitter " << jitter * 1e3
+                    << " ms: lock after " << r.lockTime << " s, rate error "
+                    << r.rateError << ", error mean " << r.meanError * 1e3
+                    << " ms, std dev " << r.stdDevError * 1e3
+                    << " ms, max " << r.maxError * 1e3 << " ms, "
+                    << r.locateCount << " locates" << std::endl;
+        }
+        ok = ok && good;
+        worstLock = std::max(worstLock, r.lockTime);
+        worstRate = std::max(worstRate, r.rateError);
+        worstRateStdDev[j] = std::max(worstRateStdDev[j], r.rateStdDev);
+        worstStdDev[j] = std::max(worstStdDev[j], r.stdDevError);
+      }
+    }
+  }
+
+  std::cout << "4 rates x 3 speeds x 3 jitters, " << duration
+            << " s each, bandwidth " << MTCChase().bandwidth() << " Hz\n"
+            << "  lock time: " << worstLock << " s (bound " << kLockTimeBound
+            << ")\n"
+            << "  mean rate error: " << worstRate << " (bound "
+            << kRateErrorBound << ")\n"
+            << "  no jitter, position error: " << worstNoJitter * 1e6
+            << " us (bound " << kNoJitterErrorBound * 1e6 << ")\n";
+  for (int j = 1; j < 3; ++j) {
+    std::cout << "  " << jitters[j] * 1e3
+              << " ms jitter, position error std dev: "
+              << worstStdDev[j] * 1e3 << " ms (bound "
+              << kStdDevPerJitterBound * jitters[j] * 1e6
+              << "), rate std dev: " << worstRateStdDev[j] << "\n";
+  }
+
+  uint64_t numReads = 0;
+  const uint64_t torn = tornReads(numWrites, numReads);
+  std::cout << "at least " << numWrites << " locates against " << numReads
+            << " concurrent reads: " << torn << " torn\n";
+  ok = ok && torn == 0;
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include "al/app/al_App.hpp"
 #include "al/io/al_File.hpp"
 #include "al/io/al_Imgui.hpp"
+#include "al/io/al_MIDI.hpp"
 #include "al/io/al_Toml.hpp"
 #include "al/sound/al_DownMixer.hpp"
 #include "al/sound/al_SpeakerAdjustment.hpp"
@@ -8,17 +9,134 @@
 #include "al/sphere/al_SphereUtils.hpp"
 #include "al/ui/al_FileSelector.hpp"
 #include "al/ui/al_ParameterGUI.hpp"
-#include "al_ext/soundfile/al_SoundfileBuffered.hpp"
+
+#include "DownmixMatrix.h"
+#include "MTCChase.h"
+#include "MTCParser.h"
+#include "PlaybackTransport.h"
+#include "RoutingTable.h"
+#include "StreamingScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
 
 using namespace al;
 
+/// A DownMixer compiled into a sparse DownmixMatrix, applied in place to
+/// the outputs. The DownMixer is still used if the matrix doesn't reproduce
+/// it exactly, or if the number of outputs changed since compile().
+struct CompiledDownMixer {
+  DownMixer mixer;
+  DownmixMatrix matrix;
+  bool exact{false};
+  std::vector<float *> buffers;
+
+  /// Measures the mixer, which must be set up for io, and checks the
+  /// matrix against it. Uses and clears the output buffers of io.
+  void compile(AudioIOData &io) {
+    const size_t channels = io.channelsOut();
+    const size_t frames = io.framesPerBuffer();
+    matrix.build(channels, channels, true, [&](size_t input, float *gains) {
+      io.zeroOut();
+      io.outBuffer(int(input))[0] = 1.0f;
+      io.frame(0);
+      mixer.downMix(io);
+      for (size_t c = 0; c < channels; c++) {
+        gains[c] = io.outBuffer(int(c))[0];
+      }
+    });
+    exact = matrix.matches(frames, true,
+                           [&](float *const *inputs, float *const *outputs) {
+                             for (size_t c = 0; c < channels; c++) {
+                               std::copy(inputs[c], inputs[c] + frames,
+                                         io.outBuffer(int(c)));
+                             }
+                             io.frame(0);
+                             mixer.downMix(io);
+                             for (size_t c = 0; c < channels; c++) {
+                               std::copy(io.outBuffer(int(c)),
+                                         io.outBuffer(int(c)) + frames,
+                                         outputs[c]);
+                             }
+                           });
+    io.zeroOut();
+    buffers.resize(channels);
+  }
+
+  void downMix(AudioIOData &io) {
+    const size_t channels = io.channelsOut();
+    if (!exact || channels != buffers.size()) {
+      mixer.downMix(io);
+      return;
+    }
+    for (size_t c = 0; c < channels; c++) {
+      buffers[c] = io.outBuffer(int(c));
+    }
+    matrix.process(buffers.data(), buffers.data(), io.framesPerBuffer());
+  }
+};
+
+/// A [[file]] entry of the session
+struct SessionFile {
+  std::string name;
+  std::vector<size_t> outChannels;
+  float gain{1.0f};
+  bool loop{false};
+  bool map{false};
+};
+
+/// Options for AudioPlayerApp::bounce()
+struct BounceSettings {
+  std::string outputFile;
+  /// Length in seconds, 0 for the longest file that doesn't loop
+  double seconds{0.0};
+  /// Frames rendered by one thread at a time
+  size_t blockFrames{65536};
+  unsigned int jobs{1};
+  WavSampleFormat format{WavSampleFormat::FLOAT32};
+  bool downmixStereo{false};
+};
+
 struct MappedAudioFile {
-  std::unique_ptr<SoundFileBuffered> soundfile;
+  // Index in AudioPlayerApp::streamer
+  int stream{-1};
+  int channels{0};
+  int frameRate{0};
   std::vector<size_t> outChannelMap;
   std::string fileInfoText;
   std::string fileName;
   float gain;
   bool mute{false};
+  // Range of this file's entries in AudioPlayerApp::routes
+  size_t firstRoute{0};
+  size_t numRoutes{0};
+};
+
+/// Decodes MIDI Time Code on the MIDI input thread and feeds the chase
+class MTCInput : public MIDIMessageHandler {
+public:
+  MTCParser parser;
+  MTCChase chase;
+  virtual ~MTCInput() {}
+
+  virtual void onMIDIMessage(const MIDIMessage &m) {
+    if (m.type() == MIDIByte::SYSTEM_MSG && m.status() == MIDIByte::TIME_CODE) {
+      const auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+      parser.feed(m.bytes, m.dataSize(), uint64_t(now));
+      MTCParser::MTCEvent event;
+      while (parser.pop(event)) {
+        chase.addEvent(event);
+      }
+    }
+  }
 };
 
 class AudioPlayerApp : public App {
@@ -30,94 +148,185 @@ public:
   Trigger rewind{"rewind"};
   Trigger fw{"fw"};
   Trigger back{"back"};
+  /// Follow incoming MIDI Time Code, see followMTC()
+  ParameterBool chaseMTC{"chaseMTC", "", 0.0};
+
+  StreamingScheduler streamer;
+  /// Applies play, pause and seeks to all files at block boundaries
+  PlaybackTransport transport;
+  /// Frames every file must have buffered before playback starts or resumes
+  uint64_t prefetchFrames{8192};
+  /// Time taken to open, check and prime all files
+  double loadSeconds{0.0};
+  /// Timecode in seconds at which the timeline starts
+  double mtcOffset{0.0};
+  /// Distance in seconds between the transport and the timecode beyond
+  /// which the transport relocates
+  double mtcTolerance{0.1};
+
+  RtMidiIn midiIn;
+  MTCInput mtcInput;
 
   bool loadFile(std::string fileName, std::vector<size_t> channelMap,
-                float gain, bool loop) {
-    soundfiles.push_back(MappedAudioFile());
-    soundfiles.back().soundfile = std::make_unique<SoundFileBuffered>(
-        File::conformPathToOS(rootDir) + fileName, false, 4096);
-    soundfiles.back().soundfile->loop(loop);
-    if (!soundfiles.back().soundfile->opened()) {
-      std::cerr << "ERROR: opening "
-                << File::conformPathToOS(rootDir) + fileName << std::endl;
+                float gain, bool loop, bool map = false) {
+    return loadSession({{fileName, channelMap, gain, loop, map}}, 1);
+  }
+
+  /// Opens all files of a session, up to `threads` at a time, then checks
+  /// every header before any audio is read: all files must exist, have one
+  /// output channel per file channel and share one sample rate. If any
+  /// check fails, every problem is printed and nothing is primed. Otherwise
+  /// the first prefetchFrames of every file are read (or mapped files
+  /// warmed up), also in parallel, and a timing breakdown is printed.
+  bool loadSession(const std::vector<SessionFile> &files,
+                   unsigned int threads) {
+    using Clock = std::chrono::steady_clock;
+    auto secondsSince = [](Clock::time_point t) {
+      return std::chrono::duration<double>(Clock::now() - t).count();
+    };
+    const auto start = Clock::now();
+    std::vector<StreamRequest> requests;
+    for (const auto &file : files) {
+      requests.push_back({File::conformPathToOS(rootDir) + file.name,
+                          file.loop, file.map});
+    }
+    std::vector<std::string> errors;
+    const std::vector<int> streams =
+        streamer.addFiles(requests, threads, errors);
+    const double openSeconds = secondsSince(start);
+
+    int sampleRate = soundfiles.empty() ? 0 : soundfiles.front().frameRate;
+    size_t failures = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+      const int stream = streams[i];
+      if (stream < 0) {
+        std::cerr << "ERROR: opening " << requests[i].path << ": "
+                  << errors[i] << std::endl;
+        failures++;
+        continue;
+      }
+      if (streamer.channels(stream) != int(files[i].outChannels.size())) {
+        std::cerr << "ERROR: channel mismatch for file " << files[i].name
+                  << ". File has " << streamer.channels(stream) << " but "
+                  << files[i].outChannels.size() << " provided." << std::endl;
+        failures++;
+      }
+      if (sampleRate == 0) {
+        sampleRate = streamer.sampleRate(stream);
+      } else if (streamer.sampleRate(stream) != sampleRate) {
+        std::cerr << "ERROR: sample rate mismatch for file " << files[i].name
+                  << ". File has " << streamer.sampleRate(stream)
+                  << " Hz but the session " << sampleRate << " Hz."
+                  << std::endl;
+        failures++;
+      }
+      if (files[i].map && !streamer.mapped(stream)) {
+        std::cerr << "WARNING: could not map " << files[i].name
+                  << ", streaming it" << std::endl;
+      }
+    }
+    if (failures > 0) {
+      std::cerr << failures << " problems in " << files.size()
+                << " files. Aborting." << std::endl;
       return false;
     }
-    if (soundfiles.back().soundfile->channels() != channelMap.size()) {
-      std::cerr << "Channel mismatch for file " << fileName << ". File has "
-                << soundfiles.back().soundfile->channels() << " but "
-                << channelMap.size() << " provided. Aborting." << std::endl;
-    }
-    soundfiles.back().outChannelMap = channelMap;
-    soundfiles.back().gain = gain;
-    soundfiles.back().fileName = fileName;
-    soundfiles.back().fileInfoText +=
-        " channels: " +
-        std::to_string(soundfiles.back().soundfile->channels()) +
-        " sr: " + std::to_string(soundfiles.back().soundfile->frameRate()) +
-        "\n";
-    soundfiles.back().fileInfoText +=
-        " length: " + std::to_string(soundfiles.back().soundfile->frames()) +
-        "\n";
-    soundfiles.back().fileInfoText +=
-        " gain: " + std::to_string(soundfiles.back().gain) + "\n";
+
+    const auto primeStart = Clock::now();
+    streamer.prime(streams, threads, prefetchFrames);
+    const double primeSeconds = secondsSince(primeStart);
+
+    size_t slowestOpen = 0;
+    size_t slowestPrime = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+      const int stream = streams[i];
+      if (streamer.openSeconds(stream) >
+          streamer.openSeconds(streams[slowestOpen])) {
+        slowestOpen = i;
+      }
+      if (streamer.primeSeconds(stream) >
+          streamer.primeSeconds(streams[slowestPrime])) {
+        slowestPrime = i;
+      }
+      soundfiles.push_back(MappedAudioFile());
+      MappedAudioFile &sf = soundfiles.back();
+      sf.stream = stream;
+      sf.channels = streamer.channels(stream);
+      sf.frameRate = streamer.sampleRate(stream);
+      sf.outChannelMap = files[i].outChannels;
+      sf.gain = files[i].gain;
+      sf.fileName = files[i].name;
+      sf.fileInfoText += " channels: " + std::to_string(sf.channels) +
+                         " sr: " + std::to_string(sf.frameRate) + "\n";
+      sf.fileInfoText +=
+          " length: " + std::to_string(streamer.frames(stream)) + "\n";
+      sf.fileInfoText += " gain: " + std::to_string(sf.gain) + "\n";
+      sf.fileInfoText +=
+          std::string(streamer.mapped(stream) ? " mapped" : " streamed") +
+          ", opened in " +
+          std::to_string(streamer.openSeconds(stream) * 1000.0) +
+          " ms, primed in " +
+          std::to_string(streamer.primeSeconds(stream) * 1000.0) + " ms\n";
+    }
+    const double totalSeconds = secondsSince(start);
+    loadSeconds += totalSeconds;
+    std::cout << "Loaded " << files.size() << " files with " << threads
+              << " threads in " << totalSeconds * 1000.0 << " ms:\n  open "
+              << openSeconds * 1000.0 << " ms (slowest "
+              << files[slowestOpen].name << ", "
+              << streamer.openSeconds(streams[slowestOpen]) * 1000.0
+              << " ms)\n  prime " << primeSeconds * 1000.0 << " ms (slowest "
+              << files[slowestPrime].name << ", "
+              << streamer.primeSeconds(streams[slowestPrime]) * 1000.0
+              << " ms)" << std::endl;
     return true;
   }
 
   // App callbacks
   void onInit() override {
-    rewind.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(0);
+    // The transport moves all files together on the audio thread
+    play.registerChangeCallback([&](float value) {
+      if (value == 1.0f) {
+        transport.play();
+      } else {
+        transport.pause();
       }
-      play = 1.0;
     });
+    rewind.registerChangeCallback(
+        [&](float /*value*/) { transport.locate(0); });
     fw.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(sf.soundfile->currentPosition() +
-                           5 * sf.soundfile->frameRate());
-      }
-      play = 1.0;
+      transport.skip(5 * int64_t(soundfiles.front().frameRate));
     });
     back.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(sf.soundfile->currentPosition() -
-                           5 * sf.soundfile->frameRate());
-      }
-      play = 1.0;
+      transport.skip(-5 * int64_t(soundfiles.front().frameRate));
     });
+    mtcInput.bindTo(midiIn);
+    midiIn.ignoreTypes(false, false, false);
 
     AudioDevice dev = AudioDevice::defaultOutput();
     if (sphere::isSphereMachine()) {
       dev = AudioDevice("ECHO X5");
-      gainAdjustment.configure(AlloSphereSpeakerLayoutCompensated(), 1.82);
     }
-    configureAudio(dev, soundfiles.back().soundfile->frameRate(), 1024,
+    configureSpeakerGains(gainAdjustment);
+    configureAudio(dev, soundfiles.back().frameRate, 1024,
                    dev.channelsOutMax(), 0);
 
     audioIO().append(gainAdjustment);
 
-    int highestChannel = 0;
-    for (const auto &sf : soundfiles) {
-      for (const auto entry : sf.outChannelMap) {
-        assert(entry <= INT32_MAX);
-        if (highestChannel < static_cast<int32_t>(entry)) {
-          highestChannel = static_cast<int32_t>(entry);
-        }
-      }
-    }
-    audioIO().channelsOut(highestChannel + 1);
-    if (soundfiles.size() == 6) {
-      // assume 5.1 to stereo
-      mDownMixer.set5_1toStereo(audioIO());
-      mDownMixer.setOutputs({0, 1});
+    audioIO().channelsOut(numOutputChannels());
+    buildRoutes();
+    configureTransport();
+    streamer.start();
+    configureDownMixer(mDownMixer, audioIO());
+    if (!mDownMixer.exact) {
+      std::cout << "Downmix matrix differs from DownMixer, using DownMixer"
+                << std::endl;
     }
   }
 
   void onCreate() override { imguiInit(); }
 
+  void onAnimate(double /*dt*/) override { followMTC(); }
+
   void onDraw(Graphics &g) override {
     imguiBeginFrame();
 
@@ -130,20 +339,40 @@ public:
     ImGui::SameLine(0, 20);
     ParameterGUI::draw(&fw);
 
+    ParameterGUI::draw(&chaseMTC);
+    ParameterGUI::drawMIDIIn(&midiIn);
+    const MTCChasePosition mtc =
+        mtcInput.chase.position(MTCChase::hostSeconds());
+    ImGui::Text("MTC %s: %.3f s, rate %.5f, jitter %.2f ms, %u relocates",
+                mtc.running ? (mtc.locked ? "locked" : "locking")
+                            : "stopped",
+                mtc.seconds, mtc.rate, mtc.jitter * 1000.0,
+                unsigned(mChaseLocates));
+
     ParameterGUI::drawParameterMeta(audioDomain()->parameters(),
                                     " (Global)##AudioIO");
     ParameterGUI::drawAudioIO(audioIO());
     if (soundfiles.size() > 0) {
-      ImGui::Text("Time: %f", soundfiles[0].soundfile->currentPosition() /
-                                  soundfiles[0].soundfile->frameRate());
+      ImGui::Text("Time: %f", transport.position() /
+                                  double(soundfiles[0].frameRate));
+    }
+    if (transport.state() == TransportState::Prefetching) {
+      ImGui::SameLine(0, 20);
+      ImGui::Text("buffering");
     }
+    ImGui::Text("Files loaded in %.1f ms", loadSeconds * 1000.0);
     ImGui::Separator();
     for (auto &sf : soundfiles) {
       ImGui::Text("*** %s", sf.fileName.c_str());
       ImGui::SameLine(0, 20);
-      ImGui::PushID(sf.soundfile.get());
+      ImGui::PushID(sf.stream);
       ImGui::Checkbox("Mute", &sf.mute);
       ImGui::Text("%s", sf.fileInfoText.c_str());
+      ImGui::Text(" underruns: %llu (%llu frames)",
+                  (unsigned long long)streamer.underruns(sf.stream),
+                  (unsigned long long)streamer.underrunFrames(sf.stream));
+      ImGui::Text(" last seek: %.3f ms",
+                  streamer.lastSeekLatency(sf.stream) * 1000.0);
       ImGui::PopID();
     }
 
@@ -154,24 +383,46 @@ public:
   }
 
   void onSound(AudioIOData &io) override {
-    float buffer[2048 * 60];
-    if (play.get() == 1.0f) {
-      for (auto &sf : soundfiles) {
-        int numChannels = sf.soundfile->channels();
-        int framesRead = sf.soundfile->read(buffer, io.framesPerBuffer());
-        if (framesRead != io.framesPerBuffer()) {
-          std::cout << "short buffer " << framesRead << std::endl;
+    const size_t framesPerBuffer = io.framesPerBuffer();
+    // Applies pending play, pause and seeks, and keeps the rings of stopped
+    // files up to date
+    const TransportBlock block = transport.beginBlock(framesPerBuffer);
+    if (block.read) {
+      // Blocks larger than the arena are processed in chunks
+      const size_t channelsOut = io.channelsOut();
+      for (size_t start = 0; start < framesPerBuffer;
+           start += scratchFrames) {
+        const size_t numFrames =
+            std::min(scratchFrames, framesPerBuffer - start);
+        // Routes to channels the device doesn't have (e.g. after changing it
+        // in the GUI) go to a discard buffer
+        for (size_t r = 0; r < routes.size(); r++) {
+          routeOutputs[r] = routes[r].outChannel < channelsOut
+                                ? io.outBuffer(routes[r].outChannel) + start
+                                : discardBuffer;
         }
-        for (size_t i = 0; i < sf.outChannelMap.size(); i++) {
-          size_t outIndex = sf.outChannelMap[i];
+        // Short reads are counted by the streamer and shown in the GUI.
+        // Mapped float files are mixed straight from the mapping.
+        for (auto &sf : soundfiles) {
+          uint64_t framesRead = 0;
+          const float *samples =
+              streamer.readDirect(sf.stream, numFrames, framesRead);
+          if (!samples) {
+            framesRead = streamer.read(sf.stream, scratch.data(), numFrames);
+            samples = scratch.data();
+          }
           if (!sf.mute) {
-            for (uint64_t sample = 0; sample < framesRead; sample++) {
-              io.outBuffer(outIndex)[sample] +=
-                  sf.gain * buffer[sample * numChannels + i];
-            }
+            deinterleaveAccumulate(samples, sf.channels,
+                                   routes.data() + sf.firstRoute,
+                                   routeOutputs.data() + sf.firstRoute,
+                                   sf.numRoutes, framesRead);
           }
         }
       }
+      // Fades around stops and seeks
+      for (size_t channel = 0; channel < channelsOut; channel++) {
+        block.applyGain(io.outBuffer(channel), framesPerBuffer);
+      }
       if (downmixStereo.get() == 1.0) {
         mDownMixer.downMix(io);
       }
@@ -179,16 +430,372 @@ public:
   }
 
   void onExit() override {
-    for (auto &sf : soundfiles) {
-      sf.soundfile->close();
-    }
+    streamer.stop();
     imguiShutdown();
   }
 
+  /// Streams all files for the given time without audio device or window,
+  /// pulling blocks through the transport at the real-time rate of the
+  /// first file, and prints the underruns per file. Halfway through, the
+  /// transport locates back to the start to measure the seek latency. For
+  /// testing the streaming against slow disks.
+  void runHeadless(double seconds, size_t framesPerBuffer) {
+    size_t maxChannels = 1;
+    for (const auto &sf : soundfiles) {
+      maxChannels = std::max(maxChannels, size_t(sf.channels));
+    }
+    std::vector<float> buffer(framesPerBuffer * maxChannels);
+    const double blockSeconds =
+        double(framesPerBuffer) / soundfiles.front().frameRate;
+    const auto blockDuration =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(blockSeconds));
+
+    configureTransport();
+    streamer.start();
+    transport.play();
+    const auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    double worstLateness = 0.0;
+    size_t silentBlocks = 0;
+    const size_t numBlocks = size_t(seconds / blockSeconds);
+    for (size_t block = 0; block < numBlocks; block++) {
+      if (block == numBlocks / 2) {
+        transport.locate(0);
+      }
+      next += blockDuration;
+      std::this_thread::sleep_until(next);
+      const double lateness =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        next)
+              .count();
+      worstLateness = std::max(worstLateness, lateness);
+      if (!transport.beginBlock(framesPerBuffer).read) {
+        silentBlocks++;
+        continue;
+      }
+      for (auto &sf : soundfiles) {
+        uint64_t framesRead = 0;
+        if (!streamer.readDirect(sf.stream, framesPerBuffer, framesRead)) {
+          streamer.read(sf.stream, buffer.data(), framesPerBuffer);
+        }
+      }
+    }
+    streamer.stop();
+
+    uint64_t totalUnderruns = 0;
+    double worstSeek = 0.0;
+    for (const auto &sf : soundfiles) {
+      const uint64_t underruns = streamer.underruns(sf.stream);
+      totalUnderruns += underruns;
+      worstSeek = std::max(worstSeek, streamer.lastSeekLatency(sf.stream));
+      std::cout << sf.fileName << ": underruns " << underruns << " ("
+                << streamer.underrunFrames(sf.stream) << " frames), reads "
+                << streamer.readRequests(sf.stream) << " for "
+                << streamer.blocksRead(sf.stream) << " blocks, seek "
+                << streamer.lastSeekLatency(sf.stream) * 1000.0 << " ms"
+                << std::endl;
+    }
+    std::cout << "Played " << numBlocks << " blocks of " << framesPerBuffer
+              << " frames from " << soundfiles.size() << " files, "
+              << totalUnderruns << " underruns, consumer late by up to "
+              << worstLateness * 1000.0 << " ms" << std::endl;
+    std::cout << silentBlocks << " blocks spent buffering after "
+              << transport.locateCount() << " locates" << std::endl;
+    std::cout << "Files loaded in " << loadSeconds * 1000.0
+              << " ms, slowest seek " << worstSeek * 1000.0 << " ms"
+              << std::endl;
+  }
+
+  /// Renders the session to one interleaved WAV file with an output channel
+  /// for every output of the session, without audio device or window and
+  /// as fast as possible. The timeline is cut into blocks that are rendered
+  /// in parallel, each thread with its own readers, through the same
+  /// routing, downmix and speaker gain stages as onSound(). Blocks are
+  /// written in order. Prints the realtime factor.
+  bool bounce(const BounceSettings &settings) {
+    const int sampleRate = soundfiles.back().frameRate;
+    const size_t channelsOut = numOutputChannels();
+    const float globalGain = audioDomain()->parameters()[0]->toFloat();
+    uint64_t totalFrames = 0;
+    if (settings.seconds > 0.0) {
+      totalFrames = uint64_t(settings.seconds * sampleRate);
+    } else {
+      // The longest file, not counting loops unless all files loop
+      uint64_t longestLooping = 0;
+      for (const auto &sf : soundfiles) {
+        if (streamer.loops(sf.stream)) {
+          longestLooping =
+              std::max(longestLooping, streamer.frames(sf.stream));
+        } else {
+          totalFrames = std::max(totalFrames, streamer.frames(sf.stream));
+        }
+      }
+      if (totalFrames == 0) {
+        totalFrames = longestLooping;
+      }
+    }
+
+    WavWriter writer;
+    if (!writer.open(settings.outputFile, int(channelsOut), sampleRate,
+                     settings.format)) {
+      std::cerr << "ERROR: " << writer.errorMessage() << std::endl;
+      return false;
+    }
+    // Route table only, the workers have their own buffers
+    buildRoutes();
+    const size_t blockFrames = std::max<size_t>(settings.blockFrames, 64);
+    const size_t numBlocks = size_t((totalFrames + blockFrames - 1) /
+                                    blockFrames);
+    const unsigned int jobs = unsigned(
+        std::max<size_t>(1, std::min<size_t>(settings.jobs, numBlocks)));
+
+    std::atomic<size_t> nextBlock{0};
+    size_t nextToWrite = 0;
+    std::mutex writeLock;
+    std::condition_variable writeTurn;
+    std::atomic<bool> failed{false};
+
+    auto worker = [&]() {
+      std::vector<WavReader> readers(soundfiles.size());
+      size_t maxChannels = 1;
+      for (size_t i = 0; i < soundfiles.size(); i++) {
+        if (!readers[i].open(File::conformPathToOS(rootDir) +
+                             soundfiles[i].fileName)) {
+          std::cerr << "ERROR: " << readers[i].errorMessage() << std::endl;
+          std::lock_guard<std::mutex> lock(writeLock);
+          failed = true;
+          writeTurn.notify_all();
+        }
+        maxChannels = std::max(maxChannels, size_t(soundfiles[i].channels));
+      }
+      std::vector<float> fileBuffer(blockFrames * maxChannels);
+      std::vector<float> interleaved(blockFrames * channelsOut);
+      std::vector<float *> outs(routes.size());
+      AudioIOData io;
+      io.framesPerSecond(sampleRate);
+      io.framesPerBuffer(unsigned(blockFrames));
+      io.channelsOut(int(channelsOut));
+      SpeakerDistanceGainAdjustmentProcessor speakerGains;
+      configureSpeakerGains(speakerGains);
+      CompiledDownMixer downMixer;
+      configureDownMixer(downMixer, io);
+
+      size_t block;
+      while (!failed && (block = nextBlock++) < numBlocks) {
+        const uint64_t start = uint64_t(block) * blockFrames;
+        const size_t numFrames =
+            size_t(std::min<uint64_t>(blockFrames, totalFrames - start));
+        io.zeroOut();
+        for (size_t i = 0; i < soundfiles.size(); i++) {
+          const MappedAudioFile &sf = soundfiles[i];
+          if (sf.mute) {
+            continue;
+          }
+          WavReader &reader = readers[i];
+          const bool loop = streamer.loops(sf.stream);
+          const uint64_t frames = reader.frames();
+          size_t done = 0;
+          while (done < numFrames && frames > 0) {
+            uint64_t position = start + done;
+            if (loop) {
+              position %= frames;
+            } else if (position >= frames) {
+              break;
+            }
+            reader.seek(position);
+            const size_t count = size_t(reader.read(
+                fileBuffer.data(),
+                std::min<uint64_t>(numFrames - done, frames - position)));
+            if (count == 0) {
+              break;
+            }
+            for (size_t r = sf.firstRoute; r < sf.firstRoute + sf.numRoutes;
+                 r++) {
+              outs[r] = io.outBuffer(routes[r].outChannel) + done;
+            }
+            deinterleaveAccumulate(fileBuffer.data(), sf.channels,
+                                   routes.data() + sf.firstRoute,
+                                   outs.data() + sf.firstRoute, sf.numRoutes,
+                                   count);
+            done += count;
+          }
+        }
+        if (settings.downmixStereo) {
+          downMixer.downMix(io);
+        }
+        speakerGains.onAudioCB(io);
+        for (size_t channel = 0; channel < channelsOut; channel++) {
+          const float *src = io.outBuffer(int(channel));
+          float *dest = interleaved.data() + channel;
+          for (size_t i = 0; i < numFrames; i++) {
+            dest[i * channelsOut] = globalGain * src[i];
+          }
+        }
+
+        std::unique_lock<std::mutex> lock(writeLock);
+        writeTurn.wait(lock, [&] { return nextToWrite == block || failed; });
+        if (!failed && !writer.write(interleaved.data(), numFrames)) {
+          std::cerr << "ERROR: " << writer.errorMessage() << std::endl;
+          failed = true;
+        }
+        nextToWrite++;
+        writeTurn.notify_all();
+      }
+    };
+
+    const auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : threads) {
+      t.join();
+    }
+    if (!writer.close()) {
+      failed = true;
+    }
+    const double elapsed = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - startTime)
+                               .count();
+    if (failed) {
+      std::cerr << "ERROR: bounce to " << settings.outputFile << " failed"
+                << std::endl;
+      return false;
+    }
+    const double seconds = double(totalFrames) / sampleRate;
+    std::cout << "Bounced " << soundfiles.size() << " files to "
+              << settings.outputFile << ": " << channelsOut << " ch, "
+              << seconds << " s in " << elapsed << " s with " << jobs
+              << " jobs, " << (elapsed > 0.0 ? seconds / elapsed : 0.0)
+              << "x realtime" << std::endl;
+    return true;
+  }
+
 private:
+  /// Slaves the transport to the MTC chase while chaseMTC is on: plays when
+  /// the sender runs, pauses when it stops, and locates when it jumps.
+  /// Called from onAnimate(), since the transport commands lock; position()
+  /// of the chase is lock-free. The transport has no varispeed, so drift
+  /// beyond mtcTolerance is corrected by locating too, aimed ahead by the
+  /// last seek latency.
+  void followMTC() {
+    if (soundfiles.empty()) {
+      return;
+    }
+    const MTCChasePosition p =
+        mtcInput.chase.position(MTCChase::hostSeconds());
+    if (chaseMTC.get() != 1.0 || !p.running) {
+      if (mChasing) {
+        mChasing = false;
+        if (!p.running) {
+          play.setNoCalls(0.0);
+          transport.pause();
+        }
+      }
+      return;
+    }
+    const double sampleRate = soundfiles.front().frameRate;
+    double seekLatency = 0.0;
+    for (const auto &sf : soundfiles) {
+      seekLatency = std::max(seekLatency, streamer.lastSeekLatency(sf.stream));
+    }
+    const double target = p.seconds - mtcOffset;
+    const double drift = double(transport.position()) / sampleRate - target;
+    if (!mChasing || p.locateCount != mChaseLocateCount ||
+        (p.locked && transport.state() == TransportState::Playing &&
+         std::fabs(drift) > mtcTolerance)) {
+      transport.locate(int64_t(
+          std::max(0.0, (target + p.rate * seekLatency) * sampleRate)));
+      mChaseLocateCount = p.locateCount;
+      mChaseLocates++;
+    }
+    if (!mChasing) {
+      mChasing = true;
+      play.setNoCalls(1.0);
+      transport.play();
+    }
+  }
+
+  /// Highest output channel used by any file, plus one
+  int numOutputChannels() const {
+    int highestChannel = 0;
+    for (const auto &sf : soundfiles) {
+      for (const auto entry : sf.outChannelMap) {
+        assert(entry <= INT32_MAX);
+        if (highestChannel < static_cast<int32_t>(entry)) {
+          highestChannel = static_cast<int32_t>(entry);
+        }
+      }
+    }
+    return highestChannel + 1;
+  }
+
+  static void
+  configureSpeakerGains(SpeakerDistanceGainAdjustmentProcessor &processor) {
+    if (sphere::isSphereMachine()) {
+      processor.configure(AlloSphereSpeakerLayoutCompensated(), 1.82);
+    }
+  }
+
+  void configureDownMixer(CompiledDownMixer &downMixer, AudioIOData &io) {
+    if (soundfiles.size() == 6) {
+      // assume 5.1 to stereo
+      downMixer.mixer.set5_1toStereo(io);
+      downMixer.mixer.setOutputs({0, 1});
+    }
+    downMixer.compile(io);
+  }
+
+  void configureTransport() {
+    std::vector<int> streams;
+    for (const auto &sf : soundfiles) {
+      streams.push_back(sf.stream);
+    }
+    // 5 ms fades
+    transport.configure(streamer, uint32_t(soundfiles.front().frameRate / 200),
+                        prefetchFrames);
+    transport.setStreams(streams);
+  }
+
+  /// Flattens the channel maps into the routing table and allocates the
+  /// read arena, so the audio callback doesn't allocate or touch the stack
+  /// beyond a few locals.
+  void buildRoutes() {
+    routes.clear();
+    size_t maxChannels = 1;
+    for (auto &sf : soundfiles) {
+      const size_t numChannels = sf.channels;
+      maxChannels = std::max(maxChannels, numChannels);
+      sf.firstRoute = routes.size();
+      // Channels beyond the file's channel count are ignored
+      for (size_t i = 0; i < sf.outChannelMap.size() && i < numChannels;
+           i++) {
+        routes.push_back({uint32_t(i), uint32_t(sf.outChannelMap[i]),
+                          sf.gain});
+      }
+      sf.numRoutes = routes.size() - sf.firstRoute;
+    }
+    routeOutputs.resize(routes.size());
+    scratchFrames = std::max<size_t>(audioIO().framesPerBuffer(), 64);
+    // Interleaved read buffer for the widest file, then the discard buffer
+    scratch.assign(scratchFrames * (maxChannels + 1), 0.0f);
+    discardBuffer = scratch.data() + scratchFrames * maxChannels;
+  }
+
   std::vector<MappedAudioFile> soundfiles;
+  std::vector<Route> routes;
+  std::vector<float *> routeOutputs;
+  std::vector<float> scratch;
+  size_t scratchFrames{0};
+  float *discardBuffer{nullptr};
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
-  DownMixer mDownMixer;
+  CompiledDownMixer mDownMixer;
+  // MTC following, graphics thread only
+  bool mChasing{false};
+  uint32_t mChaseLocateCount{0};
+  uint64_t mChaseLocates{0};
 };
 
 int main(int argc, char *argv[]) {
@@ -207,15 +814,98 @@ outChannels = [1]
 gain = 1.2
     */
 
-  std::string configFile;
-  if (argc > 1) {
-    configFile = argv[1];
-  } else {
-    configFile = "multichannel_playback.toml";
+  std::string configFile = "multichannel_playback.toml";
+  double headlessSeconds = 0.0;
+  BounceSettings bounce;
+  bounce.jobs = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--headless") {
+      headlessSeconds = 10.0;
+      // The next argument is the time only if it is a positive number,
+      // otherwise it is the config file or another option
+      if (hasValue) {
+        char *end = nullptr;
+        const double seconds = std::strtod(argv[i + 1], &end);
+        if (end != argv[i + 1] && *end == '\0' && std::isfinite(seconds) &&
+            seconds > 0.0) {
+          headlessSeconds = seconds;
+          i++;
+        }
+      }
+    } else if (arg == "--downmix") {
+      bounce.downmixStereo = true;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return -1;
+    } else if (arg == "--bounce") {
+      bounce.outputFile = argv[++i];
+    } else if (arg == "--length") {
+      bounce.seconds = std::atof(argv[++i]);
+    } else if (arg == "--block") {
+      bounce.blockFrames = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--jobs") {
+      bounce.jobs = unsigned(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--format") {
+      if (!wavSampleFormatFromName(argv[++i], bounce.format)) {
+        std::cerr << "ERROR: unknown format " << argv[i] << std::endl;
+        return -1;
+      }
+    } else {
+      configFile = arg;
+    }
   }
 
   TomlLoader appConfig(configFile);
 
+  // Disk streaming, see StreamingScheduler.h
+  StreamingConfig streaming;
+  if (auto value = appConfig.root->get_as<int64_t>("ringFrames")) {
+    streaming.ringFrames = uint64_t(std::max<int64_t>(*value, 0));
+  }
+  if (auto value = appConfig.root->get_as<int64_t>("blockFrames")) {
+    streaming.blockFrames = uint64_t(std::max<int64_t>(*value, 0));
+  }
+  if (auto value = appConfig.root->get_as<int64_t>("ioThreads")) {
+    streaming.ioThreads = unsigned(std::max<int64_t>(*value, 1));
+  }
+  if (auto value = appConfig.root->get_as<int64_t>("prefetchFrames")) {
+    app.prefetchFrames = uint64_t(std::max<int64_t>(*value, 0));
+  }
+  // Memory mapping, for all files or per [[file]]
+  bool mapFiles = false;
+  if (auto value = appConfig.root->get_as<bool>("mmap")) {
+    mapFiles = *value;
+  }
+  if (auto value = appConfig.root->get_as<std::string>("mmapAdvice")) {
+    if (*value == "none") {
+      streaming.mapAdvice = MapAdvice::None;
+    } else if (*value == "sequential") {
+      streaming.mapAdvice = MapAdvice::Sequential;
+    } else if (*value == "willneed") {
+      streaming.mapAdvice = MapAdvice::WillNeed;
+    } else {
+      std::cerr << "Unknown mmapAdvice " << *value << ", using willneed"
+                << std::endl;
+    }
+  }
+  if (auto value = appConfig.root->get_as<bool>("mmapWarmup")) {
+    streaming.mapWarmup = *value;
+  }
+  app.streamer.configure(streaming);
+
+  // MIDI Time Code chase
+  if (auto value = appConfig.root->get_as<bool>("mtcChase")) {
+    app.chaseMTC.set(*value ? 1.0 : 0.0);
+  }
+  if (auto value = appConfig.root->get_as<double>("mtcOffset")) {
+    app.mtcOffset = *value;
+  }
+  if (auto value = appConfig.root->get_as<double>("mtcTolerance")) {
+    app.mtcTolerance = std::max(*value, 0.0);
+  }
+
   if (appConfig.hasKey<std::string>("rootDir")) {
     app.rootDir = appConfig.gets("rootDir");
   }
@@ -223,8 +913,12 @@ gain = 1.2
     assert(app.audioDomain()->parameters()[0]->getName() == "gain");
     app.audioDomain()->parameters()[0]->fromFloat(appConfig.getd("globalGain"));
   }
+  unsigned int loaderThreads = 8;
+  if (auto value = appConfig.root->get_as<int64_t>("loaderThreads")) {
+    loaderThreads = unsigned(std::max<int64_t>(*value, 1));
+  }
   auto nodesTable = appConfig.root->get_table_array("file");
-  std::vector<std::string> filesToLoad;
+  std::vector<SessionFile> filesToLoad;
   if (nodesTable) {
     for (const auto &table : *nodesTable) {
       std::string name = *table->get_as<std::string>("name");
@@ -232,25 +926,37 @@ gain = 1.2
       std::vector<size_t> outChannels;
       float gain = 1.0f;
       bool loop = false;
+      bool map = mapFiles;
       if (table->contains("gain")) {
         gain = *table->get_as<double>("gain");
       }
       if (table->contains("loop")) {
         loop = *table->get_as<bool>("loop");
       }
+      if (table->contains("mmap")) {
+        map = *table->get_as<bool>("mmap");
+      }
       for (auto channel : outChannelsToml) {
         outChannels.push_back(channel);
       }
-      // Load requested file into app. If any file fails, abort.
-      if (!app.loadFile(name, outChannels, gain, loop)) {
-        return -1;
-      }
+      filesToLoad.push_back({name, outChannels, gain, loop, map});
     }
   } else {
     std::cout << "Error loading file. Aborting" << std::endl;
     return -1;
   }
+  // If any file fails, abort
+  if (filesToLoad.empty() || !app.loadSession(filesToLoad, loaderThreads)) {
+    return -1;
+  }
 
+  if (!bounce.outputFile.empty()) {
+    return app.bounce(bounce) ? 0 : -1;
+  }
+  if (headlessSeconds > 0.0) {
+    app.runHeadless(headlessSeconds, 1024);
+    return 0;
+  }
   app.start();
   return 0;
 }
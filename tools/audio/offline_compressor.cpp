@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "WavFile.h"
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/GainReductionComputer.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/LookAheadGainReduction.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/TruePeakDetector.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/MultichannelCompressor.cpp"
+
+// Renders WAV files through the SimpleCompressor DSP without an audio device,
+// as fast as the machine allows. Independent files are processed in parallel.
+// See readme_offline_compressor.md
+
+struct RenderSettings {
+  float threshold{-10.0f};
+  float ratio{4.0f};
+  float knee{0.0f};
+  float attack{0.01f};
+  float release{0.15f};
+  float makeUpGain{0.0f};
+  float lookAhead{0.0f};
+  int blockSize{8192};
+  bool truePeak{false};
+  bool writeEnvelope{true};
+  bool convertFormat{false};
+  WavSampleFormat outputFormat{WavSampleFormat::PCM24};
+  std::string outputDir;
+  std::string suffix{"_compressed"};
+};
+
+struct RenderResult {
+  std::string outputFile;
+  std::string error;
+  uint64_t frames{0};
+  int channels{0};
+  int sampleRate{0};
+  double seconds{0.0};
+  float maxGainReduction{0.0f};
+};
+
+// Index of the first character of the file name in a path
+size_t fileNameStart(const std::string &path) {
+  const size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? 0 : slash + 1;
+}
+
+// The directory of a path with a trailing separator, "./" if it has none
+std::string directoryOf(const std::string &path) {
+  const size_t start = fileNameStart(path);
+  return start == 0 ? "./" : path.substr(0, start);
+}
+
+// A directory with a trailing separator
+std::string withTrailingSeparator(const std::string &dir) {
+  if (dir.empty() || dir.back() == '/' || dir.back() == '\\') {
+    return dir;
+  }
+  return dir + "/";
+}
+
+// The extension of the file name with its dot, empty if it has none
+std::string extensionOf(const std::string &path) {
+  const size_t start = fileNameStart(path);
+  const size_t dot = path.find_last_of('.');
+  return dot == std::string::npos || dot <= start ? std::string()
+                                                  : path.substr(dot);
+}
+
+bool pathExists(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+bool makeDirectory(const std::string &path) {
+#ifdef _WIN32
+  return _mkdir(path.c_str()) == 0;
+#else
+  return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+std::string outputPath(const std::string &inputFile,
+                       const RenderSettings &settings) {
+  std::string dir = settings.outputDir.empty()
+                        ? directoryOf(inputFile)
+                        : withTrailingSeparator(settings.outputDir);
+  std::string extension = extensionOf(inputFile);
+  std::string name = inputFile.substr(fileNameStart(inputFile));
+  name.resize(name.size() - extension.size());
+  return dir + name + settings.suffix + extension;
+}
+
+// True if both paths name the same file, e.g. an output directory that is
+// the input's own directory spelled differently
+bool isSameFile(const std::string &a, const std::string &b) {
+  if (a == b) {
+    return true;
+  }
+#ifndef _WIN32
+  struct stat infoA, infoB;
+  if (stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0) {
+    return infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+  }
+#endif
+  return false;
+}
+
+float toDecibels(float gain) {
+  return gain > 0.0f ? 20.0f * std::log10(gain) : -200.0f;
+}
+
+RenderResult renderFile(const std::string &inputFile,
+                        const RenderSettings &settings) {
+  RenderResult result;
+  result.outputFile = outputPath(inputFile, settings);
+  if (isSameFile(inputFile, result.outputFile)) {
+    result.error = "the output would overwrite the input, use --suffix or "
+                   "--out-dir";
+    return result;
+  }
+
+  WavReader reader;
+  if (!reader.open(inputFile)) {
+    result.error = reader.errorMessage();
+    return result;
+  }
+  result.channels = reader.channels();
+  result.sampleRate = reader.sampleRate();
+  result.frames = reader.frames();
+
+  WavWriter writer;
+  if (!writer.open(result.outputFile, reader.channels(), reader.sampleRate(),
+                   settings.convertFormat ? settings.outputFormat
+                                          : reader.sampleFormat())) {
+    result.error = writer.errorMessage();
+    return result;
+  }
+
+  std::ofstream envelope;
+  if (settings.writeEnvelope) {
+    envelope.open(result.outputFile + ".gr.csv");
+    envelope << "block,time_s,input_peak_db,gain_db,output_peak_db\n";
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  const int nCh = reader.channels();
+  const int blockSize = settings.blockSize;
+
+  MultichannelCompressor compressor;
+  auto &gainComputer = compressor.getGainReductionComputer();
+  gainComputer.setThreshold(settings.threshold);
+  gainComputer.setRatio(settings.ratio);
+  gainComputer.setKnee(settings.knee);
+  gainComputer.setAttackTime(settings.attack);
+  gainComputer.setReleaseTime(settings.release);
+  gainComputer.setMakeUpGain(settings.makeUpGain);
+  compressor.setLookAheadTime(settings.lookAhead);
+  compressor.setLookAheadEnabled(settings.lookAhead > 0.0f);
+  compressor.setTruePeakEnabled(settings.truePeak);
+  compressor.prepare(reader.sampleRate(), blockSize, nCh);
+
+  // the look-ahead and the true-peak detector delay the audio, so the first `latency` output frames are
+  // dropped, and the input is padded with as many zeros at the end
+  const uint64_t latency = uint64_t(compressor.getLatencyInSamples());
+  uint64_t framesToSkip = latency;
+  uint64_t paddingFrames = latency;
+
+  std::vector<float> interleaved(size_t(blockSize) * nCh);
+  std::vector<std::vector<float>> planar(nCh, std::vector<float>(blockSize));
+  std::vector<float *> channelPointers(nCh);
+  for (int ch = 0; ch < nCh; ch++) {
+    channelPointers[ch] = planar[ch].data();
+  }
+
+  uint64_t block = 0;
+  while (true) {
+    uint64_t numFrames = reader.read(interleaved.data(), blockSize);
+    if (numFrames < uint64_t(blockSize) && paddingFrames > 0) {
+      uint64_t padding =
+          std::min(paddingFrames, uint64_t(blockSize) - numFrames);
+      std::fill(interleaved.begin() + numFrames * nCh,
+                interleaved.begin() + (numFrames + padding) * nCh, 0.0f);
+      numFrames += padding;
+      paddingFrames -= padding;
+    }
+    if (numFrames == 0) {
+      break;
+    }
+
+    for (int ch = 0; ch < nCh; ch++) {
+      float *dest = planar[ch].data();
+      const float *src = interleaved.data() + ch;
+      for (uint64_t i = 0; i < numFrames; i++) {
+        dest[i] = src[i * nCh];
+      }
+    }
+
+    compressor.process(channelPointers.data(), nCh, int(numFrames));
+
+    for (int ch = 0; ch < nCh; ch++) {
+      const float *src = planar[ch].data();
+      float *dest = interleaved.data() + ch;
+      for (uint64_t i = 0; i < numFrames; i++) {
+        dest[i * nCh] = src[i];
+      }
+    }
+
+    const uint64_t skip = std::min(framesToSkip, numFrames);
+    framesToSkip -= skip;
+    if (!writer.write(interleaved.data() + skip * nCh, numFrames - skip)) {
+      result.error = writer.errorMessage();
+      return result;
+    }
+
+    const float gainDb = toDecibels(compressor.getMinimumGain());
+    result.maxGainReduction = std::min(result.maxGainReduction, gainDb);
+    if (settings.writeEnvelope) {
+      envelope << block << ","
+               << double(block * blockSize) / reader.sampleRate() << ","
+               << toDecibels(compressor.getInputPeak()) << "," << gainDb << ","
+               << toDecibels(compressor.getOutputPeak()) << "\n";
+    }
+    block++;
+  }
+
+  if (!writer.close()) {
+    result.error = "error finalizing " + result.outputFile;
+    return result;
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return result;
+}
+
+void printUsage() {
+  std::cout
+      << "Usage: offline_compressor [options] file.wav [file2.wav ...]\n"
+         "  --threshold <dB>    default -10\n"
+         "  --ratio <ratio>     default 4\n"
+         "  --knee <dB>         default 0\n"
+         "  --attack <s>        default 0.01\n"
+         "  --release <s>       default 0.15\n"
+         "  --makeup <dB>       default 0\n"
+         "  --lookahead <s>     default 0 (off), latency is compensated\n"
+         "  --true-peak         detect inter-sample peaks (4x oversampled)\n"
+         "  --block <frames>    default 8192, also the envelope resolution\n"
+         "  --jobs <n>          files processed in parallel, default: "
+         "number of cores\n"
+         "  --format <f>        pcm16, pcm24, pcm32 or float, default: same "
+         "as input\n"
+         "  --out-dir <dir>     default: next to the input file\n"
+         "  --suffix <s>        appended to the file name, default "
+         "_compressed\n"
+         "  --no-envelope       don't write the .gr.csv envelope files\n";
+}
+
+int main(int argc, char *argv[]) {
+  RenderSettings settings;
+  std::vector<std::string> files;
+  unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    try {
+      bool hasValue = i + 1 < argc;
+      if (arg == "--help" || arg == "-h") {
+        printUsage();
+        return 0;
+      } else if (arg == "--no-envelope") {
+        settings.writeEnvelope = false;
+      } else if (arg == "--true-peak") {
+        settings.truePeak = true;
+      } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+        std::cerr << "ERROR: missing value for " << arg << std::endl;
+        return 1;
+      } else if (arg == "--threshold") {
+        settings.threshold = std::stof(argv[++i]);
+      } else if (arg == "--ratio") {
+        settings.ratio = std::stof(argv[++i]);
+      } else if (arg == "--knee") {
+        settings.knee = std::stof(argv[++i]);
+      } else if (arg == "--attack") {
+        settings.attack = std::stof(argv[++i]);
+      } else if (arg == "--release") {
+        settings.release = std::stof(argv[++i]);
+      } else if (arg == "--makeup") {
+        settings.makeUpGain = std::stof(argv[++i]);
+      } else if (arg == "--lookahead") {
+        settings.lookAhead = std::stof(argv[++i]);
+      } else if (arg == "--block") {
+        settings.blockSize = std::max(1, std::stoi(argv[++i]));
+      } else if (arg == "--jobs") {
+        jobs = unsigned(std::max(1, std::stoi(argv[++i])));
+      } else if (arg == "--format") {
+        if (!wavSampleFormatFromName(argv[++i], settings.outputFormat)) {
+          std::cerr << "ERROR: unknown format " << argv[i] << std::endl;
+          return 1;
+        }
+        settings.convertFormat = true;
+      } else if (arg == "--out-dir") {
+        settings.outputDir = argv[++i];
+      } else if (arg == "--suffix") {
+        settings.suffix = argv[++i];
+      } else if (arg.compare(0, 2, "--") == 0) {
+        std::cerr << "ERROR: unknown option " << arg << std::endl;
+        printUsage();
+        return 1;
+      } else {
+        files.push_back(arg);
+      }
+    } catch (std::exception &) {
+      std::cerr << "ERROR: invalid value for " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (files.empty()) {
+    printUsage();
+    return 1;
+  }
+  if (settings.suffix.empty() && settings.outputDir.empty()) {
+    std::cerr << "ERROR: an empty --suffix without --out-dir would overwrite "
+                 "the input files"
+              << std::endl;
+    return 1;
+  }
+  if (!settings.outputDir.empty() && !pathExists(settings.outputDir) &&
+      !makeDirectory(settings.outputDir)) {
+    std::cerr << "ERROR: cannot create " << settings.outputDir << std::endl;
+    return 1;
+  }
+
+  jobs = std::min(jobs, unsigned(files.size()));
+  std::vector<RenderResult> results(files.size());
+  std::atomic<size_t> nextFile{0};
+  std::mutex printMutex;
+
+  auto start = std::chrono::steady_clock::now();
+
+  // every worker has its own compressor and buffers, files are handed out
+  // one at a time so long and short files balance out
+  auto worker = [&]() {
+    size_t index;
+    while ((index = nextFile++) < files.size()) {
+      results[index] = renderFile(files[index], settings);
+      const RenderResult &r = results[index];
+
+      std::lock_guard<std::mutex> lock(printMutex);
+      if (!r.error.empty()) {
+        std::cerr << "ERROR: " << files[index] << ": " << r.error
+                  << std::endl;
+        continue;
+      }
+      const double samplesPerSecond =
+          r.seconds > 0.0 ? double(r.frames) * r.channels / r.seconds : 0.0;
+      const double realtimeFactor =
+          r.seconds > 0.0 ? double(r.frames) / r.sampleRate / r.seconds : 0.0;
+      std::cout << files[index] << " -> " << r.outputFile << "\n  "
+                << r.channels << " ch, " << r.frames << " frames, "
+                << r.seconds << " s, " << samplesPerSecond / 1e6
+                << " Msamples/s, " << realtimeFactor
+                << "x realtime, max gain reduction " << r.maxGainReduction
+                << " dB" << std::endl;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < jobs; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  double totalSamples = 0.0;
+  int failed = 0;
+  for (auto &r : results) {
+    if (r.error.empty()) {
+      totalSamples += double(r.frames) * r.channels;
+    } else {
+      failed++;
+    }
+  }
+  std::cout << files.size() - failed << " of " << files.size()
+            << " files rendered in " << seconds << " s with " << jobs
+            << " jobs, " << totalSamples / seconds / 1e6 << " Msamples/s"
+            << std::endl;
+
+  return failed == 0 ? 0 : 1;
+}
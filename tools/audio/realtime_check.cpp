@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/GainReductionComputer.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/LookAheadGainReduction.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/TruePeakDetector.cpp"
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/MultichannelCompressor.cpp"
+
+// Checks that GainReductionComputer, and the MultichannelCompressor around
+// it, neither allocate nor lock on the audio thread while another thread
+// keeps calling the setters, and that threshold and make-up gain changes are
+// ramped across one block. Exits with 1 on any allocation, lock or ramp
+// error. See readme_realtime_check.md
+
+namespace {
+
+// Set on the thread under test only; the hooks below count its calls
+thread_local bool tCounting = false;
+std::atomic<uint64_t> gAllocations{0};
+std::atomic<uint64_t> gLocks{0};
+
+} // namespace
+
+// Every allocation of the program goes through these
+void *operator new(std::size_t size) {
+  if (tCounting) {
+    gAllocations++;
+  }
+  if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *pointer) noexcept {
+  if (tCounting && pointer != nullptr) {
+    gAllocations++;
+  }
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+#ifdef __linux__
+// std::mutex and most other locks end up here. The executable's definition
+// takes precedence over the one of the C library, which it forwards to.
+extern "C" int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  typedef int (*Lock)(pthread_mutex_t *);
+  static const Lock next =
+      reinterpret_cast<Lock>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+  if (tCounting) {
+    gLocks++;
+  }
+  return next(mutex);
+}
+
+extern "C" int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  typedef int (*Lock)(pthread_mutex_t *);
+  static const Lock next =
+      reinterpret_cast<Lock>(dlsym(RTLD_NEXT, "pthread_mutex_trylock"));
+  if (tCounting) {
+    gLocks++;
+  }
+  return next(mutex);
+}
+#endif
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int kBlockSize = 128;
+const int kNumChannels = 8;
+
+// Threshold ramps are checked on the gain reduction in decibels, make-up
+// ramps on the linear gain, which goes through fastExp2 (VectorOperations.h)
+const double kThresholdRampBoundDb = 1e-5;
+const double kMakeUpRampBoundDb = 1.2e-4;
+
+// Makes sure the hooks see what they should, so a silent linker or libc
+// change can't turn the check into a no-op
+bool hooksWork() {
+  std::mutex mutex;
+  tCounting = true;
+  int *pointer = new int(1);
+  delete pointer;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+  }
+  tCounting = false;
+  const uint64_t allocations = gAllocations.exchange(0);
+  const uint64_t locks = gLocks.exchange(0);
+#ifdef __linux__
+  const bool locksCounted = locks == 1;
+#else
+  const bool locksCounted = true; // not hooked, see the readme
+#endif
+  if (allocations != 2 || !locksCounted) {
+    std::cerr << "ERROR: the hooks counted " << allocations
+              << " allocations (expected 2) and " << locks
+              << " locks (expected 1)" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Runs the audio thread for numBlocks blocks while a second thread calls
+// every setter and getter, and a third takes out the telemetry
+void runUnderLoad(int numBlocks, uint64_t &allocations, uint64_t &locks) {
+  GainReductionComputer computer;
+  computer.prepare(kSampleRate);
+
+  MultichannelCompressor compressor;
+  compressor.setLookAheadTime(0.005f);
+  compressor.setLookAheadEnabled(true);
+  compressor.setTruePeakEnabled(true);
+  compressor.setTelemetryCapacity(64);
+  compressor.prepare(kSampleRate, kBlockSize, kNumChannels);
+
+  std::vector<std::vector<float>> audio(
+      kNumChannels, std::vector<float>(static_cast<size_t>(kBlockSize)));
+  std::vector<float *> channels;
+  for (auto &channel : audio) {
+    channels.push_back(channel.data());
+  }
+  std::vector<float> sideChain(static_cast<size_t>(kBlockSize)),
+      gain(static_cast<size_t>(kBlockSize));
+
+  std::atomic<bool> running{true};
+  std::thread setters([&]() {
+    float step = 0.0f;
+    while (running.load(std::memory_order_relaxed)) {
+      step = step > 10.0f ? 0.0f : step + 0.01f;
+      for (GainReductionComputer *c :
+           {&computer, &compressor.getGainReductionComputer()}) {
+        c->setThreshold(-30.0f + step);
+        c->setKnee(step);
+        c->setRatio(2.0f + step);
+        c->setAttackTime(0.001f + 0.001f * step);
+        c->setReleaseTime(0.05f + 0.01f * step);
+        c->setMakeUpGain(0.5f * step);
+        c->getCharacteristicSample(-20.0f);
+      }
+    }
+  });
+  std::thread telemetry([&]() {
+    MultichannelCompressor::Telemetry block;
+    while (running.load(std::memory_order_relaxed)) {
+      while (compressor.popTelemetry(block)) {
+      }
+      std::this_thread::yield();
+    }
+  });
+
+  std::thread audioThread([&]() {
+    tCounting = true;
+    uint32_t noise = 1;
+    for (int block = 0; block < numBlocks; ++block) {
+      for (auto &channel : audio) {
+        for (float &sample : channel) {
+          noise = noise * 1664525u + 1013904223u;
+          sample = float(int32_t(noise)) * (1.0f / 2147483648.0f);
+        }
+      }
+      VectorOperations::abs(sideChain.data(), audio[0].data(), kBlockSize);
+      computer.computeLinearGainFromSidechainSignal(sideChain.data(),
+                                                    gain.data(), kBlockSize);
+      compressor.process(channels.data(), kNumChannels, kBlockSize);
+    }
+    tCounting = false;
+  });
+
+  audioThread.join();
+  running = false;
+  setters.join();
+  telemetry.join();
+  allocations = gAllocations.exchange(0);
+  locks = gLocks.exchange(0);
+}
+
+// Processes a constant side-chain level and returns the gain in decibels:
+// the gain reduction as computed, or the linear gain with make-up converted
+// back to decibels
+std::vector<double> processBlock(GainReductionComputer &computer, float level,
+                                 bool linear) {
+  std::vector<float> sideChain(static_cast<size_t>(kBlockSize), level);
+  std::vector<float> gain(static_cast<size_t>(kBlockSize));
+  computer.computeGainInDecibelsFromSidechainSignal(sideChain.data(),
+                                                    gain.data(), kBlockSize);
+  if (linear) {
+    computer.convertToLinearGain(gain.data(), gain.data(), kBlockSize);
+  }
+  std::vector<double> decibels;
+  for (float g : gain) {
+    decibels.push_back(linear ? 20.0 * std::log10(double(g)) : double(g));
+  }
+  return decibels;
+}
+
+// A change between two blocks ramps linearly across the second one, from
+// the old value (exclusive) to the new one (on the last sample). Returns
+// the largest deviation from that line, in dB.
+double rampError(bool threshold) {
+  GainReductionComputer computer;
+  computer.setKnee(0.0f);
+  computer.setRatio(4.0f);
+  computer.setAttackTime(0.0f); // instant, so the ramp isn't smoothed
+  computer.setReleaseTime(0.0f);
+  computer.setThreshold(-20.0f);
+  computer.setMakeUpGain(0.0f);
+  computer.prepare(kSampleRate);
+
+  const float level = 0.5f; // -6 dBFS, above both thresholds
+  const bool linear = !threshold;
+  const double before = processBlock(computer, level, linear).back();
+  if (threshold) {
+    computer.setThreshold(-10.0f);
+  } else {
+    computer.setMakeUpGain(6.0f);
+  }
+  const std::vector<double> ramp = processBlock(computer, level, linear);
+  const double after = processBlock(computer, level, linear).back();
+
+  double error = 0.0;
+  for (int i = 0; i < kBlockSize; ++i) {
+    const double expected =
+        before + (after - before) * double(i + 1) / kBlockSize;
+    error = std::max(error, std::fabs(ramp[size_t(i)] - expected));
+  }
+  return error;
+}
+
+void printUsage() {
+  std::cout << "Usage: realtime_check [options]\n"
+               "  --blocks <n>        audio blocks under load, default "
+               "20000\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numBlocks = 20000;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--blocks") {
+      numBlocks = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  bool ok = hooksWork();
+
+  const bool lockFree = std::atomic<float>().is_lock_free() &&
+                        std::atomic<uint32_t>().is_lock_free();
+  std::cout << "atomic<float> and atomic<uint32_t> lock-free: "
+            << (lockFree ? "yes" : "NO") << "\n";
+  ok = ok && lockFree;
+
+  uint64_t allocations = 0, locks = 0;
+  runUnderLoad(numBlocks, allocations, locks);
+  std::cout << numBlocks << " blocks of " << kBlockSize
+            << " samples (GainReductionComputer, and an " << kNumChannels
+            << "-channel MultichannelCompressor with look-ahead, true peak "
+               "and telemetry) while another thread calls the setters: "
+            << allocations << " allocations, " << locks
+            << " locks on the audio thread\n";
+#ifndef __linux__
+  std::cout << "(locks are only counted on Linux)\n";
+#endif
+  ok = ok && allocations == 0 && locks == 0;
+
+  const double thresholdError = rampError(true);
+  const double makeUpError = rampError(false);
+  std::cout << "threshold -20 -> -10 dB: max deviation from a linear ramp "
+            << thresholdError << " dB (bound " << kThresholdRampBoundDb
+            << ")\n"
+            << "make-up gain 0 -> 6 dB: max deviation from a linear ramp "
+            << makeUpError << " dB (bound " << kMakeUpRampBoundDb << ")\n";
+  ok = ok && thresholdError <= kThresholdRampBoundDb &&
+       makeUpError <= kMakeUpRampBoundDb;
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
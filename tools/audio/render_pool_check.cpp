@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "RenderPool.h"
+
+// Checks RenderPool, the pool spatial_sequencer renders its objects on:
+// runs of random sizes with two alternating jobs, whose items now and then
+// stall the helper threads and yield the calling one, so helpers often come
+// late to a run or are still busy when the next one starts. Every item must
+// run exactly once, with its own run's job and context, and run() must
+// return only when all of them are done. Exits with 1 otherwise. See
+// readme_render_pool_check.md
+
+namespace {
+
+const size_t kMaxItems = 256;
+
+// The context of one job. active is set by the caller of run() for the
+// length of the run, so an item running outside its run is seen.
+struct Context {
+  std::atomic<bool> active{false};
+  std::atomic<uint32_t> hits[kMaxItems];
+  std::atomic<uint64_t> misplaced{0};
+  std::atomic<uint64_t> stalls{0};
+  uint32_t stallEvery{0}; // 0 never
+
+  Context() {
+    for (auto &hit : hits) {
+      hit.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// Counted when the item ends, so an item still running when run() returns
+// is missing from its run
+void visit(Context &context, unsigned int worker, size_t item,
+           uint32_t jobId) {
+  if (worker > 0 && context.stallEvery > 0 &&
+      item % context.stallEvery == 0) {
+    context.stalls++;
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  } else if (worker == 0 && item % 4 == 0) {
+    // Lets the helpers in, even on one core
+    std::this_thread::yield();
+  }
+  if (!context.active.load(std::memory_order_acquire) || item >= kMaxItems) {
+    context.misplaced++;
+    return;
+  }
+  // Each job counts in its own bits, so an item run with the other run's
+  // job shows up too
+  context.hits[item].fetch_add(jobId, std::memory_order_relaxed);
+}
+
+void jobA(void *context, unsigned int worker, size_t item) {
+  visit(*static_cast<Context *>(context), worker, item, 1);
+}
+
+void jobB(void *context, unsigned int worker, size_t item) {
+  visit(*static_cast<Context *>(context), worker, item, 1u << 16);
+}
+
+// The per-run cost: items that only count, no stalls
+void countItem(void *context, unsigned int, size_t) {
+  static_cast<std::atomic<uint64_t> *>(context)->fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void printUsage() {
+  std::cout << "Usage: render_pool_check [options]\n"
+               "  --threads <n>       helper threads, default 3\n"
+               "  --runs <n>          runs, default 200000\n"
+               "  --seed <n>          seed of the run sizes, default 1\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned int threads = 3;
+  int numRuns = 200000;
+  uint32_t seed = 1;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--threads") {
+      threads = unsigned(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--runs") {
+      numRuns = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  RenderPool pool;
+  pool.start(threads + 1, false);
+  Context contexts[2];
+  contexts[0].stallEvery = 7;
+  contexts[1].stallEvery = 5;
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<size_t> size(0, kMaxItems);
+
+  uint64_t wrongRuns = 0, items = 0;
+  double seconds = 0.0;
+  for (int run = 0; run < numRuns; run++) {
+    const int which = run & 1;
+    Context &context = contexts[which];
+    const uint32_t jobId = which == 0 ? 1 : 1u << 16;
+    // Mostly small runs, like the output channels of a few objects
+    const size_t count = run % 16 == 0 ? size(random) : size(random) % 8;
+    context.active.store(true, std::memory_order_release);
+    const auto start = std::chrono::steady_clock::now();
+    pool.run(count, which == 0 ? jobA : jobB, &context);
+    seconds += std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    context.active.store(false, std::memory_order_release);
+    bool good = true;
+    for (size_t i = 0; i < kMaxItems; i++) {
+      const uint32_t expected = i < count ? jobId : 0;
+      if (context.hits[i].exchange(0, std::memory_order_relaxed) !=
+          expected) {
+        good = false;
+      }
+    }
+    if (!good) {
+      if (wrongRuns < 10) {
+        std::cerr << "MISMATCH: run " << run << ", " << count
+                  << " items not run exactly once by their job" << std::endl;
+      }
+      wrongRuns++;
+    }
+    items += count;
+  }
+
+  // 64 items, like the output channels summed after the voices
+  std::atomic<uint64_t> counted{0};
+  const int numTimedRuns = std::max(1, numRuns / 10);
+  const auto start = std::chrono::steady_clock::now();
+  for (int run = 0; run < numTimedRuns; run++) {
+    pool.run(64, countItem, &counted);
+  }
+  const double timedSeconds = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+  pool.stop();
+  const bool countedAll = counted.load() == uint64_t(numTimedRuns) * 64;
+
+  const uint64_t misplaced =
+      contexts[0].misplaced.load() + contexts[1].misplaced.load();
+  std::cout << numRuns << " runs of 0 to " << kMaxItems << " items ("
+            << items << " items) on " << threads << " helper threads, "
+            << contexts[0].stalls.load() + contexts[1].stalls.load()
+            << " items stalled a helper\n"
+            << "  runs not done exactly once: " << wrongRuns << "\n"
+            << "  items run outside their run: " << misplaced << "\n"
+            << "  mean time in run(): " << seconds * 1e6 / numRuns
+            << " us\n"
+            << numTimedRuns << " runs of 64 items that only count: "
+            << timedSeconds * 1e6 / numTimedRuns << " us per run"
+            << (countedAll ? "" : ", ITEMS MISSING") << "\n";
+  const bool ok = wrongRuns == 0 && misplaced == 0 && countedAll;
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
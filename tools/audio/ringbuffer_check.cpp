@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/LookAheadGainReduction.cpp"
+
+// Checks RingBuffer against a plain history of every written sample, over
+// random capacities, write sizes, read offsets and in-place edits, and times
+// it as a delay-line against the split-copy code it replaced. Exits with 1
+// on any mismatch. See readme_ringbuffer_check.md
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const float kDelaySeconds = 0.005f;
+
+// Every sample ever written, after a capacity of zeros for the cleared
+// buffer, so the expected value of any position is known
+class History {
+public:
+  explicit History(int capacity)
+      : mCapacity(capacity), mSamples(static_cast<size_t>(capacity), 0.0f) {}
+
+  void write(const float *src, int numSamples) {
+    mSamples.insert(mSamples.end(), src, src + numSamples);
+  }
+
+  // The sample `numSamplesBack` before the write position, read forward by
+  // `offset`. Past the write position a span continues with the samples
+  // written a capacity ago, as RingBuffer documents.
+  float &at(int numSamplesBack, int offset) {
+    int distance = numSamplesBack - offset;
+    if (distance <= 0) {
+      distance += mCapacity;
+    }
+    return mSamples[mSamples.size() - size_t(distance)];
+  }
+
+private:
+  int mCapacity;
+  std::vector<float> mSamples;
+};
+
+struct Counts {
+  uint64_t operations{0};
+  uint64_t comparedSamples{0};
+  uint64_t mismatches{0};
+};
+
+bool compare(RingBuffer<float> &buffer, History &history, int numSamplesBack,
+             int numSamples, Counts &counts, const char *what) {
+  std::vector<float> read(static_cast<size_t>(numSamples));
+  buffer.read(read.data(), numSamplesBack, numSamples);
+  const float *pointer = buffer.getReadPointer(numSamplesBack);
+  bool ok = true;
+  for (int i = 0; i < numSamples; i++) {
+    counts.comparedSamples++;
+    const float expected = history.at(numSamplesBack, i);
+    if (read[size_t(i)] != expected || pointer[i] != expected) {
+      ok = false;
+      if (counts.mismatches++ < 5) {
+        std::cerr << "MISMATCH after " << what << ": capacity "
+                  << buffer.getCapacity() << ", " << numSamplesBack
+                  << " back, offset " << i << ": read " << read[size_t(i)]
+                  << ", pointer " << pointer[i] << ", expected " << expected
+                  << std::endl;
+      }
+    }
+  }
+  return ok;
+}
+
+// One buffer through a random sequence of writes, reads and in-place edits
+void checkBuffer(std::mt19937 &random, int minimumCapacity, Counts &counts) {
+  RingBuffer<float> buffer;
+  buffer.setCapacity(minimumCapacity);
+  const int capacity = buffer.getCapacity();
+  if (capacity < minimumCapacity || (capacity & (capacity - 1)) != 0 ||
+      capacity >= 2 * std::max(1, minimumCapacity)) {
+    counts.mismatches++;
+    std::cerr << "CAPACITY " << capacity << " for " << minimumCapacity
+              << std::endl;
+    return;
+  }
+  History history(capacity);
+  std::uniform_int_distribution<int> operation(0, 9);
+  std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+  std::vector<float> block(static_cast<size_t>(capacity));
+  float next = 1.0f;
+  int writePosition = 0;
+
+  for (int step = 0; step < 200; step++) {
+    counts.operations++;
+    const int op = operation(random);
+    if (op < 5) {
+      // write anything from nothing to the full capacity, and hit the wrap
+      // edge: exactly up to the end of the first half, or one sample over
+      std::uniform_int_distribution<int> size(0, capacity);
+      int numSamples = size(random);
+      if (op == 0) {
+        numSamples = capacity;
+      } else if (op == 1) {
+        numSamples = capacity - writePosition;
+      } else if (op == 2) {
+        numSamples = std::min(capacity, capacity - writePosition + 1);
+      }
+      writePosition = (writePosition + numSamples) % capacity;
+      for (int i = 0; i < numSamples; i++) {
+        block[size_t(i)] = next++; // distinct values reveal misplacements
+      }
+      buffer.write(block.data(), numSamples);
+      history.write(block.data(), numSamples);
+      compare(buffer, history, capacity, capacity, counts, "write");
+    } else if (op < 8) {
+      // read a random span, possibly running past the write position
+      std::uniform_int_distribution<int> back(1, capacity);
+      const int numSamplesBack = back(random);
+      std::uniform_int_distribution<int> size(0, capacity);
+      compare(buffer, history, numSamplesBack, size(random), counts, "read");
+    } else {
+      // modify a span in place, then sync its mirror
+      std::uniform_int_distribution<int> back(1, capacity);
+      const int numSamplesBack = back(random);
+      std::uniform_int_distribution<int> size(0, numSamplesBack);
+      const int numSamples = size(random);
+      float *samples = buffer.getWritePointer(numSamplesBack);
+      for (int i = 0; i < numSamples; i++) {
+        samples[i] = value(random);
+        history.at(numSamplesBack, i) = samples[i];
+      }
+      buffer.updateMirror(samples, numSamples);
+      compare(buffer, history, capacity, capacity, counts, "updateMirror");
+    }
+  }
+
+  buffer.clear();
+  History cleared(capacity);
+  compare(buffer, cleared, capacity, capacity, counts, "clear");
+}
+
+// The delay-line as it was before RingBuffer: any buffer size, positions
+// wrapped with a modulo, and every copy split in two where it wraps
+class SplitDelayLine {
+public:
+  void prepare(int size) {
+    mBuffer.assign(static_cast<size_t>(size), 0.0f);
+    mWritePosition = 0;
+  }
+
+  void write(const float *src, int numSamples) {
+    int start, size1, size2;
+    positions(mWritePosition, numSamples, start, size1, size2);
+    for (int i = 0; i < size1; ++i) {
+      mBuffer[size_t(start + i)] = src[i];
+    }
+    for (int i = 0; i < size2; ++i) {
+      mBuffer[size_t(i)] = src[size1 + i];
+    }
+    mWritePosition = (mWritePosition + numSamples) % int(mBuffer.size());
+  }
+
+  void read(float *dest, int numSamplesBack, int numSamples) const {
+    int start, size1, size2;
+    positions(mWritePosition - numSamplesBack, numSamples, start, size1,
+              size2);
+    for (int i = 0; i < size1; ++i) {
+      dest[i] = mBuffer[size_t(start + i)];
+    }
+    for (int i = 0; i < size2; ++i) {
+      dest[size1 + i] = mBuffer[size_t(i)];
+    }
+  }
+
+private:
+  void positions(int position, int numSamples, int &start, int &size1,
+                 int &size2) const {
+    const int size = int(mBuffer.size());
+    if (position < 0) {
+      position += size;
+    }
+    start = position % size;
+    size1 = std::min(size - start, numSamples);
+    size2 = std::max(0, numSamples - size1);
+  }
+
+  std::vector<float> mBuffer;
+  int mWritePosition{0};
+};
+
+template <typename Function> double secondsOf(Function function, int runs) {
+  double best = 1e9;
+  for (int run = 0; run < runs; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best;
+}
+
+void printUsage() {
+  std::cout << "Usage: ringbuffer_check [options]\n"
+               "  --buffers <n>       random buffers, default 2000\n"
+               "  --seed <n>          default 1\n"
+               "  --samples <n>       samples per timed run, default "
+               "4800000\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numBuffers = 2000;
+  unsigned int seed = 1;
+  int numSamples = 4800000;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--buffers") {
+      numBuffers = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = unsigned(std::atoi(argv[++i]));
+    } else if (arg == "--samples") {
+      numSamples = std::max(4096, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  // Small capacities hit the wrap edges all the time, so most buffers are
+  // small; powers of two and their neighbours are always included
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int> small(1, 64), large(65, 5000);
+  Counts counts;
+  for (int c = 0; c < numBuffers; c++) {
+    int minimumCapacity = c % 4 == 0 ? large(random) : small(random);
+    if (c < 39) {
+      minimumCapacity = (1 << (c / 3)) + (c % 3) - 1; // 2^k - 1, 2^k, 2^k+1
+    }
+    checkBuffer(random, std::max(1, minimumCapacity), counts);
+  }
+  std::cout << numBuffers << " buffers, " << counts.operations
+            << " operations, " << counts.comparedSamples
+            << " samples compared, " << counts.mismatches << " mismatches\n";
+
+  // Throughput, in Msamples/s: the plain delay-line (write a block, read
+  // the block written 5 ms before), and the LookAheadGainReduction built
+  // on it (push, backward scan, read)
+  std::vector<float> input(static_cast<size_t>(numSamples));
+  std::uniform_real_distribution<float> gainReduction(-20.0f, 0.0f);
+  for (float &sample : input) {
+    sample = gainReduction(random);
+  }
+  const int delay = int(kDelaySeconds * kSampleRate);
+  std::cout << "delay-line at " << delay
+            << " samples delay, Msamples/s (split copies / RingBuffer / "
+               "LookAheadGainReduction):\n";
+  for (int blockSize : {32, 128, 512, 4096}) {
+    const int numBlocks = numSamples / blockSize;
+    std::vector<float> output(static_cast<size_t>(blockSize));
+
+    SplitDelayLine split;
+    split.prepare(blockSize + delay);
+    const double splitSeconds = secondsOf(
+        [&]() {
+          for (int b = 0; b < numBlocks; b++) {
+            split.write(input.data() + b * blockSize, blockSize);
+            split.read(output.data(), blockSize + delay, blockSize);
+          }
+        },
+        runs);
+
+    RingBuffer<float> ring;
+    ring.setCapacity(blockSize + delay);
+    const double ringSeconds = secondsOf(
+        [&]() {
+          for (int b = 0; b < numBlocks; b++) {
+            ring.write(input.data() + b * blockSize, blockSize);
+            ring.read(output.data(), blockSize + delay, blockSize);
+          }
+        },
+        runs);
+
+    LookAheadGainReduction lookAhead;
+    lookAhead.setDelayTime(kDelaySeconds);
+    lookAhead.prepare(kSampleRate, blockSize);
+    const double lookAheadSeconds = secondsOf(
+        [&]() {
+          for (int b = 0; b < numBlocks; b++) {
+            lookAhead.pushSamples(input.data() + b * blockSize, blockSize);
+            lookAhead.process();
+            lookAhead.readSamples(output.data(), blockSize);
+          }
+        },
+        runs);
+
+    const double processed = double(numBlocks) * blockSize / 1e6;
+    std::cout << "  block " << blockSize << ": " << processed / splitSeconds
+              << " / " << processed / ringSeconds << " / "
+              << processed / lookAheadSeconds << "\n";
+  }
+
+  const bool ok = counts.mismatches == 0;
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
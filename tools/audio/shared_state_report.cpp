@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "MeterLevels.h"
+#include "StatePacking.h"
+#include "WavFile.h"
+
+// Measures what the packed shared state of spatial_sequencer and
+// sphere_audio_test costs and how exact it is, on a recorded session: the
+// file is panned around a ring of speakers, metered like in the apps, and
+// packed once per graphics frame as the primary does, while a simulated
+// renderer that misses some frames unpacks it. Exits with 1 if the renderer
+// ever ends a frame with other values than the primary sent. See
+// readme_shared_state_report.md
+
+namespace {
+
+const size_t kMeters = 64; // meters in the shared state of both apps
+
+// The shared states of the apps, as of StatePacking.h
+struct MeterState {
+  StateHeader header;
+  PackedMeters<kMeters> meters;
+};
+
+struct MeterPoseState {
+  StateHeader header;
+  PackedMeters<kMeters> meters;
+  PackedPose pose;
+};
+
+int popCount(uint64_t bits) {
+  int count = 0;
+  for (; bits != 0; bits &= bits - 1) {
+    count++;
+  }
+  return count;
+}
+
+void printUsage() {
+  std::cout << "Usage: shared_state_report [options] session.wav\n"
+               "  --channels <n>      speakers on the ring, default 60, at "
+               "most 64\n"
+               "  --fps <n>           graphics frames per second, default 60\n"
+               "  --block <frames>    audio block size, default 512\n"
+               "  --drop <n>          the renderer misses 1 in n frames, "
+               "default 20 (0 for none)\n"
+               "  --rms               RMS meters instead of peak meters\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string file;
+  size_t numChannels = 60;
+  double fps = 60.0;
+  size_t blockSize = 512;
+  unsigned int dropEvery = 20;
+  MeterMode mode = MeterMode::Peak;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg == "--rms") {
+      mode = MeterMode::Rms;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--channels") {
+      numChannels = size_t(std::min(std::max(1, std::atoi(argv[++i])),
+                                    int(kMeters)));
+    } else if (arg == "--fps") {
+      fps = std::max(1.0, std::atof(argv[++i]));
+    } else if (arg == "--block") {
+      blockSize = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--drop") {
+      dropEvery = unsigned(std::max(0, std::atoi(argv[++i])));
+    } else if (arg.compare(0, 2, "--") == 0) {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    } else {
+      file = arg;
+    }
+  }
+  if (file.empty()) {
+    printUsage();
+    return 1;
+  }
+
+  WavReader reader;
+  if (!reader.open(file)) {
+    std::cerr << "ERROR: " << reader.errorMessage() << std::endl;
+    return 1;
+  }
+  const int fileChannels = reader.channels();
+  const double sampleRate = reader.sampleRate();
+  std::cout << file << ": " << fileChannels << " ch, " << sampleRate
+            << " Hz, " << double(reader.frames()) / sampleRate << " s"
+            << std::endl;
+
+  MeterLevels levels;
+  levels.configure(numChannels, sampleRate, mode);
+  std::vector<float> interleaved(blockSize * fileChannels);
+  std::vector<float> planar(numChannels * blockSize);
+  std::vector<const float *> channels(numChannels);
+  for (size_t c = 0; c < numChannels; c++) {
+    channels[c] = planar.data() + c * blockSize;
+  }
+
+  MeterState sent;
+  StateReceiver receiver;
+  float received[kMeters] = {};
+  std::mt19937 random(7);
+
+  const double pi = 3.14159265358979323846;
+  const double blocksPerFrame = sampleRate / double(blockSize) / fps;
+  double blocksSinceFrame = 0.0;
+  uint64_t position = 0;
+  uint64_t frames = 0, dropped = 0, changedFrames = 0, changedMeters = 0;
+  uint64_t mismatches = 0;
+  double maxErrorDb = 0.0;
+
+  while (reader.read(interleaved.data(), blockSize) == blockSize) {
+    // The first channel, on a source that circles the ring every 8 s with a
+    // cos^2 panning law
+    const double azimuth = 2.0 * pi * double(position) / (8.0 * sampleRate);
+    position += blockSize;
+    for (size_t c = 0; c < numChannels; c++) {
+      const double d = std::cos(azimuth - 2.0 * pi * double(c) / numChannels);
+      const float gain = d > 0.0 ? float(d * d) : 0.0f;
+      float *out = planar.data() + c * blockSize;
+      for (size_t i = 0; i < blockSize; i++) {
+        out[i] = gain * interleaved[i * fileChannels];
+      }
+    }
+    levels.process(channels.data(), numChannels, blockSize);
+
+    blocksSinceFrame += 1.0;
+    if (blocksSinceFrame < blocksPerFrame) {
+      continue;
+    }
+    blocksSinceFrame -= blocksPerFrame;
+
+    // Primary, once per graphics frame
+    frames++;
+    const std::vector<float> &values = levels.values();
+    uint32_t fields = 0;
+    if (sent.meters.pack(values.data(), values.size())) {
+      fields |= 1;
+      changedFrames++;
+      for (uint64_t bits : sent.meters.changed) {
+        changedMeters += uint64_t(popCount(bits));
+      }
+    }
+    sent.header.publish(fields);
+    for (size_t c = 0; c < numChannels; c++) {
+      // 0.005 display units per dB, see MeterLevels.h
+      const float sentValue = PackedMeters<kMeters>::unpack(
+          sent.meters.levels[c]);
+      maxErrorDb = std::max(
+          maxErrorDb, double(std::fabs(sentValue - values[c])) / 0.005);
+    }
+
+    // Renderer, unless it misses this frame
+    if (dropEvery > 0 && random() % dropEvery == 0) {
+      dropped++;
+      continue;
+    }
+    const uint32_t apply = receiver.receive(sent.header);
+    if (apply & 1) {
+      sent.meters.unpack(received, kMeters, StateReceiver::all(apply));
+    }
+    for (size_t c = 0; c < numChannels; c++) {
+      if (received[c] !=
+          PackedMeters<kMeters>::unpack(sent.meters.levels[c])) {
+        mismatches++;
+      }
+    }
+  }
+
+  std::cout << frames << " frames at " << fps << " fps, " << dropped
+            << " missed by the renderer\n";
+  std::cout << "spatial_sequencer (meters): " << sizeof(float[kMeters])
+            << " -> " << sizeof(MeterState) << " bytes per frame\n";
+  std::cout << "sphere_audio_test (meters and pose): " << sizeof(float[kMeters])
+            << " bytes + an al::Pose (7 doubles, 56 bytes) -> "
+            << sizeof(MeterPoseState) << " bytes per frame\n";
+  std::cout << "frames with meter changes: "
+            << (frames > 0 ? 100.0 * double(changedFrames) / double(frames)
+                           : 0.0)
+            << "%, meters changed per changed frame: "
+            << double(changedMeters) / double(std::max<uint64_t>(changedFrames,
+                                                                 1))
+            << " of " << numChannels << "\n";
+  std::cout << "max quantization error: " << maxErrorDb << " dB\n";
+  std::cout << "renderer values different from the primary's: " << mismatches
+            << std::endl;
+  return mismatches == 0 ? 0 : 1;
+}
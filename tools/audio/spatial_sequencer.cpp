@@ -23,12 +23,30 @@
 #include "Gamma/Analysis.h"
 #include "Gamma/scl.h"
 
+#include "AutomationCurve.h"
+#include "DownmixMatrix.h"
+#include "RenderPool.h"
+#include "StatePacking.h"
+#include "WavFile.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
 using namespace al;
 
+/// Sent to the renderers every frame, see StatePacking.h
 struct SharedState {
-  float meterValues[64] = {0};
+  StateHeader header;
+  PackedMeters<64> meters;
 };
 
+/// StateHeader::changedFields
+enum : uint32_t { kMeterField = 1 };
+
 struct MappedAudioFile {
   std::unique_ptr<SoundFileBuffered> soundfile;
   std::vector<size_t> outChannelMap;
@@ -38,11 +56,249 @@ struct MappedAudioFile {
   bool mute{false};
 };
 
+/// The latest N floats written by one thread, read by another without locks
+/// (a sequence lock): the writer never waits, and a read that overlaps a
+/// write fails and is retried later.
+template <size_t N> class LatestValues {
+public:
+  LatestValues() {
+    for (auto &value : mValues) {
+      value.store(0.0f, std::memory_order_relaxed);
+    }
+  }
+
+  void write(const float *values) {
+    const uint32_t version = mVersion.load(std::memory_order_relaxed);
+    mVersion.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < N; i++) {
+      mValues[i].store(values[i], std::memory_order_relaxed);
+    }
+    mVersion.store(version + 2, std::memory_order_release);
+  }
+
+  /// Copies the values and their version, false if a write was under way
+  bool read(float *values, uint32_t &version) const {
+    const uint32_t before = mVersion.load(std::memory_order_acquire);
+    if (before & 1) {
+      return false;
+    }
+    for (size_t i = 0; i < N; i++) {
+      values[i] = mValues[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mVersion.load(std::memory_order_relaxed) != before) {
+      return false;
+    }
+    version = before;
+    return true;
+  }
+
+  /// Even, and 0 until the first write
+  uint32_t version() const {
+    return mVersion.load(std::memory_order_acquire) & ~1u;
+  }
+
+private:
+  std::atomic<uint32_t> mVersion{0};
+  std::atomic<float> mValues[N];
+};
+
+/// Pointers handed from the audio thread to a control thread through a
+/// fixed set of slots, filled and emptied with atomic operations: neither
+/// side locks, and push() never allocates. Any number of threads can push
+/// and drain.
+template <typename T> class HandoffSlots {
+public:
+  /// Control thread, before the audio starts
+  void reserve(size_t count) {
+    mSlots.reset(new std::atomic<T *>[count]);
+    for (size_t i = 0; i < count; i++) {
+      mSlots[i].store(nullptr, std::memory_order_relaxed);
+    }
+    mCount = count;
+  }
+
+  /// False if all slots are taken, then the caller keeps item
+  bool push(T *item) {
+    for (size_t i = 0; i < mCount; i++) {
+      T *expected = nullptr;
+      if (mSlots[i].compare_exchange_strong(expected, item,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Takes every item pushed so far and passes it to function
+  template <typename Function> void drain(Function function) {
+    for (size_t i = 0; i < mCount; i++) {
+      if (mSlots[i].load(std::memory_order_relaxed)) {
+        T *item = mSlots[i].exchange(nullptr, std::memory_order_acquire);
+        if (item) {
+          function(item);
+        }
+      }
+    }
+  }
+
+private:
+  std::unique_ptr<std::atomic<T *>[]> mSlots;
+  size_t mCount{0};
+};
+
+/// An audio file opened by the loader for one trigger of an AudioObject,
+/// with the buffer the render worker reads it into
+struct StreamedFile {
+  std::unique_ptr<SoundFileBuffered> soundfile;
+  std::vector<float> readBuffer;
+  uint64_t frames{0};
+};
+
+class AudioObject;
+
+/// The scene's spatializer. The scene still runs the voices (turns them on
+/// and off and calls their onProcess), but spatializing is done by the
+/// ObjectRenderer, so this one does nothing.
+class DeferredSpatializer : public Spatializer {
+public:
+  DeferredSpatializer(const Speakers &sl) : Spatializer(sl) {}
+
+  void renderSample(AudioIOData &, const Vec3f &, const float &,
+                    const unsigned int &) override {}
+  void renderBuffer(AudioIOData &, const Vec3f &, const float *,
+                    const unsigned int &) override {}
+};
+
+/// Renders and spatializes the audio objects of a scene on an app-owned
+/// RenderPool. AudioObject::onProcess, called by the scene in the audio
+/// thread, only queues the voice; render() then renders the queued voices
+/// on all workers, each spatializing with its own Lbap into its own bus
+/// with all output channels, and sums the buses into the output with SIMD
+/// adds, one output channel per item. Nothing on the way locks or
+/// allocates.
+class ObjectRenderer {
+public:
+  /// Blocks larger than this are rendered in pieces
+  static const unsigned int kMaxFrames = 2048;
+
+  /// Allocates everything and starts the threads helping the audio thread
+  /// (0 renders in the audio thread only). Not while render() runs.
+  void configure(const Speakers &speakers, int channels,
+                 unsigned int renderThreads, bool pinToCores,
+                 size_t maxVoices = 1024) {
+    mPool.stop();
+    mChannels = channels;
+    mQueue.assign(maxVoices, nullptr);
+    mNumQueued = 0;
+    mWorkers.clear();
+    for (unsigned int w = 0; w <= renderThreads; w++) {
+      std::unique_ptr<Worker> worker(new Worker);
+      worker->bus.framesPerBuffer(kMaxFrames);
+      worker->bus.channelsOut(channels);
+      // Lbap renders through buffers of its own, so every worker needs one
+      worker->spatializer.reset(new Lbap(speakers));
+      worker->spatializer->compile();
+      worker->spatializer->prepare(worker->bus);
+      worker->voice.assign(kMaxFrames, 0.0f);
+      worker->inputs.assign(renderThreads + 1, nullptr);
+      mWorkers.push_back(std::move(worker));
+    }
+    mPool.start(renderThreads + 1, pinToCores);
+  }
+
+  unsigned int numWorkers() const { return mPool.numWorkers(); }
+
+  /// Stops the threads. Not while render() runs.
+  void stop() { mPool.stop(); }
+
+  /// Audio thread, from AudioObject::onProcess. False if the queue is full
+  /// (counted in dropped()), then the voice isn't rendered in this block.
+  bool queue(AudioObject *voice) {
+    if (mNumQueued == mQueue.size()) {
+      mDropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    mQueue[mNumQueued++] = voice;
+    return true;
+  }
+
+  /// Audio thread, after the scene has run: renders the queued voices and
+  /// adds them to the outputs of io, spatialized for the listener.
+  void render(AudioIOData &io, const Pose &listener,
+              DistAtten<> &attenuation);
+
+  uint64_t dropped() const { return mDropped.load(); }
+
+private:
+  // Allocated separately, so the workers don't share cache lines
+  struct Worker {
+    AudioIOData bus;
+    std::unique_ptr<Lbap> spatializer;
+    std::vector<float> voice;
+    std::vector<const float *> inputs;
+    bool used{false};
+  };
+
+  static void renderVoice(void *context, unsigned int worker, size_t item);
+  static void mixChannel(void *context, unsigned int worker, size_t channel);
+
+  RenderPool mPool;
+  int mChannels{0};
+  std::vector<AudioObject *> mQueue;
+  size_t mNumQueued{0};
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  std::atomic<uint64_t> mDropped{0};
+  // The block being rendered, set by render() for the jobs
+  AudioIOData *mOutput{nullptr};
+  Pose mListener;
+  DistAtten<> *mAttenuation{nullptr};
+  unsigned int mOffset{0};
+  unsigned int mFrames{0};
+};
+
 struct AudioObjectData {
   std::string rootPath;
   uint16_t audioSampleRate;
   uint16_t audioBlockSize;
   Mesh *mesh;
+  /// Opens and closes the objects' sound files off the render thread
+  WorkerPool *loader{nullptr};
+  /// Compiled automation files, shared by the objects
+  AutomationLibrary *automation{nullptr};
+  /// Renders the objects, see AudioObject::onProcess()
+  ObjectRenderer *renderer{nullptr};
+
+  // Streaming health, summed over all objects
+  /// Triggers whose file wasn't open yet at their first block
+  std::atomic<uint64_t> lateStarts{0};
+  /// Blocks rendered silent while waiting for a file
+  std::atomic<uint64_t> lateBlocks{0};
+  /// Blocks that came up short before the end of the file, and the frames
+  /// missing
+  std::atomic<uint64_t> underruns{0};
+  std::atomic<uint64_t> underrunFrames{0};
+  std::atomic<uint64_t> openFailures{0};
+
+  /// Files released by the voices in the audio thread, see
+  /// AudioObject::onFree(). Reserve a slot per voice.
+  HandoffSlots<StreamedFile> retiredFiles;
+
+  /// Control thread: hands file to the loader to close, which joins its
+  /// reader thread
+  void closeFile(StreamedFile *file) {
+    std::shared_ptr<StreamedFile> closing(file);
+    if (loader) {
+      loader->post([closing]() { closing->soundfile->close(); });
+    }
+  }
+
+  /// Control thread: closes the files the voices retired
+  void closeRetiredFiles() {
+    retiredFiles.drain([this](StreamedFile *file) { closeFile(file); });
+  }
 };
 
 class AudioObject : public PositionedVoice {
@@ -58,6 +314,11 @@ public:
   // Internal
   Parameter env{"env", "", 1.0, 0.00001, 10};
 
+  ~AudioObject() {
+    delete mFile.exchange(nullptr);
+    delete mRetired;
+  }
+
   void init() override {
     registerTriggerParameters(file, automation, gain);
     registerParameters(env);             // Propagate from audio rendering node
@@ -68,28 +329,49 @@ public:
     mSequencer << mPresetHandler; // For morphing
   }
 
+  // Called by the scene in the audio thread: hands the voice to the
+  // ObjectRenderer, which calls renderBlock() and renderPosition() later in
+  // the same callback
   void onProcess(AudioIOData &io) override {
-    float buffer[2048 * 60];
-    int numChannels = soundfile.channels();
-    assert(io.framesPerBuffer() < INT32_MAX);
-    auto framesRead =
-        soundfile.read(buffer, static_cast<int>(io.framesPerBuffer()));
-    int outIndex = 0;
-    size_t inChannel = 0;
-    if (!mute) {
-      for (size_t sample = 0; sample < framesRead; sample++) {
-        io.outBuffer(outIndex)[sample] +=
-            gain * buffer[sample * numChannels + inChannel];
-        mEnvFollow(buffer[sample * numChannels + inChannel]);
-      }
+    (void)io;
+    static_cast<AudioObjectData *>(userData())->renderer->queue(this);
+  }
+
+  /// Adds the next numFrames of the voice to out (mono, before
+  /// spatialization). Returns false if nothing was added. Called by one
+  /// render worker at a time.
+  bool renderBlock(float *out, size_t numFrames) {
+    auto objData = static_cast<AudioObjectData *>(userData());
+    float position[3];
+    uint32_t version = 0;
+    const bool moved = mPosition.read(position, version) &&
+                       version != mPositionVersion;
+    if (moved) {
+      mPositionVersion = version;
     }
+    if (mAutomationRunning.load(std::memory_order_acquire)) {
+      applyAutomation(double(numFrames) / objData->audioSampleRate);
+    } else if (moved) {
+      mRenderPosition = Vec3d(position[0], position[1], position[2]);
+    }
+    // Handshake with retireFile(), both sequentially consistent: either
+    // this sees kIdle, or retireFile() waits until the read is done
+    mRendering.store(true);
+    const bool added = readFile(out, numFrames);
+    mRendering.store(false, std::memory_order_release);
+    return added;
   }
 
+  /// Where the voice is in this block: the automation's pose, or the pose
+  /// last handed over by publishPose(). Render worker.
+  const Vec3d &renderPosition() const { return mRenderPosition; }
+
   void onProcess(Graphics &g) override {
     auto &mesh = *static_cast<AudioObjectData *>(userData())->mesh;
     if (isPrimary()) {
       env = mEnvFollow.value();
     }
+    publishPose();
     g.scale(0.5);
     g.scale(0.1 + gain + env * 10);
     g.color(c);
@@ -99,20 +381,36 @@ public:
 
   void onTriggerOn() override {
     auto objData = static_cast<AudioObjectData *>(userData());
+    storePosition();
 
     if (isPrimary()) {
       auto &rootPath = objData->rootPath;
-      soundfile.open(File::conformPathToOS(rootPath) + file.get());
-      if (!soundfile.opened()) {
-        std::cerr << "ERROR: opening audio file: "
-                  << File::conformPathToOS(rootPath) + file.get() << std::endl;
-      }
+      openFile(File::conformPathToOS(rootPath) + file.get(), objData);
 
-      float seqStep = (float)objData->audioBlockSize / objData->audioSampleRate;
-      mSequencer.setSequencerStepTime(seqStep);
-
-      mSequencer.playSequence(File::conformPathToOS(rootPath) +
-                              automation.get());
+      mAutomationRunning = false;
+      mAutomation = nullptr;
+      if (!automation.get().empty()) {
+        // Compiled with the session, see SpatialSequencer::setPath()
+        std::string error;
+        if (objData->automation) {
+          mAutomation = objData->automation->get(automation.get(), &error);
+        }
+        if (mAutomation) {
+          mAutomationCursor = AutomationCursor();
+          mAutomationTime = 0.0;
+          mAutomationRunning.store(true, std::memory_order_release);
+        } else {
+          // Played as text by the PresetSequencer
+          const std::string path =
+              File::conformPathToOS(rootPath) + automation.get();
+          std::cerr << "Automation not compiled: " << path << ": " << error
+                    << std::endl;
+          float seqStep =
+              (float)objData->audioBlockSize / objData->audioSampleRate;
+          mSequencer.setSequencerStepTime(seqStep);
+          mSequencer.playSequence(path);
+        }
+      }
     }
     auto colorIndex = automation.get()[0] - 'A';
     c = HSV(colorIndex / 6.0f, 1.0f, 1.0f);
@@ -122,23 +420,326 @@ public:
     if (isPrimary()) {
       mPresetHandler.stopMorphing();
       mSequencer.stopSequence();
-      soundfile.close();
+      mAutomationRunning = false;
+      // The render thread may still be reading: the file is closed on the
+      // next trigger, or when the voice is freed
+      stopFile();
     }
   }
 
-  void onFree() override { soundfile.close(); }
+  // Called by the scene in the audio thread: retires the file without
+  // locking or allocating, see retireFile()
+  void onFree() override {
+    StreamedFile *file = retireFile();
+    auto objData = static_cast<AudioObjectData *>(userData());
+    if (file && !(objData && objData->retiredFiles.push(file))) {
+      // No slot left: kept until the next trigger
+      mRetired = file;
+    }
+  }
 
 private:
+  // mFileState holds the generation of the file, counted up on every
+  // trigger and stop, above the state in the lowest two bits
+  enum FileState : uint64_t { kIdle, kOpening, kReady, kFailed };
+  static FileState stateOf(uint64_t fileState) {
+    return FileState(fileState & 3u);
+  }
+  static uint64_t generationOf(uint64_t fileState) { return fileState >> 2; }
+
+  // Renders the block at the pose of the compiled automation, and stops
+  // once the pose holds for good. The pose parameter is only set later by
+  // publishPose(), since setPose() notifies and sends to the other nodes.
+  void applyAutomation(double blockSeconds) {
+    AutomationPose pose;
+    if (mAutomation->evaluate(mAutomationTime, mAutomationCursor, pose)) {
+      mRenderPosition =
+          Vec3d(pose.position[0], pose.position[1], pose.position[2]);
+      float values[7];
+      std::copy(pose.position, pose.position + 3, values);
+      std::copy(pose.orientation, pose.orientation + 4, values + 3);
+      mAutomationPose.write(values);
+      if (mAutomationTime >= mAutomation->endTime()) {
+        mAutomationRunning = false;
+      }
+    }
+    mAutomationTime += blockSeconds;
+  }
+
+  // Reads the next numFrames of the file into out, see renderBlock()
+  bool readFile(float *out, size_t numFrames) {
+    auto objData = static_cast<AudioObjectData *>(userData());
+    const FileState state = stateOf(mFileState.load());
+    if (state == kOpening) {
+      // Triggered before the loader opened the file: stay silent meanwhile
+      if (!mLate) {
+        mLate = true;
+        objData->lateStarts++;
+      }
+      objData->lateBlocks++;
+      return false;
+    }
+    // Null if the file was retired since: a release waits for this read
+    // to end before closing it, see retireFile()
+    StreamedFile *file = mFile.load(std::memory_order_acquire);
+    if (state != kReady || !file) {
+      return false;
+    }
+    std::vector<float> &readBuffer = file->readBuffer;
+    const size_t numChannels = file->soundfile->channels();
+    const size_t chunkFrames = readBuffer.size() / numChannels;
+    const size_t inChannel = 0;
+    size_t done = 0;
+    while (done < numFrames) {
+      const size_t wanted = std::min(chunkFrames, numFrames - done);
+      const size_t framesRead =
+          file->soundfile->read(readBuffer.data(), static_cast<int>(wanted));
+      if (!mute) {
+        for (size_t sample = 0; sample < framesRead; sample++) {
+          const float value = readBuffer[sample * numChannels + inChannel];
+          out[done + sample] += gain * value;
+          mEnvFollow(value);
+        }
+      }
+      done += framesRead;
+      mFramesPlayed += framesRead;
+      if (framesRead < wanted) {
+        if (mFramesPlayed < file->frames) {
+          objData->underruns++;
+          objData->underrunFrames += numFrames - done;
+        }
+        break;
+      }
+    }
+    return !mute && done > 0;
+  }
+
+  // Graphics thread, every frame: sets the pose parameter to the latest
+  // automation pose, then hands the parameter's pose to the render workers
+  // (so they don't read the parameter). While the parameter lags behind the
+  // automation, the workers keep the automation's.
+  void publishPose() {
+    float values[7];
+    uint32_t version = 0;
+    if (mAutomationPose.read(values, version) &&
+        version != mPublishedVersion) {
+      setPose(Pose(Vec3d(values[0], values[1], values[2]),
+                   Quatd(values[3], values[4], values[5], values[6])));
+      mPublishedVersion = version;
+    }
+    if (mAutomationPose.version() == mPublishedVersion) {
+      storePosition();
+    }
+  }
+
+  void storePosition() {
+    const Vec3d position = pose().vec();
+    const float values[3] = {float(position.x), float(position.y),
+                             float(position.z)};
+    mPosition.write(values);
+  }
+
+  // Opens path on the loader threads. The voice is not being rendered here.
+  // The handshake is mFileState: the loader allocates and opens the file
+  // without locks, installs it in mFile, then publishes kReady for its
+  // generation, and the render thread only reads it after seeing that. A
+  // file that finishes opening after the voice was stopped or retriggered
+  // (a newer generation) is taken back and closed by the loader, unless a
+  // release took it first.
+  void openFile(const std::string &path, AudioObjectData *objData) {
+    releaseFile();
+    if (mRetired) {
+      objData->closeFile(mRetired);
+      mRetired = nullptr;
+    }
+    objData->closeRetiredFiles();
+    // Only a superseded loader writes meanwhile, and its compare-exchange
+    // fails
+    const uint64_t generation = generationOf(mFileState.load()) + 1;
+    const uint64_t opening = (generation << 2) | kOpening;
+    mFileState.store(opening);
+    mLate = false;
+    mFramesPlayed = 0;
+    objData->loader->post([this, path, generation, opening, objData]() {
+      // The constructor and open() start the file's reader thread, which
+      // prefetches the start of the file
+      std::unique_ptr<StreamedFile> file(new StreamedFile);
+      file->soundfile.reset(new SoundFileBuffered(8192));
+      file->soundfile->open(path);
+      if (!file->soundfile->opened() || file->soundfile->channels() <= 0) {
+        uint64_t expected = opening;
+        if (mFileState.compare_exchange_strong(expected,
+                                               (generation << 2) | kFailed)) {
+          std::cerr << "ERROR: opening audio file: " << path << std::endl;
+          objData->openFailures++;
+        }
+        return;
+      }
+      file->frames = file->soundfile->frames();
+      file->readBuffer.assign(
+          std::max<size_t>(objData->audioBlockSize, 256) *
+              file->soundfile->channels(),
+          0.0f);
+      // A superseded loader may not have taken its file back yet
+      StreamedFile *empty = nullptr;
+      while (!mFile.compare_exchange_weak(empty, file.get())) {
+        if (mFileState.load() != opening) {
+          return;
+        }
+        empty = nullptr;
+        std::this_thread::yield();
+      }
+      StreamedFile *installed = file.release();
+      uint64_t expected = opening;
+      if (!mFileState.compare_exchange_strong(expected,
+                                              (generation << 2) | kReady)) {
+        // Stopped meanwhile. If a release already took the file, it's
+        // closing it.
+        if (mFile.compare_exchange_strong(installed, nullptr)) {
+          objData->closeFile(installed);
+        }
+      }
+    });
+  }
+
+  // Moves the state to kIdle of a new generation, so the render workers
+  // stop reading and a loader still opening drops its file. Lock-free.
+  void stopFile() {
+    uint64_t fileState = mFileState.load();
+    while (!mFileState.compare_exchange_weak(
+        fileState, ((generationOf(fileState) + 1) << 2) | kIdle)) {
+    }
+  }
+
+  // Stops the file and takes it out of the voice. A render worker may be
+  // reading the file right now: the state goes to kIdle first, then this
+  // waits for the read to end (renderBlock() sees kIdle from then on). The
+  // render workers never wait for this, and in the audio thread (onFree()
+  // from the scene) no read is running, so it neither waits nor locks nor
+  // allocates there.
+  StreamedFile *retireFile() {
+    stopFile();
+    while (mRendering.load()) {
+      std::this_thread::yield();
+    }
+    return mFile.exchange(nullptr);
+  }
+
+  // Control thread: retires the file and hands it to the loader to close
+  void releaseFile() {
+    StreamedFile *file = retireFile();
+    auto objData = static_cast<AudioObjectData *>(userData());
+    if (file && objData) {
+      objData->closeFile(file);
+    } else {
+      delete file;
+    }
+  }
+
+  // Automation files the AutomationCurve compiler doesn't support
   PresetSequencer mSequencer;
   PresetHandler mPresetHandler{""};
-  SoundFileBuffered soundfile{8192};
   Color c;
 
+  // Compiled automation, set on trigger while the voice isn't rendered
+  std::shared_ptr<const AutomationCurve> mAutomation;
+  AutomationCursor mAutomationCursor;
+  double mAutomationTime{0.0};
+  std::atomic<bool> mAutomationRunning{false};
+
+  // Pose handover, see publishPose(). Written by the render workers
+  LatestValues<7> mAutomationPose;
+  Vec3d mRenderPosition{0.0, 0.0, 0.0};
+  uint32_t mPositionVersion{0};
+  // Written on trigger, and by the graphics thread while the voice plays
+  LatestValues<3> mPosition;
+  uint32_t mPublishedVersion{0};
+
+  // File, installed by the loader, see openFile()
+  std::atomic<StreamedFile *> mFile{nullptr};
+  std::atomic<uint64_t> mFileState{kIdle};
+  // Retired by onFree() when AudioObjectData::retiredFiles was full,
+  // closed on the next trigger
+  StreamedFile *mRetired{nullptr};
+  // Render thread
+  uint64_t mFramesPlayed{0};
+  bool mLate{false};
+  // Set while a render worker reads the file, see retireFile()
+  std::atomic<bool> mRendering{false};
+
   gam::EnvFollow<> mEnvFollow;
 };
 
+void ObjectRenderer::render(AudioIOData &io, const Pose &listener,
+                            DistAtten<> &attenuation) {
+  mOutput = &io;
+  mListener = listener;
+  mAttenuation = &attenuation;
+  const unsigned int frames = io.framesPerBuffer();
+  const unsigned int maxFrames = kMaxFrames;
+  for (mOffset = 0; mOffset < frames; mOffset += maxFrames) {
+    mFrames = std::min(maxFrames, frames - mOffset);
+    for (auto &worker : mWorkers) {
+      worker->used = false;
+    }
+    mPool.run(mNumQueued, renderVoice, this);
+    mPool.run(size_t(std::min(mChannels, io.channelsOut())), mixChannel,
+              this);
+  }
+  mNumQueued = 0;
+}
+
+void ObjectRenderer::renderVoice(void *context, unsigned int worker,
+                                 size_t item) {
+  auto &self = *static_cast<ObjectRenderer *>(context);
+  Worker &w = *self.mWorkers[worker];
+  AudioObject *voice = self.mQueue[item];
+  const unsigned int frames = self.mFrames;
+  float *buffer = w.voice.data();
+  std::fill(buffer, buffer + frames, 0.0f);
+  if (!voice->renderBlock(buffer, frames)) {
+    return;
+  }
+  if (!w.used) {
+    for (int c = 0; c < self.mChannels; c++) {
+      std::fill(w.bus.outBuffer(c), w.bus.outBuffer(c) + frames, 0.0f);
+    }
+    w.used = true;
+  }
+  // As DynamicScene does it
+  Vec3d direction = voice->renderPosition() - self.mListener.vec();
+  direction = self.mListener.quat().rotate(direction);
+  if (voice->useDistanceAttenuation()) {
+    const float gain = self.mAttenuation->attenuation(direction.mag());
+    for (unsigned int i = 0; i < frames; i++) {
+      buffer[i] *= gain;
+    }
+  }
+  w.spatializer->renderBuffer(w.bus, Vec3f(direction), buffer, frames);
+}
+
+void ObjectRenderer::mixChannel(void *context, unsigned int worker,
+                                size_t channel) {
+  auto &self = *static_cast<ObjectRenderer *>(context);
+  std::vector<const float *> &inputs = self.mWorkers[worker]->inputs;
+  size_t numInputs = 0;
+  for (auto &w : self.mWorkers) {
+    if (w->used) {
+      inputs[numInputs++] = w->bus.outBuffer(int(channel));
+    }
+  }
+  RenderPool::accumulate(self.mOutput->outBuffer(int(channel)) + self.mOffset,
+                         inputs.data(), numInputs, self.mFrames);
+}
+
 class SpatialSequencer : public DistributedAppWithState<SharedState> {
 public:
+  /// renderThreads is the number of threads, pinned to cores, that help
+  /// the audio thread render the objects, see ObjectRenderer. 0 renders
+  /// them all in the audio thread.
+  explicit SpatialSequencer(int renderThreads = 0)
+      : mRenderThreads(unsigned(std::max(renderThreads, 0))) {}
+
   std::string rootDir{""};
 
   DistributedScene scene{"spatial_sequencer", 0,
@@ -149,9 +750,23 @@ public:
   PersistentConfig config;
   DownMixer downMixer;
 
+  /// Sets the session folder, and compiles its .sequence files for the
+  /// voices, so triggering one doesn't read or parse anything
   void setPath(std::string path) {
     rootDir = al::File::conformDirectory(path);
     mSequencer.setDirectory(rootDir);
+    std::vector<std::string> sequenceFiles;
+    FileList files = fileListFromDir(rootDir);
+    for (size_t i = 0; i < files.count(); i++) {
+      const std::string name = files[i].file();
+      if (name.size() > 9 &&
+          name.compare(name.size() - 9, 9, ".sequence") == 0) {
+        sequenceFiles.push_back(name);
+      }
+    }
+    const size_t compiled = mAutomation.compile(rootDir, sequenceFiles);
+    std::cout << "Automation: compiled " << compiled << " of "
+              << sequenceFiles.size() << " .sequence files" << std::endl;
   }
 
   void onInit() override {
@@ -160,24 +775,32 @@ public:
     mObjectData.rootPath = rootDir;
     mObjectData.audioSampleRate = audioIO().framesPerSecond();
     mObjectData.audioBlockSize = audioIO().framesPerBuffer();
+    mObjectData.loader = &mLoader;
+    mObjectData.automation = &mAutomation;
+    mObjectData.renderer = &mRenderer;
     scene.setDefaultUserData(&mObjectData);
+    mObjectData.retiredFiles.reserve(kPolyphony);
+    mLoader.start(4);
 
     if (al::sphere::isSimulatorMachine()) {
     }
     auto sl = al::AlloSphereSpeakerLayoutCompensated();
-    mSpatializer = scene.setSpatializer<Lbap>(sl);
+    // The scene only runs the voices, mRenderer spatializes them
+    mSpatializer = scene.setSpatializer<DeferredSpatializer>(sl);
+    mRenderer.configure(sl, 60, mRenderThreads, true);
 
     audioIO().channelsOut(60);
     audioIO().print();
 
     downMixer.layoutToStereo(sl, audioIO());
     downMixer.setStereoOutput();
+    compileDownMixer(audioIO());
 
     mSequencer << scene;
 
     registerDynamicScene(scene);
     scene.registerSynthClass<AudioObject>(); // Allow AudioObject in sequences
-    scene.allocatePolyphony<AudioObject>(16);
+    scene.allocatePolyphony<AudioObject>(kPolyphony);
 
     // Prepare GUI
     if (isPrimary()) {
@@ -190,8 +813,22 @@ public:
           mObjectData.audioSampleRate = audioIO().framesPerSecond();
           mObjectData.audioBlockSize = audioIO().framesPerBuffer();
         }
+        ImGui::Text("Late starts: %llu (%llu blocks)",
+                    (unsigned long long)mObjectData.lateStarts.load(),
+                    (unsigned long long)mObjectData.lateBlocks.load());
+        ImGui::Text("Underruns: %llu (%llu frames)",
+                    (unsigned long long)mObjectData.underruns.load(),
+                    (unsigned long long)mObjectData.underrunFrames.load());
+        ImGui::Text("Open failures: %llu  Loader queue: %zu",
+                    (unsigned long long)mObjectData.openFailures.load(),
+                    mLoader.pending());
+        ImGui::Text("Objects not rendered: %llu",
+                    (unsigned long long)mRenderer.dropped());
       };
     }
+    std::cout << "Shared state: " << sizeof(SharedState)
+              << " bytes per frame (" << sizeof(float[64])
+              << " as float meters)" << std::endl;
     CuttleboneDomain<SharedState>::enableCuttlebone(this);
   }
 
@@ -206,12 +843,21 @@ public:
 
   void onAnimate(double dt) override {
     mSequencer.update(dt);
+    mObjectData.closeRetiredFiles();
     if (isPrimary()) {
       auto &values = mMeter.getMeterValues();
       assert(values.size() < 65);
-      memcpy(state().meterValues, values.data(), values.size() * sizeof(float));
+      uint32_t fields = 0;
+      if (state().meters.pack(values.data(), values.size())) {
+        fields |= kMeterField;
+      }
+      state().header.publish(fields);
     } else {
-      mMeter.setMeterValues(state().meterValues, 64);
+      const uint32_t fields = mStateReceiver.receive(state().header);
+      if (fields & kMeterField) {
+        state().meters.unpack(mMeterValues, 64, StateReceiver::all(fields));
+        mMeter.setMeterValues(mMeterValues, 64);
+      }
     }
   }
 
@@ -238,9 +884,21 @@ public:
 
   void onSound(AudioIOData &io) override {
     mSequencer.render(io);
+    mRenderer.render(io, scene.listenerPose(), scene.distanceAttenuation());
     mMeter.processSound(io);
     // downmix to stereo to bus 0 and 1
-    downMixer.downMixToBus(io);
+    if (mDownmixExact && size_t(io.channelsOut()) == mDownmixInputs.size()) {
+      for (size_t c = 0; c < mDownmixInputs.size(); c++) {
+        mDownmixInputs[c] = io.outBuffer(int(c));
+      }
+      for (size_t b = 0; b < mDownmixOutputs.size(); b++) {
+        mDownmixOutputs[b] = io.busBuffer(int(b));
+      }
+      mDownmix.process(mDownmixInputs.data(), mDownmixOutputs.data(),
+                       io.framesPerBuffer());
+    } else {
+      downMixer.downMixToBus(io);
+    }
     // This can be used to create a global reverb
     while (io()) {
       float lfeLevel = 0.1;
@@ -252,9 +910,67 @@ public:
     }
   }
 
-  void onExit() override {}
+  void onExit() override {
+    mRenderer.stop();
+    mObjectData.closeRetiredFiles();
+    mLoader.stop();
+  }
 
 private:
+  /// Measures downMixToBus() into a sparse matrix over the stereo bus, so
+  /// the callback only does the non-zero multiply-adds. The DownMixer stays
+  /// in use if the matrix doesn't match it bit for bit.
+  void compileDownMixer(AudioIOData &io) {
+    const size_t channels = io.channelsOut();
+    const size_t buses = std::min(2, io.channelsBus());
+    const size_t frames = io.framesPerBuffer();
+    mDownmix.build(channels, buses, false, [&](size_t input, float *gains) {
+      io.zeroOut();
+      io.zeroBus();
+      io.outBuffer(int(input))[0] = 1.0f;
+      io.frame(0);
+      downMixer.downMixToBus(io);
+      for (size_t b = 0; b < buses; b++) {
+        gains[b] = io.busBuffer(int(b))[0];
+      }
+    });
+    mDownmixExact =
+        buses > 0 &&
+        mDownmix.matches(frames, false,
+                         [&](float *const *inputs, float *const *outputs) {
+                           for (size_t c = 0; c < channels; c++) {
+                             std::copy(inputs[c], inputs[c] + frames,
+                                       io.outBuffer(int(c)));
+                           }
+                           for (size_t b = 0; b < buses; b++) {
+                             std::copy(outputs[b], outputs[b] + frames,
+                                       io.busBuffer(int(b)));
+                           }
+                           io.frame(0);
+                           downMixer.downMixToBus(io);
+                           for (size_t b = 0; b < buses; b++) {
+                             std::copy(io.busBuffer(int(b)),
+                                       io.busBuffer(int(b)) + frames,
+                                       outputs[b]);
+                           }
+                         });
+    io.zeroOut();
+    io.zeroBus();
+    mDownmixInputs.resize(channels);
+    mDownmixOutputs.resize(buses);
+    std::cout << "Downmix: " << mDownmix.numEntries() << " gains for "
+              << channels << " -> " << buses << " channels"
+              << (mDownmixExact ? "" : ", differs from DownMixer, not used")
+              << std::endl;
+  }
+
+  static const int kPolyphony = 16;
+
+  DownmixMatrix mDownmix;
+  bool mDownmixExact{false};
+  std::vector<float *> mDownmixInputs;
+  std::vector<float *> mDownmixOutputs;
+
   VAOMesh mObjectMesh;
   VAOMesh mSphereMesh;
 
@@ -262,18 +978,152 @@ private:
   AudioObjectData mObjectData;
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
   Meter mMeter;
+  // Renderers
+  StateReceiver mStateReceiver;
+  float mMeterValues[64] = {0};
+  AutomationLibrary mAutomation;
+  // Destroyed before the scene, so no job outlives the voices
+  WorkerPool mLoader;
+  ObjectRenderer mRenderer;
+  unsigned int mRenderThreads{0};
   std::shared_ptr<Spatializer> mSpatializer;
 };
 
+/// Renders numObjects AudioObjects spread over the sphere offline, as the
+/// audio callback would, and prints the time per block. With renderThreads
+/// > 0 that many pinned threads help render and spatialize the voices, each
+/// into its own 60 channel bus, and the buses are summed into the output.
+/// The objects play a generated noise file, streamed like any other.
+void benchmarkRender(size_t numObjects, int renderThreads, size_t numBlocks) {
+  const int sampleRate = 48000;
+  const unsigned int blockFrames = 512;
+  const int channels = 60;
+
+  const std::string fileName = "spatial_sequencer_benchmark.wav";
+  const std::string path = File::currentPath() + fileName;
+  {
+    WavWriter writer;
+    if (!writer.open(path, 1, sampleRate, WavSampleFormat::FLOAT32)) {
+      std::cerr << "ERROR: " << writer.errorMessage() << std::endl;
+      return;
+    }
+    std::vector<float> noise(size_t(sampleRate) * 30);
+    uint32_t state = 12345;
+    for (auto &sample : noise) {
+      state = state * 1664525u + 1013904223u;
+      sample = 0.1f * float(int32_t(state)) / 2147483648.0f;
+    }
+    writer.write(noise.data(), noise.size());
+  }
+
+  WorkerPool loader;
+  loader.start(4);
+  AudioObjectData objectData;
+  objectData.rootPath = File::currentPath();
+  objectData.audioSampleRate = sampleRate;
+  objectData.audioBlockSize = blockFrames;
+  objectData.mesh = nullptr;
+  objectData.loader = &loader;
+  objectData.retiredFiles.reserve(numObjects);
+  ObjectRenderer renderer;
+  objectData.renderer = &renderer;
+  {
+    DynamicScene scene;
+    scene.setDefaultUserData(&objectData);
+    const auto speakers = al::AlloSphereSpeakerLayoutCompensated();
+    scene.setSpatializer<DeferredSpatializer>(speakers);
+    renderer.configure(speakers, channels, unsigned(renderThreads), true,
+                       numObjects);
+    scene.registerSynthClass<AudioObject>();
+    scene.allocatePolyphony<AudioObject>(int(numObjects));
+
+    AudioIOData io;
+    io.framesPerSecond(sampleRate);
+    io.framesPerBuffer(blockFrames);
+    io.channelsOut(channels);
+    scene.prepare(io);
+
+    for (size_t i = 0; i < numObjects; i++) {
+      auto *voice = scene.getVoice<AudioObject>();
+      voice->file.set(fileName);
+      // Spiral from pole to pole
+      const double elevation = M_PI * ((i + 0.5) / numObjects - 0.5);
+      const double azimuth = 2.39996 * i;
+      voice->setPose(Pose(Vec3d(std::cos(elevation) * std::sin(azimuth),
+                                std::sin(elevation),
+                                std::cos(elevation) * std::cos(azimuth))));
+      scene.triggerOn(voice);
+    }
+    // Start the voices, and let the loader open their files
+    io.zeroOut();
+    scene.render(io);
+    renderer.render(io, scene.listenerPose(), scene.distanceAttenuation());
+    while (loader.pending() > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    double total = 0.0, worst = 0.0;
+    for (size_t block = 0; block < numBlocks; block++) {
+      const auto start = std::chrono::steady_clock::now();
+      io.zeroOut();
+      scene.render(io);
+      renderer.render(io, scene.listenerPose(), scene.distanceAttenuation());
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      total += seconds;
+      worst = std::max(worst, seconds);
+    }
+    const double deadline = double(blockFrames) / sampleRate;
+    const double mean = total / std::max<size_t>(numBlocks, 1);
+    std::printf("%zu objects, %d render threads: %.1f us per block (worst "
+                "%.1f us), %.1f%% of the %.0f us deadline\n",
+                numObjects, renderThreads, mean * 1e6, worst * 1e6,
+                100.0 * mean / deadline, deadline * 1e6);
+    std::printf("  late starts %llu, underruns %llu, open failures %llu\n",
+                (unsigned long long)objectData.lateStarts.load(),
+                (unsigned long long)objectData.underruns.load(),
+                (unsigned long long)objectData.openFailures.load());
+    renderer.stop();
+    objectData.closeRetiredFiles();
+    loader.stop();
+  }
+  std::remove(path.c_str());
+}
+
 int main(int argc, char *argv[]) {
-  SpatialSequencer app;
+  std::string folder = "Morris Allosphere piece";
+  int renderThreads = 0;
+  size_t benchmarkObjects = 0;
+  size_t benchmarkBlocks = 2000;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return -1;
+    } else if (arg == "--threads") {
+      renderThreads = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--benchmark") {
+      benchmarkObjects = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--blocks") {
+      benchmarkBlocks = size_t(std::max(1, std::atoi(argv[++i])));
+    } else {
+      folder = arg;
+    }
+  }
 
-  std::string folder;
-  if (argc > 1) {
-    folder = argv[1];
-  } else {
-    folder = "Morris Allosphere piece";
+  if (benchmarkObjects > 0) {
+    // Serial, then with the --threads helpers, if any
+    benchmarkRender(benchmarkObjects, 0, benchmarkBlocks);
+    if (renderThreads > 0) {
+      benchmarkRender(benchmarkObjects, renderThreads, benchmarkBlocks);
+    }
+    return 0;
   }
+
+  SpatialSequencer app(renderThreads);
   app.setPath(folder);
 
   app.start();
@@ -26,13 +26,21 @@
 #include "Gamma/Noise.h"
 #include "Gamma/scl.h"
 
+#include "MeterLevels.h"
+#include "StatePacking.h"
+
 using namespace al;
 
+/// Sent to the renderers every frame, see StatePacking.h
 struct SharedState {
-  float meterValues[64] = {0};
-  Pose pose;
+  StateHeader header;
+  PackedMeters<64> meters;
+  PackedPose pose;
 };
 
+/// StateHeader::changedFields
+enum : uint32_t { kMeterField = 1, kPoseField = 2 };
+
 struct AudioObjectData {
   uint16_t audioSampleRate;
   uint16_t audioBlockSize;
@@ -41,45 +49,23 @@ struct AudioObjectData {
 
 class Meter {
 public:
-  void init(const Speakers &sl) {
+  /// Allocates for numChannels output channels. Call before the audio
+  /// starts; processSound() doesn't allocate.
+  void init(const Speakers &sl, size_t numChannels, double sampleRate,
+            MeterMode mode = MeterMode::Peak) {
     addCube(mMesh);
     mSl = sl;
+    mLevels.configure(numChannels, sampleRate, mode);
+    mChannels.resize(numChannels);
   }
 
   void processSound(AudioIOData &io) {
-
-    if (tempValues.size() != io.channelsOut()) {
-      tempValues.resize(io.channelsOut());
-      values.resize(io.channelsOut());
-      std::cout << "Resizing Meter buffers" << std::endl;
-    }
-    for (int i = 0; i < io.channelsOut(); i++) {
-      tempValues[i] = FLT_MIN;
-      auto *outBuf = io.outBuffer(i);
-      auto fpb = io.framesPerBuffer();
-      for (int samp = 0; samp < fpb; samp++) {
-        float val = fabs(*outBuf);
-        if (tempValues[i] < val) {
-          tempValues[i] = val;
-        }
-        outBuf++;
-      }
-      if (tempValues[i] == 0) {
-        tempValues[i] = 0.01;
-      } else {
-        float db = 20.0 * log10(tempValues[i]);
-        if (db < -60) {
-          tempValues[i] = 0.01;
-        } else {
-          tempValues[i] = 0.01 + 0.005 * (60 + db);
-        }
-      }
-      if (values[i] > tempValues[i]) {
-        values[i] = values[i] - 0.05 * (values[i] - tempValues[i]);
-      } else {
-        values[i] = tempValues[i];
-      }
+    const size_t numChannels =
+        std::min(size_t(io.channelsOut()), mChannels.size());
+    for (size_t i = 0; i < numChannels; i++) {
+      mChannels[i] = io.outBuffer(i);
     }
+    mLevels.process(mChannels.data(), numChannels, io.framesPerBuffer());
   }
 
   void draw(Graphics &g) {
@@ -87,7 +73,7 @@ public:
     int index = 0;
     auto spkrIt = mSl.begin();
     g.color(1);
-    for (const auto &v : values) {
+    for (const auto &v : mLevels.values()) {
       if (spkrIt != mSl.end()) {
         // FIXME assumes speakers are sorted by device channel index
         // Should sort inside init()
@@ -107,25 +93,16 @@ public:
     }
   }
 
-  const std::vector<float> &getMeterValues() { return values; }
+  const std::vector<float> &getMeterValues() { return mLevels.values(); }
 
   void setMeterValues(float *newValues, size_t count) {
-    if (tempValues.size() != count) {
-      tempValues.resize(count);
-      values.resize(count);
-      std::cout << "Resizing Meter buffers" << std::endl;
-    }
-    count = values.size();
-    for (int i = 0; i < count; i++) {
-      values[i] = *newValues;
-      newValues++;
-    }
+    mLevels.setValues(newValues, count);
   }
 
 private:
   Mesh mMesh;
-  std::vector<float> values;
-  std::vector<float> tempValues;
+  MeterLevels mLevels;
+  std::vector<const float *> mChannels;
   Speakers mSl;
 };
 
@@ -226,6 +203,8 @@ private:
 class SpatialSequencer : public DistributedAppWithState<SharedState> {
 public:
   std::string rootDir{""};
+  /// Peak meters, or mean square integrated over 0.4 s
+  MeterMode meterMode{MeterMode::Peak};
 
   DistributedScene scene{"spatial_sequencer", 0,
                          TimeMasterMode::TIME_MASTER_GRAPHICS};
@@ -287,6 +266,9 @@ public:
       };
     }
 
+    std::cout << "Shared state: " << sizeof(SharedState)
+              << " bytes per frame (" << sizeof(float[64]) + sizeof(Pose)
+              << " as float meters and a Pose)" << std::endl;
     CuttleboneDomain<SharedState>::enableCuttlebone(this);
   }
 
@@ -296,7 +278,8 @@ public:
     mSphereMesh.update();
     addSphere(mObjectMesh, 0.1, 8, 4);
     mObjectMesh.update();
-    mMeter.init(mSpatializer->speakerLayout());
+    mMeter.init(mSpatializer->speakerLayout(), audioIO().channelsOut(),
+                audioIO().framesPerSecond(), meterMode);
   }
 
   void onAnimate(double dt) override {
@@ -304,11 +287,32 @@ public:
     if (isPrimary()) {
       auto &values = mMeter.getMeterValues();
       assert(values.size() < 65);
-      memcpy(state().meterValues, values.data(), values.size() * sizeof(float));
-      state().pose = nav();
+      uint32_t fields = 0;
+      if (state().meters.pack(values.data(), values.size())) {
+        fields |= kMeterField;
+      }
+      const Vec3d &pos = nav().pos();
+      const Quatd &quat = nav().quat();
+      const float position[3] = {float(pos.x), float(pos.y), float(pos.z)};
+      const float quaternion[4] = {float(quat.w), float(quat.x),
+                                   float(quat.y), float(quat.z)};
+      if (state().pose.pack(position, quaternion)) {
+        fields |= kPoseField;
+      }
+      state().header.publish(fields);
     } else {
-      mMeter.setMeterValues(state().meterValues, 64);
-      nav().set(state().pose);
+      const uint32_t fields = mStateReceiver.receive(state().header);
+      if (fields & kMeterField) {
+        state().meters.unpack(mMeterValues, 64, StateReceiver::all(fields));
+        mMeter.setMeterValues(mMeterValues, 64);
+      }
+      if (fields & kPoseField) {
+        float position[3], quaternion[4];
+        state().pose.unpack(position, quaternion);
+        nav().set(Pose(Vec3d(position[0], position[1], position[2]),
+                       Quatd(quaternion[0], quaternion[1], quaternion[2],
+                             quaternion[3])));
+      }
     }
   }
 
@@ -364,6 +368,9 @@ private:
   AudioObjectData mObjectData;
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
   Meter mMeter;
+  // Renderers
+  StateReceiver mStateReceiver;
+  float mMeterValues[64] = {0};
   std::shared_ptr<Spatializer> mSpatializer;
 };
 
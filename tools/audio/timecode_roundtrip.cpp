@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "MTCGenerator.h"
+#include "MTCParser.h"
+#include "Timecode.h"
+
+// Checks the timecode arithmetic of Timecode.h and the quarter frames of
+// MTCGenerator.h exhaustively, over 24 hours of frames at every MTC rate.
+// Prints the first mismatches and exits with 1 if there are any. See
+// readme_timecode_roundtrip.md
+
+namespace {
+
+const char *rateName(TimecodeRate rate) {
+  switch (rate) {
+  case TimecodeRate::FPS_24:
+    return "24";
+  case TimecodeRate::FPS_25:
+    return "25";
+  case TimecodeRate::FPS_29_97_DF:
+    return "29.97 drop";
+  case TimecodeRate::FPS_30:
+    return "30";
+  }
+  return "?";
+}
+
+std::string label(const Timecode &tc) {
+  char text[16];
+  std::snprintf(text, sizeof(text), "%02d:%02d:%02d%c%02d", tc.hours,
+                tc.minutes, tc.seconds,
+                tc.rate == TimecodeRate::FPS_29_97_DF ? ';' : ':', tc.frames);
+  return text;
+}
+
+struct Checker {
+  uint64_t checks{0};
+  uint64_t mismatches{0};
+
+  /// Counts a check, and prints the first few that fail
+  bool expect(bool ok, const std::string &what) {
+    checks++;
+    if (!ok) {
+      if (mismatches < 10) {
+        std::cerr << "MISMATCH: " << what << std::endl;
+      }
+      mismatches++;
+    }
+    return ok;
+  }
+};
+
+// Every label of the day in order: frame counts must follow one by one, both
+// ways, and full frame messages must decode to the same label. Labels that
+// drop-frame skips must map to the next existing frame.
+void checkLabels(TimecodeRate rate, Checker &checker) {
+  const int nominal = Timecode::nominalFrameRate(rate);
+  MTCParser parser;
+  int64_t count = 0;
+  for (int h = 0; h < 24; h++) {
+    for (int m = 0; m < 60; m++) {
+      for (int s = 0; s < 60; s++) {
+        for (int f = 0; f < nominal; f++) {
+          const Timecode tc(uint8_t(h), uint8_t(m), uint8_t(s), uint8_t(f),
+                            rate);
+          if (!tc.valid()) {
+            checker.expect(tc.toFrameCount() == count,
+                           "skipped " + label(tc) + " -> " +
+                               std::to_string(tc.toFrameCount()) +
+                               ", next frame is " + std::to_string(count));
+            continue;
+          }
+          checker.expect(tc.toFrameCount() == count,
+                         label(tc) + " -> " +
+                             std::to_string(tc.toFrameCount()) +
+                             ", expected " + std::to_string(count));
+          const Timecode back = Timecode::fromFrameCount(count, rate);
+          checker.expect(back == tc, std::to_string(count) + " -> " +
+                                         label(back) + ", expected " +
+                                         label(tc));
+          const MTCMessage message = MTCGenerator::fullFrame(tc);
+          parser.feed(message.bytes, message.size);
+          if (checker.expect(parser.available(),
+                             "full frame " + label(tc) + " not decoded")) {
+            checker.expect(parser.timecode() == tc,
+                           "full frame " + label(tc) + " decoded as " +
+                               label(parser.timecode()));
+            parser.pop();
+          }
+          count++;
+        }
+      }
+    }
+  }
+  checker.expect(count == Timecode::framesPerDay(rate),
+                 std::to_string(count) + " labels per day, framesPerDay() is " +
+                     std::to_string(Timecode::framesPerDay(rate)));
+  checker.expect(Timecode::fromFrameCount(count, rate) ==
+                     Timecode(0, 0, 0, 0, rate),
+                 "frame count of a day doesn't wrap to 00:00:00:00");
+  checker.expect(Timecode::fromFrameCount(-1, rate) ==
+                     Timecode(23, 59, 59, uint8_t(nominal - 1), rate),
+                 "frame count -1 doesn't wrap to the last frame");
+}
+
+// Frame counts to sample positions and back, at the first sample of every
+// frame and the one before it
+void checkSamples(TimecodeRate rate, uint32_t sampleRate, Checker &checker) {
+  const int64_t frames = Timecode::framesPerDay(rate);
+  for (int64_t f = -2; f <= frames + 2; f++) {
+    const int64_t sample = Timecode::frameCountToSamples(f, rate, sampleRate);
+    const int64_t back =
+        Timecode::samplesToFrameCount(sample, rate, sampleRate);
+    const int64_t before =
+        Timecode::samplesToFrameCount(sample - 1, rate, sampleRate);
+    checker.expect(back == f && before == f - 1,
+                   "frame " + std::to_string(f) + " at " +
+                       std::to_string(sampleRate) + " Hz starts at sample " +
+                       std::to_string(sample) + ", which maps to frame " +
+                       std::to_string(back));
+  }
+}
+
+// A day (and a bit, to cross midnight) of quarter frames, generated in
+// blocks and decoded: every sequence must carry the frame two after the
+// previous one, and arrive after that frame started.
+void checkGenerator(TimecodeRate rate, uint32_t sampleRate,
+                    uint32_t blockSize, Checker &checker) {
+  const int64_t framesPerDay = Timecode::framesPerDay(rate);
+  const int64_t end =
+      Timecode::frameCountToSamples(framesPerDay + 8, rate, sampleRate);
+  MTCGenerator generator(rate, sampleRate);
+  MTCParser parser;
+  MTCMessage messages[64];
+  int64_t lastSample = -1;
+  int64_t lastFrame = -1;
+  int64_t decoded = 0;
+  for (int64_t block = 0; block < end; block += blockSize) {
+    const size_t count = generator.generate(block, blockSize, messages, 64);
+    for (size_t i = 0; i < count; i++) {
+      const int64_t sample = block + messages[i].sampleOffset;
+      checker.expect(sample > lastSample && messages[i].sampleOffset <
+                                                blockSize,
+                     "quarter frame at sample " + std::to_string(sample) +
+                         " out of order");
+      lastSample = sample;
+      parser.feed(messages[i].bytes, messages[i].size);
+      while (parser.available()) {
+        const Timecode tc = parser.timecode();
+        parser.pop();
+        // Unwrapped, so the start time can be compared after midnight
+        int64_t frame = tc.toFrameCount();
+        while (frame < lastFrame) {
+          frame += framesPerDay;
+        }
+        checker.expect(lastFrame < 0 || frame == lastFrame + 2,
+                       "decoded " + label(tc) + " after frame " +
+                           std::to_string(lastFrame));
+        checker.expect(
+            sample >= Timecode::frameCountToSamples(frame, rate, sampleRate),
+            "decoded " + label(tc) + " at sample " + std::to_string(sample) +
+                ", before the frame started");
+        lastFrame = frame;
+        decoded++;
+      }
+    }
+  }
+  checker.expect(decoded >= framesPerDay / 2,
+                 "only " + std::to_string(decoded) + " timecodes decoded");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  uint32_t blockSize = 512;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--block" && i + 1 < argc) {
+      blockSize = uint32_t(std::max(1, std::atoi(argv[++i])));
+    } else {
+      std::cout << "Usage: timecode_roundtrip [--block <frames>]\n"
+                   "  --block <frames>    generator block size, default 512"
+                << std::endl;
+      return arg == "--help" || arg == "-h" ? 0 : 1;
+    }
+  }
+
+  const TimecodeRate rates[] = {TimecodeRate::FPS_24, TimecodeRate::FPS_25,
+                                TimecodeRate::FPS_29_97_DF,
+                                TimecodeRate::FPS_30};
+  const uint32_t sampleRates[] = {44100, 48000, 96000, 192000};
+
+  Checker checker;
+  for (TimecodeRate rate : rates) {
+    const uint64_t before = checker.mismatches;
+    checkLabels(rate, checker);
+    for (uint32_t sampleRate : sampleRates) {
+      checkSamples(rate, sampleRate, checker);
+    }
+    checkGenerator(rate, 48000, blockSize, checker);
+    std::cout << rateName(rate) << " fps: "
+              << Timecode::framesPerDay(rate) << " frames per day, "
+              << checker.mismatches - before << " mismatches" << std::endl;
+  }
+  std::cout << checker.checks << " checks, " << checker.mismatches
+            << " mismatches" << std::endl;
+  return checker.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PlaybackTransport.h"
+#include "StreamingScheduler.h"
+#include "WavFile.h"
+
+// Plays 60 generated WAV files in sync through StreamingScheduler and
+// PlaybackTransport, in real time and without an audio device, while a
+// control thread fires random locates, skips and pauses. Every block of
+// every stream is compared with the frames the transport position says it
+// should hold, and the fades are checked for steps. Exits with 1 on any
+// mismatch. See readme_transport_selftest.md
+
+namespace {
+
+const int kStreams = 60;
+const int kSampleRate = 48000;
+const size_t kBlockFrames = 1024;
+const uint32_t kFadeFrames = kSampleRate / 200; // 5 ms, as multichannel_playback
+const uint64_t kPrefetchFrames = 8192;
+
+// Sample of a generated file, unique per stream, frame and channel, and
+// exact in float
+float sampleValue(int stream, uint64_t frame, int channel) {
+  return float((frame * 7 + uint64_t(channel) * 13 + uint64_t(stream) * 101) %
+               30001) /
+             30001.0f -
+         0.5f;
+}
+
+int streamChannels(int stream) { return stream % 11 == 0 ? 8 : 1; }
+
+std::string streamPath(const std::string &dir, int stream) {
+  return dir + "/transport_selftest_" + std::to_string(stream) + ".wav";
+}
+
+bool writeFiles(const std::string &dir, uint64_t frames) {
+  std::vector<float> buffer;
+  for (int i = 0; i < kStreams; i++) {
+    const int channels = streamChannels(i);
+    WavWriter writer;
+    if (!writer.open(streamPath(dir, i), channels, kSampleRate,
+                     WavSampleFormat::FLOAT32)) {
+      std::cerr << "ERROR: " << writer.errorMessage() << std::endl;
+      return false;
+    }
+    buffer.resize(4096 * size_t(channels));
+    for (uint64_t f = 0; f < frames; f += 4096) {
+      const uint64_t n = std::min<uint64_t>(4096, frames - f);
+      for (uint64_t k = 0; k < n; k++) {
+        for (int c = 0; c < channels; c++) {
+          buffer[k * channels + c] = sampleValue(i, f + k, c);
+        }
+      }
+      if (!writer.write(buffer.data(), n)) {
+        std::cerr << "ERROR: " << writer.errorMessage() << std::endl;
+        return false;
+      }
+    }
+    if (!writer.close()) {
+      std::cerr << "ERROR: can't finalize " << streamPath(dir, i) << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+struct PassResult {
+  uint64_t blocksRead{0};
+  uint64_t silentBlocks{0};
+  uint64_t locates{0};
+  uint64_t badSamples{0};
+  uint64_t misalignedReads{0};
+  uint64_t gainSteps{0};
+  uint64_t underruns{0};
+  double worstBeginBlock{0.0};
+
+  bool ok() const {
+    return badSamples == 0 && misalignedReads == 0 && gainSteps == 0;
+  }
+};
+
+// One pass of `seconds` in real time. Stream 1 loops; with mapHalf, every
+// second stream is memory mapped and read without a copy.
+PassResult runPass(const std::string &dir, uint64_t frames, double seconds,
+                   bool mapHalf) {
+  PassResult result;
+  StreamingScheduler streamer;
+  streamer.configure(StreamingConfig());
+  std::vector<int> streams;
+  for (int i = 0; i < kStreams; i++) {
+    streams.push_back(
+        streamer.addFile(streamPath(dir, i), i == 1, mapHalf && i % 2 == 1));
+    if (streams.back() < 0) {
+      std::cerr << "ERROR: " << streamer.errorMessage() << std::endl;
+      result.badSamples++;
+      return result;
+    }
+  }
+  PlaybackTransport transport;
+  transport.configure(streamer, kFadeFrames, kPrefetchFrames);
+  transport.setStreams(streams);
+  streamer.start();
+
+  // Commands at random times, like a user on the transport buttons
+  std::atomic<bool> done{false};
+  std::thread control([&]() {
+    std::mt19937 random(1);
+    transport.play();
+    while (!done) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(50 + random() % 300));
+      switch (random() % 5) {
+      case 0:
+        transport.locate(random() % frames);
+        break;
+      case 1:
+        transport.skip(5 * kSampleRate);
+        break;
+      case 2:
+        transport.skip(-5 * kSampleRate);
+        break;
+      case 3:
+        transport.pause();
+        std::this_thread::sleep_for(std::chrono::milliseconds(random() % 100));
+        transport.play();
+        break;
+      default:
+        transport.locate(frames - 2000); // runs into the end of the files
+        break;
+      }
+    }
+  });
+
+  const float maxGainStep = 1.0f / float(kFadeFrames) + 1e-6f;
+  std::vector<float> buffer(kBlockFrames * 8);
+  std::vector<float> gain(kBlockFrames);
+  float lastGain = 0.0f;
+  const int64_t blocks = int64_t(seconds * kSampleRate / kBlockFrames);
+  const auto blockPeriod =
+      std::chrono::microseconds(kBlockFrames * 1000000 / kSampleRate);
+  auto next = std::chrono::steady_clock::now();
+  for (int64_t b = 0; b < blocks; b++) {
+    next += blockPeriod;
+    std::this_thread::sleep_until(next);
+
+    const auto start = std::chrono::steady_clock::now();
+    const TransportBlock block = transport.beginBlock(kBlockFrames);
+    result.worstBeginBlock = std::max(
+        result.worstBeginBlock, std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count());
+    if (!block.read) {
+      // Silence only after a fade out
+      if (lastGain > maxGainStep) {
+        result.gainSteps++;
+      }
+      lastGain = 0.0f;
+      result.silentBlocks++;
+      continue;
+    }
+    result.blocksRead++;
+
+    for (int i = 0; i < kStreams; i++) {
+      const int channels = streamer.channels(streams[i]);
+      uint64_t framesRead = 0;
+      const float *samples =
+          streamer.readDirect(streams[i], kBlockFrames, framesRead);
+      if (!samples) {
+        framesRead = streamer.read(streams[i], buffer.data(), kBlockFrames);
+        samples = buffer.data();
+      }
+      const bool loops = streamer.loops(streams[i]);
+      const uint64_t first = loops ? block.position % frames : block.position;
+      const uint64_t expected =
+          loops ? kBlockFrames
+                : (first >= frames ? 0
+                                   : std::min<uint64_t>(kBlockFrames,
+                                                        frames - first));
+      if (framesRead != expected) {
+        result.misalignedReads++;
+      }
+      for (uint64_t k = 0; k < framesRead; k++) {
+        for (int c = 0; c < channels; c++) {
+          if (samples[k * channels + c] !=
+              sampleValue(i, (first + k) % frames, c)) {
+            result.badSamples++;
+          }
+        }
+      }
+    }
+
+    // The gain may only move by one fade step per frame, across blocks too
+    std::fill(gain.begin(), gain.end(), 1.0f);
+    block.applyGain(gain.data(), kBlockFrames);
+    if (std::fabs(gain[0] - lastGain) > maxGainStep) {
+      result.gainSteps++;
+    }
+    for (size_t k = 1; k < kBlockFrames; k++) {
+      if (std::fabs(gain[k] - gain[k - 1]) > maxGainStep) {
+        result.gainSteps++;
+      }
+    }
+    lastGain = gain[kBlockFrames - 1];
+  }
+  done = true;
+  control.join();
+  streamer.stop();
+
+  result.locates = transport.locateCount();
+  for (int stream : streams) {
+    result.underruns += streamer.underruns(stream);
+  }
+  return result;
+}
+
+void printUsage() {
+  std::cout << "Usage: transport_selftest [options]\n"
+               "  --dir <dir>         where the test files are written, "
+               "default .\n"
+               "  --seconds <s>       length of each pass, default 20\n"
+               "  --keep              don't delete the test files\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string dir = ".";
+  double seconds = 20.0;
+  bool keep = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg == "--keep") {
+      keep = true;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--dir") {
+      dir = argv[++i];
+    } else if (arg == "--seconds") {
+      seconds = std::max(1.0, std::atof(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  // Short files, so the locates near the end and the loop wrap come up
+  // often
+  const uint64_t frames = uint64_t(kSampleRate) * 10;
+  std::cout << "Writing " << kStreams << " test files to " << dir << std::endl;
+  if (!writeFiles(dir, frames)) {
+    return 1;
+  }
+
+  bool ok = true;
+  for (bool mapHalf : {false, true}) {
+    const PassResult r = runPass(dir, frames, seconds, mapHalf);
+    std::cout << (mapHalf ? "half mapped" : "streamed") << ": "
+              << r.blocksRead << " blocks read, " << r.silentBlocks
+              << " silent, " << r.locates << " locates, " << r.badSamples
+              << " bad samples, " << r.misalignedReads
+              << " misaligned reads, " << r.gainSteps << " gain steps, "
+              << r.underruns << " underruns, worst beginBlock "
+              << r.worstBeginBlock * 1e6 << " us" << std::endl;
+    ok = ok && r.ok();
+  }
+
+  if (!keep) {
+    for (int i = 0; i < kStreams; i++) {
+      std::remove(streamPath(dir, i).c_str());
+    }
+  }
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../tutorials/allolib-s21/SimpleCompressor/src/TruePeakDetector.cpp"
+
+// Compares the 4x polyphase output of TruePeakDetector with a direct-form
+// evaluation of the same filter and with a long reference upsampler, on
+// random signals in random block sizes, and times it. Exits with 1 on any
+// deviation beyond the bounds. See readme_truepeak_check.md
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kSampleRate = 48000.0;
+const int kFactor = TruePeakDetector::oversamplingFactor;
+const int kTaps = TruePeakDetector::tapsPerPhase;
+const int kLatency = TruePeakDetector::getLatencyInSamples();
+
+// The same filter as the detector, in double precision and direct form
+const double kFilterBound = 1e-5; // relative to the signal peak
+// The short filter against the long one, for signals up to kBandLimit
+const double kBandLimit = 17000.0;
+const double kReferenceBoundDb = 0.05;
+
+// Zeroth-order modified Bessel function of the first kind, computed here
+// again so the reference doesn't share code with the detector
+double referenceBesselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 50; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// Interpolated value at input position n + phase / kFactor
+class Upsampler {
+public:
+  virtual ~Upsampler() {}
+  virtual double at(const std::vector<float> &x, long n, int phase) const = 0;
+};
+
+// The detector's own filter: a 49-tap Kaiser sinc (beta 5), each phase
+// normalized to unity gain at DC, evaluated one output at a time
+class SameFilter : public Upsampler {
+public:
+  SameFilter() {
+    const int length = kFactor * kTaps + 1;
+    const double center = 0.5 * (length - 1);
+    for (int phase = 1; phase < kFactor; ++phase) {
+      double sum = 0.0;
+      for (int k = 0; k < kTaps; ++k) {
+        const double n = kFactor * k + phase - center;
+        const double x = kPi * n / kFactor;
+        const double r = n / center;
+        mTaps[phase][k] = std::sin(x) / x *
+                          referenceBesselI0(5.0 * std::sqrt(1.0 - r * r)) /
+                          referenceBesselI0(5.0);
+        sum += mTaps[phase][k];
+      }
+      for (int k = 0; k < kTaps; ++k) {
+        mTaps[phase][k] /= sum;
+      }
+    }
+  }
+
+  double at(const std::vector<float> &x, long n, int phase) const override {
+    // tap k weights the input sample kLatency - k after n
+    double y = 0.0;
+    for (int k = 0; k < kTaps; ++k) {
+      const long m = n + kLatency - k;
+      if (m >= 0 && m < long(x.size())) {
+        y += mTaps[phase][k] * x[size_t(m)];
+      }
+    }
+    return y;
+  }
+
+private:
+  double mTaps[kFactor][kTaps];
+};
+
+// A windowed sinc over 2 * kHalfLength input samples (1024 taps at the
+// upsampled rate), Kaiser beta 8, close to ideal up to 20 kHz at 48 kHz
+class LongSinc : public Upsampler {
+public:
+  static const int kHalfLength = 128;
+
+  LongSinc() {
+    for (int phase = 1; phase < kFactor; ++phase) {
+      const double t = double(phase) / kFactor;
+      for (int j = 0; j < 2 * kHalfLength; ++j) {
+        // tap j weights the input sample n - kHalfLength + 1 + j
+        const double d = t + kHalfLength - 1 - j;
+        const double r = d / kHalfLength;
+        mTaps[phase][j] = std::sin(kPi * d) / (kPi * d) *
+                          referenceBesselI0(8.0 * std::sqrt(1.0 - r * r)) /
+                          referenceBesselI0(8.0);
+      }
+    }
+  }
+
+  double at(const std::vector<float> &x, long n, int phase) const override {
+    double y = 0.0;
+    for (int j = 0; j < 2 * kHalfLength; ++j) {
+      const long m = n - kHalfLength + 1 + j;
+      if (m >= 0 && m < long(x.size())) {
+        y += mTaps[phase][j] * x[size_t(m)];
+      }
+    }
+    return y;
+  }
+
+private:
+  double mTaps[kFactor][2 * kHalfLength];
+};
+
+// The detector output at sample i: the largest absolute value of input
+// sample i - latency and the three interpolated values after it
+double expectedPeak(const Upsampler &upsampler, const std::vector<float> &x,
+                    long i) {
+  const long n = i - kLatency;
+  double peak = n >= 0 && n < long(x.size()) ? std::fabs(x[size_t(n)]) : 0.0;
+  for (int phase = 1; phase < kFactor; ++phase) {
+    peak = std::max(peak, std::fabs(upsampler.at(x, n, phase)));
+  }
+  return peak;
+}
+
+// Random sines up to maxFrequency, with random amplitudes and phases,
+// scaled to a sample peak of 0.5
+std::vector<float> makeSignal(std::mt19937 &random, size_t numSamples,
+                              double maxFrequency) {
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const int numSines = 1 + int(8.0 * uniform(random));
+  std::vector<double> signal(numSamples, 0.0);
+  for (int s = 0; s < numSines; ++s) {
+    const double frequency = 20.0 + (maxFrequency - 20.0) * uniform(random);
+    const double amplitude = uniform(random);
+    const double phase = 2.0 * kPi * uniform(random);
+    for (size_t i = 0; i < numSamples; ++i) {
+      signal[i] += amplitude * std::sin(2.0 * kPi * frequency * double(i) /
+                                            kSampleRate +
+                                        phase);
+    }
+  }
+  double peak = 1e-9;
+  for (double s : signal) {
+    peak = std::max(peak, std::fabs(s));
+  }
+  std::vector<float> x(numSamples);
+  for (size_t i = 0; i < numSamples; ++i) {
+    x[i] = float(0.5 * signal[i] / peak);
+  }
+  return x;
+}
+
+// Runs channels through one detector in random block sizes, with process
+// for channel 0 and processMax for the others, as MultichannelCompressor
+// does. Returns the per-channel outputs and the linked one.
+void runDetector(const std::vector<std::vector<float>> &channels,
+                 int maxBlock, std::mt19937 &random,
+                 std::vector<std::vector<float>> &perChannel,
+                 std::vector<float> &linked) {
+  const int numChannels = int(channels.size());
+  const size_t numSamples = channels[0].size();
+  TruePeakDetector single, multi;
+  single.prepare(maxBlock, numChannels);
+  multi.prepare(maxBlock, numChannels);
+  perChannel.assign(channels.size(), std::vector<float>(numSamples));
+  linked.assign(numSamples, 0.0f);
+  std::uniform_int_distribution<int> blockSize(1, maxBlock);
+  for (size_t offset = 0; offset < numSamples;) {
+    const int n =
+        int(std::min<size_t>(size_t(blockSize(random)), numSamples - offset));
+    for (int c = 0; c < numChannels; ++c) {
+      single.process(c, channels[size_t(c)].data() + offset,
+                     perChannel[size_t(c)].data() + offset, n);
+      if (c == 0) {
+        multi.process(c, channels[0].data() + offset, linked.data() + offset,
+                      n);
+      } else {
+        multi.processMax(c, channels[size_t(c)].data() + offset,
+                         linked.data() + offset, n);
+      }
+    }
+    offset += size_t(n);
+  }
+}
+
+struct Errors {
+  double filter{0.0};       // relative to the peak, against SameFilter
+  double linked{0.0};       // processMax against the per-channel maximum
+  double bandLimitedDb{0.0}; // peak against LongSinc, up to kBandLimit
+  double fullBandDb{0.0};    // peak against LongSinc, up to 20 kHz
+};
+
+double toDb(double ratio) { return 20.0 * std::log10(ratio); }
+
+void checkSignal(std::mt19937 &random, bool bandLimited, Errors &errors) {
+  std::uniform_int_distribution<int> channelCount(1, 8), maxBlock(1, 512);
+  const int numChannels = channelCount(random);
+  const size_t numSamples = 4096;
+  std::vector<std::vector<float>> channels;
+  for (int c = 0; c < numChannels; ++c) {
+    channels.push_back(
+        makeSignal(random, numSamples, bandLimited ? kBandLimit : 20000.0));
+  }
+  std::vector<std::vector<float>> perChannel;
+  std::vector<float> linked;
+  runDetector(channels, maxBlock(random), random, perChannel, linked);
+
+  static const SameFilter sameFilter;
+  static const LongSinc longSinc;
+  for (size_t i = 0; i < numSamples; ++i) {
+    float channelMax = 0.0f;
+    for (int c = 0; c < numChannels; ++c) {
+      channelMax = std::max(channelMax, perChannel[size_t(c)][i]);
+    }
+    errors.linked = std::max(errors.linked, double(std::fabs(linked[i] -
+                                                             channelMax)));
+  }
+  for (int c = 0; c < numChannels; ++c) {
+    const std::vector<float> &x = channels[size_t(c)];
+    const std::vector<float> &y = perChannel[size_t(c)];
+    double detectorPeak = 0.0, referencePeak = 0.0;
+    for (size_t i = 0; i < numSamples; ++i) {
+      errors.filter = std::max(
+          errors.filter,
+          std::fabs(y[i] - expectedPeak(sameFilter, x, long(i))) / 0.5);
+      // away from the edges, where the long filter runs out of samples
+      if (i >= size_t(LongSinc::kHalfLength) &&
+          i + size_t(LongSinc::kHalfLength) < numSamples) {
+        detectorPeak = std::max(detectorPeak, double(y[i]));
+        referencePeak =
+            std::max(referencePeak, expectedPeak(longSinc, x, long(i)));
+      }
+    }
+    const double deviation = std::fabs(toDb(detectorPeak / referencePeak));
+    double &error = bandLimited ? errors.bandLimitedDb : errors.fullBandDb;
+    error = std::max(error, deviation);
+  }
+}
+
+void printUsage() {
+  std::cout << "Usage: truepeak_check [options]\n"
+               "  --signals <n>       random signals, default 200\n"
+               "  --seed <n>          default 1\n"
+               "  --block <frames>    benchmark block size, default 128\n"
+               "  --channels <n>      benchmark channels, default 60\n"
+               "  --runs <n>          timed runs, the fastest counts, "
+               "default 5\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int numSignals = 200;
+  unsigned int seed = 1;
+  int blockSize = 128;
+  int numChannels = 60;
+  int runs = 5;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+      std::cerr << "ERROR: missing value for " << arg << std::endl;
+      return 1;
+    } else if (arg == "--signals") {
+      numSignals = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--seed") {
+      seed = unsigned(std::atoi(argv[++i]));
+    } else if (arg == "--block") {
+      blockSize = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--channels") {
+      numChannels = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--runs") {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::mt19937 random(seed);
+  Errors errors;
+  for (int s = 0; s < numSignals; ++s) {
+    checkSignal(random, s % 2 == 0, errors);
+  }
+  std::cout << numSignals << " random signals of 1 to 8 channels\n"
+            << "  against the same filter in direct form: max error "
+            << errors.filter << " of the peak (bound " << kFilterBound
+            << ")\n"
+            << "  processMax against the per-channel maximum: max error "
+            << errors.linked << "\n"
+            << "  true peak against the long reference, up to "
+            << kBandLimit / 1000.0 << " kHz: max deviation "
+            << errors.bandLimitedDb << " dB (bound " << kReferenceBoundDb
+            << " dB)\n"
+            << "  true peak against the long reference, up to 20 kHz: max "
+               "deviation "
+            << errors.fullBandDb << " dB (not checked)\n";
+  const bool ok = errors.filter <= kFilterBound && errors.linked == 0.0 &&
+                  errors.bandLimitedDb <= kReferenceBoundDb;
+
+  // Cost of a linked side-chain over all channels, per block
+  std::vector<std::vector<float>> channels;
+  for (int c = 0; c < numChannels; ++c) {
+    channels.push_back(makeSignal(random, size_t(blockSize) * 64, 20000.0));
+  }
+  TruePeakDetector detector;
+  detector.prepare(blockSize, numChannels);
+  std::vector<float> sideChain(static_cast<size_t>(blockSize));
+  double best = 1e9;
+  for (int run = 0; run < runs; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int block = 0; block < 64; ++block) {
+      for (int c = 0; c < numChannels; ++c) {
+        const float *source =
+            channels[size_t(c)].data() + size_t(block) * size_t(blockSize);
+        if (c == 0) {
+          detector.process(c, source, sideChain.data(), blockSize);
+        } else {
+          detector.processMax(c, source, sideChain.data(), blockSize);
+        }
+      }
+    }
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  const double perBlock = best / 64.0;
+  std::cout << numChannels << " channels, " << blockSize
+            << " frames: " << perBlock * 1e6 << " us per block, "
+            << 100.0 * perBlock * kSampleRate / blockSize
+            << "% of the block period at 48 kHz\n";
+
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -22,6 +22,10 @@
 #include "SimpleCompressor/src/LookAheadGainReduction.cpp"
 #include "SimpleCompressor/src/GainReductionComputer.h"
 #include "SimpleCompressor/src/GainReductionComputer.cpp"
+#include "SimpleCompressor/src/TruePeakDetector.h"
+#include "SimpleCompressor/src/TruePeakDetector.cpp"
+#include "SimpleCompressor/src/MultichannelCompressor.h"
+#include "SimpleCompressor/src/MultichannelCompressor.cpp"
 
 // using namespace gam;
 using namespace al;
@@ -71,95 +75,87 @@ bool operator==(const CompressorStats &l, const CompressorStats &r)
   return approxEqual(l.pre_peak, r.pre_peak) && approxEqual(l.duck, r.duck) && approxEqual(l.post_peak, r.post_peak);
 }
 
+// Linked compressor for any number of output channels. The processing is done
+// by MultichannelCompressor on the planar output buffers of AudioIOData. The
+// statistics of every block are passed to the GUI thread through a lock-free
+// queue, see printStats().
 template <int block_size>
 class CompressorPlugin
 {
 public:
   bool useLookAhead = false;
+  bool useTruePeak = false; // catches inter-sample peaks, adds 6 samples latency
   bool debug = true;
 
   CompressorStats previousStats = CompressorStats(0.0f, 1.0f, 0.0f);
+  uint64_t nextBlockIndex = 0;
 
-  CompressorPlugin()
+  CompressorPlugin(int maxChannels = 64) : channels(maxChannels, nullptr)
   {
-    gain.prepare(48000.);
+    auto &gain = compressor.getGainReductionComputer();
     gain.setThreshold(-5.f);
     gain.setRatio(100.f);
     gain.setKnee(20.f);
     gain.setAttackTime(0.0025f);
 
-    lookahead.setDelayTime(0.005f);
-    lookahead.prepare(48000., 2 * block_size);
+    compressor.setLookAheadTime(0.005f);
+    compressor.prepare(48000., block_size, maxChannels);
+
+    // about 5 seconds of blocks at 48 kHz, so a stalled GUI doesn't lose any
+    compressor.setTelemetryCapacity(2048);
   };
 
   AudioIOData &operator()(AudioIOData &io)
   {
-    // TODO get look-ahead working
-    io.frame(0);
-    for (int i = 0; io() && i < BLOCK_SIZE; i++)
+    const int numChannels = std::min(static_cast<int>(io.channelsOut()),
+                                     static_cast<int>(channels.size()));
+    for (int ch = 0; ch < numChannels; ch++)
     {
-      sidechain_buf[i] = std::max(std::abs(io.out(0)), std::abs(io.out(1)));
+      channels[ch] = io.outBuffer(ch);
     }
 
-    if (useLookAhead)
-    {
-      gain.computeGainInDecibelsFromSidechainSignal(sidechain_buf, gain_buf, block_size);
-    }
-    else
-    {
-      gain.computeLinearGainFromSidechainSignal(sidechain_buf, gain_buf, block_size);
-    }
+    compressor.setLookAheadEnabled(useLookAhead);
+    compressor.setTruePeakEnabled(useTruePeak);
+    compressor.process(channels.data(), numChannels,
+                       static_cast<int>(io.framesPerBuffer()));
 
-    if (useLookAhead)
-    {
-      lookahead.pushSamples(gain_buf, block_size);
-      lookahead.process();
-      lookahead.readSamples(look_buf, block_size);
+    return io;
+  }
 
-      for (int i = 0; i < block_size; i++)
+  // Drains the statistics of all blocks processed since the last call, and
+  // prints them if they changed. Call this from the GUI thread, not from the
+  // audio thread.
+  void printStats()
+  {
+    MultichannelCompressor::Telemetry t;
+    while (compressor.popTelemetry(t))
+    {
+      if (t.blockIndex != nextBlockIndex)
       {
-        gain_buf[i] = decibelsToLinear(look_buf[i]);
+        std::cout << "dropped " << t.blockIndex - nextBlockIndex
+                  << " blocks of compressor stats" << std::endl;
       }
-    }
-
-    float pre_peak = 0;
-    float duck = 1;
-    float post_peak = 0;
-    io.frame(0);
-    for (int i = 0; io() && i < BLOCK_SIZE; i++)
-    {
-      pre_peak = std::max(pre_peak, std::abs(io.out(0)));
-      pre_peak = std::max(pre_peak, std::abs(io.out(1)));
-      duck = std::min(duck, gain_buf[i]);
-      io.out(0) *= gain_buf[i];
-      io.out(1) *= gain_buf[i];
-      post_peak = std::max(post_peak, std::abs(io.out(0)));
-      post_peak = std::max(post_peak, std::abs(io.out(1)));
-    }
+      nextBlockIndex = t.blockIndex + 1;
 
-    if (debug)
-    {
-      CompressorStats currentStats(pre_peak, duck, post_peak);
-      if (!(currentStats == previousStats))
+      if (debug)
       {
-        std::cout << std::fixed << std::setprecision(3);
-        std::cout << "pre_peak:  " << std::setw(10) << linearToDecibels(pre_peak) << " dB  "
-                  << "compress:  " << std::setw(10) << linearToDecibels(duck) << " dB  "
-                  << "post_peak: " << std::setw(10) << linearToDecibels(post_peak) << " dB" << std::endl;
-        previousStats = currentStats;
+        CompressorStats currentStats(t.inputPeak, t.minimumGain, t.outputPeak);
+        if (!(currentStats == previousStats))
+        {
+          std::cout << std::fixed << std::setprecision(3);
+          std::cout << "pre_peak:  " << std::setw(10) << linearToDecibels(t.inputPeak) << " dB  "
+                    << "compress:  " << std::setw(10) << linearToDecibels(t.minimumGain) << " dB  "
+                    << "post_peak: " << std::setw(10) << linearToDecibels(t.outputPeak) << " dB  "
+                    << "post_rms:  " << std::setw(10) << linearToDecibels(t.outputRms) << " dB" << std::endl;
+          previousStats = currentStats;
+        }
       }
     }
-
-    return io;
   }
 
 private:
-  GainReductionComputer gain;
-  LookAheadGainReduction lookahead;
-
-  float sidechain_buf[block_size];
-  float gain_buf[block_size];
-  float look_buf[block_size];
+  MultichannelCompressor compressor;
+  std::vector<float *> channels;
 };
 
 class SineEnv : public SynthVoice
@@ -387,6 +383,8 @@ public:
 
   void onAnimate(double dt) override
   {
+    compressor.printStats();
+
     // The GUI is prepared here
     imguiBeginFrame();
     // Draw a window that contains the synth control panel
@@ -427,6 +425,12 @@ public:
         compressor.debug = !compressor.debug;
         std::cout << "compressor.debug=" << compressor.debug << std::endl;
         return false;
+
+      case ']':
+        std::cout << "] pressed!" << std::endl;
+        compressor.useTruePeak = !compressor.useTruePeak;
+        std::cout << "compressor.useTruePeak=" << compressor.useTruePeak << std::endl;
+        return false;
     }
 
     if (k.shift())
@@ -54,6 +54,10 @@ LookAheadCompressorAudioProcessorEditor::LookAheadCompressorAudioProcessorEditor
     lookAheadAttachment.reset (new ButtonAttachment (parameters, "lookAhead", lookAhead));
     lookAhead.setButtonText("look-ahead processing (5 ms)");
 
+    addAndMakeVisible (truePeak);
+    truePeakAttachment.reset (new ButtonAttachment (parameters, "truePeak", truePeak));
+    truePeak.setButtonText("true-peak detection (4x oversampling)");
+
     addAndMakeVisible (cv);
     startTimer (50);
 }
@@ -111,6 +115,7 @@ void LookAheadCompressorAudioProcessorEditor::resized()
     row.removeFromLeft (8);
     makeUp.setBounds (row.removeFromLeft (60));
 
+    truePeak.setBounds (bounds.removeFromBottom (20));
     lookAhead.setBounds (bounds.removeFromBottom (20));
     cv.setBounds (bounds.reduced (10));
 }
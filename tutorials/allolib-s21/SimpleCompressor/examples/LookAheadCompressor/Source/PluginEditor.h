@@ -44,8 +44,8 @@ private:
     std::unique_ptr<SliderAttachment> thresholdAttachment, kneeAttachment, attackAttachment,
         releaseAttachment, ratioAttachment, makeUpAttachment;
 
-    ToggleButton lookAhead;
-    std::unique_ptr<ButtonAttachment> lookAheadAttachment;
+    ToggleButton lookAhead, truePeak;
+    std::unique_ptr<ButtonAttachment> lookAheadAttachment, truePeakAttachment;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LookAheadCompressorAudioProcessorEditor)
 };
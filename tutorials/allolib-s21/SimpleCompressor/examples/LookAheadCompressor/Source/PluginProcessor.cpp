@@ -122,10 +122,17 @@ void LookAheadCompressorAudioProcessor::prepareToPlay (double sampleRate, int sa
 
     sideChainBuffer.setSize (2, samplesPerBlock);
 
+    // the audio is delayed by the latency of the true-peak detector, so the gain reduction stays in sync. Half a sample is added, so the delay time converts back to exactly that number of samples.
+    truePeakDetector.prepare (samplesPerBlock, 2);
+    truePeakDelay.setDelayTime ((TruePeakDetector::getLatencyInSamples() + 0.5f) / static_cast<float> (sampleRate));
+    truePeakDelay.prepare ({sampleRate, static_cast<uint32> (samplesPerBlock), 2});
+
+    int latency = 0;
     if (*parameters.getRawParameterValue ("lookAhead") > 0.5f)
-        setLatencySamples (static_cast<int> (0.005 * sampleRate));
-    else
-        setLatencySamples (0);
+        latency += static_cast<int> (0.005 * sampleRate);
+    if (*parameters.getRawParameterValue ("truePeak") > 0.5f)
+        latency += TruePeakDetector::getLatencyInSamples();
+    setLatencySamples (latency);
 }
 
 void LookAheadCompressorAudioProcessor::releaseResources()
@@ -164,6 +171,7 @@ void LookAheadCompressorAudioProcessor::processBlock (AudioBuffer<float>& buffer
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
     const bool useLookAhead = *parameters.getRawParameterValue ("lookAhead") > 0.5f;
+    const bool useTruePeak = *parameters.getRawParameterValue ("truePeak") > 0.5f;
     const int numSamples = buffer.getNumSamples();
 
     // clear not needed output channels
@@ -171,14 +179,29 @@ void LookAheadCompressorAudioProcessor::processBlock (AudioBuffer<float>& buffer
         buffer.clear (i, 0, numSamples);
 
     /** STEP 1: compute sidechain-signal */
-    // copy the absolute values from the first input channel to the sideChainBuffer
-    FloatVectorOperations::abs (sideChainBuffer.getWritePointer (0), buffer.getReadPointer (0), numSamples);
+    if (useTruePeak)
+    {
+        // true-peak levels of all channels, linked by taking their maximum
+        truePeakDetector.process (0, buffer.getReadPointer (0), sideChainBuffer.getWritePointer (0), numSamples);
+        for (int ch = 1; ch < totalNumInputChannels; ++ch)
+            truePeakDetector.processMax (ch, buffer.getReadPointer (ch), sideChainBuffer.getWritePointer (0), numSamples);
 
-    // copy all other channels to the second channel of the sideChainBuffer and write the maximum of both channels to the first one
-    for (int ch = 1; ch < totalNumInputChannels; ++ch)
+        // delay audio signal by the latency of the detector
+        AudioBlock<float> ab (buffer);
+        ProcessContextReplacing<float> context (ab);
+        truePeakDelay.process (context);
+    }
+    else
     {
-        FloatVectorOperations::abs (sideChainBuffer.getWritePointer (1), buffer.getReadPointer (ch), numSamples);
-        FloatVectorOperations::max (sideChainBuffer.getWritePointer (0), sideChainBuffer.getReadPointer (0), sideChainBuffer.getReadPointer (1), numSamples);
+        // copy the absolute values from the first input channel to the sideChainBuffer
+        FloatVectorOperations::abs (sideChainBuffer.getWritePointer (0), buffer.getReadPointer (0), numSamples);
+
+        // copy all other channels to the second channel of the sideChainBuffer and write the maximum of both channels to the first one
+        for (int ch = 1; ch < totalNumInputChannels; ++ch)
+        {
+            FloatVectorOperations::abs (sideChainBuffer.getWritePointer (1), buffer.getReadPointer (ch), numSamples);
+            FloatVectorOperations::max (sideChainBuffer.getWritePointer (0), sideChainBuffer.getReadPointer (0), sideChainBuffer.getReadPointer (1), numSamples);
+        }
     }
 
     /** STEP 2: calculate gain reduction, which one depends on lookAhead */
@@ -205,9 +228,7 @@ void LookAheadCompressorAudioProcessor::processBlock (AudioBuffer<float>& buffer
         lookAheadFadeIn.readSamples (sideChainBuffer.getWritePointer(1), numSamples);
 
         // add make-up and convert to linear gain
-        const float makeUpGainInDecibels = gainReductionComputer.getMakeUpGain();
-        for (int i = 0; i < numSamples; ++i)
-            sideChainBuffer.setSample (1, i, Decibels::decibelsToGain (sideChainBuffer.getSample (1, i) + makeUpGainInDecibels));
+        gainReductionComputer.convertToLinearGain (sideChainBuffer.getReadPointer (1), sideChainBuffer.getWritePointer (1), numSamples);
     }
 
 
@@ -263,6 +284,7 @@ AudioProcessorValueTreeState::ParameterLayout LookAheadCompressorAudioProcessor:
                                                              [](float value, int maximumStringLength) { if (value > 15.9f) return String ("inf"); return String (value, 2);}));
     params.push_back (std::make_unique<AudioParameterFloat> ("makeUp", "MakeUp Gain", NormalisableRange<float> (-10.0f, 20.0f, 0.1f), 0.0f, "dB"));
     params.push_back (std::make_unique<AudioParameterBool> ("lookAhead", "Look-Ahead", false));
+    params.push_back (std::make_unique<AudioParameterBool> ("truePeak", "True-Peak Detection", false));
 
     return { params.begin(), params.end() };
 }
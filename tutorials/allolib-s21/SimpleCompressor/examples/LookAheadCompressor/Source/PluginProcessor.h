@@ -13,6 +13,7 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "../../../src/GainReductionComputer.h"
 #include "../../../src/LookAheadGainReduction.h"
+#include "../../../src/TruePeakDetector.h"
 #include "../../thirdparty/Delay.h"
 
 //==============================================================================
@@ -71,6 +72,8 @@ private:
     Delay delay;
     GainReductionComputer gainReductionComputer;
     LookAheadGainReduction lookAheadFadeIn;
+    TruePeakDetector truePeakDetector;
+    Delay truePeakDelay;
     AudioBuffer<float> sideChainBuffer;
 
     //==============================================================================
@@ -23,6 +23,7 @@
 
 #pragma once
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "../../src/RingBuffer.h"
 
 using namespace dsp;
 class Delay : private ProcessorBase
@@ -61,9 +62,9 @@ public:
 
         delayInSamples = static_cast<int> (delay * specs.sampleRate);
 
-        buffer.setSize (specs.numChannels, specs.maximumBlockSize + delayInSamples);
-        buffer.clear();
-        writePosition = 0;
+        buffers.resize (specs.numChannels);
+        for (auto& buffer : buffers)
+            buffer.setCapacity (specs.maximumBlockSize + delayInSamples);
     }
 
     void process (const ProcessContextReplacing<float>& context) override
@@ -77,33 +78,14 @@ public:
             auto L = static_cast<int> (abIn.getNumSamples());
             auto nCh = jmin((int) spec.numChannels, (int) abIn.getNumChannels());
 
-            int startIndex, blockSize1, blockSize2;
-
-
-            // write in delay line
-            getReadWritePositions(false, (int) L, startIndex, blockSize1, blockSize2);
-
             for (int ch = 0; ch < nCh; ch++)
-                buffer.copyFrom(ch, startIndex, abIn.getChannelPointer (ch), blockSize1);
-
-            if (blockSize2 > 0)
-                for (int ch = 0; ch < nCh; ch++)
-                    buffer.copyFrom(ch, 0, abIn.getChannelPointer (ch) + blockSize1, blockSize2);
-
-
-            // read from delay line
-            getReadWritePositions(true, (int) L, startIndex, blockSize1, blockSize2);
+            {
+                // write in delay line
+                buffers[ch].write (abIn.getChannelPointer (ch), L);
 
-            for (int ch = 0; ch < nCh; ch++)
-                FloatVectorOperations::copy (abOut.getChannelPointer(ch), buffer.getReadPointer(ch) + startIndex, blockSize1);
-
-            if (blockSize2 > 0)
-                for (int ch = 0; ch < nCh; ch++)
-                    FloatVectorOperations::copy (abOut.getChannelPointer(ch) + blockSize1, buffer.getReadPointer (ch), blockSize2);
-
-
-            writePosition += L;
-            writePosition = writePosition % buffer.getNumSamples();
+                // read from delay line
+                buffers[ch].read (abOut.getChannelPointer (ch), L + delayInSamples, L);
+            }
         }
     }
 
@@ -112,41 +94,11 @@ public:
 
     }
 
-    void getReadWritePositions (bool read, int numSamples, int& startIndex, int& blockSize1, int& blockSize2)
-    {
-        const int L = buffer.getNumSamples();
-        int pos = writePosition;
-        if (read)
-        {
-            pos = writePosition - delayInSamples;
-        }
-        if (pos < 0)
-            pos = pos + L;
-        pos = pos % L;
-
-        jassert(pos >= 0 && pos < L);
-
-        if (numSamples <= 0)
-        {
-            startIndex = 0;
-            blockSize1 = 0;
-            blockSize2 = 0;
-        }
-        else
-        {
-            startIndex = pos;
-            blockSize1 = jmin (L - pos, numSamples);
-            numSamples -= blockSize1;
-            blockSize2 = numSamples <= 0 ? 0 : numSamples;
-        }
-    }
-
 private:
     //==============================================================================
     ProcessSpec spec = {-1, 0, 0};
     float delay;
     int delayInSamples = 0;
     bool bypassed = false;
-    int writePosition = 0;
-    AudioBuffer<float> buffer;
+    std::vector<RingBuffer<float>> buffers;
 };
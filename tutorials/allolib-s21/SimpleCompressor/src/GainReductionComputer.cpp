@@ -17,18 +17,19 @@
  */
 
 #include "GainReductionComputer.h"
+#include "VectorOperations.h"
 
 GainReductionComputer::GainReductionComputer()
 {
     sampleRate = 0.0f;
 
-    threshold = -10.0f;
-    knee = 0.0f;
-    kneeHalf = 0.0f;
-    attackTime = 0.01f;
-    releaseTime = 0.15f;
+    setThreshold (-10.0f);
+    setKnee (0.0f);
+    setAttackTime (0.01f);
+    setReleaseTime (0.15f);
     setRatio (2); // 2 : 1
-    makeUpGain = 0.0f;
+    setMakeUpGain (0.0f);
+    prepare (sampleRate);
     reset();
 }
 
@@ -36,20 +37,23 @@ void GainReductionComputer::prepare (const double newSampleRate)
 {
     sampleRate = newSampleRate;
 
-    alphaAttack = 1.0f - timeToGain (attackTime);
-    alphaRelease = 1.0f - timeToGain (releaseTime);
+    // apply everything right away, the ramps are only needed for changes while processing
+    applyParameterChanges (0);
+    alphaAttack = 1.0f - timeToGain (targetAttackTime);
+    alphaRelease = 1.0f - timeToGain (targetReleaseTime);
+    appliedMakeUpGain = makeUpGain;
 }
 
 void GainReductionComputer::setAttackTime (const float attackTimeInSeconds)
 {
-    attackTime = attackTimeInSeconds;
-    alphaAttack = 1.0f - timeToGain (attackTime);
+    targetAttackTime.store (attackTimeInSeconds, std::memory_order_relaxed);
+    markAsChanged (attackTimeChanged);
 }
 
 void GainReductionComputer::setReleaseTime (const float releaseTimeInSeconds)
 {
-    releaseTime = releaseTimeInSeconds;
-    alphaRelease = 1.0f - timeToGain (releaseTime);
+    targetReleaseTime.store (releaseTimeInSeconds, std::memory_order_relaxed);
+    markAsChanged (releaseTimeChanged);
 }
 
 const float GainReductionComputer::timeToGain (const float timeInSeconds)
@@ -59,75 +63,208 @@ const float GainReductionComputer::timeToGain (const float timeInSeconds)
 
 void GainReductionComputer::setKnee (const float kneeInDecibels)
 {
-    knee = kneeInDecibels;
-    kneeHalf = knee / 2.0f;
+    targetKnee.store (kneeInDecibels, std::memory_order_relaxed);
+    markAsChanged (kneeChanged);
 }
 
 void GainReductionComputer::setThreshold (const float thresholdInDecibels)
 {
-    threshold = thresholdInDecibels;
+    targetThreshold.store (thresholdInDecibels, std::memory_order_relaxed);
+    markAsChanged (thresholdChanged);
 }
 
 void GainReductionComputer::setMakeUpGain (const float makeUpGainInDecibels)
 {
-    makeUpGain = makeUpGainInDecibels;
+    targetMakeUpGain.store (makeUpGainInDecibels, std::memory_order_relaxed);
+    markAsChanged (makeUpGainChanged);
 }
 
 void GainReductionComputer::setRatio (const float ratio)
 {
-    slope = 1.0f / ratio - 1.0f;
+    targetSlope.store (1.0f / ratio - 1.0f, std::memory_order_relaxed);
+    markAsChanged (ratioChanged);
+}
+
+void GainReductionComputer::applyParameterChanges (const int numSamples)
+{
+    thresholdIncrement = 0.0f;
+
+    // the plain load keeps the common case (nothing changed) free of read-modify-write operations
+    if (changedParameters.load (std::memory_order_relaxed) == 0)
+        return;
+
+    // the acquire pairs with the release in markAsChanged, so the new values are visible. Values stored after the exchange are picked up with the next block
+    const uint32_t changed = changedParameters.exchange (0, std::memory_order_acquire);
+
+    if (changed & attackTimeChanged)
+        alphaAttack = 1.0f - timeToGain (targetAttackTime.load (std::memory_order_relaxed));
+
+    if (changed & releaseTimeChanged)
+        alphaRelease = 1.0f - timeToGain (targetReleaseTime.load (std::memory_order_relaxed));
+
+    if (changed & (kneeChanged | ratioChanged))
+    {
+        knee = targetKnee.load (std::memory_order_relaxed);
+        kneeHalf = knee / 2.0f;
+        slope = targetSlope.load (std::memory_order_relaxed);
+        updateCharacteristic();
+    }
+
+    if (changed & thresholdChanged)
+    {
+        // ramp from the current threshold to the new one, reaching it with the last sample of the block
+        const float newThreshold = targetThreshold.load (std::memory_order_relaxed);
+        if (numSamples > 0)
+            thresholdIncrement = (newThreshold - threshold) / numSamples;
+        threshold = newThreshold;
+    }
+
+    // ramped in convertToLinearGain
+    if (changed & makeUpGainChanged)
+        makeUpGain = targetMakeUpGain.load (std::memory_order_relaxed);
+}
+
+void GainReductionComputer::updateCharacteristic()
+{
+    if (knee > 0.0f)
+        characteristic = Characteristic::softKnee;
+    else if (slope == -1.0f)
+        characteristic = Characteristic::limiter;
+    else
+        characteristic = Characteristic::hardKnee;
 }
 
 
-inline const float GainReductionComputer::applyCharacteristicToOverShoot (const float overShootInDecibels)
+inline const float GainReductionComputer::applyCharacteristicToOverShoot (const float overShootInDecibels, const float kneeInDecibels, const float characteristicSlope)
 {
-    if (overShootInDecibels <= -kneeHalf)
+    const float halfKnee = kneeInDecibels / 2.0f;
+    if (overShootInDecibels <= -halfKnee)
         return 0.0f;
-    else if (overShootInDecibels > -kneeHalf && overShootInDecibels <= kneeHalf)
-        return 0.5f * slope * (overShootInDecibels + kneeHalf) * (overShootInDecibels + kneeHalf) / knee;
+    else if (overShootInDecibels > -halfKnee && overShootInDecibels <= halfKnee)
+        return 0.5f * characteristicSlope * (overShootInDecibels + halfKnee) * (overShootInDecibels + halfKnee) / kneeInDecibels;
     else
-        return slope * overShootInDecibels;
+        return characteristicSlope * overShootInDecibels;
+}
+
+namespace CharacteristicKernels
+{
+    /** Each kernel maps an input level to the gain in decibels, like applyCharacteristicToOverShoot, but without branches, so the calling loop vectorizes. Everything that only depends on the parameters is computed once per block in the constructor. */
+    struct HardKnee
+    {
+        HardKnee (const float threshold, const float slope, const float, const float) : threshold (threshold), slope (slope) {}
+
+        inline float operator() (const float levelInDecibels) const
+        {
+            const float overShoot = levelInDecibels - threshold;
+            return slope * (overShoot > 0.0f ? overShoot : 0.0f);
+        }
+
+        const float threshold, slope;
+    };
+
+    struct SoftKnee
+    {
+        SoftKnee (const float threshold, const float slope, const float knee, const float kneeHalf)
+            : lowerKneeEdge (threshold - kneeHalf), upperKneeEdge (threshold + kneeHalf), knee (knee), slope (slope), quadraticFactor (0.5f * slope / knee) {}
+
+        inline float operator() (const float levelInDecibels) const
+        {
+            // quadratic part within the knee (reaching knee / 2 * slope at its upper edge) plus the linear part above it
+            float inKnee = levelInDecibels - lowerKneeEdge;
+            inKnee = inKnee > 0.0f ? inKnee : 0.0f;
+            inKnee = inKnee < knee ? inKnee : knee;
+            const float aboveKnee = levelInDecibels - upperKneeEdge;
+            return quadraticFactor * inKnee * inKnee + slope * (aboveKnee > 0.0f ? aboveKnee : 0.0f);
+        }
+
+        const float lowerKneeEdge, upperKneeEdge, knee, slope, quadraticFactor;
+    };
+
+    struct Limiter
+    {
+        Limiter (const float threshold, const float, const float, const float) : threshold (threshold) {}
+
+        inline float operator() (const float levelInDecibels) const
+        {
+            const float overShoot = levelInDecibels - threshold;
+            return overShoot > 0.0f ? -overShoot : 0.0f;
+        }
+
+        const float threshold;
+    };
+}
+
+template <typename Kernel>
+inline float GainReductionComputer::computeStaticGain (const float* sideChainSignal, float* destination, const int numSamples)
+{
+    // a ramping threshold is the same as a ramping offset of the level, so the kernels themselves don't need to know about it
+    const float increment = thresholdIncrement;
+    const Kernel kernel (threshold - increment * (numSamples - 1), slope, knee, kneeHalf);
+
+    return VectorOperations::amplitudeToDecibels (destination, sideChainSignal, numSamples,
+                                                  [kernel, increment] (const float levelInDecibels, const int i) { return kernel (levelInDecibels - increment * i); });
 }
 
 void GainReductionComputer::computeGainInDecibelsFromSidechainSignal (const float* sideChainSignal, float* destination, const int numSamples)
 {
-    maxInputLevel = -std::numeric_limits<float>::infinity();
-    maxGainReduction = 0.0f;
+    applyParameterChanges (numSamples);
+
+    // STEP 1: stateless part (level detection and static characteristic), vectorizable
+    float maxAbsInput;
+    switch (characteristic)
+    {
+        case Characteristic::softKnee:
+            maxAbsInput = computeStaticGain<CharacteristicKernels::SoftKnee> (sideChainSignal, destination, numSamples);
+            break;
+        case Characteristic::limiter:
+            maxAbsInput = computeStaticGain<CharacteristicKernels::Limiter> (sideChainSignal, destination, numSamples);
+            break;
+        default:
+            maxAbsInput = computeStaticGain<CharacteristicKernels::HardKnee> (sideChainSignal, destination, numSamples);
+            break;
+    }
+
+    // STEP 2: apply ballistics, this is a recursion and stays scalar
+    float currentState = state;
+    float blockMaxGainReduction = 0.0f;
 
     for (int i = 0; i < numSamples; ++i)
     {
-        // convert sample to decibels
-        const float levelInDecibels = 20.0f * std::log10 (abs (sideChainSignal[i]));
-        
-        if (levelInDecibels > maxInputLevel)
-            maxInputLevel = levelInDecibels;
-
-        // calculate overshoot and apply knee and ratio
-        const float overShoot = levelInDecibels - threshold;
-        const float gainReduction = applyCharacteristicToOverShoot (overShoot);
-
-        // apply ballistics
-        const float diff = gainReduction - state;
+        const float diff = destination[i] - currentState;
         if (diff < 0.0f) // wanted gain reduction is below state -> attack phase
-            state += alphaAttack * diff;
+            currentState += alphaAttack * diff;
         else // release phase
-            state += alphaRelease * diff;
+            currentState += alphaRelease * diff;
 
         // write back gain reduction
-        destination[i] = state;
+        destination[i] = currentState;
 
-        if (state < maxGainReduction)
-            maxGainReduction = state;
+        if (currentState < blockMaxGainReduction)
+            blockMaxGainReduction = currentState;
     }
+
+    state = currentState;
+
+    // publish block statistics only once per block
+    maxInputLevel = 20.0f * std::log10 (maxAbsInput);
+    maxGainReduction = blockMaxGainReduction;
 }
 
 void GainReductionComputer::computeLinearGainFromSidechainSignal (const float* sideChainSignal, float* destination, const int numSamples)
 {
     computeGainInDecibelsFromSidechainSignal (sideChainSignal, destination, numSamples);
-    for (int i = 0; i < numSamples; ++i)
-        destination[i] = std::pow (10.0f, 0.05f * (destination[i] + makeUpGain));
+    convertToLinearGain (destination, destination, numSamples);
 }
 
+void GainReductionComputer::convertToLinearGain (const float* gainInDecibels, float* destination, const int numSamples)
+{
+    if (appliedMakeUpGain == makeUpGain)
+        VectorOperations::decibelsToGain (destination, gainInDecibels, makeUpGain, numSamples);
+    else
+        VectorOperations::decibelsToGain (destination, gainInDecibels, appliedMakeUpGain, makeUpGain, numSamples);
+
+    appliedMakeUpGain = makeUpGain;
+}
 
 void GainReductionComputer::getCharacteristic (float* inputLevelsInDecibels, float* dest, const int numSamples)
 {
@@ -137,7 +274,8 @@ void GainReductionComputer::getCharacteristic (float* inputLevelsInDecibels, flo
 
 float GainReductionComputer::getCharacteristicSample (const float inputLevelInDecibels)
 {
-    float overShoot = inputLevelInDecibels - threshold;
-    overShoot = applyCharacteristicToOverShoot (overShoot);
-    return overShoot + inputLevelInDecibels + makeUpGain;
+    // called from the GUI, so it uses the values last set, not the ones of the audio thread
+    float overShoot = inputLevelInDecibels - targetThreshold;
+    overShoot = applyCharacteristicToOverShoot (overShoot, targetKnee, targetSlope);
+    return overShoot + inputLevelInDecibels + targetMakeUpGain;
 }
@@ -22,9 +22,12 @@
 #include <limits>
 #include <cmath>
 #include <atomic>
+#include <cstdint>
 
 /**
  This class acts as the side-chain path of a dynamic range compressor. It processes a given side-chain signal and computes the gain reduction samples depending on the parameters threshold, knee, attack-time, release-time, ratio, and make-up gain.
+
+ The setters can be called from any thread, also while the audio thread is processing: they only store the new value in an atomic and mark it as changed. The audio thread picks up all changes at the start of the next block, without locks or allocations. Threshold and make-up gain are ramped linearly across that block to avoid zipper noise, the other parameters change at the block boundary. The getters return the values last set.
  */
 class GainReductionComputer
 {
@@ -47,19 +50,19 @@ public:
      Sets the knee-width in decibels.
      */
     void setKnee (const float kneeInDecibels);
-    const float getKnee() { return knee; }
+    const float getKnee() { return targetKnee; }
 
     /**
      Sets the threshold above which the compressor will start to compress the signal.
      */
     void setThreshold (const float thresholdInDecibels);
-    const float getThreshold() { return threshold; }
+    const float getThreshold() { return targetThreshold; }
 
     /**
      Sets the make-up-gain of the compressor in decibels.
      */
     void setMakeUpGain (const float makeUpGainInDecibels);
-    const float getMakeUpGain()  { return makeUpGain; }
+    const float getMakeUpGain()  { return targetMakeUpGain; }
 
     /**
      Sets the ratio of input-output signal above threshold. Set to 1 for no compression, up to infinity for a brickwall limiter.
@@ -79,7 +82,7 @@ public:
 
     // ======================================================================
     /**
-     Prepares the compressor with sampleRate and expected blockSize. Make sure you call this before you do any processing!
+     Prepares the compressor with sampleRate and expected blockSize. Make sure you call this before you do any processing! All parameters set so far are applied right away, without ramps.
      */
     void prepare (const double sampleRate);
 
@@ -89,7 +92,7 @@ public:
     void reset() { state = 0.0f; }
 
     /**
-     Computes the gain reduction for a given side-chain signal. The values will be in decibels and will NOT contain the make-up gain.
+     Computes the gain reduction for a given side-chain signal. The values will be in decibels and will NOT contain the make-up gain. The level detection uses the approximations of VectorOperations, the statistics returned by getMaxInputLevelInDecibels and getMaxGainReductionInDecibels are updated once per call.
      */
     void computeGainInDecibelsFromSidechainSignal (const float* sideChainSignal, float* destination, const int numSamples);
 
@@ -98,22 +101,68 @@ public:
      */
     void computeLinearGainFromSidechainSignal (const float* sideChainSignal, float* destination, const int numSamples);
 
+    /**
+     Adds the make-up gain to gain-reduction values in decibels and converts them to linear gain. Use this instead of getMakeUpGain on the audio thread, if you process the decibel values further, e.g. with the LookAheadGainReduction class, as it ramps the make-up gain after a change. Source and destination may be the same.
+     */
+    void convertToLinearGain (const float* gainInDecibels, float* destination, const int numSamples);
+
     const float getMaxInputLevelInDecibels() { return maxInputLevel; }
     const float getMaxGainReductionInDecibels() { return maxGainReduction; }
 
 private:
     inline const float timeToGain (const float timeInSeconds);
-    inline const float applyCharacteristicToOverShoot (const float overShootInDecibels);
+    static inline const float applyCharacteristicToOverShoot (const float overShootInDecibels, const float kneeInDecibels, const float characteristicSlope);
+
+    /** Flags of the changed parameters, collected in changedParameters. */
+    enum ParameterFlags : uint32_t
+    {
+        attackTimeChanged = 1 << 0,
+        releaseTimeChanged = 1 << 1,
+        kneeChanged = 1 << 2,
+        thresholdChanged = 1 << 3,
+        ratioChanged = 1 << 4,
+        makeUpGainChanged = 1 << 5
+    };
+
+    void markAsChanged (const uint32_t flags) { changedParameters.fetch_or (flags, std::memory_order_release); }
+
+    /** Called by the audio thread at the start of each block. Copies the changed parameters and sets up the threshold ramp for a block of the given length. */
+    void applyParameterChanges (const int numSamples);
+
+    /** The static characteristics, each with its own branch-free processing kernel. Which one is used, is decided whenever the knee or ratio change, so the per-sample loop doesn't have to.
+     */
+    enum class Characteristic
+    {
+        hardKnee, // knee of 0 dB
+        softKnee,
+        limiter // knee of 0 dB and infinite ratio
+    };
+
+    void updateCharacteristic();
+
+    /** Level detection and static characteristic in a single loop, returns the largest absolute side-chain value. */
+    template <typename Kernel>
+    inline float computeStaticGain (const float* sideChainSignal, float* destination, const int numSamples);
 
     double sampleRate;
 
-    // parameters
+    // parameters as set by the setters
+    std::atomic<float> targetKnee;
+    std::atomic<float> targetThreshold;
+    std::atomic<float> targetAttackTime;
+    std::atomic<float> targetReleaseTime;
+    std::atomic<float> targetSlope;
+    std::atomic<float> targetMakeUpGain;
+    std::atomic<uint32_t> changedParameters {0};
+
+    // parameters used by the audio thread
     float knee, kneeHalf;
     float threshold;
-    float attackTime;
-    float releaseTime;
+    float thresholdIncrement; // per sample, within the current block
     float slope;
     float makeUpGain;
+    float appliedMakeUpGain; // make-up gain at the end of the last block, the start of the next ramp
+    Characteristic characteristic;
 
     std::atomic<float> maxInputLevel {-std::numeric_limits<float>::infinity()};
     std::atomic<float> maxGainReduction {0};
@@ -0,0 +1,108 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <type_traits>
+
+/**
+ A bounded single-producer / single-consumer queue, used to get data out of the audio thread without locks or allocations, e.g. for metering.
+
+ One thread (the audio thread) calls push, another one (GUI or logging thread) calls pop. Neither of them ever blocks: push returns false if the queue is full, pop returns false if it's empty. The producer and the consumer each only write their own position, so there are no read-modify-write operations, and each side keeps a cached copy of the other side's position, so it only has to load it when the queue seems full or empty.
+
+ All memory is allocated in setCapacity, which must not be called while one of the threads is pushing or popping.
+ */
+template <typename Type>
+class LockFreeQueue
+{
+    static_assert (std::is_trivially_copyable<Type>::value, "LockFreeQueue is meant for plain data");
+
+public:
+    LockFreeQueue() {}
+    ~LockFreeQueue() {}
+
+    /** Allocates space for at least the given number of elements (rounded up to a power of two), and empties the queue. A capacity of zero disables the queue, push will always return false.
+     */
+    void setCapacity (const int minimumCapacity)
+    {
+        int capacity = minimumCapacity > 0 ? 1 : 0;
+        while (capacity < minimumCapacity)
+            capacity *= 2;
+
+        elements.resize (capacity);
+        mask = static_cast<unsigned int> (capacity - 1);
+
+        writePosition.store (0);
+        readPosition.store (0);
+        cachedReadPosition = 0;
+        cachedWritePosition = 0;
+    }
+
+    const int getCapacity() { return static_cast<int> (elements.size()); }
+
+    /** Producer side: appends an element, returns false if the queue is full (or disabled). */
+    bool push (const Type& element)
+    {
+        const unsigned int write = writePosition.load (std::memory_order_relaxed);
+
+        if (write - cachedReadPosition >= elements.size())
+        {
+            cachedReadPosition = readPosition.load (std::memory_order_acquire);
+            if (write - cachedReadPosition >= elements.size())
+                return false;
+        }
+
+        elements[write & mask] = element;
+        writePosition.store (write + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side: takes the oldest element, returns false if the queue is empty. */
+    bool pop (Type& element)
+    {
+        const unsigned int read = readPosition.load (std::memory_order_relaxed);
+
+        if (read == cachedWritePosition)
+        {
+            cachedWritePosition = writePosition.load (std::memory_order_acquire);
+            if (read == cachedWritePosition)
+                return false;
+        }
+
+        element = elements[read & mask];
+        readPosition.store (read + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<Type> elements;
+    unsigned int mask = 0;
+
+    // positions are never wrapped, only the indices into `elements` are; unsigned overflow keeps the differences right.
+    // The padding keeps the producer's and the consumer's data on separate cache lines.
+    char padding1[64];
+    std::atomic<unsigned int> writePosition { 0 };
+    unsigned int cachedReadPosition = 0; // producer's copy
+
+    char padding2[64];
+    std::atomic<unsigned int> readPosition { 0 };
+    unsigned int cachedWritePosition = 0; // consumer's copy
+    char padding3[64];
+};
@@ -20,6 +20,7 @@
 #include "LookAheadGainReduction.h"
 #include <cmath>
 #include <algorithm>
+#include <limits>
 
 void LookAheadGainReduction::setDelayTime (float delayTimeInSeconds)
 {
@@ -32,6 +33,14 @@ void LookAheadGainReduction::setDelayTime (float delayTimeInSeconds)
         prepare (sampleRate, blockSize);
 }
 
+void LookAheadGainReduction::setProcessingMode (const ProcessingMode newMode)
+{
+    mode = newMode;
+
+    if (sampleRate != 0.0)
+        prepare (sampleRate, blockSize);
+}
+
 void LookAheadGainReduction::prepare (const double newSampleRate, const int newBlockSize)
 {
     sampleRate = newSampleRate;
@@ -39,32 +48,34 @@ void LookAheadGainReduction::prepare (const double newSampleRate, const int newB
 
     delayInSamples = static_cast<int> (delay * sampleRate);
 
-    buffer.resize (blockSize + delayInSamples);
-    std::fill (buffer.begin(), buffer.end(), 0.0f);
-    writePosition = 0;
+    buffer.setCapacity (blockSize + delayInSamples);
+    lastPushedSamples = 0;
+
+    // at most delayInSamples + 1 peaks can be relevant at once, plus the one pushed before the oldest is dropped. The capacity is rounded up to a power of two so indices can be wrapped with a mask
+    int capacity = 1;
+    while (mode == ProcessingMode::slidingMinimum && capacity < delayInSamples + 2)
+        capacity *= 2;
+    peaks.resize (capacity);
+    peaksFront = 0;
+    peaksSize = 0;
+    numProcessedSamples = 0;
 }
 
 void LookAheadGainReduction::pushSamples (const float* src, const int numSamples)
 {
-    int startIndex, blockSize1, blockSize2;
-
-    // write in delay line
-    getWritePositions (numSamples, startIndex, blockSize1, blockSize2);
-
-    for (int i = 0; i < blockSize1; ++i)
-        buffer[startIndex + i] = src[i];
-
-    if (blockSize2 > 0)
-        for (int i = 0; i < blockSize2; ++i)
-            buffer[i] = src[blockSize1 + i];
-
-    writePosition += numSamples;
-    writePosition = writePosition % buffer.size();
-
+    buffer.write (src, numSamples);
     lastPushedSamples = numSamples;
 }
 
 void LookAheadGainReduction::process()
+{
+    if (mode == ProcessingMode::slidingMinimum)
+        processSlidingMinimum();
+    else
+        processBackwardScan();
+}
+
+void LookAheadGainReduction::processBackwardScan()
 {
     /** The basic idea here is to look for high gain-reduction values in the signal, and apply a fade which starts exactly  `delayInSamples` many samples before that value appears. Depending on the value itself, the slope of the fade will vary.
 
@@ -82,26 +93,21 @@ void LookAheadGainReduction::process()
     float nextGainReductionValue = 0.0f;
     float step = 0.0f;
 
+    // The recently pushed samples and the `delayInSamples` samples before them lie contiguously in memory, thanks to the mirrored ring-buffer.
+    const int numSamples = lastPushedSamples + delayInSamples;
+    float* samples = buffer.getWritePointer (numSamples);
 
-    // Get the position of the last sample in the buffer, which is the sample right before our new write position.
-    int index = writePosition - 1;
-    if (index < 0) // in case it's negative...
-        index += static_cast<int> (buffer.size()); // ... add the buffersize so we wrap around.
+    // Start with the last sample in the buffer, which is the sample right before our write position.
+    int index = numSamples - 1;
 
     // == FIRST STEP: Process all recently pushed samples.
-
-    // We want to process all `lastPushedSamples` many samples, so let's find out, how many we can process in a first run before we have to wrap around our `index` variable (ring-buffer).
-    int size1, size2;
-    getProcessPositions (index, lastPushedSamples, size1, size2);
-
-    // first run
-    for (int i = 0; i < size1; ++i)
+    for (; index >= delayInSamples; --index)
     {
-        const float smpl = buffer[index];
+        const float smpl = samples[index];
 
         if (smpl > nextGainReductionValue) // in case the sample is above our ramp...
         {
-            buffer[index] = nextGainReductionValue; // ... replace it with the current ramp value
+            samples[index] = nextGainReductionValue; // ... replace it with the current ramp value
             nextGainReductionValue += step; // and update the next ramp value
         }
         else // otherwise... (new peak)
@@ -109,31 +115,6 @@ void LookAheadGainReduction::process()
             step = - smpl / delayInSamples; // calculate the new slope
             nextGainReductionValue = smpl + step; // and also the new ramp value
         }
-        --index;
-    }
-
-    // second run
-    if (size2 > 0) // in case we have some samples left for the second run
-    {
-        index = static_cast<int> (buffer.size()) - 1; // wrap around: start from the last sample of the buffer
-
-        // exactly the same procedure as before... I guess I could have written that better...
-        for (int i = 0; i < size2; ++i)
-        {
-            const float smpl = buffer[index];
-
-            if (smpl > nextGainReductionValue)
-            {
-                buffer[index] = nextGainReductionValue;
-                nextGainReductionValue += step;
-            }
-            else
-            {
-                step = - smpl / delayInSamples;
-                nextGainReductionValue = smpl + step;
-            }
-            --index;
-        }
     }
 
     /*
@@ -142,132 +123,118 @@ void LookAheadGainReduction::process()
      What if the first pushed sample has such a high gain-reduction value, that itself needs a fade-in? So we have to apply a gain-ramp even further into the past. And that is exactly the reason why we need lookahead, why we need to buffer our signal for a short amount of time: so we can apply that gain ramp for the first handful of gain-reduction samples.
      */
 
-    if (index < 0) // it's possible the index is exactly -1
-        index = static_cast<int> (buffer.size()) - 1; // so let's take care of that
-
     /*
      This time we only need to check `delayInSamples` many samples.
      And there's another cool thing!
         We know that the samples have been processed already, so in case one of the samples is below our ramp value, that's the new minimum, which has been faded-in already! So what we do is hit the break, and call it a day!
      */
-    getProcessPositions (index, delayInSamples, size1, size2);
-    bool breakWasUsed = false;
-
-    // first run
-    for (int i = 0; i < size1; ++i) // we iterate over the first size1 samples
+    for (; index >= 0; --index)
     {
-        const float smpl = buffer[index];
+        const float smpl = samples[index];
 
         if (smpl > nextGainReductionValue) // in case the sample is above our ramp...
         {
-            buffer[index] = nextGainReductionValue; // ... replace it with the current ramp value
+            samples[index] = nextGainReductionValue; // ... replace it with the current ramp value
             nextGainReductionValue += step; // and update the next ramp value
         }
         else // otherwise... JACKPOT! Nothing left to do here!
-        {
-            breakWasUsed = true; // let the guys know we are finished
             break;
-        }
-        --index;
     }
 
-    // second run
-    if (! breakWasUsed && size2 > 0) // is there still some work to do?
-    {
-        index = static_cast<int> (buffer.size()) - 1; // wrap around (ring-buffer)
-        for (int i = 0; i < size2; ++i)
-        {
-            const float smpl = buffer[index];
-
-            // same as before
-            if (smpl > nextGainReductionValue) // in case the sample is above our ramp...
-            {
-                buffer[index] = nextGainReductionValue; // ... replace it with the current ramp value
-                nextGainReductionValue += step; // and update the next ramp value
-            }
-            else // otherwise... already processed -> byebye!
-                break;
-            --index;
-        }
-    }
+    // all samples after `index` might have been modified, so let the ring-buffer update their mirrored copies
+    buffer.updateMirror (samples + index + 1, numSamples - 1 - index);
 }
 
-
-void LookAheadGainReduction::readSamples (float* dest, int numSamples)
+void LookAheadGainReduction::processSlidingMinimum()
 {
-    int startIndex, blockSize1, blockSize2;
+    /** The backward scan above computes, for each sample n, the minimum of all fade-in ramps of the samples within the next `delayInSamples` samples, including the sample itself:
 
-    // read from delay line
-    getReadPositions (numSamples, startIndex, blockSize1, blockSize2);
+            y[n] = min over j = 0 ... delayInSamples of x[n + j] * (1 - j / delayInSamples)
 
-    for (int i = 0; i < blockSize1; ++i)
-        dest[i] = buffer[startIndex + i];
+     Going forward in time, each ramp is a line which starts at zero `delayInSamples` samples before its peak, and ends at the peak. Lines of deeper peaks are steeper. We keep a queue of the lines which can still become the minimum, ordered by time: each one takes over from its predecessor at a known time, either because it crosses it or because the predecessor ends. A new line removes the lines at the back of the queue, which it takes over from before they would have taken over themselves. Every line is pushed and popped only once, so it's amortized O(1) per sample.
 
-    if (blockSize2 > 0)
-        for (int i = 0; i < blockSize2; ++i)
-            dest[blockSize1 + i] = buffer[i];
-}
+     The latency is the same as for the backward scan: pushing sample m lets us compute the output for sample m - delayInSamples, which is then written into the buffer at its position, where readSamples will find it. As the pushed samples lie behind the output samples, they are read before they are overwritten.
+     */
 
+    const int mask = static_cast<int> (peaks.size()) - 1;
+    const double D = static_cast<double> (delayInSamples);
+    const float inverseDelay = 1.0f / static_cast<float> (delayInSamples);
 
-inline void LookAheadGainReduction::getProcessPositions (int startIndex, int numSamples, int& blockSize1, int& blockSize2)
-{
-    if (numSamples <= 0)
+    // output sample i lies `delayInSamples` samples before the pushed sample i
+    float* samples = buffer.getWritePointer (lastPushedSamples + delayInSamples);
+
+    if (delayInSamples == 0) // no look-ahead, nothing to fade in
     {
-        blockSize1 = 0;
-        blockSize2 = 0;
+        numProcessedSamples += lastPushedSamples;
+        return;
     }
-    else
+
+    for (int i = 0; i < lastPushedSamples; ++i)
     {
-        blockSize1 = std::min (startIndex + 1, numSamples);
-        numSamples -= blockSize1;
-        blockSize2 = numSamples <= 0 ? 0 : numSamples;
-    }
-}
+        const int64_t m = numProcessedSamples++;
+        const float value = samples[i + delayInSamples];
 
-inline void LookAheadGainReduction::getWritePositions (int numSamples, int& startIndex, int& blockSize1, int& blockSize2)
-{
-    const int L = static_cast<int> (buffer.size());
-    int pos = writePosition;
+        // == push the line of the new sample
+        if (value < 0.0f)
+        {
+            double takeOver = -std::numeric_limits<double>::infinity();
 
-    if (pos < 0)
-        pos = pos + L;
-    pos = pos % L;
+            while (peaksSize > 0)
+            {
+                const Peak& back = peaks[(peaksFront + peaksSize - 1) & mask];
+
+                // the back line ends after sample back.index, the new one might cross it before
+                takeOver = static_cast<double> (back.index + 1);
+                if (value < back.value)
+                {
+                    // value * (n - m + D) = back.value * (n - back.index + D), solved for n without dividing by D
+                    const double crossing = (value * (m - D) - back.value * (back.index - D)) / (static_cast<double> (value) - back.value);
+                    takeOver = std::min (takeOver, crossing);
+                }
+
+                if (takeOver <= back.takeOver)
+                    --peaksSize; // the back line would never be the minimum
+                else
+                    break;
+            }
 
-    if (numSamples <= 0)
-    {
-        startIndex = 0;
-        blockSize1 = 0;
-        blockSize2 = 0;
-    }
-    else
-    {
-        startIndex = pos;
-        blockSize1 = std::min (L - pos, numSamples);
-        numSamples -= blockSize1;
-        blockSize2 = numSamples <= 0 ? 0 : numSamples;
-    }
-}
+            if (peaksSize == 0)
+                takeOver = -std::numeric_limits<double>::infinity();
 
-inline void LookAheadGainReduction::getReadPositions (int numSamples, int& startIndex, int& blockSize1, int& blockSize2)
-{
-    const int L = static_cast<int> (buffer.size());
-    int pos = writePosition - lastPushedSamples - delayInSamples;
+            peaks[(peaksFront + peaksSize) & mask] = { m, value, takeOver };
+            ++peaksSize;
+        }
 
-    if (pos < 0)
-        pos = pos + L;
-    pos = pos % L;
+        // == evaluate the output for sample n
+        const int64_t n = m - delayInSamples;
 
-    if (numSamples <= 0)
-    {
-        startIndex = 0;
-        blockSize1 = 0;
-        blockSize2 = 0;
-    }
-    else
-    {
-        startIndex = pos;
-        blockSize1 = std::min (L - pos, numSamples);
-        numSamples -= blockSize1;
-        blockSize2 = numSamples <= 0 ? 0 : numSamples;
+        while (peaksSize > 1 && peaks[(peaksFront + 1) & mask].takeOver <= static_cast<double> (n))
+        {
+            peaksFront = (peaksFront + 1) & mask;
+            --peaksSize;
+        }
+
+        if (peaksSize == 1 && peaks[peaksFront].index < n)
+        {
+            peaksFront = (peaksFront + 1) & mask;
+            peaksSize = 0;
+        }
+
+        float output = 0.0f;
+        if (peaksSize > 0)
+        {
+            const Peak& front = peaks[peaksFront];
+            output = front.value * static_cast<float> (n - front.index + delayInSamples) * inverseDelay;
+        }
+
+        samples[i] = output;
     }
+
+    buffer.updateMirror (samples, lastPushedSamples);
+}
+
+void LookAheadGainReduction::readSamples (float* dest, int numSamples)
+{
+    // read from delay line
+    buffer.read (dest, lastPushedSamples + delayInSamples, numSamples);
 }
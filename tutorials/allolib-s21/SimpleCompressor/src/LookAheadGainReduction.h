@@ -19,15 +19,32 @@
 
 #pragma once
 #include <vector>
+#include <cstdint>
+#include "RingBuffer.h"
 
 /** This class acts as a delay line for gain-reduction samples, which additionally fades in high gain-reduction values in order to avoid distortion when limiting an audio signal.
  */
 class LookAheadGainReduction
 {
 public:
+    /** The algorithm used by process().
+        - backwardScan: walks back through the recently pushed samples and the look-ahead region once per block. It follows the deepest fade-in and skips fade-ins of samples which lie above it, although those can start earlier. Cheap for short delays, but with small blocks its cost grows with the delay time.
+        - slidingMinimum: the exact minimum of all fade-ins, y[n] = min x[n + j] * (1 - j / delayInSamples) for j = 0 ... delayInSamples. It keeps a monotonic queue of the fade-ins which can still become the minimum, so each sample costs amortized constant time, independent of the delay time and block size. This is a different envelope, not a faster backward scan: its gain reduction is never less than the one of the backward scan, and on bursts of peaks it is deeper, so switching modes changes the sound. backwardScan stays the default.
+     */
+    enum class ProcessingMode
+    {
+        backwardScan,
+        slidingMinimum
+    };
+
     LookAheadGainReduction() : sampleRate (0.0) {}
     ~LookAheadGainReduction() {}
 
+    /** Selects the processing algorithm. This resets the delay-line, so call it before or right after prepare.
+     */
+    void setProcessingMode (const ProcessingMode newMode);
+    const ProcessingMode getProcessingMode() { return mode; }
+
     void setDelayTime (float delayTimeInSeconds);
 
     const int getDelayInSamples() { return delayInSamples; }
@@ -50,13 +67,9 @@ public:
 
 
 private:
-    /** A little helper-function which calulcates how many samples we should process in a first step before we have to wrap around, as our buffer is a ring-buffer.
-     */
-    inline void getProcessPositions (int startIndex, int numSamples, int& blockSize1, int& blockSize2);
+    void processBackwardScan();
 
-    inline void getWritePositions (int numSamples, int& startIndex, int& blockSize1, int& blockSize2);
-
-    inline void getReadPositions (int numSamples, int& startIndex, int& blockSize1, int& blockSize2);
+    void processSlidingMinimum();
 
 
 private:
@@ -66,7 +79,23 @@ private:
 
     float delay;
     int delayInSamples = 0;
-    int writePosition = 0;
     int lastPushedSamples = 0;
-    std::vector<float> buffer;
+    RingBuffer<float> buffer;
+
+    ProcessingMode mode = ProcessingMode::backwardScan;
+
+    /** A gain-reduction peak of value `value` at sample `index` fades in linearly from zero, starting `delayInSamples` samples earlier. `takeOver` is the time from which on this fade-in is lower than the one of its predecessor in the queue.
+     */
+    struct Peak
+    {
+        int64_t index;
+        float value;
+        double takeOver;
+    };
+
+    // monotonic queue of peaks (ring-buffer, allocated in prepare)
+    std::vector<Peak> peaks;
+    int peaksFront = 0;
+    int peaksSize = 0;
+    int64_t numProcessedSamples = 0;
 };
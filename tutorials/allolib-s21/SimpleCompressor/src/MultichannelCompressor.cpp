@@ -0,0 +1,180 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MultichannelCompressor.h"
+#include "VectorOperations.h"
+#include <algorithm>
+#include <cmath>
+
+void MultichannelCompressor::setLookAheadTime (const float lookAheadTimeInSeconds)
+{
+    lookAheadTime = std::max (0.0f, lookAheadTimeInSeconds);
+
+    if (sampleRate != 0.0)
+        prepare (sampleRate, maximumBlockSize, maximumNumChannels);
+}
+
+void MultichannelCompressor::setLookAheadProcessingMode (const LookAheadGainReduction::ProcessingMode newMode)
+{
+    lookAheadGainReduction.setProcessingMode (newMode);
+
+    if (sampleRate != 0.0)
+        prepare (sampleRate, maximumBlockSize, maximumNumChannels);
+}
+
+void MultichannelCompressor::prepare (const double newSampleRate, const int newMaximumBlockSize, const int newMaximumNumChannels)
+{
+    sampleRate = newSampleRate;
+    maximumBlockSize = newMaximumBlockSize;
+    maximumNumChannels = newMaximumNumChannels;
+
+    gainReductionComputer.prepare (sampleRate);
+
+    lookAheadGainReduction.setDelayTime (lookAheadTime);
+    lookAheadGainReduction.prepare (sampleRate, maximumBlockSize);
+
+    truePeakDetector.prepare (maximumBlockSize, maximumNumChannels);
+
+    sideChainBuffer.resize (maximumBlockSize);
+    gainBuffer.resize (maximumBlockSize);
+
+    // long enough for both delays, so look-ahead and true-peak detection can be toggled while processing
+    const int delayLength = maximumBlockSize + lookAheadGainReduction.getDelayInSamples() + TruePeakDetector::getLatencyInSamples();
+    delayBuffers.resize (maximumNumChannels);
+    for (auto& delayBuffer : delayBuffers)
+        delayBuffer.setCapacity (delayLength);
+
+    reset();
+}
+
+void MultichannelCompressor::reset()
+{
+    gainReductionComputer.reset();
+    lookAheadGainReduction.prepare (sampleRate, maximumBlockSize);
+    truePeakDetector.reset();
+
+    for (auto& delayBuffer : delayBuffers)
+        delayBuffer.clear();
+
+    inputPeak = 0.0f;
+    minimumGain = 1.0f;
+    outputPeak = 0.0f;
+    blockIndex = 0;
+}
+
+void MultichannelCompressor::process (float* const* channels, const int numChannels, const int numSamples)
+{
+    // not prepared yet: the chunk loop below would never advance
+    if (maximumBlockSize <= 0)
+        return;
+
+    const int nCh = std::min (numChannels, maximumNumChannels);
+
+    float blockInputPeak = 0.0f;
+    float blockMinimumGain = 1.0f;
+    float blockOutputPeak = 0.0f;
+    outputSumOfSquares = 0.0f;
+
+    for (int offset = 0; offset < numSamples; offset += maximumBlockSize)
+    {
+        processBlock (channels, nCh, offset, std::min (maximumBlockSize, numSamples - offset));
+
+        blockInputPeak = std::max (blockInputPeak, inputPeak);
+        blockMinimumGain = std::min (blockMinimumGain, minimumGain);
+        blockOutputPeak = std::max (blockOutputPeak, outputPeak);
+    }
+
+    inputPeak = blockInputPeak;
+    minimumGain = blockMinimumGain;
+    outputPeak = blockOutputPeak;
+
+    if (telemetry.getCapacity() > 0)
+    {
+        const int numValues = nCh * numSamples;
+        const float rms = numValues > 0 ? std::sqrt (outputSumOfSquares / numValues) : 0.0f;
+        telemetry.push ({ blockIndex, numSamples, inputPeak, minimumGain, outputPeak, rms });
+    }
+    ++blockIndex;
+}
+
+void MultichannelCompressor::processBlock (float* const* channels, const int numChannels, const int offset, const int numSamples)
+{
+    if (numChannels <= 0 || numSamples <= 0)
+        return;
+
+    float* sideChain = sideChainBuffer.data();
+    float* gains = gainBuffer.data();
+
+    /** STEP 1: compute linked side-chain signal, channel by channel */
+    if (truePeakEnabled)
+    {
+        truePeakDetector.process (0, channels[0] + offset, sideChain, numSamples);
+        for (int ch = 1; ch < numChannels; ++ch)
+            truePeakDetector.processMax (ch, channels[ch] + offset, sideChain, numSamples);
+    }
+    else
+    {
+        VectorOperations::abs (sideChain, channels[0] + offset, numSamples);
+        for (int ch = 1; ch < numChannels; ++ch)
+            VectorOperations::maxAbs (sideChain, channels[ch] + offset, numSamples);
+    }
+
+    inputPeak = VectorOperations::findMaxAbs (sideChain, numSamples);
+
+    /** STEP 2: calculate gain reduction, faded-in and converted to linear gain if look-ahead is enabled */
+    if (lookAheadEnabled)
+    {
+        gainReductionComputer.computeGainInDecibelsFromSidechainSignal (sideChain, gains, numSamples);
+
+        lookAheadGainReduction.pushSamples (gains, numSamples);
+        lookAheadGainReduction.process();
+        lookAheadGainReduction.readSamples (gains, numSamples);
+
+        gainReductionComputer.convertToLinearGain (gains, gains, numSamples);
+    }
+    else
+        gainReductionComputer.computeLinearGainFromSidechainSignal (sideChain, gains, numSamples);
+
+    minimumGain = VectorOperations::findMinimumOfPositive (gains, numSamples);
+
+    /** STEP 3: delay the audio by the latency of look-ahead and true-peak detection, and apply the gain with a single pass per channel */
+    const int latency = getLatencyInSamples();
+    float peak = 0.0f;
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        float* samples = channels[ch] + offset;
+
+        if (latency > 0)
+            delayChannel (ch, samples, numSamples, latency);
+
+        peak = std::max (peak, VectorOperations::applyGain (samples, gains, numSamples));
+
+        if (telemetry.getCapacity() > 0)
+            outputSumOfSquares += VectorOperations::sumOfSquares (samples, numSamples);
+    }
+    outputPeak = peak;
+}
+
+void MultichannelCompressor::delayChannel (const int channel, float* samples, const int numSamples, const int delayInSamples)
+{
+    RingBuffer<float>& buffer = delayBuffers[channel];
+
+    buffer.write (samples, numSamples);
+    buffer.read (samples, numSamples + delayInSamples, numSamples);
+}
@@ -0,0 +1,157 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#include <vector>
+#include "GainReductionComputer.h"
+#include "LookAheadGainReduction.h"
+#include "TruePeakDetector.h"
+#include "RingBuffer.h"
+#include "LockFreeQueue.h"
+#include <cstdint>
+
+/**
+ A compressor / limiter for any number of channels, which doesn't depend on any framework. All channels are linked: the side-chain signal is the maximum of the absolute values of all channels, and the same gain is applied to every channel. The audio is passed as planar buffers (one pointer per channel), which is how allolib's AudioIOData and JUCE's AudioBuffer store their samples.
+
+ If look-ahead is enabled, the gain reduction is faded in with the LookAheadGainReduction class, and the audio is delayed by the look-ahead time. If true-peak detection is enabled, the side-chain signal is computed with the TruePeakDetector class, and the audio is additionally delayed by its latency.
+ */
+class MultichannelCompressor
+{
+public:
+    MultichannelCompressor() : sampleRate (0.0), maximumBlockSize (0), maximumNumChannels (0) {}
+    ~MultichannelCompressor() {}
+
+    // ======================================================================
+    /**
+     Sets the look-ahead time in seconds. The delay-lines are resized, so call this before prepare or from the thread which calls prepare, not from the audio thread.
+     */
+    void setLookAheadTime (const float lookAheadTimeInSeconds);
+
+    /**
+     Enables or disables the look-ahead. This is cheap and can be called from the audio thread. Note that toggling it changes the latency, so it will cause a discontinuity in the output.
+     */
+    void setLookAheadEnabled (const bool shouldBeEnabled) { lookAheadEnabled = shouldBeEnabled; }
+    const bool isLookAheadEnabled() { return lookAheadEnabled; }
+
+    /**
+     Selects the algorithm used to fade in the gain reduction, see LookAheadGainReduction::ProcessingMode. Like setLookAheadTime, this resets the delay-lines.
+     */
+    void setLookAheadProcessingMode (const LookAheadGainReduction::ProcessingMode newMode);
+
+    /**
+     Enables or disables the true-peak detection of the side-chain signal, which also catches peaks between the samples. Like setLookAheadEnabled, this is cheap and can be called from the audio thread, but changes the latency.
+     */
+    void setTruePeakEnabled (const bool shouldBeEnabled) { truePeakEnabled = shouldBeEnabled; }
+    const bool isTruePeakEnabled() { return truePeakEnabled; }
+
+    /**
+     Returns the latency introduced by the compressor: the look-ahead delay if enabled, plus the latency of the true-peak detector if enabled.
+     */
+    const int getLatencyInSamples()
+    {
+        return (lookAheadEnabled ? lookAheadGainReduction.getDelayInSamples() : 0) + (truePeakEnabled ? TruePeakDetector::getLatencyInSamples() : 0);
+    }
+
+    /**
+     Prepares the compressor and allocates all buffers. Make sure you call this before you do any processing! Blocks larger than maximumBlockSize are processed in several steps, channels beyond maximumNumChannels are left untouched.
+     */
+    void prepare (const double sampleRate, const int maximumBlockSize, const int maximumNumChannels);
+
+    /**
+     Resets the compressor state and clears the delay-lines.
+     */
+    void reset();
+
+    // ======================================================================
+    /**
+     Compresses the given planar buffers in place. Leaves them untouched
+     until prepare() has been called.
+     */
+    void process (float* const* channels, const int numChannels, const int numSamples);
+
+    /**
+     Use this to set the parameters (threshold, ratio, knee, attack, release, make-up) of the compressor.
+     */
+    GainReductionComputer& getGainReductionComputer() { return gainReductionComputer; }
+
+    // ======================================================================
+    /** Largest absolute sample value of all channels in the last processed block, before compression. With true-peak detection enabled, this is the true peak. */
+    const float getInputPeak() { return inputPeak; }
+
+    /** Smallest linear gain (including make-up gain) applied within the last processed block. */
+    const float getMinimumGain() { return minimumGain; }
+
+    /** Largest absolute sample value of all channels in the last processed block, after compression. */
+    const float getOutputPeak() { return outputPeak; }
+
+    // ======================================================================
+    /** Statistics of one call of process(), see setTelemetryCapacity. */
+    struct Telemetry
+    {
+        uint64_t blockIndex; // counts the calls of process(), gaps mean the queue was full
+        int numSamples;
+        float inputPeak;
+        float minimumGain;
+        float outputPeak;
+        float outputRms; // over all channels
+    };
+
+    /**
+     Makes process() push the statistics of every call into a lock-free queue, which holds the given number of blocks. Another thread (e.g. the GUI) can take them out with popTelemetry, so the audio thread never has to print or lock anything. If the queue is full, the statistics of that block are dropped. A capacity of zero (the default) turns it off. Don't call this while processing.
+     */
+    void setTelemetryCapacity (const int numBlocks) { telemetry.setCapacity (numBlocks); }
+
+    /**
+     Takes the oldest statistics out of the telemetry queue. Returns false if there are none. Call this only from one thread.
+     */
+    bool popTelemetry (Telemetry& destination) { return telemetry.pop (destination); }
+
+private:
+    void processBlock (float* const* channels, const int numChannels, const int offset, const int numSamples);
+
+    void delayChannel (const int channel, float* samples, const int numSamples, const int delayInSamples);
+
+private:
+    //==============================================================================
+    double sampleRate;
+    int maximumBlockSize;
+    int maximumNumChannels;
+
+    GainReductionComputer gainReductionComputer;
+    LookAheadGainReduction lookAheadGainReduction;
+    float lookAheadTime = 0.005f;
+    bool lookAheadEnabled = false;
+
+    TruePeakDetector truePeakDetector;
+    bool truePeakEnabled = false;
+
+    std::vector<float> sideChainBuffer;
+    std::vector<float> gainBuffer;
+
+    // delay-lines for the audio signal, one per channel
+    std::vector<RingBuffer<float>> delayBuffers;
+
+    float inputPeak = 0.0f;
+    float minimumGain = 1.0f;
+    float outputPeak = 0.0f;
+
+    LockFreeQueue<Telemetry> telemetry;
+    uint64_t blockIndex = 0;
+    float outputSumOfSquares = 0.0f;
+};
@@ -0,0 +1,112 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+/**
+ A ring-buffer (delay-line) which hands out contiguous memory for any read or write of up to `getCapacity()` samples, so the calling code never has to split its loops or copies where the buffer wraps around.
+
+ The capacity is a power of two, so positions wrap with a bit-mask instead of a modulo. Each sample is stored twice: at its position and at its position plus the capacity. A span which runs over the end of the first half simply continues into the mirrored copy. Writing has to keep both copies in sync, which `write` does with two additional copies and no branches. If you modify samples in place via `getWritePointer`, call `updateMirror` with the modified range afterwards.
+
+ Positions are given relative to the write position: `numSamplesBack` samples back is where the sample lies, which has been written `numSamplesBack` samples ago. All memory is allocated in `setCapacity`, all other methods are real-time safe.
+ */
+template <typename Type>
+class RingBuffer
+{
+    static_assert (std::is_trivially_copyable<Type>::value, "RingBuffer copies its samples with memcpy");
+
+public:
+    RingBuffer() {}
+    ~RingBuffer() {}
+
+    /** Allocates the buffer with at least the given capacity, rounded up to the next power of two, and clears it.
+     */
+    void setCapacity (const int minimumCapacity)
+    {
+        capacity = 1;
+        while (capacity < minimumCapacity)
+            capacity *= 2;
+        mask = capacity - 1;
+
+        data.resize (2 * capacity);
+        clear();
+    }
+
+    const int getCapacity() { return capacity; }
+
+    /** Sets all samples to zero and resets the write position. */
+    void clear()
+    {
+        std::fill (data.begin(), data.end(), Type());
+        writePosition = 0;
+    }
+
+    /** Writes `numSamples` samples (at most the capacity) at the write position, and advances it. */
+    void write (const Type* src, const int numSamples)
+    {
+        std::memcpy (data.data() + writePosition, src, numSamples * sizeof (Type));
+        updateRange (writePosition, numSamples);
+        writePosition = (writePosition + numSamples) & mask;
+    }
+
+    /** Copies `numSamples` samples, starting `numSamplesBack` samples before the write position, to the destination. */
+    void read (Type* dest, const int numSamplesBack, const int numSamples) const
+    {
+        std::memcpy (dest, getReadPointer (numSamplesBack), numSamples * sizeof (Type));
+    }
+
+    /** Returns a pointer to the sample `numSamplesBack` samples before the write position (at most the capacity). Up to `getCapacity()` samples can be read contiguously from it. */
+    const Type* getReadPointer (const int numSamplesBack) const
+    {
+        return data.data() + ((writePosition - numSamplesBack) & mask);
+    }
+
+    /** Same as getReadPointer, but writable. Call updateMirror with the modified range afterwards. */
+    Type* getWritePointer (const int numSamplesBack)
+    {
+        return data.data() + ((writePosition - numSamplesBack) & mask);
+    }
+
+    /** Copies in-place modifications of `numSamples` samples to their mirrored copies. `modifiedSamples` has to point into a span returned by getWritePointer, as the samples it points to are the ones which will be kept. */
+    void updateMirror (const Type* modifiedSamples, const int numSamples)
+    {
+        updateRange (static_cast<int> (modifiedSamples - data.data()), numSamples);
+    }
+
+private:
+    /** The range [position, position + numSamples) lies within the first half, the second half, or runs from the first into the second one. The part in the first half is copied to the second half, the part in the second half to the first one. */
+    void updateRange (const int position, const int numSamples)
+    {
+        Type* ptr = data.data();
+        const int size1 = std::max (0, std::min (numSamples, capacity - position));
+        const int position2 = position + size1;
+        std::memcpy (ptr + position + capacity, ptr + position, size1 * sizeof (Type));
+        std::memcpy (ptr + (position2 & mask), ptr + position2, (numSamples - size1) * sizeof (Type));
+    }
+
+    //==============================================================================
+    std::vector<Type> data;
+    int capacity = 0;
+    int mask = 0;
+    int writePosition = 0;
+};
@@ -0,0 +1,133 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TruePeakDetector.h"
+#include "VectorOperations.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+    /** Zeroth-order modified Bessel function of the first kind, for the Kaiser window. */
+    double besselI0 (const double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < 1e-12 * sum)
+                break;
+        }
+        return sum;
+    }
+}
+
+TruePeakDetector::TruePeakDetector()
+{
+    // prototype lowpass at the upsampled rate with its cutoff at the original Nyquist frequency. It has oversamplingFactor * tapsPerPhase + 1 taps and is centered on tap oversamplingFactor * latency, so phase 0 is a pure delay (the sinc is zero at all other multiples of the oversampling factor) and only phases 1 to 3 have to be computed.
+    constexpr double beta = 5.0;
+    constexpr int length = oversamplingFactor * tapsPerPhase + 1;
+    const double center = 0.5 * (length - 1);
+    const double pi = 3.14159265358979323846;
+
+    for (int phase = 1; phase < oversamplingFactor; ++phase)
+    {
+        double sum = 0.0;
+        double taps[tapsPerPhase];
+        for (int k = 0; k < tapsPerPhase; ++k)
+        {
+            const double n = oversamplingFactor * k + phase - center;
+            const double x = pi * n / oversamplingFactor;
+            const double r = n / center;
+            taps[k] = std::sin (x) / x * besselI0 (beta * std::sqrt (1.0 - r * r)) / besselI0 (beta);
+            sum += taps[k];
+        }
+
+        // normalize each phase to unity gain at DC, so a constant signal is interpolated without ripple
+        for (int k = 0; k < tapsPerPhase; ++k)
+            coefficients[phase - 1][k] = static_cast<float> (taps[k] / sum);
+    }
+}
+
+void TruePeakDetector::prepare (const int newMaximumBlockSize, const int newMaximumNumChannels)
+{
+    maximumBlockSize = newMaximumBlockSize;
+    maximumNumChannels = newMaximumNumChannels;
+
+    history.resize (maximumNumChannels * (maximumBlockSize + tapsPerPhase - 1));
+    phaseBuffer.resize (maximumBlockSize);
+    reset();
+}
+
+void TruePeakDetector::reset()
+{
+    std::fill (history.begin(), history.end(), 0.0f);
+}
+
+void TruePeakDetector::process (const int channel, const float* source, float* destination, const int numSamples)
+{
+    processChannel (channel, source, destination, numSamples, false);
+}
+
+void TruePeakDetector::processMax (const int channel, const float* source, float* destination, const int numSamples)
+{
+    processChannel (channel, source, destination, numSamples, true);
+}
+
+void TruePeakDetector::processChannel (const int channel, const float* source, float* destination, const int numSamples, const bool accumulate)
+{
+    constexpr int historyLength = tapsPerPhase - 1;
+    float* x = history.data() + channel * (maximumBlockSize + historyLength);
+    float* phaseSamples = phaseBuffer.data();
+
+    // x[i + historyLength] is the current input sample i, x[i + historyLength - k] the one k samples earlier
+    std::memcpy (x + historyLength, source, numSamples * sizeof (float));
+
+    // phase 0: the input, delayed by the latency of the filter
+    const float* delayed = x + historyLength - getLatencyInSamples();
+    if (accumulate)
+        VectorOperations::maxAbs (destination, delayed, numSamples);
+    else
+        VectorOperations::abs (destination, delayed, numSamples);
+
+    // phases 1 to 3, one tap at a time over the whole block
+    for (int phase = 0; phase < oversamplingFactor - 1; ++phase)
+    {
+        const float* c = coefficients[phase];
+
+        const float* x0 = x + historyLength;
+        for (int i = 0; i < numSamples; ++i)
+            phaseSamples[i] = c[0] * x0[i];
+
+        for (int k = 1; k < tapsPerPhase; ++k)
+        {
+            const float ck = c[k];
+            const float* xk = x + historyLength - k;
+            for (int i = 0; i < numSamples; ++i)
+                phaseSamples[i] += ck * xk[i];
+        }
+
+        VectorOperations::maxAbs (destination, phaseSamples, numSamples);
+    }
+
+    // keep the last samples for the next block
+    std::memmove (x, x + numSamples, historyLength * sizeof (float));
+}
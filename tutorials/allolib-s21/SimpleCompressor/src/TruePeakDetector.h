@@ -0,0 +1,71 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <vector>
+
+/**
+ A true-peak level detector, which estimates the peaks of the continuous signal between the samples, so the compressor can react to inter-sample overs which a sample-peak detector misses.
+
+ Each channel is upsampled by a factor of 4 with a polyphase FIR filter (a Kaiser-windowed sinc), similar to the true-peak meter described in ITU-R BS.1770. For every input sample the detector writes the largest absolute value of the sample itself and the three interpolated values between it and the next sample. The filter is linear-phase, so the detector delays the signal by getLatencyInSamples() samples; delay the audio by the same amount to keep the gain reduction in sync.
+
+ The phases are computed one tap at a time over the whole block, so the inner loops are plain multiply-adds over contiguous memory, which the compiler vectorizes. All memory is allocated in prepare.
+ */
+class TruePeakDetector
+{
+public:
+    static constexpr int oversamplingFactor = 4;
+    static constexpr int tapsPerPhase = 12;
+
+    TruePeakDetector();
+    ~TruePeakDetector() {}
+
+    /** The delay of the detector output in samples at the original sample rate. */
+    static constexpr int getLatencyInSamples() { return tapsPerPhase / 2; }
+
+    /** Allocates the filter states for the given number of channels and clears them. Don't pass more than maximumBlockSize samples per call to process.
+     */
+    void prepare (const int maximumBlockSize, const int maximumNumChannels);
+
+    /** Clears the filter states. */
+    void reset();
+
+    /** Writes the true-peak levels of one channel to the destination. */
+    void process (const int channel, const float* source, float* destination, const int numSamples);
+
+    /** Like process, but replaces each destination sample with the maximum of itself and the true-peak level. Use it after process to build a linked side-chain signal of several channels.
+     */
+    void processMax (const int channel, const float* source, float* destination, const int numSamples);
+
+
+private:
+    void processChannel (const int channel, const float* source, float* destination, const int numSamples, const bool accumulate);
+
+
+private:
+    //==============================================================================
+    // the interpolating phases 1 to 3, phase 0 is the delayed input itself
+    float coefficients[oversamplingFactor - 1][tapsPerPhase];
+
+    int maximumBlockSize = 0;
+    int maximumNumChannels = 0;
+
+    // per channel: tapsPerPhase - 1 samples of the previous block, followed by the current block
+    std::vector<float> history;
+    std::vector<float> phaseBuffer;
+};
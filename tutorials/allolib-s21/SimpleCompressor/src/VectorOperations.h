@@ -0,0 +1,223 @@
+/*
+ This file is part of the SimpleCompressor project.
+ https://github.com/DanielRudrich/SimpleCompressor
+ Copyright (c) 2019 Daniel Rudrich
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+/**
+ A small collection of block operations on float arrays, used by the compressor classes in their per-sample loops. All loops are branch-free and free of function calls, so that the compiler can vectorize them (SSE/AVX on x86, NEON on ARM) without any platform specific code.
+
+ The logarithm and exponential are approximations, which are accurate enough for gain computations:
+    - fastLog2: absolute error below 4e-6 for normal numbers, which corresponds to less than 2.5e-5 dB in amplitudeToDecibels
+    - fastExp2: relative error below 6e-6 for arguments within [-126, 126], which corresponds to less than 5.5e-5 dB in decibelsToGain
+ Zero and denormal inputs to fastLog2 result in values around -127 (approx. -765 dB) instead of -infinity.
+ */
+struct VectorOperations
+{
+    /** Approximates log2 (x) for positive x. */
+    static inline float fastLog2 (const float x)
+    {
+        // split x into exponent and mantissa, so that the mantissa lies within [sqrt(0.5), sqrt(2))
+        int32_t bits;
+        std::memcpy (&bits, &x, sizeof (float));
+        const int32_t offset = (bits - 0x3f3504f3) & static_cast<int32_t> (0xff800000);
+        const float exponent = static_cast<float> (offset >> 23);
+        bits -= offset;
+        float mantissa;
+        std::memcpy (&mantissa, &bits, sizeof (float));
+
+        // ln (m) = 2 * atanh (u) with u = (m - 1) / (m + 1), |u| < 0.172
+        const float u = (mantissa - 1.0f) / (mantissa + 1.0f);
+        const float u2 = u * u;
+        const float lnMantissa = 2.0f * u * (1.0f + u2 * (0.333333333f + u2 * (0.2f + u2 * (0.142857143f + u2 * 0.111111111f))));
+
+        return exponent + 1.44269504f * lnMantissa;
+    }
+
+    /** Approximates 2^x, arguments are clipped to [-126, 126]. */
+    static inline float fastExp2 (float x)
+    {
+        // clip without comparisons, those would keep the compiler from vectorizing the calling loop
+        x = 0.5f * (std::fabs (x + 126.0f) - std::fabs (x - 126.0f));
+
+        // round to the nearest integer, so the fractional part lies within [-0.5, 0.5]
+        const int32_t integerPart = static_cast<int32_t> (x + 128.5f) - 128;
+        const float f = (x - static_cast<float> (integerPart)) * 0.693147181f;
+
+        const float p = 1.0f + f * (1.0f + f * (0.5f + f * (0.166666667f + f * (0.0416666667f + f * (0.00833333333f + f * 0.00138888889f)))));
+
+        int32_t bits;
+        std::memcpy (&bits, &p, sizeof (float));
+        bits += integerPart * (1 << 23);
+        float result;
+        std::memcpy (&result, &bits, sizeof (float));
+        return result;
+    }
+
+    // ======================================================================
+    /**
+     Converts the absolute values of the source samples to decibels, and returns the largest absolute value of the source (linear, not in decibels). Source and destination may be the same.
+     */
+    static inline float amplitudeToDecibels (float* destination, const float* source, const int numSamples)
+    {
+        return amplitudeToDecibels (destination, source, numSamples, [] (const float levelInDecibels, const int) { return levelInDecibels; });
+    }
+
+    /**
+     Same as above, but the decibel values are passed through the given function, together with their sample index, before they are written to the destination. As the function is inlined into the loop, this fuses further per-sample processing with the level detection. Make sure the function is branch-free, so the loop still vectorizes.
+     */
+    template <typename Function>
+    static inline float amplitudeToDecibels (float* destination, const float* source, const int numSamples, Function function)
+    {
+        constexpr float decibelsPerOctave = 6.02059991f; // 20 * log10 (2)
+
+        // the maximum is tracked on the bit patterns, as integer max-reductions vectorize and float ones don't
+        int32_t maxBits = 0;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            int32_t bits;
+            std::memcpy (&bits, source + i, sizeof (float));
+            bits &= 0x7fffffff;
+            maxBits = bits > maxBits ? bits : maxBits;
+
+            float a;
+            std::memcpy (&a, &bits, sizeof (float));
+            destination[i] = function (decibelsPerOctave * fastLog2 (a), i);
+        }
+
+        float maxAbs;
+        std::memcpy (&maxAbs, &maxBits, sizeof (float));
+        return maxAbs;
+    }
+
+    /**
+     Converts decibel values plus a constant offset to linear gain values. Source and destination may be the same.
+     */
+    static inline void decibelsToGain (float* destination, const float* source, const float offsetInDecibels, const int numSamples)
+    {
+        constexpr float octavesPerDecibel = 0.166096405f; // log2 (10) / 20
+        for (int i = 0; i < numSamples; ++i)
+            destination[i] = fastExp2 (octavesPerDecibel * (source[i] + offsetInDecibels));
+    }
+
+    /**
+     Same as above, but the offset is ramped linearly across the block: from startOffsetInDecibels (exclusive) to endOffsetInDecibels, which is used for the last sample.
+     */
+    static inline void decibelsToGain (float* destination, const float* source, const float startOffsetInDecibels, const float endOffsetInDecibels, const int numSamples)
+    {
+        constexpr float octavesPerDecibel = 0.166096405f; // log2 (10) / 20
+        const float increment = numSamples > 0 ? (endOffsetInDecibels - startOffsetInDecibels) / numSamples : 0.0f;
+        for (int i = 0; i < numSamples; ++i)
+            destination[i] = fastExp2 (octavesPerDecibel * (source[i] + startOffsetInDecibels + increment * (i + 1)));
+    }
+
+    // ======================================================================
+    /**
+     Writes the absolute values of the source to the destination.
+     */
+    static inline void abs (float* destination, const float* source, const int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            destination[i] = std::fabs (source[i]);
+    }
+
+    /**
+     Replaces each destination sample with the maximum of itself and the absolute value of the source sample. Use it after abs() to build a linked side-chain signal of several channels.
+     */
+    static inline void maxAbs (float* destination, const float* source, const int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float a = std::fabs (source[i]);
+            destination[i] = a > destination[i] ? a : destination[i];
+        }
+    }
+
+    /**
+     Multiplies the samples with the gain values in place, and returns the largest absolute value of the result.
+     */
+    static inline float applyGain (float* samples, const float* gains, const int numSamples)
+    {
+        int32_t maxBits = 0;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float y = samples[i] * gains[i];
+            samples[i] = y;
+
+            int32_t bits;
+            std::memcpy (&bits, &y, sizeof (float));
+            bits &= 0x7fffffff;
+            maxBits = bits > maxBits ? bits : maxBits;
+        }
+
+        float maxAbs;
+        std::memcpy (&maxAbs, &maxBits, sizeof (float));
+        return maxAbs;
+    }
+
+    /**
+     Returns the sum of the squared samples, e.g. for RMS measurements.
+     */
+    static inline float sumOfSquares (const float* source, const int numSamples)
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < numSamples; ++i)
+            sum += source[i] * source[i];
+        return sum;
+    }
+
+    /**
+     Returns the largest absolute value of the source.
+     */
+    static inline float findMaxAbs (const float* source, const int numSamples)
+    {
+        int32_t maxBits = 0;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            int32_t bits;
+            std::memcpy (&bits, source + i, sizeof (float));
+            bits &= 0x7fffffff;
+            maxBits = bits > maxBits ? bits : maxBits;
+        }
+
+        float maxAbs;
+        std::memcpy (&maxAbs, &maxBits, sizeof (float));
+        return maxAbs;
+    }
+
+    /**
+     Returns the smallest value of the source, the source must not contain negative values.
+     */
+    static inline float findMinimumOfPositive (const float* source, const int numSamples)
+    {
+        int32_t minBits = 0x7f800000; // +infinity
+        for (int i = 0; i < numSamples; ++i)
+        {
+            int32_t bits;
+            std::memcpy (&bits, source + i, sizeof (float));
+            minBits = bits < minBits ? bits : minBits;
+        }
+
+        float minimum;
+        std::memcpy (&minimum, &minBits, sizeof (float));
+        return minimum;
+    }
+};